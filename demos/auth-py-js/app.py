@@ -1,19 +1,33 @@
 #!/usr/bin/env python3
 
-from binascii import hexlify, unhexlify
+from binascii import unhexlify
 from flask import Flask, request, render_template
-from opaque import (CreateRegistrationResponse,
+from opaque import (CreateRegistrationResponseSeeded,
                     StoreUserRecord,
-                    CreateCredentialResponse,
-                    UserAuth,
-                    Register,
+                    UserRecordToSeeded,
+                    FakeUserRecordSeeded,
+                    CreateCredentialResponseSeeded,
+                    SealContinuation,
+                    UserAuthContinuation,
+                    Continuations,
+                    OprfSeed,
+                    Keyring,
                     Ids)
 from pysodium import crypto_secretbox, crypto_secretbox_open, randombytes
 
 app = Flask(__name__)
 server_key = randombytes(32)
 users = {}
-fake, _ = Register(hexlify(randombytes(16)), Ids(hexlify(randombytes(16)), hexlify(randombytes(16))))
+# the long-term key of the server, id 1 in its keyring
+server_skS = randombytes(32)
+keyring = Keyring(1)
+keyring.add(1, server_skS)
+# the per-user OPRF keys are derived from this seed and the user id,
+# unknown users get a fake record derived from it too
+oprfseed = OprfSeed(cache_entries=1024)
+# the expected authU of a login travels in a token through the client,
+# servers sharing the token key can authenticate it
+continuations = Continuations(lifetime=60)
 
 # the server is stateless apart from the user dict
 
@@ -39,22 +53,22 @@ def start():
 def req_creds():
    req = unhexlify(request.form['request'])
    idU = request.form['id']
-   rec=users.get(idU, fake)
+   rec=users.get(idU) or FakeUserRecordSeeded(oprfseed, 1, idU)
    # wrap the IDs into an opaque.Ids struct:
    ids=Ids(idU, "demo server")
    # create a context string
    context = b"pyopaque-v0.2.0-demo"
    # server responds to credential request
-   resp, _, authU = CreateCredentialResponse(req, rec, ids, context)
-   return { "response": resp.hex(), "ctx": seal(authU).hex() }
+   resp, sk, authU = CreateCredentialResponseSeeded(req, rec, ids, keyring, oprfseed, idU, context)
+   return { "response": resp.hex(), "ctx": SealContinuation(continuations, authU, sk).hex() }
 
 @app.route("/authenticate", methods=['POST'])
 def authenticate():
    authU = unhexlify(request.form['authU'])
-   authU0 = unseal(unhexlify(request.form['ctx']))
+   token = unhexlify(request.form['ctx'])
    # server authenticates user
    try:
-       UserAuth(authU0, authU)
+       UserAuthContinuation(continuations, token, authU)
    except:
        return { "response": False }
    return { "response": True }
@@ -62,7 +76,8 @@ def authenticate():
 @app.route("/register", methods=['POST'])
 def register():
    req = request.form['request']
-   sec, resp = CreateRegistrationResponse(unhexlify(req))
+   idU = request.form['id']
+   sec, resp = CreateRegistrationResponseSeeded(unhexlify(req), oprfseed, idU, server_skS)
    return { 'response': resp.hex(), "ctx": seal(sec).hex() }
 
 @app.route("/store", methods=['POST'])
@@ -73,7 +88,11 @@ def store():
    if idU in users:
        return { "response": False }
    rec = StoreUserRecord(ctx, reg_rec)
-   users[idU]=rec
+   # fails if the user id is not the one the registration started with
+   try:
+       users[idU]=UserRecordToSeeded(keyring, oprfseed, idU, rec)
+   except ValueError:
+       return { "response": False }
    return { "response": True}
 
 @app.after_request
@@ -62,7 +62,7 @@ int get_session_secret(const int sock,
   // we recover the shared session key, and we set the authorization
   // token and the export_key parameters to NULL since we do not care
   // about them in this demo.
-  if(0!=opaque_RecoverCredentials(response, ctx, context, strlen((char*)context), &ids, sk, NULL, NULL)) {
+  if(0!=opaque_RecoverCredentials(response, ctx, context, strlen((char*)context), &ids, NULL, sk, NULL, NULL)) {
     fprintf(stderr,"Failed to recovercredential\n");
     return 1;
   }
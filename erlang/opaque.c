@@ -91,7 +91,7 @@ static ERL_NIF_TERM c_register(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv
   uint8_t export_key[crypto_hash_sha512_BYTES];
   uint8_t rec[OPAQUE_USER_RECORD_LEN];
 
-  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, rec, export_key)) {
+  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, NULL, rec, export_key)) {
     return enif_raise_exception(env, enif_make_atom(env, "register_failed"));
   }
 
@@ -213,7 +213,7 @@ static ERL_NIF_TERM c_recover_cred(ErlNifEnv* env, int argc, const ERL_NIF_TERM
   uint8_t authU[crypto_auth_hmacsha512_BYTES];
   uint8_t export_key[crypto_hash_sha512_BYTES];
 
-  if(0!=opaque_RecoverCredentials(resp, sec, context, context_len, &ids, sk, authU, export_key)) {
+  if(0!=opaque_RecoverCredentials(resp, sec, context, context_len, &ids, NULL, sk, authU, export_key)) {
     return enif_raise_exception(env, enif_make_atom(env, "recover_cred_failed"));
   }
 
@@ -341,7 +341,7 @@ static ERL_NIF_TERM c_finalize_reg(ErlNifEnv* env, int argc, const ERL_NIF_TERM
   uint8_t export_key[crypto_hash_sha512_BYTES];
   uint8_t rec[OPAQUE_REGISTRATION_RECORD_LEN];
 
-  if(0!=opaque_FinalizeRequest(sec, pub, &ids, rec, export_key)) {
+  if(0!=opaque_FinalizeRequest(sec, pub, &ids, NULL, rec, export_key)) {
     return enif_raise_exception(env, enif_make_atom(env, "finalize_reg_failed"));
   }
 
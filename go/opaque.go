@@ -84,6 +84,7 @@ func Register(pwdU string, skS []byte, ids OpaqueIDS) ([]byte, []byte, error) {
 		C.ushort(len(pwdB)),
 		skS_ptr,
 		&idCC,
+		nil,
 		(*C.uchar)(rec),
 		(*C.uchar)(ek),
 	)
@@ -280,6 +281,7 @@ func RecoverCred(resp []byte, sec []byte, context string, ids OpaqueIDS) ([]byte
 		(*C.uchar)(C.CBytes(ctxB)),
 		C.ushort(len(ctxB)),
 		&idCC,
+		nil,
 		(*C.uchar)(sk),
 		(*C.uchar)(authU),
 		(*C.uchar)(export_key),
@@ -471,6 +473,7 @@ func FinalizeReq(sec []byte, resp []byte, ids OpaqueIDS) ([]byte, []byte, error)
 		(*C.uchar)(C.CBytes(sec)),
 		(*C.uchar)(C.CBytes(resp)),
 		&idCC,
+		nil,
 		(*C.uchar)(rec),
 		(*C.uchar)(ek),
 	)
@@ -112,7 +112,7 @@ static jobject c_register(JNIEnv *env, jobject obj, jstring pwd_, jbyteArray skS
   uint8_t export_key[crypto_hash_sha512_BYTES];
   uint8_t rec[OPAQUE_USER_RECORD_LEN];
 
-  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, rec, export_key)) {
+  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, NULL, rec, export_key)) {
     exception(env,"opaque register() failed...");
   }
   (*env)->ReleaseStringUTFChars(env, pwd_, pwdU);
@@ -249,7 +249,7 @@ static jobject c_recoverCredentials(JNIEnv *env, jobject obj, jbyteArray resp_,
   uint8_t authU[crypto_auth_hmacsha512_BYTES];
   uint8_t export_key[crypto_hash_sha512_BYTES];
 
-  if(0!=opaque_RecoverCredentials(resp, sec, context, context_len, &ids, sk, authU, export_key)) {
+  if(0!=opaque_RecoverCredentials(resp, sec, context, context_len, &ids, NULL, sk, authU, export_key)) {
     exception(env,"opaque recoverCredentials() failed...");
   }
 
@@ -398,7 +398,7 @@ static jobject c_finalizeReg(JNIEnv *env, jobject obj, jbyteArray sec_, jbyteArr
   uint8_t export_key[crypto_hash_sha512_BYTES];
   uint8_t rec[OPAQUE_USER_RECORD_LEN];
 
-  if(0!=opaque_FinalizeRequest(sec, pub, &ids, rec, export_key)) {
+  if(0!=opaque_FinalizeRequest(sec, pub, &ids, NULL, rec, export_key)) {
     exception(env,"opaque register() failed...");
   }
 
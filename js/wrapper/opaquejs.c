@@ -89,7 +89,7 @@ int opaquejs_Register(
   uint8_t export_key[crypto_hash_sha512_BYTES]) {
 
   const Opaque_Ids ids = { ids_idU_len, (uint8_t *)ids_idU, ids_idS_len, (uint8_t *)ids_idS };
-  return opaque_Register(pwdU, pwdU_len, skS, &ids, rec, export_key);
+  return opaque_Register(pwdU, pwdU_len, skS, &ids, NULL, rec, export_key);
 }
 
 
@@ -135,7 +135,7 @@ int opaquejs_RecoverCredentials(
   uint8_t export_key[crypto_hash_sha512_BYTES]) {
 
   const Opaque_Ids ids = { ids_idU_len, (uint8_t *)ids_idU, ids_idS_len, (uint8_t *)ids_idS };
-  if (0 != opaque_RecoverCredentials(resp, sec, ctx, ctx_len, &ids, sk, authU, export_key))
+  if (0 != opaque_RecoverCredentials(resp, sec, ctx, ctx_len, &ids, NULL, sk, authU, export_key))
     return 1;
   return 0;
 }
@@ -180,7 +180,7 @@ int opaquejs_FinalizeRequest(
   uint8_t export_key[crypto_hash_sha512_BYTES]) {
 
   const Opaque_Ids ids = { ids_idU_len, (uint8_t *)ids_idU, ids_idS_len, (uint8_t *)ids_idS };
-  return opaque_FinalizeRequest(sec, pub, &ids, rec, export_key);
+  return opaque_FinalizeRequest(sec, pub, &ids, NULL, rec, export_key);
 }
 
 
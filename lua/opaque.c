@@ -35,7 +35,7 @@ static int reg(lua_State *L) {
   uint8_t export_key[crypto_hash_sha512_BYTES];
   uint8_t rec[OPAQUE_USER_RECORD_LEN];
 
-  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, rec, export_key)) {
+  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, NULL, rec, export_key)) {
     lua_pushstring(L, "opaque register failed.");
     return lua_error(L);
   }
@@ -177,7 +177,7 @@ static int recover_creds(lua_State *L) {
   uint8_t authU[crypto_auth_hmacsha512_BYTES];
   uint8_t export_key[crypto_hash_sha512_BYTES];
 
-  if(0!=opaque_RecoverCredentials(resp, sec, context, context_len, &ids, sk, authU, export_key)) {
+  if(0!=opaque_RecoverCredentials(resp, sec, context, context_len, &ids, NULL, sk, authU, export_key)) {
     lua_pushstring(L, "opaque recover credentials failed.");
     return lua_error(L);
   }
@@ -312,7 +312,7 @@ static int finalize_req(lua_State *L) {
   uint8_t export_key[crypto_hash_sha512_BYTES];
   uint8_t rec[OPAQUE_REGISTRATION_RECORD_LEN];
 
-  if(0!=opaque_FinalizeRequest(sec, pub, &ids, rec, export_key)) {
+  if(0!=opaque_FinalizeRequest(sec, pub, &ids, NULL, rec, export_key)) {
     lua_pushstring(L, "opaque finalize request failed.");
     return lua_error(L);
   }
@@ -48,7 +48,7 @@ PHP_FUNCTION(opaque_register) {
   uint8_t export_key[crypto_hash_sha512_BYTES];
   uint8_t rec[OPAQUE_USER_RECORD_LEN];
 
-  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, rec, export_key)) return;
+  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, NULL, rec, export_key)) return;
 
   zend_array *ret = zend_new_array(2);
   zval zarr;
@@ -169,7 +169,7 @@ PHP_FUNCTION(opaque_recover_credentials) {
   uint8_t authU[crypto_auth_hmacsha512_BYTES];
   uint8_t export_key[crypto_hash_sha512_BYTES];
 
-  if(0!=opaque_RecoverCredentials(resp, sec, context, context_len, &ids, sk, authU, export_key)) return;
+  if(0!=opaque_RecoverCredentials(resp, sec, context, context_len, &ids, NULL, sk, authU, export_key)) return;
 
   zend_array *ret = zend_new_array(3);
   zval zarr;
@@ -298,7 +298,7 @@ PHP_FUNCTION(opaque_finalize_request) {
 
   uint8_t rec[OPAQUE_REGISTRATION_RECORD_LEN];
   uint8_t export_key[crypto_hash_sha512_BYTES];
-  if(0!=opaque_FinalizeRequest(sec, pub, &ids, rec, export_key)) return;
+  if(0!=opaque_FinalizeRequest(sec, pub, &ids, NULL, rec, export_key)) return;
 
   zend_array *ret = zend_new_array(2);
   zval zarr;
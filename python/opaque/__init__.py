@@ -52,19 +52,37 @@ OPAQUE_USER_RECORD_LEN = (
     crypto_scalarmult_SCALARBYTES+             # skS
     OPAQUE_REGISTRATION_RECORD_LEN)
 
+OPAQUE_USER_RECORD_V2_LEN = (
+    4+                                         # key_id
+    crypto_core_ristretto255_SCALARBYTES+      # kU
+    OPAQUE_REGISTRATION_RECORD_LEN)
+
+OPAQUE_USER_RECORD_SEEDED_LEN = (
+    4+                                         # key_id
+    OPAQUE_REGISTRATION_RECORD_LEN)
+
+OPAQUE_OPRF_SEEDBYTES = 64
+
 OPAQUE_USER_SESSION_PUBLIC_LEN = (
     crypto_core_ristretto255_BYTES+            # blinded
     crypto_scalarmult_BYTES+                   # X_u
     OPAQUE_NONCE_BYTES)                        # nonceU
 
 OPAQUE_USER_SESSION_SECRET_LEN = (
-    crypto_core_ristretto255_SCALARBYTES+      # r
+    crypto_core_ristretto255_SCALARBYTES+      # 1/r
     crypto_scalarmult_SCALARBYTES+             # x_u
     OPAQUE_NONCE_BYTES+                        # nonceU
     crypto_core_ristretto255_BYTES+            # blinded
     OPAQUE_USER_SESSION_PUBLIC_LEN+            # ke1
     2)                                         # pwdU_len
 
+OPAQUE_USER_PRECOMPUTED_LEN = (
+    crypto_core_ristretto255_SCALARBYTES+      # r
+    crypto_core_ristretto255_SCALARBYTES+      # 1/r
+    crypto_scalarmult_SCALARBYTES+             # x_u
+    crypto_scalarmult_BYTES+                   # X_u
+    OPAQUE_NONCE_BYTES)                        # nonceU
+
 OPAQUE_SERVER_SESSION_LEN = (
     crypto_core_ristretto255_BYTES+            # Z
     32+                                        # masking_nonce
@@ -87,6 +105,41 @@ OPAQUE_REGISTER_SECRET_LEN = (
     crypto_scalarmult_SCALARBYTES+             # skS
     crypto_core_ristretto255_SCALARBYTES)      # kU
 
+OPAQUE_TICKET_KEYBYTES = 32
+OPAQUE_RESUMPTION_SECRETBYTES = 64
+OPAQUE_TICKET_IDU_MAX = 1024
+
+OPAQUE_TICKET_LEN = (                          # without the user id
+    24+                                        # nonce
+    2+                                         # idU_len
+    8+                                         # expires
+    OPAQUE_RESUMPTION_SECRETBYTES+             # rs
+    16)                                        # mac
+
+OPAQUE_CONTINUATION_KEYBYTES = 32
+
+OPAQUE_CONTINUATION_LEN = (
+    4+                                         # key_id
+    24+                                        # nonce
+    8+                                         # expires
+    crypto_auth_hmacsha512_BYTES+              # authU
+    OPAQUE_SHARED_SECRETBYTES+                 # sk
+    16)                                        # mac
+
+OPAQUE_RESUME_REQUEST_LEN = (                  # without the ticket
+    OPAQUE_NONCE_BYTES+                        # nonceU
+    crypto_scalarmult_BYTES)                   # X_u
+
+OPAQUE_RESUME_SECRET_LEN = (
+    crypto_scalarmult_SCALARBYTES+             # x_u
+    OPAQUE_RESUMPTION_SECRETBYTES+             # rs
+    crypto_hash_sha512_BYTES)                  # request hash
+
+OPAQUE_RESUME_RESPONSE_LEN = (
+    OPAQUE_NONCE_BYTES+                        # nonceS
+    crypto_scalarmult_BYTES+                   # X_s
+    crypto_auth_hmacsha512_BYTES)              # auth
+
 
 def __check(code):
     if code != 0:
@@ -108,6 +161,81 @@ class Ids(ctypes.Structure):
             self.idS=ids.encode('utf8') if isinstance(ids,str) else ids
             self.idS_len=len(self.idS)
 
+# key stretching functions hardening the OPRF output into rwdU
+KSF_IDENTITY = 0  # no stretching, only for testing
+KSF_ARGON2ID = 1  # Argon2id version 0x13 (RFC 9106)
+KSF_SCRYPT = 2    # scrypt (RFC 7914)
+
+# struct describing the key stretching function and its cost
+# parameters, client and server must agree on it. None selects
+# Argon2id with t=2, m=65536 (64MB) and p=1, the same defaults apply
+# to the ops and mem of KSF(KSF_ARGON2ID), scrypt needs both.
+class KSF(ctypes.Structure):
+    _fields_ = [('alg', ctypes.c_uint32),          # one of KSF_*
+                ('parallelism', ctypes.c_uint32),  # Argon2id: lanes p, scrypt: parallelization p
+                ('ops', ctypes.c_uint64),          # Argon2id: passes t, scrypt: cost N, a power of 2
+                ('mem', ctypes.c_uint64),          # Argon2id: memory m in KiB, scrypt: block size r
+                ('workspace', ctypes.c_void_p),    # Argon2id: a Workspace reused across calls, or None
+                ('cache', ctypes.c_void_p)]        # client: an RwdCache of earlier logins, or None
+
+    def __init__(self, alg, ops=None, mem=None, parallelism=1, workspace=None, cache=None):
+        if alg == KSF_ARGON2ID:
+            if ops is None: ops = 2
+            if mem is None: mem = 65536
+        elif alg == KSF_SCRYPT:
+            if ops is None or mem is None: raise ValueError("scrypt needs ops and mem")
+        else:
+            ops = ops or 0
+            mem = mem or 0
+        super().__init__(alg, parallelism, ops, mem,
+                         workspace._ws if workspace is not None else None,
+                         cache._cache if cache is not None else None)
+        # keep the workspace and the cache alive as long as the KSF refers to them
+        self._workspace = workspace
+        self._cache = cache
+
+opaquelib.opaque_workspace_new.restype = ctypes.c_void_p
+opaquelib.opaque_workspace_new.argtypes = [ctypes.c_uint64]
+opaquelib.opaque_workspace_free.argtypes = [ctypes.c_void_p]
+
+# memory for Argon2id that is allocated once, backed by huge pages if
+# possible, and reused by all the calls with a KSF pointing to it. mem
+# is the KiB to allocate right away, or 0 to allocate on first use.
+class Workspace:
+    def __init__(self, mem=0):
+        self._ws = opaquelib.opaque_workspace_new(mem)
+        if self._ws is None: raise MemoryError("opaque_workspace_new failed")
+
+    def __del__(self):
+        if getattr(self, '_ws', None) is not None:
+            opaquelib.opaque_workspace_free(self._ws)
+            self._ws = None
+
+opaquelib.opaque_rwdcache_new.restype = ctypes.c_void_p
+opaquelib.opaque_rwdcache_new.argtypes = [ctypes.c_size_t, ctypes.c_uint32]
+opaquelib.opaque_rwdcache_purge.argtypes = [ctypes.c_void_p]
+opaquelib.opaque_rwdcache_free.argtypes = [ctypes.c_void_p]
+
+# client side cache of hardened passwords in locked memory, logins
+# with a KSF pointing to it skip the key stretching if the same
+# password was recovered within ttl seconds. Call purge() on logout or
+# password change.
+class RwdCache:
+    def __init__(self, max_entries=16, ttl=3600):
+        self._cache = opaquelib.opaque_rwdcache_new(max_entries, ttl)
+        if self._cache is None: raise ValueError("opaque_rwdcache_new failed")
+
+    def purge(self):
+        opaquelib.opaque_rwdcache_purge(self._cache)
+
+    def __del__(self):
+        if getattr(self, '_cache', None) is not None:
+            opaquelib.opaque_rwdcache_free(self._cache)
+            self._cache = None
+
+def __ksf(ksf):
+    return ctypes.pointer(ksf) if ksf is not None else None
+
 #  This function implements the storePwdFile function from the paper
 #  it is not specified by the RFC. This function runs on the server
 #  and creates a new output record rec of secret key material. The
@@ -120,6 +248,8 @@ class Ids(ctypes.Structure):
 #       private key, should be set to NULL if per/user keys are to be
 #       generated
 #  @param [in] ids - the ids of the user and server, see Opaque_Ids
+#  @param [in] ksf - the key stretching function hardening the
+#       password, see Opaque_KSF, NULL for the default
 #  @param [out] rec - the opaque record the server needs to
 #       store. this is a pointer to memory allocated by the caller,
 #       and must be large enough to hold the record and take into
@@ -132,9 +262,10 @@ class Ids(ctypes.Structure):
 #int opaque_Register(const uint8_t *pwdU, const uint16_t pwdU_len,
 #                    const uint8_t skS[crypto_scalarmult_SCALARBYTES],
 #                    const Opaque_Ids *ids,
+#                    const Opaque_KSF *ksf,
 #                    uint8_t rec[OPAQUE_USER_RECORD_LEN],
 #                    uint8_t export_key[crypto_hash_sha512_BYTES]);
-def Register(pwdU, ids, skS=None):
+def Register(pwdU, ids, skS=None, ksf=None):
     if not pwdU:
         raise ValueError("invalid parameter")
     if skS and len(skS) != crypto_scalarmult_SCALARBYTES:
@@ -144,7 +275,7 @@ def Register(pwdU, ids, skS=None):
 
     rec = ctypes.create_string_buffer(OPAQUE_USER_RECORD_LEN)
     export_key = ctypes.create_string_buffer(crypto_hash_sha512_BYTES)
-    __check(opaquelib.opaque_Register(pwdU, len(pwdU), skS, ctypes.pointer(ids), rec, export_key))
+    __check(opaquelib.opaque_Register(pwdU, len(pwdU), skS, ctypes.pointer(ids), __ksf(ksf), rec, export_key))
     return rec.raw, export_key.raw
 
 #  This function initiates a new OPAQUE session, is the same as the
@@ -169,6 +300,35 @@ def CreateCredentialRequest(pwdU):
     opaquelib.opaque_CreateCredentialRequest(pwdU, len(pwdU), sec, pub)
     return pub.raw, sec.raw
 
+#  Computes the password independent values of
+#  CreateCredentialRequest() ahead of time, each result can be passed
+#  once to CreateCredentialRequestPrecomputed(). The result is a
+#  mutable ctypes buffer, which CreateCredentialRequestPrecomputed()
+#  wipes, do not copy it.
+#int opaque_PrecomputeCredentialRequest(uint8_t pre[OPAQUE_USER_PRECOMPUTED_LEN]);
+def PrecomputeCredentialRequest():
+    pre = ctypes.create_string_buffer(OPAQUE_USER_PRECOMPUTED_LEN)
+    __check(opaquelib.opaque_PrecomputeCredentialRequest(pre))
+    return pre
+
+#int opaque_CreateCredentialRequestPrecomputed(uint8_t pre[OPAQUE_USER_PRECOMPUTED_LEN],
+#                                              const uint8_t *pwdU, const uint16_t pwdU_len,
+#                                              uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len],
+#                                              uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN]);
+def CreateCredentialRequestPrecomputed(pre, pwdU):
+    if not pwdU or pre is None:
+        raise ValueError("invalid parameter")
+    # only the buffer of PrecomputeCredentialRequest(), so that it is the
+    # one wiped
+    if not isinstance(pre, ctypes.Array) or ctypes.sizeof(pre) != OPAQUE_USER_PRECOMPUTED_LEN:
+        raise ValueError("invalid pre param")
+    pwdU=pwdU.encode("utf8") if isinstance(pwdU,str) else pwdU
+
+    sec = ctypes.create_string_buffer(OPAQUE_USER_SESSION_SECRET_LEN+len(pwdU))
+    pub = ctypes.create_string_buffer(OPAQUE_USER_SESSION_PUBLIC_LEN)
+    __check(opaquelib.opaque_CreateCredentialRequestPrecomputed(pre, pwdU, len(pwdU), sec, pub))
+    return pub.raw, sec.raw
+
 #  This is the same function as defined in the paper with name
 #  srvSession name. This function runs on the server and
 #  receives the output pub from the user running opaque_CreateCredentialRequest(),
@@ -211,6 +371,272 @@ def CreateCredentialResponse(pub, rec, ids, ctx):
     __check(opaquelib.opaque_CreateCredentialResponse(pub, rec, ctypes.pointer(ids), ctx, len(ctx), resp, sk, sec))
     return resp.raw, sk.raw, sec.raw
 
+#  Server keyring and v2 records, see opaque.h: a v2 record stores
+#  the id of its servers key in a Keyring instead of a copy of skS.
+
+opaquelib.opaque_keyring_new.restype = ctypes.c_void_p
+opaquelib.opaque_keyring_new.argtypes = [ctypes.c_size_t]
+opaquelib.opaque_keyring_add.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_char_p]
+opaquelib.opaque_keyring_remove.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+opaquelib.opaque_keyring_free.argtypes = [ctypes.c_void_p]
+opaquelib.opaque_UserRecordToV2.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+opaquelib.opaque_UserRecordFromV2.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+
+# the long-term keys of a server by key id, for at most slots keys
+class Keyring:
+    def __init__(self, slots=16):
+        self._keyring = opaquelib.opaque_keyring_new(slots)
+        if self._keyring is None: raise ValueError("opaque_keyring_new failed")
+
+    def add(self, key_id, skS):
+        if skS is None or len(skS) != crypto_scalarmult_SCALARBYTES: raise ValueError("invalid skS param")
+        if 0 != opaquelib.opaque_keyring_add(self._keyring, key_id, skS): raise ValueError("opaque_keyring_add failed")
+
+    def remove(self, key_id):
+        if 0 != opaquelib.opaque_keyring_remove(self._keyring, key_id): raise ValueError("opaque_keyring_remove failed")
+
+    def __del__(self):
+        if getattr(self, '_keyring', None) is not None:
+            opaquelib.opaque_keyring_free(self._keyring)
+            self._keyring = None
+
+#int opaque_UserRecordToV2(const Opaque_Keyring *keyring,
+#                          const uint8_t rec[OPAQUE_USER_RECORD_LEN],
+#                          uint8_t rec2[OPAQUE_USER_RECORD_V2_LEN]);
+def UserRecordToV2(keyring, rec):
+    if rec is None or len(rec) != OPAQUE_USER_RECORD_LEN: raise ValueError("invalid rec param")
+    rec2 = ctypes.create_string_buffer(OPAQUE_USER_RECORD_V2_LEN)
+    __check(opaquelib.opaque_UserRecordToV2(keyring._keyring, rec, rec2))
+    return rec2.raw
+
+#int opaque_UserRecordFromV2(const Opaque_Keyring *keyring,
+#                            const uint8_t rec2[OPAQUE_USER_RECORD_V2_LEN],
+#                            uint8_t rec[OPAQUE_USER_RECORD_LEN]);
+def UserRecordFromV2(keyring, rec2):
+    if rec2 is None or len(rec2) != OPAQUE_USER_RECORD_V2_LEN: raise ValueError("invalid rec2 param")
+    rec = ctypes.create_string_buffer(OPAQUE_USER_RECORD_LEN)
+    __check(opaquelib.opaque_UserRecordFromV2(keyring._keyring, rec2, rec))
+    return rec.raw
+
+#int opaque_CreateCredentialResponseV2(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+#                                      const uint8_t rec2[OPAQUE_USER_RECORD_V2_LEN],
+#                                      const Opaque_Ids *ids,
+#                                      const Opaque_Keyring *keyring,
+#                                      const uint8_t *ctx, const uint16_t ctx_len,
+#                                      uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+#                                      uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+#                                      uint8_t authU[crypto_auth_hmacsha512_BYTES]);
+opaquelib.opaque_CreateCredentialResponseV2.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_void_p, ctypes.c_void_p,
+                                                        ctypes.c_char_p, ctypes.c_uint16,
+                                                        ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p]
+def CreateCredentialResponseV2(pub, rec2, ids, keyring, ctx):
+    if None in (pub, rec2, keyring):
+        raise ValueError("invalid parameter")
+    if len(pub) != OPAQUE_USER_SESSION_PUBLIC_LEN: raise ValueError("invalid pub param")
+    if len(rec2) != OPAQUE_USER_RECORD_V2_LEN: raise ValueError("invalid rec2 param")
+
+    ctx=ctx.encode("utf8") if isinstance(ctx,str) else ctx
+
+    resp = ctypes.create_string_buffer(OPAQUE_SERVER_SESSION_LEN)
+    sk = ctypes.create_string_buffer(OPAQUE_SHARED_SECRETBYTES)
+    sec = ctypes.create_string_buffer(crypto_auth_hmacsha512_BYTES)
+    __check(opaquelib.opaque_CreateCredentialResponseV2(pub, rec2, ctypes.cast(ctypes.pointer(ids), ctypes.c_void_p), keyring._keyring, ctx, len(ctx), resp, sk, sec))
+    return resp.raw, sk.raw, sec.raw
+
+#  Server OPRF seed and seeded records, see opaque.h: the kU of a
+#  seeded record is derived from an OprfSeed and the credential
+#  identifier credid, and its skS is in a Keyring.
+
+opaquelib.opaque_oprfseed_new.restype = ctypes.c_void_p
+opaquelib.opaque_oprfseed_new.argtypes = [ctypes.c_char_p, ctypes.c_size_t]
+opaquelib.opaque_oprfseed_free.argtypes = [ctypes.c_void_p]
+opaquelib.opaque_RegisterSeeded.argtypes = [ctypes.c_char_p, ctypes.c_uint16, ctypes.c_char_p, ctypes.c_void_p,
+                                            ctypes.c_char_p, ctypes.c_uint16, ctypes.c_void_p, ctypes.c_void_p,
+                                            ctypes.c_char_p, ctypes.c_char_p]
+opaquelib.opaque_CreateRegistrationResponseSeeded.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_void_p,
+                                                              ctypes.c_char_p, ctypes.c_uint16,
+                                                              ctypes.c_char_p, ctypes.c_char_p]
+opaquelib.opaque_UserRecordToSeeded.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint16,
+                                                ctypes.c_char_p, ctypes.c_char_p]
+opaquelib.opaque_UserRecordFromSeeded.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint16,
+                                                  ctypes.c_char_p, ctypes.c_char_p]
+opaquelib.opaque_FakeUserRecordSeeded.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_char_p, ctypes.c_uint16,
+                                                  ctypes.c_char_p]
+opaquelib.opaque_CreateCredentialResponseSeeded.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_void_p, ctypes.c_void_p,
+                                                            ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint16,
+                                                            ctypes.c_char_p, ctypes.c_uint16,
+                                                            ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p]
+
+# the OPRF seed of a server, random if seed is None, caching the keys
+# of cache_entries credids
+class OprfSeed:
+    def __init__(self, seed=None, cache_entries=0):
+        if seed is not None and len(seed) != OPAQUE_OPRF_SEEDBYTES: raise ValueError("invalid seed param")
+        self._oprfseed = opaquelib.opaque_oprfseed_new(seed, cache_entries)
+        if self._oprfseed is None: raise ValueError("opaque_oprfseed_new failed")
+
+    def __del__(self):
+        if getattr(self, '_oprfseed', None) is not None:
+            opaquelib.opaque_oprfseed_free(self._oprfseed)
+            self._oprfseed = None
+
+def __credid(credid):
+    credid=credid.encode("utf8") if isinstance(credid,str) else credid
+    if not credid or len(credid) > 0xffff: raise ValueError("invalid credid param")
+    return credid
+
+def RegisterSeeded(pwdU, ids, oprfseed, credid, skS=None, ksf=None):
+    if not pwdU or oprfseed is None:
+        raise ValueError("invalid parameter")
+    if skS and len(skS) != crypto_scalarmult_SCALARBYTES:
+        raise ValueError("invalid skS param")
+
+    pwdU=pwdU.encode("utf8") if isinstance(pwdU,str) else pwdU
+    credid=__credid(credid)
+
+    rec = ctypes.create_string_buffer(OPAQUE_USER_RECORD_LEN)
+    export_key = ctypes.create_string_buffer(crypto_hash_sha512_BYTES)
+    __check(opaquelib.opaque_RegisterSeeded(pwdU, len(pwdU), skS, oprfseed._oprfseed, credid, len(credid),
+                                            ctypes.cast(ctypes.pointer(ids), ctypes.c_void_p),
+                                            __ksf(ksf), rec, export_key))
+    return rec.raw, export_key.raw
+
+def CreateRegistrationResponseSeeded(request, oprfseed, credid, skS=None):
+    if not request or oprfseed is None:
+        raise ValueError("invalid parameter")
+    if len(request) != crypto_core_ristretto255_BYTES: raise ValueError("invalid request param")
+    if skS is not None and len(skS) != crypto_scalarmult_SCALARBYTES: raise ValueError("invalid skS param")
+    credid=__credid(credid)
+
+    sec = ctypes.create_string_buffer(OPAQUE_REGISTER_SECRET_LEN)
+    pub = ctypes.create_string_buffer(OPAQUE_REGISTER_PUBLIC_LEN)
+    __check(opaquelib.opaque_CreateRegistrationResponseSeeded(request, skS, oprfseed._oprfseed, credid, len(credid), sec, pub))
+    return sec.raw, pub.raw
+
+def UserRecordToSeeded(keyring, oprfseed, credid, rec):
+    if rec is None or len(rec) != OPAQUE_USER_RECORD_LEN: raise ValueError("invalid rec param")
+    credid=__credid(credid)
+    rec3 = ctypes.create_string_buffer(OPAQUE_USER_RECORD_SEEDED_LEN)
+    __check(opaquelib.opaque_UserRecordToSeeded(keyring._keyring, oprfseed._oprfseed, credid, len(credid), rec, rec3))
+    return rec3.raw
+
+def UserRecordFromSeeded(keyring, oprfseed, credid, rec3):
+    if rec3 is None or len(rec3) != OPAQUE_USER_RECORD_SEEDED_LEN: raise ValueError("invalid rec3 param")
+    credid=__credid(credid)
+    rec = ctypes.create_string_buffer(OPAQUE_USER_RECORD_LEN)
+    __check(opaquelib.opaque_UserRecordFromSeeded(keyring._keyring, oprfseed._oprfseed, credid, len(credid), rec3, rec))
+    return rec.raw
+
+# the record to answer logins of an unknown credid with
+def FakeUserRecordSeeded(oprfseed, key_id, credid):
+    credid=__credid(credid)
+    rec3 = ctypes.create_string_buffer(OPAQUE_USER_RECORD_SEEDED_LEN)
+    __check(opaquelib.opaque_FakeUserRecordSeeded(oprfseed._oprfseed, key_id, credid, len(credid), rec3))
+    return rec3.raw
+
+def CreateCredentialResponseSeeded(pub, rec3, ids, keyring, oprfseed, credid, ctx):
+    if None in (pub, rec3, keyring, oprfseed):
+        raise ValueError("invalid parameter")
+    if len(pub) != OPAQUE_USER_SESSION_PUBLIC_LEN: raise ValueError("invalid pub param")
+    if len(rec3) != OPAQUE_USER_RECORD_SEEDED_LEN: raise ValueError("invalid rec3 param")
+
+    ctx=ctx.encode("utf8") if isinstance(ctx,str) else ctx
+    credid=__credid(credid)
+
+    resp = ctypes.create_string_buffer(OPAQUE_SERVER_SESSION_LEN)
+    sk = ctypes.create_string_buffer(OPAQUE_SHARED_SECRETBYTES)
+    sec = ctypes.create_string_buffer(crypto_auth_hmacsha512_BYTES)
+    __check(opaquelib.opaque_CreateCredentialResponseSeeded(pub, rec3, ctypes.cast(ctypes.pointer(ids), ctypes.c_void_p),
+                                                            keyring._keyring, oprfseed._oprfseed, credid, len(credid),
+                                                            ctx, len(ctx), resp, sk, sec))
+    return resp.raw, sk.raw, sec.raw
+
+#  Record cache, see opaque_hotcache_new() in opaque.h: keeps the
+#  values derived from the records of accounts that log in often.
+
+class HotCacheStats(ctypes.Structure):
+    _fields_ = [('hits', ctypes.c_uint64), ('misses', ctypes.c_uint64), ('evictions', ctypes.c_uint64),
+                ('entries', ctypes.c_uint64), ('hit_ns', ctypes.c_uint64), ('miss_ns', ctypes.c_uint64)]
+
+opaquelib.opaque_hotcache_new.restype = ctypes.c_void_p
+opaquelib.opaque_hotcache_new.argtypes = [ctypes.c_size_t, ctypes.c_size_t]
+opaquelib.opaque_hotcache_evict.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+opaquelib.opaque_hotcache_purge.argtypes = [ctypes.c_void_p]
+opaquelib.opaque_hotcache_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(HotCacheStats)]
+opaquelib.opaque_hotcache_free.argtypes = [ctypes.c_void_p]
+opaquelib.opaque_CreateCredentialResponseCached.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_void_p, ctypes.c_void_p,
+                                                            ctypes.c_char_p, ctypes.c_uint16,
+                                                            ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p]
+
+class HotCache:
+    def __init__(self, max_entries=1024, shards=1):
+        self._hotcache = opaquelib.opaque_hotcache_new(max_entries, shards)
+        if self._hotcache is None: raise ValueError("opaque_hotcache_new failed")
+
+    # returns True if rec was cached
+    def evict(self, rec):
+        if rec is None or len(rec) != OPAQUE_USER_RECORD_LEN: raise ValueError("invalid rec param")
+        return opaquelib.opaque_hotcache_evict(self._hotcache, rec) == 0
+
+    def purge(self):
+        opaquelib.opaque_hotcache_purge(self._hotcache)
+
+    def stats(self):
+        stats = HotCacheStats()
+        opaquelib.opaque_hotcache_stats(self._hotcache, ctypes.byref(stats))
+        return {name: getattr(stats, name) for name, _ in HotCacheStats._fields_}
+
+    def __del__(self):
+        if getattr(self, '_hotcache', None) is not None:
+            opaquelib.opaque_hotcache_free(self._hotcache)
+            self._hotcache = None
+
+#int opaque_CreateCredentialResponseCached(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+#                                          const uint8_t rec[OPAQUE_USER_RECORD_LEN],
+#                                          const Opaque_Ids *ids,
+#                                          Opaque_HotCache *cache,
+#                                          const uint8_t *ctx, const uint16_t ctx_len,
+#                                          uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+#                                          uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+#                                          uint8_t authU[crypto_auth_hmacsha512_BYTES]);
+def CreateCredentialResponseCached(pub, rec, ids, cache, ctx):
+    if None in (pub, rec, ids, cache):
+        raise ValueError("invalid parameter")
+    if len(pub) != OPAQUE_USER_SESSION_PUBLIC_LEN: raise ValueError("invalid pub param")
+    if len(rec) != OPAQUE_USER_RECORD_LEN: raise ValueError("invalid rec param")
+
+    ctx=ctx.encode("utf8") if isinstance(ctx,str) else ctx
+
+    resp = ctypes.create_string_buffer(OPAQUE_SERVER_SESSION_LEN)
+    sk = ctypes.create_string_buffer(OPAQUE_SHARED_SECRETBYTES)
+    sec = ctypes.create_string_buffer(crypto_auth_hmacsha512_BYTES)
+    __check(opaquelib.opaque_CreateCredentialResponseCached(pub, rec, ctypes.cast(ctypes.pointer(ids), ctypes.c_void_p),
+                                                            cache._hotcache, ctx, len(ctx), resp, sk, sec))
+    return resp.raw, sk.raw, sec.raw
+
+#  Precomputes the nonces and ephemeral keys of
+#  CreateCredentialResponse() in threads background threads, see
+#  opaque_keyshares_start() in opaque.h.
+#int opaque_keyshares_start(const size_t capacity, const size_t threads);
+opaquelib.opaque_keyshares_start.argtypes = [ctypes.c_size_t, ctypes.c_size_t]
+opaquelib.opaque_keyshares_fill.restype = ctypes.c_size_t
+opaquelib.opaque_keyshares_fill.argtypes = [ctypes.c_size_t]
+opaquelib.opaque_keyshares_available.restype = ctypes.c_size_t
+def KeysharesStart(capacity=1024, threads=1):
+    __check(opaquelib.opaque_keyshares_start(capacity, threads))
+
+#size_t opaque_keyshares_fill(const size_t max);
+def KeysharesFill(max=1024):
+    return opaquelib.opaque_keyshares_fill(max)
+
+#size_t opaque_keyshares_available(void);
+def KeysharesAvailable():
+    return opaquelib.opaque_keyshares_available()
+
+#void opaque_keyshares_stop(void);
+def KeysharesStop():
+    opaquelib.opaque_keyshares_stop()
+
 #  This is the same function as defined in the paper with the
 #  usrSessionEnd name. It is run by the user and receives as input the
 #  response from the previous server opaque_CreateCredentialResponse()
@@ -229,6 +655,8 @@ def CreateCredentialResponse(pub, rec, ids, ctx):
 #  @param [in] ctx - a context of this instantiation of this protocol, e.g. "AppABCv12.34"
 #  @param [in] ctx_len - a context of this instantiation of this protocol
 #  @param [in] ids - The ids of the server/client in case they are not the default.
+#  @param [in] ksf - the key stretching function the password was
+#  registered with, see Opaque_KSF, NULL for the default
 #  @param [out] sk - the shared secret established between the user & server
 #  @param [out] authU - the authentication code to be sent to the server
 #  in case explicit user authentication is required
@@ -239,10 +667,11 @@ def CreateCredentialResponse(pub, rec, ids, ctx):
 #                              const uint8_t *sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
 #                              const uint8_t *ctx, const uint16_t ctx_len,
 #                              const Opaque_Ids *ids,
+#                              const Opaque_KSF *ksf,
 #                              uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
 #                              uint8_t authU[crypto_auth_hmacsha512_BYTES],
 #                              uint8_t export_key[crypto_hash_sha512_BYTES]);
-def RecoverCredentials(resp, sec, ctx, ids=None):
+def RecoverCredentials(resp, sec, ctx, ids=None, ksf=None):
     if None in (resp, sec):
         raise ValueError("invalid parameter")
     if len(resp) != OPAQUE_SERVER_SESSION_LEN: raise ValueError("invalid resp param")
@@ -256,7 +685,7 @@ def RecoverCredentials(resp, sec, ctx, ids=None):
 
     if ids is None: ids = Ids()
 
-    __check(opaquelib.opaque_RecoverCredentials(resp, sec, ctx, len(ctx), ctypes.pointer(ids), sk, authU, export_key))
+    __check(opaquelib.opaque_RecoverCredentials(resp, sec, ctx, len(ctx), ctypes.pointer(ids), __ksf(ksf), sk, authU, export_key))
     return sk.raw, authU.raw, export_key.raw
 
 #  Explicit User Authentication.
@@ -278,6 +707,280 @@ def UserAuth(authU0, authU):
 
     __check(opaquelib.opaque_UserAuth(authU0, authU))
 
+#  Continuation tokens, see opaque.h: instead of keeping authU and sk
+#  until the client authenticates, the server seals them into a token
+#  for the client, and any server sharing the key completes the login.
+
+opaquelib.opaque_continuations_new.restype = ctypes.c_void_p
+opaquelib.opaque_continuations_new.argtypes = [ctypes.c_char_p, ctypes.c_uint32, ctypes.c_uint32, ctypes.c_size_t]
+opaquelib.opaque_continuations_rotate.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint32]
+opaquelib.opaque_continuations_free.argtypes = [ctypes.c_void_p]
+opaquelib.opaque_SealContinuation.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p]
+opaquelib.opaque_UserAuthContinuation.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p]
+
+# the token key of id key_id and the replay protection of a server.
+# key is None for a random one, tokens are valid for lifetime seconds
+# and the last max_used redeemed ones are remembered.
+class Continuations:
+    def __init__(self, key=None, key_id=1, lifetime=60, max_used=4096):
+        if key is not None and len(key) != OPAQUE_CONTINUATION_KEYBYTES: raise ValueError("invalid key param")
+        self._continuations = opaquelib.opaque_continuations_new(key, key_id, lifetime, max_used)
+        if self._continuations is None: raise ValueError("opaque_continuations_new failed")
+
+    def rotate(self, key_id, key=None):
+        if key is not None and len(key) != OPAQUE_CONTINUATION_KEYBYTES: raise ValueError("invalid key param")
+        if 0 != opaquelib.opaque_continuations_rotate(self._continuations, key, key_id): raise ValueError("opaque_continuations_rotate failed")
+
+    def __del__(self):
+        if getattr(self, '_continuations', None) is not None:
+            opaquelib.opaque_continuations_free(self._continuations)
+            self._continuations = None
+
+#int opaque_SealContinuation(Opaque_Continuations *continuations,
+#                            const uint8_t authU[crypto_auth_hmacsha512_BYTES],
+#                            const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+#                            uint8_t token[OPAQUE_CONTINUATION_LEN]);
+def SealContinuation(continuations, authU, sk):
+    if authU is None or len(authU) != crypto_auth_hmacsha512_BYTES: raise ValueError("invalid authU param")
+    if sk is None or len(sk) != OPAQUE_SHARED_SECRETBYTES: raise ValueError("invalid sk param")
+    token = ctypes.create_string_buffer(OPAQUE_CONTINUATION_LEN)
+    __check(opaquelib.opaque_SealContinuation(continuations._continuations, authU, sk, token))
+    return token.raw
+
+#int opaque_UserAuthContinuation(Opaque_Continuations *continuations,
+#                                const uint8_t token[OPAQUE_CONTINUATION_LEN],
+#                                const uint8_t authU[crypto_auth_hmacsha512_BYTES],
+#                                uint8_t sk[OPAQUE_SHARED_SECRETBYTES]);
+def UserAuthContinuation(continuations, token, authU):
+    if token is None or len(token) != OPAQUE_CONTINUATION_LEN: raise ValueError("invalid token param")
+    if authU is None or len(authU) != crypto_auth_hmacsha512_BYTES: raise ValueError("invalid authU param")
+    sk = ctypes.create_string_buffer(OPAQUE_SHARED_SECRETBYTES)
+    __check(opaquelib.opaque_UserAuthContinuation(continuations._continuations, token, authU, sk))
+    return sk.raw
+
+#  Asynchronous calls, see opaque.h: the calls run on a pool of
+#  threads, an event loop waits for the fd of the pool to be readable,
+#  e.g. with loop.add_reader(a.fileno(), ...), and takes the results
+#  with complete(). The submit methods return the tag of the call, or
+#  None while depth calls are pending, the buffers of a call are kept
+#  here until it completes.
+
+OPAQUE_ASYNC_FULL = 1
+
+class AsyncResult(ctypes.Structure):
+    _fields_ = [('user', ctypes.c_void_p), ('ret', ctypes.c_int)]
+
+opaquelib.opaque_async_new.restype = ctypes.c_void_p
+opaquelib.opaque_async_new.argtypes = [ctypes.c_size_t, ctypes.c_size_t]
+opaquelib.opaque_async_fd.argtypes = [ctypes.c_void_p]
+opaquelib.opaque_async_complete.restype = ctypes.c_size_t
+opaquelib.opaque_async_complete.argtypes = [ctypes.c_void_p, ctypes.POINTER(AsyncResult), ctypes.c_size_t]
+opaquelib.opaque_async_drain.argtypes = [ctypes.c_void_p]
+opaquelib.opaque_async_free.argtypes = [ctypes.c_void_p]
+
+# __ksf() would be mangled inside the class
+def _async_ksf(ksf):
+    return ctypes.pointer(ksf) if ksf is not None else None
+
+class Async:
+    def __init__(self, threads=0, depth=256):
+        self._async = opaquelib.opaque_async_new(threads, depth)
+        if self._async is None: raise ValueError("opaque_async_new failed")
+        # the inputs and outputs of the pending calls by their tag
+        self._pending = {}
+        self._next = 1
+
+    def fileno(self):
+        return opaquelib.opaque_async_fd(self._async)
+
+    def _submit(self, fn, tag, keep, outputs, *args):
+        if tag is None:
+            tag = self._next
+            self._next += 1
+        ret = fn(ctypes.c_void_p(self._async), None, ctypes.c_void_p(id(keep)), *args)
+        if ret == OPAQUE_ASYNC_FULL: return None
+        if ret != 0: raise ValueError("the pool is stopping")
+        self._pending[id(keep)] = (tag, keep, outputs)
+        return tag
+
+    # returns a list of (tag, outputs) of the completed calls, outputs
+    # is the tuple returned by the synchronous function, or None if
+    # the call failed
+    def complete(self, max=64):
+        results = (AsyncResult * max)()
+        n = opaquelib.opaque_async_complete(self._async, results, max)
+        done = []
+        for i in range(n):
+            tag, keep, outputs = self._pending.pop(results[i].user)
+            done.append((tag, tuple(o.raw for o in outputs) if results[i].ret == 0 else None))
+        return done
+
+    def drain(self):
+        opaquelib.opaque_async_drain(self._async)
+
+    def Register(self, pwdU, ids, skS=None, ksf=None, tag=None):
+        if pwdU is None or ids is None: raise ValueError("invalid parameter")
+        pwdU=pwdU.encode("utf8") if isinstance(pwdU,str) else pwdU
+        if skS is not None and len(skS) != crypto_scalarmult_SCALARBYTES: raise ValueError("invalid skS param")
+        rec = ctypes.create_string_buffer(OPAQUE_USER_RECORD_LEN)
+        export_key = ctypes.create_string_buffer(crypto_hash_sha512_BYTES)
+        keep = [pwdU, skS, ids, ksf, rec, export_key]
+        return self._submit(opaquelib.opaque_async_Register, tag, keep, (rec, export_key),
+                            ctypes.c_char_p(pwdU), ctypes.c_uint16(len(pwdU)), ctypes.c_char_p(skS),
+                            ctypes.pointer(ids), _async_ksf(ksf), rec, export_key)
+
+    def CreateRegistrationResponse(self, request, skS=None, tag=None):
+        if request is None or len(request) != crypto_core_ristretto255_BYTES: raise ValueError("invalid request param")
+        if skS is not None and len(skS) != crypto_scalarmult_SCALARBYTES: raise ValueError("invalid skS param")
+        sec = ctypes.create_string_buffer(OPAQUE_REGISTER_SECRET_LEN)
+        pub = ctypes.create_string_buffer(OPAQUE_REGISTER_PUBLIC_LEN)
+        keep = [request, skS, sec, pub]
+        return self._submit(opaquelib.opaque_async_CreateRegistrationResponse, tag, keep, (sec, pub),
+                            ctypes.c_char_p(request), ctypes.c_char_p(skS), sec, pub)
+
+    def FinalizeRequest(self, sec, pub, ids, ksf=None, tag=None):
+        if None in (sec, pub, ids): raise ValueError("invalid parameter")
+        if len(sec) <= OPAQUE_REGISTER_USER_SEC_LEN: raise ValueError("invalid sec param")
+        if len(pub) != OPAQUE_REGISTER_PUBLIC_LEN: raise ValueError("invalid pub param")
+        rec = ctypes.create_string_buffer(OPAQUE_REGISTRATION_RECORD_LEN)
+        export_key = ctypes.create_string_buffer(crypto_hash_sha512_BYTES)
+        keep = [sec, pub, ids, ksf, rec, export_key]
+        return self._submit(opaquelib.opaque_async_FinalizeRequest, tag, keep, (rec, export_key),
+                            ctypes.c_char_p(sec), ctypes.c_char_p(pub), ctypes.pointer(ids), _async_ksf(ksf), rec, export_key)
+
+    def CreateCredentialRequest(self, pwdU, tag=None):
+        if pwdU is None: raise ValueError("invalid parameter")
+        pwdU=pwdU.encode("utf8") if isinstance(pwdU,str) else pwdU
+        sec = ctypes.create_string_buffer(OPAQUE_USER_SESSION_SECRET_LEN+len(pwdU))
+        pub = ctypes.create_string_buffer(OPAQUE_USER_SESSION_PUBLIC_LEN)
+        keep = [pwdU, sec, pub]
+        return self._submit(opaquelib.opaque_async_CreateCredentialRequest, tag, keep, (pub, sec),
+                            ctypes.c_char_p(pwdU), ctypes.c_uint16(len(pwdU)), sec, pub)
+
+    def CreateCredentialResponse(self, pub, rec, ids, ctx, tag=None):
+        if None in (pub, rec, ids): raise ValueError("invalid parameter")
+        if len(pub) != OPAQUE_USER_SESSION_PUBLIC_LEN: raise ValueError("invalid pub param")
+        if len(rec) != OPAQUE_USER_RECORD_LEN: raise ValueError("invalid rec param")
+        ctx=ctx.encode("utf8") if isinstance(ctx,str) else ctx
+        resp = ctypes.create_string_buffer(OPAQUE_SERVER_SESSION_LEN)
+        sk = ctypes.create_string_buffer(OPAQUE_SHARED_SECRETBYTES)
+        authU = ctypes.create_string_buffer(crypto_auth_hmacsha512_BYTES)
+        keep = [pub, rec, ids, ctx, resp, sk, authU]
+        return self._submit(opaquelib.opaque_async_CreateCredentialResponse, tag, keep, (resp, sk, authU),
+                            ctypes.c_char_p(pub), ctypes.c_char_p(rec), ctypes.pointer(ids),
+                            ctypes.c_char_p(ctx), ctypes.c_uint16(len(ctx)), resp, sk, authU)
+
+    def RecoverCredentials(self, resp, sec, ctx, ids=None, ksf=None, tag=None):
+        if None in (resp, sec): raise ValueError("invalid parameter")
+        if len(resp) != OPAQUE_SERVER_SESSION_LEN: raise ValueError("invalid resp param")
+        if len(sec) <= OPAQUE_USER_SESSION_SECRET_LEN: raise ValueError("invalid sec param")
+        ctx=ctx.encode("utf8") if isinstance(ctx,str) else ctx
+        if ids is None: ids = Ids()
+        sk = ctypes.create_string_buffer(OPAQUE_SHARED_SECRETBYTES)
+        authU = ctypes.create_string_buffer(crypto_auth_hmacsha512_BYTES)
+        export_key = ctypes.create_string_buffer(crypto_hash_sha512_BYTES)
+        keep = [resp, sec, ctx, ids, ksf, sk, authU, export_key]
+        return self._submit(opaquelib.opaque_async_RecoverCredentials, tag, keep, (sk, authU, export_key),
+                            ctypes.c_char_p(resp), ctypes.c_char_p(sec), ctypes.c_char_p(ctx), ctypes.c_uint16(len(ctx)),
+                            ctypes.pointer(ids), _async_ksf(ksf), sk, authU, export_key)
+
+    def __del__(self):
+        if getattr(self, '_async', None) is not None:
+            opaquelib.opaque_async_free(self._async)
+            self._async = None
+
+#  Session resumption, see opaque.h: after a login that passed
+#  UserAuth() the server issues a ticket for the resumption secret of
+#  sk, later the client resumes with it by a key exchange without the
+#  OPRF and the key stretching.
+
+opaquelib.opaque_tickets_new.restype = ctypes.c_void_p
+opaquelib.opaque_tickets_new.argtypes = [ctypes.c_char_p, ctypes.c_uint32, ctypes.c_size_t]
+opaquelib.opaque_tickets_free.argtypes = [ctypes.c_void_p]
+
+# the ticket key and the replay protection of a server. key is None
+# for a random one, tickets are valid for lifetime seconds and the
+# last max_used redeemed ones are remembered.
+class Tickets:
+    def __init__(self, key=None, lifetime=3600, max_used=4096):
+        if key is not None and len(key) != OPAQUE_TICKET_KEYBYTES: raise ValueError("invalid key param")
+        self._tickets = opaquelib.opaque_tickets_new(key, lifetime, max_used)
+        if self._tickets is None: raise ValueError("opaque_tickets_new failed")
+
+    def __del__(self):
+        if getattr(self, '_tickets', None) is not None:
+            opaquelib.opaque_tickets_free(self._tickets)
+            self._tickets = None
+
+#void opaque_ResumptionSecret(const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+#                             uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES]);
+def ResumptionSecret(sk):
+    if sk is None or len(sk) != OPAQUE_SHARED_SECRETBYTES: raise ValueError("invalid sk param")
+    rs = ctypes.create_string_buffer(OPAQUE_RESUMPTION_SECRETBYTES)
+    opaquelib.opaque_ResumptionSecret(sk, rs)
+    return rs.raw
+
+#int opaque_IssueTicket(const Opaque_Tickets *tickets,
+#                       const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+#                       const uint8_t *idU, const uint16_t idU_len,
+#                       uint8_t *ticket/*[OPAQUE_TICKET_LEN+idU_len]*/);
+def IssueTicket(tickets, sk, idU=b''):
+    if sk is None or len(sk) != OPAQUE_SHARED_SECRETBYTES: raise ValueError("invalid sk param")
+    idU=idU.encode("utf8") if isinstance(idU,str) else idU
+    if len(idU) > OPAQUE_TICKET_IDU_MAX: raise ValueError("invalid idU param")
+    ticket = ctypes.create_string_buffer(OPAQUE_TICKET_LEN+len(idU))
+    __check(opaquelib.opaque_IssueTicket(ctypes.c_void_p(tickets._tickets), sk, idU, len(idU), ticket))
+    return ticket.raw
+
+#int opaque_CreateResumptionRequest(const uint8_t *ticket, const uint16_t ticket_len,
+#                                   const uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES],
+#                                   const int dh,
+#                                   uint8_t sec[OPAQUE_RESUME_SECRET_LEN],
+#                                   uint8_t *req/*[OPAQUE_RESUME_REQUEST_LEN+ticket_len]*/);
+def CreateResumptionRequest(ticket, rs, dh=True):
+    if None in (ticket, rs):
+        raise ValueError("invalid parameter")
+    if len(ticket) < OPAQUE_TICKET_LEN: raise ValueError("invalid ticket param")
+    if len(rs) != OPAQUE_RESUMPTION_SECRETBYTES: raise ValueError("invalid rs param")
+    sec = ctypes.create_string_buffer(OPAQUE_RESUME_SECRET_LEN)
+    req = ctypes.create_string_buffer(OPAQUE_RESUME_REQUEST_LEN+len(ticket))
+    __check(opaquelib.opaque_CreateResumptionRequest(ticket, len(ticket), rs, 1 if dh else 0, sec, req))
+    return sec.raw, req.raw
+
+#int opaque_CreateResumptionResponse(Opaque_Tickets *tickets,
+#                                    const uint8_t *req, const size_t req_len,
+#                                    const uint8_t *ctx, const uint16_t ctx_len,
+#                                    uint8_t resp[OPAQUE_RESUME_RESPONSE_LEN],
+#                                    uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+#                                    uint8_t authU[crypto_auth_hmacsha512_BYTES],
+#                                    uint8_t *idU);
+def CreateResumptionResponse(tickets, req, ctx):
+    if req is None or len(req) < OPAQUE_RESUME_REQUEST_LEN+OPAQUE_TICKET_LEN: raise ValueError("invalid req param")
+    ctx=ctx.encode("utf8") if isinstance(ctx,str) else ctx
+    resp = ctypes.create_string_buffer(OPAQUE_RESUME_RESPONSE_LEN)
+    sk = ctypes.create_string_buffer(OPAQUE_SHARED_SECRETBYTES)
+    authU = ctypes.create_string_buffer(crypto_auth_hmacsha512_BYTES)
+    idU = ctypes.create_string_buffer(len(req)-OPAQUE_RESUME_REQUEST_LEN-OPAQUE_TICKET_LEN)
+    __check(opaquelib.opaque_CreateResumptionResponse(ctypes.c_void_p(tickets._tickets), req, ctypes.c_size_t(len(req)),
+                                                      ctx, len(ctx), resp, sk, authU, idU))
+    return resp.raw, sk.raw, authU.raw, idU.raw
+
+#int opaque_RecoverResumption(const uint8_t resp[OPAQUE_RESUME_RESPONSE_LEN],
+#                             const uint8_t sec[OPAQUE_RESUME_SECRET_LEN],
+#                             const uint8_t *ctx, const uint16_t ctx_len,
+#                             uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+#                             uint8_t authU[crypto_auth_hmacsha512_BYTES]);
+def RecoverResumption(resp, sec, ctx):
+    if None in (resp, sec):
+        raise ValueError("invalid parameter")
+    if len(resp) != OPAQUE_RESUME_RESPONSE_LEN: raise ValueError("invalid resp param")
+    if len(sec) != OPAQUE_RESUME_SECRET_LEN: raise ValueError("invalid sec param")
+    ctx=ctx.encode("utf8") if isinstance(ctx,str) else ctx
+    sk = ctypes.create_string_buffer(OPAQUE_SHARED_SECRETBYTES)
+    authU = ctypes.create_string_buffer(crypto_auth_hmacsha512_BYTES)
+    __check(opaquelib.opaque_RecoverResumption(resp, sec, ctx, len(ctx), sk, authU))
+    return sk.raw, authU.raw
+
 #  Alternative user initialization, user registration as specified by the RFC
 
 #  The paper originally proposes a very simple 1 shot interface for
@@ -362,6 +1065,8 @@ def CreateRegistrationResponse(request, skS=None):
 #  @param [in] pub - response from the server running
 #  opaque_CreateRegistrationResponse()
 #  @param [in] ids
+#  @param [in] ksf - the key stretching function hardening the
+#  password, see Opaque_KSF, NULL for the default
 #  @param [out] reg_ rec - the opaque registration record containing
 #  the users data.
 #  @param [out] export_key - key used to encrypt/authenticate extra
@@ -371,9 +1076,10 @@ def CreateRegistrationResponse(request, skS=None):
 #int opaque_FinalizeRequest(const uint8_t *sec/*[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len]*/,
 #                           const uint8_t pub[OPAQUE_REGISTER_PUBLIC_LEN],
 #                           const Opaque_Ids *ids,
+#                           const Opaque_KSF *ksf,
 #                           uint8_t reg_rec[OPAQUE_REGISTRATION_RECORD_LEN],
 #                           uint8_t export_key[crypto_hash_sha512_BYTES]);
-def FinalizeRequest(sec, pub, ids):
+def FinalizeRequest(sec, pub, ids, ksf=None):
     if None in (sec, pub, ids):
         raise ValueError("invalid parameter")
     if len(sec) <= OPAQUE_REGISTER_USER_SEC_LEN: raise ValueError("invalid sec param")
@@ -381,7 +1087,7 @@ def FinalizeRequest(sec, pub, ids):
 
     rec = ctypes.create_string_buffer(OPAQUE_REGISTRATION_RECORD_LEN)
     export_key = ctypes.create_string_buffer(crypto_hash_sha512_BYTES)
-    __check(opaquelib.opaque_FinalizeRequest(sec, pub, ctypes.pointer(ids), rec, export_key))
+    __check(opaquelib.opaque_FinalizeRequest(sec, pub, ctypes.pointer(ids), __ksf(ksf), rec, export_key))
     return rec.raw, export_key.raw
 
 #  Final Registration step - server adds own info to the record to be stored.
@@ -39,7 +39,7 @@ VALUE opaque_register(int argc, VALUE *argv, VALUE obj) {
   uint8_t export_key[crypto_hash_sha512_BYTES];
   uint8_t rec[OPAQUE_USER_RECORD_LEN];
 
-  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, rec, export_key)) {
+  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, NULL, rec, export_key)) {
       rb_raise(rb_eRuntimeError, "register failed");
   }
 
@@ -153,7 +153,7 @@ VALUE opaque_recover_credentials(int argc, VALUE *argv, VALUE obj) {
   uint8_t authU[crypto_auth_hmacsha512_BYTES];
   uint8_t export_key[crypto_hash_sha512_BYTES];
 
-  if(0!=opaque_RecoverCredentials(resp, sec, context, context_len, &ids, sk, authU, export_key)) {
+  if(0!=opaque_RecoverCredentials(resp, sec, context, context_len, &ids, NULL, sk, authU, export_key)) {
     rb_raise(rb_eRuntimeError, "recover credentials failed");
   }
 
@@ -264,7 +264,7 @@ VALUE opaque_finalize_request(int argc, VALUE *argv, VALUE obj) {
 
   uint8_t rec[OPAQUE_REGISTRATION_RECORD_LEN];
   uint8_t export_key[crypto_hash_sha512_BYTES];
-  if(0!=opaque_FinalizeRequest(sec, pub, &ids, rec, export_key)) {
+  if(0!=opaque_FinalizeRequest(sec, pub, &ids, NULL, rec, export_key)) {
     rb_raise(rb_eRuntimeError, "create registration response failed");
   }
 
@@ -105,6 +105,18 @@ static void opaque_common_mech_dispose(void *conn_context, const sasl_utils_t *u
     utils->free(ctx);
 }
 
+// reused by setpass, so that bulk password changes, like
+// saslpasswd2 over a list of users, map the Argon2id memory only once.
+// Created by sasl_server_plug_init(), which sasl_server_init() runs
+// before any connection, concurrent setpass calls share it safely.
+static Opaque_Workspace *setpass_ws = NULL;
+
+static void opaque_server_mech_free(void *glob_context __attribute__((unused)),
+                                   const sasl_utils_t *utils __attribute__((unused))) {
+    opaque_workspace_free(setpass_ws);
+    setpass_ws = NULL;
+}
+
 static int opaque_setpass(void *glob_context __attribute__((unused)),
 		       sasl_server_params_t *sparams,
 		       const char *userstr,
@@ -143,7 +155,10 @@ static int opaque_setpass(void *glob_context __attribute__((unused)),
       const Opaque_Ids ids={idU_len,(uint8_t*)userstr,strlen(realm),(uint8_t*)realm};
       //fprintf(stderr,"idU: \"%s\"(%d), idS: \"%s\"(%d)\n", ids.idU, ids.idU_len, ids.idS, ids.idS_len);
 
-      r = opaque_Register((uint8_t*)pass, passlen, NULL, &ids, rec, NULL);
+      // the default KSF, without a workspace if it could not be allocated
+      const Opaque_KSF ksf={.alg=OPAQUE_KSF_ARGON2ID, .parallelism=1, .ops=2, .mem=65536, .workspace=setpass_ws};
+
+      r = opaque_Register((uint8_t*)pass, passlen, NULL, &ids, &ksf, rec, NULL);
       if(r) {
         sparams->utils->seterror(sparams->utils->conn, 0, "Error registering with opaque");
         goto end;
@@ -429,7 +444,7 @@ static sasl_server_plug_t opaque_server_plugins[] = {
      &opaque_server_mech_new,		/* mech_new */
      &opaque_server_mech_step,		/* mech_step */
      &opaque_common_mech_dispose,	/* mech_dispose */
-     NULL, 		/* mech_free */
+     &opaque_server_mech_free, 		/* mech_free */
      &opaque_setpass,	/* setpass */
      NULL,				/* user_query */
      NULL,				/* idle */
@@ -449,6 +464,9 @@ int sasl_server_plug_init(const sasl_utils_t *utils,
       return SASL_BADVERS;
     }
 
+    // the memory is only mapped on the first setpass
+    if(setpass_ws==NULL) setpass_ws = opaque_workspace_new(0);
+
     *out_version = SASL_SERVER_PLUG_VERSION;
     *pluglist = opaque_server_plugins;
     *plugcount = 1;
@@ -672,7 +690,7 @@ static int opaque_client_mech_step2(context_t *ctx,
   }
 
   result = opaque_RecoverCredentials((uint8_t*) serverin, ctx->client_sec,
-                                     OPAQUE_CONTEXT, OPAQUE_CONTEXT_BYTES, &ids,
+                                     OPAQUE_CONTEXT, OPAQUE_CONTEXT_BYTES, &ids, NULL,
                                      ctx->sk, (uint8_t*)ctx->out_buf, NULL);
   if(result) {
     SETERROR(params->utils, "Failed to recover OPAQUE credentials\n");
@@ -0,0 +1,513 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sodium.h>
+#include "argon2.h"
+#include "common.h"
+#include "pool.h"
+
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__) && (defined(__GNUC__) || defined(__clang__))
+#define ARGON2_X86 1
+#include <immintrin.h>
+#endif
+
+#define ARGON2_VERSION 0x13
+#define ARGON2_TYPE_ID 2
+#define ARGON2_BLOCK_BYTES 1024
+#define ARGON2_BLOCK_WORDS (ARGON2_BLOCK_BYTES / 8)
+#define ARGON2_SYNC_POINTS 4
+#define ARGON2_PREHASH_BYTES 64
+
+typedef struct {
+  uint64_t v[ARGON2_BLOCK_WORDS];
+} Argon2_Block;
+
+static uint64_t load64_le(const uint8_t *p) {
+  return (uint64_t) p[0] | ((uint64_t) p[1] << 8) | ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24) |
+         ((uint64_t) p[4] << 32) | ((uint64_t) p[5] << 40) | ((uint64_t) p[6] << 48) | ((uint64_t) p[7] << 56);
+}
+
+static void store64_le(uint8_t *p, const uint64_t x) {
+  unsigned i;
+  for(i=0;i<8;i++) p[i] = (uint8_t) (x >> (8*i));
+}
+
+static void store32_le(uint8_t p[4], const uint32_t x) {
+  unsigned i;
+  for(i=0;i<4;i++) p[i] = (uint8_t) (x >> (8*i));
+}
+
+static uint64_t rotr64(const uint64_t x, const unsigned n) {
+  return (x >> n) | (x << (64 - n));
+}
+
+static uint64_t blamka(const uint64_t x, const uint64_t y) {
+  return x + y + 2 * ((x & 0xffffffff) * (y & 0xffffffff));
+}
+
+#define ARGON2_G(a, b, c, d) do {                       \
+    a = blamka(a, b); d = rotr64(d ^ a, 32);            \
+    c = blamka(c, d); b = rotr64(b ^ c, 24);            \
+    a = blamka(a, b); d = rotr64(d ^ a, 16);            \
+    c = blamka(c, d); b = rotr64(b ^ c, 63);            \
+  } while(0)
+
+// the blake2b round without message on the 16 words v[i[0..15]]
+static void blamka_round(uint64_t *v, const unsigned i[16]) {
+  ARGON2_G(v[i[0]], v[i[4]], v[i[8]], v[i[12]]);
+  ARGON2_G(v[i[1]], v[i[5]], v[i[9]], v[i[13]]);
+  ARGON2_G(v[i[2]], v[i[6]], v[i[10]], v[i[14]]);
+  ARGON2_G(v[i[3]], v[i[7]], v[i[11]], v[i[15]]);
+  ARGON2_G(v[i[0]], v[i[5]], v[i[10]], v[i[15]]);
+  ARGON2_G(v[i[1]], v[i[6]], v[i[11]], v[i[12]]);
+  ARGON2_G(v[i[2]], v[i[7]], v[i[8]], v[i[13]]);
+  ARGON2_G(v[i[3]], v[i[4]], v[i[9]], v[i[14]]);
+}
+
+// next = G(prev, ref), or next ^= G(prev, ref) if with_xor. next may
+// be the same block as ref.
+static void fill_scalar(Argon2_Block *next, const Argon2_Block *prev, const Argon2_Block *ref, const int with_xor) {
+  Argon2_Block r, x;
+  unsigned i, j, idx[16];
+  for(i=0;i<ARGON2_BLOCK_WORDS;i++) {
+    r.v[i] = prev->v[i] ^ ref->v[i];
+    x.v[i] = with_xor ? r.v[i] ^ next->v[i] : r.v[i];
+  }
+  // rows of 16 consecutive words
+  for(i=0;i<8;i++) {
+    for(j=0;j<16;j++) idx[j] = 16*i + j;
+    blamka_round(r.v, idx);
+  }
+  // columns of word pairs
+  for(i=0;i<8;i++) {
+    for(j=0;j<8;j++) {
+      idx[2*j] = 2*i + 16*j;
+      idx[2*j+1] = 2*i + 16*j + 1;
+    }
+    blamka_round(r.v, idx);
+  }
+  for(i=0;i<ARGON2_BLOCK_WORDS;i++) next->v[i] = r.v[i] ^ x.v[i];
+}
+
+#ifdef ARGON2_X86
+#define BLAMKA_TARGET __attribute__((target("avx2")))
+#define BLAMKA fill_avx2
+#define BLAMKA_ROTR32(x) _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1))
+#define BLAMKA_ROTR24(x) _mm256_shuffle_epi8(x, _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10, \
+                                                                 3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10))
+#define BLAMKA_ROTR16(x) _mm256_shuffle_epi8(x, _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9, \
+                                                                 2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9))
+#define BLAMKA_ROTR63(x) _mm256_xor_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x))
+#include "argon2_blamka.h"
+
+// the same with the rotations and the 32 registers of AVX-512VL
+#define BLAMKA_TARGET __attribute__((target("avx2,avx512f,avx512vl")))
+#define BLAMKA fill_avx512vl
+#define BLAMKA_ROTR32(x) _mm256_ror_epi64(x, 32)
+#define BLAMKA_ROTR24(x) _mm256_ror_epi64(x, 24)
+#define BLAMKA_ROTR16(x) _mm256_ror_epi64(x, 16)
+#define BLAMKA_ROTR63(x) _mm256_ror_epi64(x, 63)
+#include "argon2_blamka.h"
+
+static int have_avx2(void) {
+  return __builtin_cpu_supports("avx2");
+}
+
+static int have_avx512(void) {
+  return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")
+    && __builtin_cpu_supports("avx2");
+}
+#endif // ARGON2_X86
+
+static int have_scalar(void) {
+  return 1;
+}
+
+typedef void (*Argon2_Fill)(Argon2_Block *next, const Argon2_Block *prev, const Argon2_Block *ref, const int with_xor);
+
+typedef struct {
+  const char *name;
+  // OPAQUE_CPU_*
+  int level;
+  Argon2_Fill fill;
+  int (*supported)(void);
+} Argon2_Impl;
+
+// in order of preference
+static const Argon2_Impl impls[] = {
+#ifdef ARGON2_X86
+  {"avx512", OPAQUE_CPU_AVX512, fill_avx512vl, have_avx512},
+  {"avx2", OPAQUE_CPU_AVX2, fill_avx2, have_avx2},
+#endif
+  {"scalar", OPAQUE_CPU_BASELINE, fill_scalar, have_scalar},
+};
+
+static const Argon2_Impl *impl = NULL;
+static pthread_once_t impl_once = PTHREAD_ONCE_INIT;
+
+static void impl_init(void) {
+#ifdef ARGON2_X86
+  __builtin_cpu_init();
+#endif
+  // an unknown OPAQUE_CPU is reported by opaque_init() and ignored here
+  const int max = opaque_cpu_max();
+  size_t i;
+  for(i=0;i<sizeof impls / sizeof impls[0];i++) {
+    if((max<0 || impls[i].level<=max) && impls[i].supported()) {
+      impl = &impls[i];
+      return;
+    }
+  }
+}
+
+static const Argon2_Impl *get_impl(void) {
+  pthread_once(&impl_once, impl_init);
+  return impl;
+}
+
+const char *argon2_impl(void) {
+  return get_impl()->name;
+}
+
+int argon2_select(const char *name) {
+  get_impl();
+  size_t i;
+  for(i=0;i<sizeof impls / sizeof impls[0];i++) {
+    if(strcmp(impls[i].name, name)==0 && impls[i].supported()) {
+      impl = &impls[i];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// H'^outlen(LE32(outlen) || in), the variable length hash of the RFC
+static void hash_long(uint8_t *out, const size_t outlen, const uint8_t *in, const size_t inlen) {
+  crypto_generichash_blake2b_state st;
+  uint8_t len[4], v[crypto_generichash_blake2b_BYTES_MAX];
+  store32_le(len, (uint32_t) outlen);
+  if(outlen <= crypto_generichash_blake2b_BYTES_MAX) {
+    crypto_generichash_blake2b_init(&st, NULL, 0, outlen);
+    crypto_generichash_blake2b_update(&st, len, sizeof len);
+    crypto_generichash_blake2b_update(&st, in, inlen);
+    crypto_generichash_blake2b_final(&st, out, outlen);
+    return;
+  }
+  // V_1 = H^64(LE32(outlen) || in), V_i = H^64(V_i-1), the output is
+  // the first 32 bytes of each V_i followed by the last one in full
+  size_t left = outlen;
+  crypto_generichash_blake2b_init(&st, NULL, 0, sizeof v);
+  crypto_generichash_blake2b_update(&st, len, sizeof len);
+  crypto_generichash_blake2b_update(&st, in, inlen);
+  crypto_generichash_blake2b_final(&st, v, sizeof v);
+  memcpy(out, v, 32);
+  out += 32;
+  left -= 32;
+  while(left > sizeof v) {
+    crypto_generichash_blake2b(v, sizeof v, v, sizeof v, NULL, 0);
+    memcpy(out, v, 32);
+    out += 32;
+    left -= 32;
+  }
+  crypto_generichash_blake2b(out, left, v, sizeof v, NULL, 0);
+  sodium_memzero(v, sizeof v);
+}
+
+typedef struct {
+  Argon2_Block *memory;
+  Argon2_Fill fill;
+  uint32_t passes;
+  uint32_t lanes;
+  uint32_t memory_blocks;
+  uint32_t lane_length;
+  uint32_t segment_length;
+  // the position all lanes are filled at
+  uint32_t pass;
+  uint32_t slice;
+} Argon2_Instance;
+
+// the block of the reference area of the current lane or of lane ref
+// (same_lane==0) the pseudo random value selects for block index
+static uint32_t index_alpha(const Argon2_Instance *in, const uint32_t index,
+                            const uint32_t pseudo_rand, const int same_lane) {
+  uint32_t area, start = 0;
+  if(in->pass==0) {
+    // only the blocks of the finished slices, and of the current
+    // segment in the own lane. Never the previous block.
+    if(in->slice==0) area = index - 1;
+    else if(same_lane) area = in->slice * in->segment_length + index - 1;
+    else area = in->slice * in->segment_length - (index==0 ? 1 : 0);
+  } else {
+    // the last 3 segments of the lane
+    if(same_lane) area = in->lane_length - in->segment_length + index - 1;
+    else area = in->lane_length - in->segment_length - (index==0 ? 1 : 0);
+    if(in->slice!=ARGON2_SYNC_POINTS - 1) start = (in->slice + 1) * in->segment_length;
+  }
+  uint64_t rel = pseudo_rand;
+  rel = (rel * rel) >> 32;
+  rel = area - 1 - (((uint64_t) area * rel) >> 32);
+  return (uint32_t) ((start + rel) % in->lane_length);
+}
+
+// fills the blocks from..to-1 of the segment of the current slice in
+// one lane
+static void fill_blocks(const Argon2_Instance *in, const uint32_t lane,
+                        const uint32_t from, const uint32_t to) {
+  // Argon2id addresses data independently in the first half of the
+  // first pass
+  const int independent = in->pass==0 && in->slice < ARGON2_SYNC_POINTS / 2;
+  Argon2_Block zero, input, address;
+  uint32_t i = from;
+
+  if(independent) {
+    memset(&zero, 0, sizeof zero);
+    memset(&input, 0, sizeof input);
+    input.v[0] = in->pass;
+    input.v[1] = lane;
+    input.v[2] = in->slice;
+    input.v[3] = in->memory_blocks;
+    input.v[4] = in->passes;
+    input.v[5] = ARGON2_TYPE_ID;
+    // the number of address blocks generated before from
+    input.v[6] = from / ARGON2_BLOCK_WORDS;
+  }
+
+  uint32_t cur = lane * in->lane_length + in->slice * in->segment_length + i;
+  uint32_t prev = (cur % in->lane_length==0) ? cur + in->lane_length - 1 : cur - 1;
+  for(;i<to;i++, cur++, prev++) {
+    if(cur % in->lane_length==1) prev = cur - 1;
+    uint64_t pseudo_rand;
+    if(independent) {
+      if(i % ARGON2_BLOCK_WORDS==0 || i==from) {
+        input.v[6]++;
+        in->fill(&address, &zero, &input, 0);
+        in->fill(&address, &zero, &address, 0);
+      }
+      pseudo_rand = address.v[i % ARGON2_BLOCK_WORDS];
+    } else {
+      pseudo_rand = in->memory[prev].v[0];
+    }
+    uint32_t ref_lane = (uint32_t) ((pseudo_rand >> 32) % in->lanes);
+    if(in->pass==0 && in->slice==0) ref_lane = lane;
+    const uint32_t ref_index = index_alpha(in, i, (uint32_t) pseudo_rand, ref_lane==lane);
+    in->fill(&in->memory[cur], &in->memory[prev],
+             &in->memory[(size_t) in->lane_length * ref_lane + ref_index], in->pass!=0);
+  }
+  if(independent) {
+    sodium_memzero(&input, sizeof input);
+    sodium_memzero(&address, sizeof address);
+  }
+}
+
+// the first block of the segments of the current slice, the first two
+// blocks of each lane are computed from H0
+static uint32_t segment_start(const Argon2_Instance *in) {
+  return (in->pass==0 && in->slice==0) ? 2 : 0;
+}
+
+// fills the segment of the current slice in one lane, run for each lane
+// on the thread pool
+static void fill_segment(void *arg, const size_t l) {
+  const Argon2_Instance *in = arg;
+  fill_blocks(in, (uint32_t) l, segment_start(in), in->segment_length);
+}
+
+static void add32(crypto_generichash_blake2b_state *st, const uint32_t x) {
+  uint8_t b[4];
+  store32_le(b, x);
+  crypto_generichash_blake2b_update(st, b, sizeof b);
+}
+
+size_t argon2_memory_len(const uint32_t m, const uint32_t p) {
+  if(p < 1 || p > ARGON2_LANES_MAX || m / 8 < p) return 0;
+  const size_t blocks = (m / (ARGON2_SYNC_POINTS * p)) * ARGON2_SYNC_POINTS * p;
+  if(blocks > SIZE_MAX / sizeof(Argon2_Block)) return 0;
+  return blocks * sizeof(Argon2_Block);
+}
+
+struct Argon2_State {
+  Argon2_Instance in;
+  // the next block to fill is block index of the segment of lane in
+  // the current slice
+  uint32_t lane;
+  uint32_t index;
+  size_t outlen;
+  size_t memory_len;
+  // memory was allocated by argon2id_begin()
+  int own_memory;
+};
+
+Argon2_State *argon2id_begin(const size_t outlen,
+                             const uint8_t *pwd, const size_t pwdlen,
+                             const uint8_t *salt, const size_t saltlen,
+                             const uint8_t *secret, const size_t secretlen,
+                             const uint8_t *ad, const size_t adlen,
+                             const uint32_t t, const uint32_t m, const uint32_t p,
+                             void *memory) {
+  if(outlen < ARGON2_OUTBYTES_MIN || outlen > ARGON2_OUTBYTES_MAX) return NULL;
+  if(t < 1 || p < 1 || p > ARGON2_LANES_MAX || m / 8 < p) return NULL;
+  if(saltlen < 8 || pwdlen > 0xffffffff || saltlen > 0xffffffff ||
+     secretlen > 0xffffffff || adlen > 0xffffffff) return NULL;
+  const size_t memory_len = argon2_memory_len(m, p);
+  if(memory_len==0) return NULL;
+
+  Argon2_State *st = malloc(sizeof *st);
+  if(st==NULL) return NULL;
+  memset(st, 0, sizeof *st);
+  st->outlen = outlen;
+  st->memory_len = memory_len;
+  st->own_memory = memory==NULL;
+  st->in.memory = (memory!=NULL) ? memory : malloc(memory_len);
+  if(st->in.memory==NULL) {
+    free(st);
+    return NULL;
+  }
+  Argon2_Instance *in = &st->in;
+  in->fill = get_impl()->fill;
+  in->passes = t;
+  in->lanes = p;
+  // a multiple of 4*p, rounded down
+  in->memory_blocks = (uint32_t) (memory_len / sizeof(Argon2_Block));
+  in->lane_length = in->memory_blocks / p;
+  in->segment_length = in->lane_length / ARGON2_SYNC_POINTS;
+
+  // H0, followed by the index of the block and the lane for the first
+  // two blocks of each lane
+  uint8_t h0[ARGON2_PREHASH_BYTES + 8];
+  uint8_t blockbytes[ARGON2_BLOCK_BYTES];
+  crypto_generichash_blake2b_state hs;
+  crypto_generichash_blake2b_init(&hs, NULL, 0, ARGON2_PREHASH_BYTES);
+  add32(&hs, p);
+  add32(&hs, (uint32_t) outlen);
+  add32(&hs, m);
+  add32(&hs, t);
+  add32(&hs, ARGON2_VERSION);
+  add32(&hs, ARGON2_TYPE_ID);
+  add32(&hs, (uint32_t) pwdlen);
+  crypto_generichash_blake2b_update(&hs, pwd, pwdlen);
+  add32(&hs, (uint32_t) saltlen);
+  crypto_generichash_blake2b_update(&hs, salt, saltlen);
+  add32(&hs, (uint32_t) secretlen);
+  if(secretlen) crypto_generichash_blake2b_update(&hs, secret, secretlen);
+  add32(&hs, (uint32_t) adlen);
+  if(adlen) crypto_generichash_blake2b_update(&hs, ad, adlen);
+  crypto_generichash_blake2b_final(&hs, h0, ARGON2_PREHASH_BYTES);
+
+  uint32_t l, i;
+  for(l=0;l<p;l++) {
+    for(i=0;i<2;i++) {
+      store32_le(h0 + ARGON2_PREHASH_BYTES, i);
+      store32_le(h0 + ARGON2_PREHASH_BYTES + 4, l);
+      hash_long(blockbytes, sizeof blockbytes, h0, sizeof h0);
+      Argon2_Block *b = &in->memory[(size_t) l * in->lane_length + i];
+      for(uint32_t w=0;w<ARGON2_BLOCK_WORDS;w++) b->v[w] = load64_le(blockbytes + 8*w);
+    }
+  }
+  sodium_memzero(h0, sizeof h0);
+  sodium_memzero(blockbytes, sizeof blockbytes);
+  sodium_memzero(&hs, sizeof hs);
+  st->index = segment_start(in);
+  return st;
+}
+
+// moves the position to the first lane of the next slice
+static void next_slice(Argon2_State *st) {
+  st->lane = 0;
+  if(++st->in.slice==ARGON2_SYNC_POINTS) {
+    st->in.slice = 0;
+    st->in.pass++;
+  }
+  st->index = segment_start(&st->in);
+}
+
+int argon2id_step(Argon2_State *st, uint32_t budget) {
+  Argon2_Instance *in = &st->in;
+  // the lanes of a slice are independent of each other, the slices
+  // are synchronization points
+  while(in->pass < in->passes) {
+    if(budget==0) return 1;
+    const uint32_t start = segment_start(in);
+    if(st->lane==0 && st->index==start && budget / in->lanes >= in->segment_length - start) {
+      // the whole slice, with the lanes in parallel
+      opaque_pool_run(in->lanes, fill_segment, in);
+      budget -= in->lanes * (in->segment_length - start);
+      next_slice(st);
+      continue;
+    }
+    // a part of a segment on this thread
+    uint32_t n = in->segment_length - st->index;
+    if(n > budget) n = budget;
+    fill_blocks(in, st->lane, st->index, st->index + n);
+    budget -= n;
+    st->index += n;
+    if(st->index==in->segment_length) {
+      if(++st->lane==in->lanes) next_slice(st);
+      else st->index = start;
+    }
+  }
+  return 0;
+}
+
+static void state_free(Argon2_State *st) {
+  sodium_memzero(st->in.memory, st->memory_len);
+  if(st->own_memory) free(st->in.memory);
+  sodium_memzero(st, sizeof *st);
+  free(st);
+}
+
+int argon2id_final(Argon2_State *st, uint8_t *out) {
+  const Argon2_Instance *in = &st->in;
+  if(in->pass < in->passes) {
+    state_free(st);
+    return -1;
+  }
+  // the xor of the last blocks of the lanes
+  uint8_t blockbytes[ARGON2_BLOCK_BYTES];
+  Argon2_Block *final = &in->memory[in->lane_length - 1];
+  uint32_t l, i;
+  for(l=1;l<in->lanes;l++) {
+    const Argon2_Block *b = &in->memory[(size_t) l * in->lane_length + in->lane_length - 1];
+    for(i=0;i<ARGON2_BLOCK_WORDS;i++) final->v[i] ^= b->v[i];
+  }
+  for(i=0;i<ARGON2_BLOCK_WORDS;i++) store64_le(blockbytes + 8*i, final->v[i]);
+  hash_long(out, st->outlen, blockbytes, sizeof blockbytes);
+  sodium_memzero(blockbytes, sizeof blockbytes);
+  state_free(st);
+  return 0;
+}
+
+void argon2id_abort(Argon2_State *st) {
+  if(st!=NULL) state_free(st);
+}
+
+int argon2id(uint8_t *out, const size_t outlen,
+             const uint8_t *pwd, const size_t pwdlen,
+             const uint8_t *salt, const size_t saltlen,
+             const uint8_t *secret, const size_t secretlen,
+             const uint8_t *ad, const size_t adlen,
+             const uint32_t t, const uint32_t m, const uint32_t p,
+             void *memory) {
+  Argon2_State *st = argon2id_begin(outlen, pwd, pwdlen, salt, saltlen, secret, secretlen,
+                                    ad, adlen, t, m, p, memory);
+  if(st==NULL) return -1;
+  while(argon2id_step(st, UINT32_MAX)!=0);
+  return argon2id_final(st, out);
+}
@@ -0,0 +1,69 @@
+#ifndef ARGON2_H
+#define ARGON2_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Argon2id version 0x13 (RFC 9106) with parallel lanes
+ *
+ * libsodium only implements a single lane. Here the p lanes of each
+ * slice are filled concurrently on the thread pool of pool.h, and the
+ * blocks are mixed with the fastest implementation the cpu supports, up
+ * to the level set by the OPAQUE_CPU environment variable (see
+ * common.h). For p=1 the output is the same as that of libsodiums
+ * crypto_pwhash() with crypto_pwhash_ALG_ARGON2ID13. */
+
+#define ARGON2_OUTBYTES_MIN 16U
+#define ARGON2_OUTBYTES_MAX 0xffffffffU
+#define ARGON2_LANES_MAX 0xffffffU
+
+// name of the selected implementation: "avx512", "avx2" or "scalar"
+const char *argon2_impl(void);
+
+// selects an implementation by name, returns -1 if it is not
+// supported by this CPU. Only meant for testing and benchmarking.
+int argon2_select(const char *impl);
+
+// bytes of memory argon2id() fills for m KiB in p lanes, 0 if p or m
+// are invalid
+size_t argon2_memory_len(const uint32_t m, const uint32_t p);
+
+// out = Argon2id(pwd, salt, secret, ad) with t passes over m KiB of
+// memory in p lanes. secret and ad are optional (NULL/0). memory is
+// either NULL, to allocate and free the memory in this call, or at
+// least argon2_memory_len(m, p) bytes of 8 byte aligned memory, which
+// is wiped before returning. Returns -1 for invalid parameters (t<1,
+// p<1, p>ARGON2_LANES_MAX, m<8*p, salt shorter than 8 bytes, outlen
+// out of range) or if out of memory.
+int argon2id(uint8_t *out, const size_t outlen,
+             const uint8_t *pwd, const size_t pwdlen,
+             const uint8_t *salt, const size_t saltlen,
+             const uint8_t *secret, const size_t secretlen,
+             const uint8_t *ad, const size_t adlen,
+             const uint32_t t, const uint32_t m, const uint32_t p,
+             void *memory);
+
+/* argon2id() in steps, for callers that can not block for the whole
+ * run, like event loops. argon2id_begin() takes the parameters of
+ * argon2id() and returns NULL where argon2id() would return -1.
+ * argon2id_step() fills at most budget blocks of memory (each 1KiB)
+ * and returns 1 while there are blocks left, 0 once all the passes are
+ * done. A budget covering a whole slice fills its lanes in parallel,
+ * smaller ones fill the blocks on the calling thread. argon2id_final()
+ * writes the output of a finished state, argon2id_abort() drops an
+ * unfinished one; both wipe and free the state and its memory.
+ * argon2id_final() on an unfinished state returns -1. */
+typedef struct Argon2_State Argon2_State;
+
+Argon2_State *argon2id_begin(const size_t outlen,
+                             const uint8_t *pwd, const size_t pwdlen,
+                             const uint8_t *salt, const size_t saltlen,
+                             const uint8_t *secret, const size_t secretlen,
+                             const uint8_t *ad, const size_t adlen,
+                             const uint32_t t, const uint32_t m, const uint32_t p,
+                             void *memory);
+int argon2id_step(Argon2_State *st, uint32_t budget);
+int argon2id_final(Argon2_State *st, uint8_t *out);
+void argon2id_abort(Argon2_State *st);
+
+#endif // ARGON2_H
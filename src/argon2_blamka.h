@@ -0,0 +1,121 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* the 256 bit vector block mixing of argon2.c, which includes this
+ * file once for each instruction set it compiles it for. The includer
+ * defines BLAMKA_TARGET, the target attribute, BLAMKA, the name of the
+ * function, and BLAMKA_ROTR32, BLAMKA_ROTR24, BLAMKA_ROTR16 and
+ * BLAMKA_ROTR63, the rotations of the 64 bit lanes. All of them are
+ * undefined at the end of this file.
+ *
+ * A block is 8 rows of 16 words, 4 registers per row. The row rounds
+ * work on two rows at once, with the diagonals rotated into the lanes.
+ * The column rounds work on two columns of word pairs at once, taking
+ * one register of each row, and exchange the halves of the registers
+ * of rows 2,3 and 6,7 instead. */
+
+#if !defined(BLAMKA_TARGET) || !defined(BLAMKA) || !defined(BLAMKA_ROTR32) || \
+  !defined(BLAMKA_ROTR24) || !defined(BLAMKA_ROTR16) || !defined(BLAMKA_ROTR63)
+#error "only to be included by argon2.c"
+#endif
+
+// a = a + b + 2*lo(a)*lo(b), d = (d ^ a) >>> r1, c = c + d + 2*lo(c)*lo(d), b = (b ^ c) >>> r2
+#define BLAMKA_G(A, B, C, D, R1, R2) do {                         \
+    __m256i ml = _mm256_mul_epu32(A, B);                          \
+    A = _mm256_add_epi64(A, _mm256_add_epi64(B, _mm256_add_epi64(ml, ml))); \
+    D = R1(_mm256_xor_si256(D, A));                               \
+    ml = _mm256_mul_epu32(C, D);                                  \
+    C = _mm256_add_epi64(C, _mm256_add_epi64(D, _mm256_add_epi64(ml, ml))); \
+    B = R2(_mm256_xor_si256(B, C));                               \
+  } while(0)
+
+#define BLAMKA_GG(A0, A1, B0, B1, C0, C1, D0, D1) do {            \
+    BLAMKA_G(A0, B0, C0, D0, BLAMKA_ROTR32, BLAMKA_ROTR24);       \
+    BLAMKA_G(A1, B1, C1, D1, BLAMKA_ROTR32, BLAMKA_ROTR24);       \
+    BLAMKA_G(A0, B0, C0, D0, BLAMKA_ROTR16, BLAMKA_ROTR63);       \
+    BLAMKA_G(A1, B1, C1, D1, BLAMKA_ROTR16, BLAMKA_ROTR63);       \
+  } while(0)
+
+#define BLAMKA_PERM(x, a, b, c, d) _mm256_permute4x64_epi64(x, _MM_SHUFFLE(a, b, c, d))
+
+// two rows: A0..D0 and A1..D1 are the 4 registers of each
+#define BLAMKA_ROW_ROUND(A0, A1, B0, B1, C0, C1, D0, D1) do {     \
+    BLAMKA_GG(A0, A1, B0, B1, C0, C1, D0, D1);                    \
+    B0 = BLAMKA_PERM(B0, 0, 3, 2, 1); B1 = BLAMKA_PERM(B1, 0, 3, 2, 1); \
+    C0 = BLAMKA_PERM(C0, 1, 0, 3, 2); C1 = BLAMKA_PERM(C1, 1, 0, 3, 2); \
+    D0 = BLAMKA_PERM(D0, 2, 1, 0, 3); D1 = BLAMKA_PERM(D1, 2, 1, 0, 3); \
+    BLAMKA_GG(A0, A1, B0, B1, C0, C1, D0, D1);                    \
+    B0 = BLAMKA_PERM(B0, 2, 1, 0, 3); B1 = BLAMKA_PERM(B1, 2, 1, 0, 3); \
+    C0 = BLAMKA_PERM(C0, 1, 0, 3, 2); C1 = BLAMKA_PERM(C1, 1, 0, 3, 2); \
+    D0 = BLAMKA_PERM(D0, 0, 3, 2, 1); D1 = BLAMKA_PERM(D1, 0, 3, 2, 1); \
+  } while(0)
+
+// two columns: the registers of rows 0..7 at the same offset
+#define BLAMKA_COL_ROUND(A0, A1, B0, B1, C0, C1, D0, D1) do {     \
+    __m256i t0, t1;                                               \
+    BLAMKA_GG(A0, A1, B0, B1, C0, C1, D0, D1);                    \
+    t0 = _mm256_blend_epi32(B0, B1, 0xcc);                        \
+    t1 = _mm256_blend_epi32(B0, B1, 0x33);                        \
+    B1 = BLAMKA_PERM(t0, 2, 3, 0, 1); B0 = BLAMKA_PERM(t1, 2, 3, 0, 1); \
+    t0 = C0; C0 = C1; C1 = t0;                                    \
+    t0 = _mm256_blend_epi32(D0, D1, 0xcc);                        \
+    t1 = _mm256_blend_epi32(D0, D1, 0x33);                        \
+    D0 = BLAMKA_PERM(t0, 2, 3, 0, 1); D1 = BLAMKA_PERM(t1, 2, 3, 0, 1); \
+    BLAMKA_GG(A0, A1, B0, B1, C0, C1, D0, D1);                    \
+    t0 = _mm256_blend_epi32(B0, B1, 0xcc);                        \
+    t1 = _mm256_blend_epi32(B0, B1, 0x33);                        \
+    B0 = BLAMKA_PERM(t0, 2, 3, 0, 1); B1 = BLAMKA_PERM(t1, 2, 3, 0, 1); \
+    t0 = C0; C0 = C1; C1 = t0;                                    \
+    t0 = _mm256_blend_epi32(D0, D1, 0x33);                        \
+    t1 = _mm256_blend_epi32(D0, D1, 0xcc);                        \
+    D0 = BLAMKA_PERM(t0, 2, 3, 0, 1); D1 = BLAMKA_PERM(t1, 2, 3, 0, 1); \
+  } while(0)
+
+BLAMKA_TARGET
+static void BLAMKA(Argon2_Block *next, const Argon2_Block *prev, const Argon2_Block *ref, const int with_xor) {
+  __m256i s[32], xy[32];
+  unsigned i;
+  for(i=0;i<32;i++) {
+    s[i] = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) prev->v + i),
+                            _mm256_loadu_si256((const __m256i*) ref->v + i));
+    xy[i] = with_xor ? _mm256_xor_si256(s[i], _mm256_loadu_si256((const __m256i*) next->v + i)) : s[i];
+  }
+  for(i=0;i<4;i++) {
+    BLAMKA_ROW_ROUND(s[8*i+0], s[8*i+4], s[8*i+1], s[8*i+5],
+                     s[8*i+2], s[8*i+6], s[8*i+3], s[8*i+7]);
+  }
+  for(i=0;i<4;i++) {
+    BLAMKA_COL_ROUND(s[i], s[4+i], s[8+i], s[12+i],
+                     s[16+i], s[20+i], s[24+i], s[28+i]);
+  }
+  for(i=0;i<32;i++) {
+    _mm256_storeu_si256((__m256i*) next->v + i, _mm256_xor_si256(s[i], xy[i]));
+  }
+}
+
+#undef BLAMKA_G
+#undef BLAMKA_GG
+#undef BLAMKA_PERM
+#undef BLAMKA_ROW_ROUND
+#undef BLAMKA_COL_ROUND
+#undef BLAMKA_TARGET
+#undef BLAMKA
+#undef BLAMKA_ROTR32
+#undef BLAMKA_ROTR24
+#undef BLAMKA_ROTR16
+#undef BLAMKA_ROTR63
@@ -0,0 +1,538 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* the asynchronous calls of opaque.h
+ *
+ * Every call is a job from a fixed array of depth jobs, a free job is
+ * taken on submit and returned after its callback ran or its result
+ * was reaped, so a full array is the backpressure. Each worker has a
+ * deque of jobs, submits from outside the pool are spread round robin
+ * over the deques, submits from a callback go to the deque of its
+ * worker. A worker runs the jobs of its own deque from the front, and
+ * when that is empty steals from the back of the others. The deques
+ * are small rings under a mutex each, their operations are a few
+ * pointer moves next to jobs of tens of microseconds at least. */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "opaque.h"
+#include "common.h"
+#include "pool.h"
+
+#define ASYNC_MAX_THREADS 64
+#define ASYNC_MAX_DEPTH (1 << 16)
+
+typedef enum {
+  OP_REGISTER,
+  OP_CREATE_REGISTRATION_RESPONSE,
+  OP_FINALIZE_REQUEST,
+  OP_CREATE_CREDENTIAL_REQUEST,
+  OP_CREATE_CREDENTIAL_RESPONSE,
+  OP_RECOVER_CREDENTIALS,
+} Op;
+
+typedef struct Job {
+  Op op;
+  // the parameters of the call, in the order of its signature
+  const uint8_t *in[3];
+  uint16_t in_len;
+  uint8_t *out[3];
+  Opaque_Ids ids;
+  const Opaque_Ids *ids_p;
+  Opaque_KSF ksf;
+  const Opaque_KSF *ksf_p;
+  Opaque_AsyncDone done;
+  void *user;
+  int ret;
+  struct Job *next;
+} Job;
+
+typedef struct {
+  pthread_mutex_t lock;
+  // a ring of depth slots, which all jobs fit
+  Job **ring;
+  size_t head;
+  size_t len;
+} Deque;
+
+typedef struct {
+  Opaque_Async *async;
+  size_t idx;
+  pthread_t tid;
+} Worker;
+
+struct Opaque_Async {
+  size_t depth;
+  size_t nworkers;
+  // the deques with a ring
+  size_t ndeques;
+  Job *jobs;
+  Deque *deques;
+  Worker *workers;
+  atomic_size_t next_deque;
+
+  // the free jobs
+  pthread_mutex_t free_lock;
+  Job *free;
+
+  // jobs in the deques, and jobs submitted but not finished
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t idle;
+  atomic_size_t queued;
+  size_t inflight;
+  int stopping;
+
+  // finished jobs without a callback, fd is readable while there are
+  pthread_mutex_t done_lock;
+  Job *done_head;
+  Job *done_tail;
+  int fd[2];
+};
+
+static pthread_key_t worker_key;
+static pthread_once_t worker_key_once = PTHREAD_ONCE_INIT;
+
+static void worker_key_init(void) {
+  pthread_key_create(&worker_key, NULL);
+}
+
+static void deque_push(Deque *d, const size_t depth, Job *job) {
+  pthread_mutex_lock(&d->lock);
+  d->ring[(d->head + d->len) % depth] = job;
+  d->len++;
+  pthread_mutex_unlock(&d->lock);
+}
+
+// from the front for the owner, from the back for thieves
+static Job *deque_pop(Deque *d, const size_t depth, const int steal) {
+  Job *job = NULL;
+  pthread_mutex_lock(&d->lock);
+  if(d->len > 0) {
+    if(steal) {
+      job = d->ring[(d->head + d->len - 1) % depth];
+    } else {
+      job = d->ring[d->head];
+      d->head = (d->head + 1) % depth;
+    }
+    d->len--;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return job;
+}
+
+static void run(Job *job) {
+  switch(job->op) {
+  case OP_REGISTER:
+    job->ret = opaque_Register(job->in[0], job->in_len, job->in[1], job->ids_p, job->ksf_p,
+                               job->out[0], job->out[1]);
+    break;
+  case OP_CREATE_REGISTRATION_RESPONSE:
+    job->ret = opaque_CreateRegistrationResponse(job->in[0], job->in[1], job->out[0], job->out[1]);
+    break;
+  case OP_FINALIZE_REQUEST:
+    job->ret = opaque_FinalizeRequest(job->in[0], job->in[1], job->ids_p, job->ksf_p,
+                                      job->out[0], job->out[1]);
+    break;
+  case OP_CREATE_CREDENTIAL_REQUEST:
+    job->ret = opaque_CreateCredentialRequest(job->in[0], job->in_len, job->out[0], job->out[1]);
+    break;
+  case OP_CREATE_CREDENTIAL_RESPONSE:
+    job->ret = opaque_CreateCredentialResponse(job->in[0], job->in[1], job->ids_p, job->in[2], job->in_len,
+                                               job->out[0], job->out[1], job->out[2]);
+    break;
+  case OP_RECOVER_CREDENTIALS:
+    job->ret = opaque_RecoverCredentials(job->in[0], job->in[1], job->in[2], job->in_len, job->ids_p, job->ksf_p,
+                                         job->out[0], job->out[1], job->out[2]);
+    break;
+  default:
+    job->ret = -1;
+  }
+}
+
+static void release(Opaque_Async *async, Job *job) {
+  pthread_mutex_lock(&async->free_lock);
+  job->next = async->free;
+  async->free = job;
+  pthread_mutex_unlock(&async->free_lock);
+}
+
+static void notify(Opaque_Async *async) {
+#ifdef __linux__
+  const uint64_t one = 1;
+  if(write(async->fd[1], &one, sizeof one)) {}
+#else
+  const uint8_t one = 1;
+  if(write(async->fd[1], &one, sizeof one)) {}
+#endif
+}
+
+static void clear(Opaque_Async *async) {
+  uint8_t buf[64];
+  while(read(async->fd[0], buf, sizeof buf) > 0) {}
+}
+
+static void finish(Opaque_Async *async, Job *job) {
+  if(job->done!=NULL) {
+    // frees the job first, so that the callback can submit the next
+    // call into it
+    const Opaque_AsyncDone done = job->done;
+    void *user = job->user;
+    const int ret = job->ret;
+    release(async, job);
+    done(user, ret);
+  } else {
+    pthread_mutex_lock(&async->done_lock);
+    job->next = NULL;
+    if(async->done_tail!=NULL) async->done_tail->next = job;
+    else {
+      async->done_head = job;
+      notify(async);
+    }
+    async->done_tail = job;
+    pthread_mutex_unlock(&async->done_lock);
+  }
+  pthread_mutex_lock(&async->lock);
+  if(--async->inflight==0) pthread_cond_broadcast(&async->idle);
+  pthread_mutex_unlock(&async->lock);
+}
+
+static Job *next_job(Worker *w) {
+  Opaque_Async *async = w->async;
+  Job *job = deque_pop(&async->deques[w->idx], async->depth, 0);
+  size_t i;
+  // ndeques is set before the workers start, nworkers while they do
+  for(i=1;job==NULL && i<async->ndeques;i++) {
+    job = deque_pop(&async->deques[(w->idx + i) % async->ndeques], async->depth, 1);
+  }
+  if(job!=NULL) atomic_fetch_sub(&async->queued, 1);
+  return job;
+}
+
+static void *worker(void *arg) {
+  Worker *w = (Worker*) arg;
+  Opaque_Async *async = w->async;
+  pthread_setspecific(worker_key, w);
+  for(;;) {
+    Job *job = next_job(w);
+    if(job!=NULL) {
+      run(job);
+      finish(async, job);
+      continue;
+    }
+    pthread_mutex_lock(&async->lock);
+    while(atomic_load(&async->queued)==0 && !async->stopping) {
+      pthread_cond_wait(&async->work, &async->lock);
+    }
+    const int stop = async->stopping && atomic_load(&async->queued)==0;
+    pthread_mutex_unlock(&async->lock);
+    if(stop) break;
+  }
+  return NULL;
+}
+
+static int open_fd(int fd[2]) {
+#ifdef __linux__
+  fd[0] = fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return (fd[0] < 0) ? -1 : 0;
+#else
+  if(0!=pipe(fd)) return -1;
+  int i;
+  for(i=0;i<2;i++) {
+    fcntl(fd[i], F_SETFL, fcntl(fd[i], F_GETFL) | O_NONBLOCK);
+    fcntl(fd[i], F_SETFD, FD_CLOEXEC);
+  }
+  return 0;
+#endif
+}
+
+static void close_fd(int fd[2]) {
+  if(fd[0] >= 0) close(fd[0]);
+  if(fd[1] >= 0 && fd[1]!=fd[0]) close(fd[1]);
+}
+
+Opaque_Async *opaque_async_new(const size_t threads, const size_t depth) {
+  size_t i, n = (threads==0) ? opaque_pool_threads() : threads;
+  if(n==0 || n > ASYNC_MAX_THREADS || depth==0 || depth > ASYNC_MAX_DEPTH) return NULL;
+  pthread_once(&worker_key_once, worker_key_init);
+  Opaque_Async *async = calloc(1, sizeof *async);
+  if(async==NULL) return NULL;
+  async->fd[0] = async->fd[1] = -1;
+  async->depth = depth;
+  async->jobs = calloc(depth, sizeof(Job));
+  async->deques = calloc(n, sizeof(Deque));
+  async->workers = calloc(n, sizeof(Worker));
+  if(async->jobs==NULL || async->deques==NULL || async->workers==NULL || 0!=open_fd(async->fd)) {
+    close_fd(async->fd);
+    free(async->jobs);
+    free(async->deques);
+    free(async->workers);
+    free(async);
+    return NULL;
+  }
+  pthread_mutex_init(&async->free_lock, NULL);
+  pthread_mutex_init(&async->lock, NULL);
+  pthread_mutex_init(&async->done_lock, NULL);
+  pthread_cond_init(&async->work, NULL);
+  pthread_cond_init(&async->idle, NULL);
+  for(i=0;i<depth;i++) {
+    async->jobs[i].next = async->free;
+    async->free = &async->jobs[i];
+  }
+  for(i=0;i<n;i++) {
+    async->deques[i].ring = calloc(depth, sizeof(Job*));
+    if(async->deques[i].ring==NULL) break;
+    pthread_mutex_init(&async->deques[i].lock, NULL);
+    async->ndeques++;
+  }
+  // without all deques or all threads there is no pool
+  if(async->ndeques==n) {
+    for(async->nworkers=0;async->nworkers<n;async->nworkers++) {
+      Worker *w = &async->workers[async->nworkers];
+      w->async = async;
+      w->idx = async->nworkers;
+      if(0!=pthread_create(&w->tid, NULL, worker, w)) break;
+    }
+  }
+  if(async->nworkers < n) {
+    // the deques of the started workers are all empty
+    opaque_async_free(async);
+    return NULL;
+  }
+  return async;
+}
+
+void opaque_async_drain(Opaque_Async *async) {
+  pthread_mutex_lock(&async->lock);
+  while(async->inflight > 0) pthread_cond_wait(&async->idle, &async->lock);
+  pthread_mutex_unlock(&async->lock);
+}
+
+void opaque_async_free(Opaque_Async *async) {
+  size_t i;
+  if(async==NULL) return;
+  // the workers run the queued jobs before they stop
+  pthread_mutex_lock(&async->lock);
+  async->stopping = 1;
+  pthread_cond_broadcast(&async->work);
+  pthread_mutex_unlock(&async->lock);
+  for(i=0;i<async->nworkers;i++) pthread_join(async->workers[i].tid, NULL);
+  for(i=0;i<async->ndeques;i++) {
+    free(async->deques[i].ring);
+    pthread_mutex_destroy(&async->deques[i].lock);
+  }
+  close_fd(async->fd);
+  pthread_mutex_destroy(&async->free_lock);
+  pthread_mutex_destroy(&async->lock);
+  pthread_mutex_destroy(&async->done_lock);
+  pthread_cond_destroy(&async->work);
+  pthread_cond_destroy(&async->idle);
+  free(async->jobs);
+  free(async->deques);
+  free(async->workers);
+  free(async);
+}
+
+int opaque_async_fd(const Opaque_Async *async) {
+  return async->fd[0];
+}
+
+size_t opaque_async_complete(Opaque_Async *async, Opaque_AsyncResult *results, const size_t max) {
+  size_t n = 0;
+  pthread_mutex_lock(&async->done_lock);
+  while(n < max && async->done_head!=NULL) {
+    Job *job = async->done_head;
+    async->done_head = job->next;
+    results[n].user = job->user;
+    results[n].ret = job->ret;
+    n++;
+    release(async, job);
+  }
+  if(async->done_head==NULL) {
+    async->done_tail = NULL;
+    clear(async);
+  }
+  pthread_mutex_unlock(&async->done_lock);
+  return n;
+}
+
+// takes a free job, NULL if there is none
+static Job *take(Opaque_Async *async, const Op op, const Opaque_AsyncDone done, void *user) {
+  pthread_mutex_lock(&async->free_lock);
+  Job *job = async->free;
+  if(job!=NULL) async->free = job->next;
+  pthread_mutex_unlock(&async->free_lock);
+  if(job==NULL) return NULL;
+  memset(job, 0, sizeof *job);
+  job->op = op;
+  job->done = done;
+  job->user = user;
+  return job;
+}
+
+static void set_ids(Job *job, const Opaque_Ids *ids) {
+  if(ids==NULL) return;
+  job->ids = *ids;
+  job->ids_p = &job->ids;
+}
+
+static void set_ksf(Job *job, const Opaque_KSF *ksf) {
+  if(ksf==NULL) return;
+  job->ksf = *ksf;
+  job->ksf_p = &job->ksf;
+}
+
+static int submit(Opaque_Async *async, Job *job) {
+  Worker *self = pthread_getspecific(worker_key);
+  size_t idx;
+  if(self!=NULL && self->async==async) idx = self->idx;
+  else idx = atomic_fetch_add(&async->next_deque, 1) % async->ndeques;
+
+  // counted and pushed under the lock, so a worker that saw the count
+  // under the lock finds the job in a deque, and the count never
+  // drops below the jobs in the deques
+  pthread_mutex_lock(&async->lock);
+  if(async->stopping) {
+    pthread_mutex_unlock(&async->lock);
+    release(async, job);
+    return -1;
+  }
+  async->inflight++;
+  atomic_fetch_add(&async->queued, 1);
+  deque_push(&async->deques[idx], async->depth, job);
+  pthread_cond_signal(&async->work);
+  pthread_mutex_unlock(&async->lock);
+  return 0;
+}
+
+int opaque_async_Register(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                          const uint8_t *pwdU, const uint16_t pwdU_len,
+                          const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                          const Opaque_Ids *ids,
+                          const Opaque_KSF *ksf,
+                          uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                          uint8_t export_key[crypto_hash_sha512_BYTES]) {
+  Job *job = take(async, OP_REGISTER, done, user);
+  if(job==NULL) return OPAQUE_ASYNC_FULL;
+  job->in[0] = pwdU;
+  job->in_len = pwdU_len;
+  job->in[1] = skS;
+  set_ids(job, ids);
+  set_ksf(job, ksf);
+  job->out[0] = rec;
+  job->out[1] = export_key;
+  return submit(async, job);
+}
+
+int opaque_async_CreateRegistrationResponse(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                                            const uint8_t request[crypto_core_ristretto255_BYTES],
+                                            const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                                            uint8_t sec[OPAQUE_REGISTER_SECRET_LEN],
+                                            uint8_t pub[OPAQUE_REGISTER_PUBLIC_LEN]) {
+  Job *job = take(async, OP_CREATE_REGISTRATION_RESPONSE, done, user);
+  if(job==NULL) return OPAQUE_ASYNC_FULL;
+  job->in[0] = request;
+  job->in[1] = skS;
+  job->out[0] = sec;
+  job->out[1] = pub;
+  return submit(async, job);
+}
+
+int opaque_async_FinalizeRequest(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                                 const uint8_t *sec/*[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len]*/,
+                                 const uint8_t pub[OPAQUE_REGISTER_PUBLIC_LEN],
+                                 const Opaque_Ids *ids,
+                                 const Opaque_KSF *ksf,
+                                 uint8_t reg_rec[OPAQUE_REGISTRATION_RECORD_LEN],
+                                 uint8_t export_key[crypto_hash_sha512_BYTES]) {
+  Job *job = take(async, OP_FINALIZE_REQUEST, done, user);
+  if(job==NULL) return OPAQUE_ASYNC_FULL;
+  job->in[0] = sec;
+  job->in[1] = pub;
+  set_ids(job, ids);
+  set_ksf(job, ksf);
+  job->out[0] = reg_rec;
+  job->out[1] = export_key;
+  return submit(async, job);
+}
+
+int opaque_async_CreateCredentialRequest(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                                         const uint8_t *pwdU, const uint16_t pwdU_len,
+                                         uint8_t *sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
+                                         uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN]) {
+  Job *job = take(async, OP_CREATE_CREDENTIAL_REQUEST, done, user);
+  if(job==NULL) return OPAQUE_ASYNC_FULL;
+  job->in[0] = pwdU;
+  job->in_len = pwdU_len;
+  job->out[0] = sec;
+  job->out[1] = pub;
+  return submit(async, job);
+}
+
+int opaque_async_CreateCredentialResponse(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                                          const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                          const uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                                          const Opaque_Ids *ids,
+                                          const uint8_t *ctx, const uint16_t ctx_len,
+                                          uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                          uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                          uint8_t authU[crypto_auth_hmacsha512_BYTES]) {
+  Job *job = take(async, OP_CREATE_CREDENTIAL_RESPONSE, done, user);
+  if(job==NULL) return OPAQUE_ASYNC_FULL;
+  job->in[0] = pub;
+  job->in[1] = rec;
+  set_ids(job, ids);
+  job->in[2] = ctx;
+  job->in_len = ctx_len;
+  job->out[0] = resp;
+  job->out[1] = sk;
+  job->out[2] = authU;
+  return submit(async, job);
+}
+
+int opaque_async_RecoverCredentials(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                                    const uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                    const uint8_t *sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
+                                    const uint8_t *ctx, const uint16_t ctx_len,
+                                    const Opaque_Ids *ids,
+                                    const Opaque_KSF *ksf,
+                                    uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                    uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                                    uint8_t export_key[crypto_hash_sha512_BYTES]) {
+  Job *job = take(async, OP_RECOVER_CREDENTIALS, done, user);
+  if(job==NULL) return OPAQUE_ASYNC_FULL;
+  job->in[0] = resp;
+  job->in[1] = sec;
+  job->in[2] = ctx;
+  job->in_len = ctx_len;
+  set_ids(job, ids);
+  set_ksf(job, ksf);
+  job->out[0] = sk;
+  job->out[1] = authU;
+  job->out[2] = export_key;
+  return submit(async, job);
+}
@@ -1,3 +1,5 @@
+#include <pthread.h>
+#include <stdlib.h>
 #include "common.h"
 
 #if (defined TRACE || defined CFRG_TEST_VEC)
@@ -23,6 +25,213 @@ void a_randomscalar(uint8_t* buf) {
 }
 #endif // NORANDOM
 
+static const char *cpu_levels[] = {
+  [OPAQUE_CPU_BASELINE] = "baseline",
+  [OPAQUE_CPU_AVX2] = "avx2",
+  [OPAQUE_CPU_AVX512] = "avx512",
+};
+
+int opaque_cpu_max(void) {
+  const char *name = getenv("OPAQUE_CPU");
+  if(name==NULL || name[0]==0) return OPAQUE_CPU_AVX512;
+  int i;
+  for(i=0;i<(int) (sizeof cpu_levels / sizeof cpu_levels[0]);i++) {
+    if(strcmp(cpu_levels[i], name)==0) return i;
+  }
+  return -1;
+}
+
+typedef struct {
+  size_t top;
+  size_t size;
+  uint8_t mem[] __attribute__((aligned(16)));
+} Opaque_Scratch;
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+static int scratch_ready = 0;
+
+static void scratch_destroy(void *ptr) {
+  // sodium_free wipes the whole allocation before unmapping it
+  sodium_free(ptr);
+}
+
+static void scratch_key_init(void) {
+  // sodium_malloc depends on the page size sodium_init() determines,
+  // sodium_init() is idempotent, so it does not hurt if the host also
+  // called it already.
+  if(sodium_init() < 0) return;
+  if(0!=pthread_key_create(&scratch_key, scratch_destroy)) return;
+  scratch_ready = 1;
+}
+
+static Opaque_Scratch* scratch_get(void) {
+  pthread_once(&scratch_once, scratch_key_init);
+  if(!scratch_ready) return NULL;
+  Opaque_Scratch *scratch = pthread_getspecific(scratch_key);
+  if(scratch!=NULL) return scratch;
+
+  // sodium_malloc mlocks the region and marks it MADV_DONTDUMP, this
+  // happens exactly once per thread.
+  scratch = sodium_malloc(sizeof(Opaque_Scratch) + OPAQUE_SCRATCH_BYTES);
+  if(scratch==NULL) return NULL;
+  scratch->top = 0;
+  scratch->size = OPAQUE_SCRATCH_BYTES;
+  if(0!=pthread_setspecific(scratch_key, scratch)) {
+    sodium_free(scratch);
+    return NULL;
+  }
+  return scratch;
+}
+
+void *opaque_scratch_alloc(const size_t len) {
+  Opaque_Scratch *scratch = scratch_get();
+  if(scratch==NULL) return NULL;
+  // keep every allocation 16 byte aligned, hash states contain uint64_t
+  const size_t size = (len + 15) & ~((size_t) 15);
+  if(size > scratch->size - scratch->top) return NULL;
+  uint8_t *ptr = scratch->mem + scratch->top;
+  scratch->top += size;
+  return ptr;
+}
+
+size_t opaque_scratch_mark(void) {
+  Opaque_Scratch *scratch = scratch_get();
+  if(scratch==NULL) return 0;
+  return scratch->top;
+}
+
+void opaque_scratch_release(const size_t mark) {
+  pthread_once(&scratch_once, scratch_key_init);
+  if(!scratch_ready) return;
+  Opaque_Scratch *scratch = pthread_getspecific(scratch_key);
+  if(scratch==NULL || mark>=scratch->top) return;
+  sodium_memzero(scratch->mem+mark, scratch->top - mark);
+  scratch->top = mark;
+}
+
+#ifndef NORANDOM
+// a fast key erasure ChaCha20 generator: each refill of the buffer
+// starts with the key of the next refill, so a leaked state does not
+// reveal earlier outputs.
+#define DRBG_BUFFER_BYTES 512
+#define DRBG_RESEED_BYTES (1 << 20)
+
+typedef struct {
+  uint8_t key[crypto_stream_chacha20_KEYBYTES];
+  uint8_t buf[crypto_stream_chacha20_KEYBYTES + DRBG_BUFFER_BYTES];
+  size_t pos;
+  size_t since_seed;
+  unsigned generation;
+  uint64_t requests;
+  uint64_t os_reads;
+} Opaque_Drbg;
+
+static pthread_key_t drbg_key;
+static pthread_once_t drbg_once = PTHREAD_ONCE_INIT;
+static int drbg_ready = 0;
+static int drbg_off = 0;
+// incremented in the child of each fork, every thread then reseeds
+// before its next output
+static volatile unsigned drbg_generation = 0;
+
+static void drbg_forked(void) {
+  drbg_generation++;
+}
+
+static void drbg_key_init(void) {
+  const char *mode = getenv("OPAQUE_DRBG");
+  drbg_off = (mode!=NULL && strcmp(mode, "off")==0);
+  if(sodium_init() < 0) return;
+  if(0!=pthread_atfork(NULL, NULL, drbg_forked)) return;
+  if(0!=pthread_key_create(&drbg_key, scratch_destroy)) return;
+  drbg_ready = 1;
+}
+
+static void drbg_seed(Opaque_Drbg *drbg) {
+  randombytes_buf(drbg->key, sizeof drbg->key);
+  drbg->os_reads++;
+  drbg->since_seed = 0;
+  drbg->generation = drbg_generation;
+  // forget what is left of the stream of the previous key
+  sodium_memzero(drbg->buf, sizeof drbg->buf);
+  drbg->pos = sizeof drbg->buf;
+}
+
+static Opaque_Drbg* drbg_get(void) {
+  pthread_once(&drbg_once, drbg_key_init);
+  if(!drbg_ready) return NULL;
+  Opaque_Drbg *drbg = pthread_getspecific(drbg_key);
+  if(drbg==NULL) {
+    drbg = sodium_malloc(sizeof(Opaque_Drbg));
+    if(drbg==NULL) return NULL;
+    drbg->requests = 0;
+    drbg->os_reads = 0;
+    if(0!=pthread_setspecific(drbg_key, drbg)) {
+      sodium_free(drbg);
+      return NULL;
+    }
+    if(!drbg_off) drbg_seed(drbg);
+  } else if(drbg_off) {
+    return drbg;
+  } else if(drbg->generation!=drbg_generation || drbg->since_seed >= DRBG_RESEED_BYTES) {
+    drbg_seed(drbg);
+  }
+  return drbg;
+}
+
+static void drbg_refill(Opaque_Drbg *drbg) {
+  static const uint8_t nonce[crypto_stream_chacha20_NONCEBYTES] = {0};
+  crypto_stream_chacha20(drbg->buf, sizeof drbg->buf, nonce, drbg->key);
+  memcpy(drbg->key, drbg->buf, sizeof drbg->key);
+  sodium_memzero(drbg->buf, sizeof drbg->key);
+  drbg->pos = sizeof drbg->key;
+}
+
+void opaque_randombytes(void* const buf, const size_t len) {
+  Opaque_Drbg *drbg = drbg_get();
+  if(drbg==NULL) {
+    randombytes_buf(buf, len);
+    return;
+  }
+  drbg->requests++;
+  if(drbg_off) {
+    randombytes_buf(buf, len);
+    drbg->os_reads++;
+    return;
+  }
+  uint8_t *out = buf;
+  size_t left = len;
+  while(left>0) {
+    if(drbg->pos==sizeof drbg->buf) drbg_refill(drbg);
+    size_t n = sizeof drbg->buf - drbg->pos;
+    if(n > left) n = left;
+    memcpy(out, drbg->buf + drbg->pos, n);
+    // served bytes are not kept
+    sodium_memzero(drbg->buf + drbg->pos, n);
+    drbg->pos += n;
+    out += n;
+    left -= n;
+  }
+  drbg->since_seed += len;
+}
+
+void opaque_randomscalar(uint8_t* buf) {
+  uint8_t tmp[crypto_core_ristretto255_NONREDUCEDSCALARBYTES];
+  do {
+    opaque_randombytes(tmp, sizeof tmp);
+    crypto_core_ristretto255_scalar_reduce(buf, tmp);
+  } while(sodium_is_zero(buf, crypto_core_ristretto255_SCALARBYTES));
+  sodium_memzero(tmp, sizeof tmp);
+}
+
+void opaque_random_stats(uint64_t *requests, uint64_t *os_reads) {
+  const Opaque_Drbg *drbg = drbg_get();
+  *requests = (drbg==NULL) ? 0 : drbg->requests;
+  *os_reads = (drbg==NULL) ? 0 : drbg->os_reads;
+}
+#endif // NORANDOM
+
 #ifdef __EMSCRIPTEN__
 
 /*
@@ -23,8 +23,53 @@ void a_randombytes(void* const buf, const size_t len);
 void a_randomscalar(uint8_t* buf);
 #define crypto_core_ristretto255_scalar_random a_randomscalar
 #define randombytes a_randombytes
+#else
+/* per-thread buffered random numbers for the protocol.
+ *
+ * Instead of asking the OS for each nonce and ephemeral key, every
+ * thread runs its own ChaCha20 generator seeded from randombytes_buf()
+ * with fast key erasure, and reseeds it after 1MiB of output and in
+ * the child after a fork(), so that processes never share a stream.
+ * Setting the environment variable OPAQUE_DRBG=off before the first
+ * use passes every request to randombytes_buf() instead. */
+void opaque_randombytes(void* const buf, const size_t len);
+void opaque_randomscalar(uint8_t* buf);
+// the number of requests to the generator of this thread, and of its
+// reads from the OS, each of which is one getrandom() with the default
+// randombytes implementation of libsodium
+void opaque_random_stats(uint64_t *requests, uint64_t *os_reads);
+#define crypto_core_ristretto255_scalar_random opaque_randomscalar
+#define randombytes opaque_randombytes
 #endif
 
+/* per-thread scratch arena for sensitive intermediate values.
+ *
+ * The arena is allocated once per thread with sodium_malloc() (which
+ * locks it and excludes it from core dumps) and is then reused, so the
+ * hot paths do not need a sodium_mlock/sodium_munlock syscall pair for
+ * each of their small secret buffers. Allocations are strictly LIFO:
+ * take a mark on entry, allocate, and release the mark before
+ * returning, which wipes everything allocated since the mark. */
+#define OPAQUE_SCRATCH_BYTES 8192
+void *opaque_scratch_alloc(const size_t len);
+size_t opaque_scratch_mark(void);
+void opaque_scratch_release(const size_t mark);
+
+/* instruction set levels of the vectorized kernels in sha512mb.c,
+ * ristretto.c and argon2.c. The library itself is built for the
+ * baseline of the target, the kernels are compiled for the higher
+ * levels with target attributes, and each of them selects its fastest
+ * implementation that the cpu supports and whose level is not above
+ * opaque_cpu_max(). */
+#define OPAQUE_CPU_BASELINE 0
+#define OPAQUE_CPU_AVX2 1
+#define OPAQUE_CPU_AVX512 2
+
+// the level named by the OPAQUE_CPU environment variable: "baseline",
+// "avx2" or "avx512". OPAQUE_CPU_AVX512 if it is not set, -1 if it
+// names no level.
+int opaque_cpu_max(void);
+
 #ifdef __EMSCRIPTEN__
 // Per
 // https://emscripten.org/docs/compiling/Building-Projects.html#detecting-emscripten-in-preprocessor,
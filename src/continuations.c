@@ -0,0 +1,239 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "common.h"
+#include "continuations.h"
+
+#define CONTINUATIONS_MAX_USED (1 << 20)
+#define CONTINUATIONS_WAYS 8
+#define CONTINUATIONS_LOCKS 64
+
+#define CONTINUATION_NONCEBYTES crypto_aead_xchacha20poly1305_ietf_NPUBBYTES
+#define CONTINUATION_HEADER_LEN (4 + CONTINUATION_NONCEBYTES)
+// expires || authU || sk
+#define CONTINUATION_PLAIN_LEN (8 + crypto_auth_hmacsha512_BYTES + OPAQUE_SHARED_SECRETBYTES)
+
+// a redeemed token, remembered until it expires
+typedef struct {
+  uint8_t nonce[CONTINUATION_NONCEBYTES];
+  uint64_t expires;
+} Used;
+
+// sodium_malloc()ed
+typedef struct {
+  uint8_t key[OPAQUE_CONTINUATION_KEYBYTES];
+  uint8_t prev_key[OPAQUE_CONTINUATION_KEYBYTES];
+} Keys;
+
+struct Opaque_Continuations {
+  pthread_rwlock_t keys_lock;
+  Keys *keys;
+  uint32_t key_id;
+  uint32_t prev_key_id;
+  int has_prev;
+  uint32_t lifetime;
+  // the number of sets, a power of 2
+  size_t sets;
+  Used *used;
+  pthread_mutex_t locks[CONTINUATIONS_LOCKS];
+};
+
+static uint64_t now_s(void) {
+  return (uint64_t) time(NULL);
+}
+
+static void store_be32(uint8_t out[4], const uint32_t v) {
+  int i;
+  for(i=0;i<4;i++) out[i] = (uint8_t) (v >> (24 - 8*i));
+}
+
+static uint32_t load_be32(const uint8_t in[4]) {
+  uint32_t v = 0;
+  int i;
+  for(i=0;i<4;i++) v = (v << 8) | in[i];
+  return v;
+}
+
+static void store_be64(uint8_t out[8], const uint64_t v) {
+  int i;
+  for(i=0;i<8;i++) out[i] = (uint8_t) (v >> (56 - 8*i));
+}
+
+static uint64_t load_be64(const uint8_t in[8]) {
+  uint64_t v = 0;
+  int i;
+  for(i=0;i<8;i++) v = (v << 8) | in[i];
+  return v;
+}
+
+Opaque_Continuations *opaque_continuations_new(const uint8_t key[OPAQUE_CONTINUATION_KEYBYTES],
+                                               const uint32_t key_id,
+                                               const uint32_t lifetime, const size_t max_used) {
+  size_t sets = 1, i;
+  if(lifetime==0 || max_used==0 || max_used > CONTINUATIONS_MAX_USED) return NULL;
+  // at most half full, so that a set rarely fills up
+  while(sets * CONTINUATIONS_WAYS < 2 * max_used) sets <<= 1;
+  Opaque_Continuations *continuations = calloc(1, sizeof *continuations);
+  if(continuations==NULL) return NULL;
+  if(0!=pthread_rwlock_init(&continuations->keys_lock, NULL)) {
+    free(continuations);
+    return NULL;
+  }
+  for(i=0;i<CONTINUATIONS_LOCKS;i++) pthread_mutex_init(&continuations->locks[i], NULL);
+  continuations->keys = sodium_malloc(sizeof(Keys));
+  continuations->used = calloc(sets * CONTINUATIONS_WAYS, sizeof(Used));
+  if(continuations->keys==NULL || continuations->used==NULL) {
+    opaque_continuations_free(continuations);
+    return NULL;
+  }
+  if(key!=NULL) memcpy(continuations->keys->key, key, OPAQUE_CONTINUATION_KEYBYTES);
+  else randombytes(continuations->keys->key, OPAQUE_CONTINUATION_KEYBYTES);
+  continuations->key_id = key_id;
+  continuations->lifetime = lifetime;
+  continuations->sets = sets;
+  return continuations;
+}
+
+int opaque_continuations_rotate(Opaque_Continuations *continuations,
+                                const uint8_t key[OPAQUE_CONTINUATION_KEYBYTES],
+                                const uint32_t key_id) {
+  int ret = 0;
+  pthread_rwlock_wrlock(&continuations->keys_lock);
+  if(key_id==continuations->key_id) {
+    ret = -1;
+  } else {
+    Keys *keys = continuations->keys;
+    memcpy(keys->prev_key, keys->key, OPAQUE_CONTINUATION_KEYBYTES);
+    if(key!=NULL) memcpy(keys->key, key, OPAQUE_CONTINUATION_KEYBYTES);
+    else randombytes(keys->key, OPAQUE_CONTINUATION_KEYBYTES);
+    continuations->prev_key_id = continuations->key_id;
+    continuations->key_id = key_id;
+    continuations->has_prev = 1;
+  }
+  pthread_rwlock_unlock(&continuations->keys_lock);
+  return ret;
+}
+
+void opaque_continuations_free(Opaque_Continuations *continuations) {
+  size_t i;
+  if(continuations==NULL) return;
+  // sodium_free wipes the keys
+  if(continuations->keys!=NULL) sodium_free(continuations->keys);
+  free(continuations->used);
+  for(i=0;i<CONTINUATIONS_LOCKS;i++) pthread_mutex_destroy(&continuations->locks[i]);
+  pthread_rwlock_destroy(&continuations->keys_lock);
+  free(continuations);
+}
+
+int opaque_continuations_seal(Opaque_Continuations *continuations,
+                              const uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                              const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                              uint8_t token[OPAQUE_CONTINUATION_LEN]) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *plain = opaque_scratch_alloc(CONTINUATION_PLAIN_LEN);
+  if(plain==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  store_be64(plain, now_s() + continuations->lifetime);
+  memcpy(plain + 8, authU, crypto_auth_hmacsha512_BYTES);
+  memcpy(plain + 8 + crypto_auth_hmacsha512_BYTES, sk, OPAQUE_SHARED_SECRETBYTES);
+
+  randombytes(token + 4, CONTINUATION_NONCEBYTES);
+  pthread_rwlock_rdlock(&continuations->keys_lock);
+  store_be32(token, continuations->key_id);
+  crypto_aead_xchacha20poly1305_ietf_encrypt(token + CONTINUATION_HEADER_LEN, NULL,
+                                             plain, CONTINUATION_PLAIN_LEN,
+                                             token, 4, NULL, token + 4, continuations->keys->key);
+  pthread_rwlock_unlock(&continuations->keys_lock);
+  opaque_scratch_release(mark);
+  return 0;
+}
+
+int opaque_continuations_open(Opaque_Continuations *continuations,
+                              const uint8_t token[OPAQUE_CONTINUATION_LEN],
+                              uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                              uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                              uint64_t *expires) {
+  const uint32_t key_id = load_be32(token);
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *plain = opaque_scratch_alloc(CONTINUATION_PLAIN_LEN);
+  if(plain==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  int ret = -1;
+  pthread_rwlock_rdlock(&continuations->keys_lock);
+  const uint8_t *key = NULL;
+  if(key_id==continuations->key_id) key = continuations->keys->key;
+  else if(continuations->has_prev && key_id==continuations->prev_key_id) key = continuations->keys->prev_key;
+  if(key!=NULL) {
+    ret = crypto_aead_xchacha20poly1305_ietf_decrypt(plain, NULL, NULL,
+                                                     token + CONTINUATION_HEADER_LEN,
+                                                     OPAQUE_CONTINUATION_LEN - CONTINUATION_HEADER_LEN,
+                                                     token, 4, token + 4, key);
+  }
+  pthread_rwlock_unlock(&continuations->keys_lock);
+  if(ret!=0 || load_be64(plain) <= now_s()) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  *expires = load_be64(plain);
+  memcpy(authU, plain + 8, crypto_auth_hmacsha512_BYTES);
+  memcpy(sk, plain + 8 + crypto_auth_hmacsha512_BYTES, OPAQUE_SHARED_SECRETBYTES);
+  opaque_scratch_release(mark);
+  return 0;
+}
+
+int opaque_continuations_redeem(Opaque_Continuations *continuations,
+                                const uint8_t token[OPAQUE_CONTINUATION_LEN],
+                                const uint64_t expires) {
+  const uint8_t *nonce = token + 4;
+  // the nonces are random, their first bytes select the set
+  size_t idx = 0, i;
+  for(i=0;i<sizeof idx;i++) idx = (idx << 8) | nonce[i];
+  idx &= continuations->sets - 1;
+  Used *set = &continuations->used[idx * CONTINUATIONS_WAYS], *slot = NULL;
+  pthread_mutex_t *lock = &continuations->locks[idx % CONTINUATIONS_LOCKS];
+  const uint64_t now = now_s();
+  int ret = 0;
+  pthread_mutex_lock(lock);
+  for(i=0;i<CONTINUATIONS_WAYS;i++) {
+    Used *u = &set[i];
+    if(u->expires <= now) {
+      if(slot==NULL) slot = u;
+      continue;
+    }
+    if(0==memcmp(u->nonce, nonce, CONTINUATION_NONCEBYTES)) {
+      ret = -1;
+      break;
+    }
+  }
+  if(ret==0 && slot==NULL) ret = -1;
+  if(ret==0) {
+    memcpy(slot->nonce, nonce, CONTINUATION_NONCEBYTES);
+    slot->expires = expires;
+  }
+  pthread_mutex_unlock(lock);
+  return ret;
+}
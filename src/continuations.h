@@ -0,0 +1,42 @@
+#ifndef CONTINUATIONS_H
+#define CONTINUATIONS_H
+
+#include <stdint.h>
+#include "opaque.h"
+
+/* sealing and opening of the continuation tokens of opaque.h
+ *
+ * A token is
+ *
+ *   I2OSP(key_id, 4) || nonce[24] || XChaCha20-Poly1305(key, nonce,
+ *     ad = I2OSP(key_id, 4), I2OSP(expires, 8) || authU[64] || sk[64])
+ *
+ * expires is in seconds of the unix epoch, the servers of a
+ * deployment share the keys and need roughly synchronized clocks. The
+ * nonce identifies a token for the replay protection, which is a set
+ * associative table of the nonces of redeemed tokens until they
+ * expire, with a lock per group of sets. */
+
+// seals authU and sk into token under the current key
+int opaque_continuations_seal(Opaque_Continuations *continuations,
+                              const uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                              const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                              uint8_t token[OPAQUE_CONTINUATION_LEN]);
+
+// opens token into authU, sk and the time it expires, fails if the
+// token is not authentic, its key is neither the current nor the
+// previous one, or it expired
+int opaque_continuations_open(Opaque_Continuations *continuations,
+                              const uint8_t token[OPAQUE_CONTINUATION_LEN],
+                              uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                              uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                              uint64_t *expires);
+
+// marks an opened token as redeemed until it expires, fails if it
+// already is or its set in the table is full of tokens that have not
+// expired yet
+int opaque_continuations_redeem(Opaque_Continuations *continuations,
+                                const uint8_t token[OPAQUE_CONTINUATION_LEN],
+                                const uint64_t expires);
+
+#endif // CONTINUATIONS_H
@@ -0,0 +1,244 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "common.h"
+#include "hotcache.h"
+
+#define HOTCACHE_MAX_ENTRIES (1 << 16)
+#define HOTCACHE_MAX_SHARDS 64
+#define HOTCACHE_WAYS 4
+
+typedef struct {
+  uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES];
+  // the ristretto backend of the table
+  const char *backend;
+  // the lookup counter of the last use, 0 for a free entry
+  uint64_t used;
+  Opaque_HotRecord hot;
+} Entry;
+
+// a cache line each, so that logins on different shards do not share
+// the line of a lock or of a counter
+typedef struct {
+  pthread_mutex_t lock;
+  uint64_t clock;
+  size_t entries;
+  Entry *set;
+  atomic_uint_fast64_t hits;
+  atomic_uint_fast64_t misses;
+  atomic_uint_fast64_t evictions;
+  atomic_uint_fast64_t hit_ns;
+  atomic_uint_fast64_t miss_ns;
+} __attribute((aligned(64))) Shard;
+
+struct Opaque_HotCache {
+  // both powers of 2, the sets are per shard
+  size_t shards;
+  size_t sets;
+  // sodium_malloc()ed
+  uint8_t *key;
+  Shard *shard;
+};
+
+Opaque_HotCache *opaque_hotcache_new(const size_t max_entries, const size_t shards) {
+  size_t nshards = 1, sets = 1, i;
+  if(max_entries==0 || max_entries > HOTCACHE_MAX_ENTRIES || shards==0 || shards > HOTCACHE_MAX_SHARDS) return NULL;
+  while(nshards < shards) nshards <<= 1;
+  while(nshards * sets * HOTCACHE_WAYS < max_entries) sets <<= 1;
+
+  Opaque_HotCache *cache = calloc(1, sizeof *cache);
+  if(cache==NULL) return NULL;
+  void *mem = NULL;
+  if(0!=posix_memalign(&mem, 64, nshards * sizeof(Shard))) {
+    free(cache);
+    return NULL;
+  }
+  memset(mem, 0, nshards * sizeof(Shard));
+  cache->shard = mem;
+  // sodium_malloc() ignores a failure to lock the memory
+  cache->key = sodium_malloc(crypto_generichash_KEYBYTES);
+  if(cache->key==NULL || 0!=sodium_mlock(cache->key, crypto_generichash_KEYBYTES)) {
+    opaque_hotcache_free(cache);
+    return NULL;
+  }
+  randombytes(cache->key, crypto_generichash_KEYBYTES);
+  cache->sets = sets;
+  for(i=0;i<nshards;i++) {
+    Shard *s = &cache->shard[i];
+    s->set = sodium_malloc(sets * HOTCACHE_WAYS * sizeof(Entry));
+    if(s->set==NULL || 0!=sodium_mlock(s->set, sets * HOTCACHE_WAYS * sizeof(Entry)) ||
+       0!=pthread_mutex_init(&s->lock, NULL)) {
+      if(s->set!=NULL) sodium_free(s->set);
+      s->set = NULL;
+      opaque_hotcache_free(cache);
+      return NULL;
+    }
+    memset(s->set, 0, sets * HOTCACHE_WAYS * sizeof(Entry));
+    // counts the shards to free
+    cache->shards++;
+  }
+  return cache;
+}
+
+void opaque_hotcache_free(Opaque_HotCache *cache) {
+  size_t i;
+  if(cache==NULL) return;
+  for(i=0;i<cache->shards;i++) {
+    // sodium_free wipes the entries
+    sodium_free(cache->shard[i].set);
+    pthread_mutex_destroy(&cache->shard[i].lock);
+  }
+  if(cache->key!=NULL) sodium_free(cache->key);
+  free(cache->shard);
+  free(cache);
+}
+
+void opaque_hotcache_purge(Opaque_HotCache *cache) {
+  size_t i;
+  if(cache==NULL) return;
+  for(i=0;i<cache->shards;i++) {
+    Shard *s = &cache->shard[i];
+    pthread_mutex_lock(&s->lock);
+    sodium_memzero(s->set, cache->sets * HOTCACHE_WAYS * sizeof(Entry));
+    s->entries = 0;
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+void opaque_hotcache_tag(const Opaque_HotCache *cache,
+                         const uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                         uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES]) {
+  crypto_generichash(tag, OPAQUE_HOTCACHE_TAGBYTES, rec, OPAQUE_USER_RECORD_LEN,
+                     cache->key, crypto_generichash_KEYBYTES);
+}
+
+// the shard of tag from its first 8 bytes, the set from the next 8
+static Shard *shard_of(const Opaque_HotCache *cache, const uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES], Entry **set) {
+  uint64_t shard = 0, idx = 0;
+  size_t i;
+  for(i=0;i<8;i++) {
+    shard = (shard << 8) | tag[i];
+    idx = (idx << 8) | tag[8+i];
+  }
+  Shard *s = &cache->shard[shard & (cache->shards - 1)];
+  *set = &s->set[(idx & (cache->sets - 1)) * HOTCACHE_WAYS];
+  return s;
+}
+
+// the entry of tag in set, NULL if there is none
+static Entry *find(Entry *set, const uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES]) {
+  size_t i;
+  for(i=0;i<HOTCACHE_WAYS;i++) {
+    if(set[i].used!=0 && 0==sodium_memcmp(set[i].tag, tag, OPAQUE_HOTCACHE_TAGBYTES)) return &set[i];
+  }
+  return NULL;
+}
+
+int opaque_hotcache_get(Opaque_HotCache *cache,
+                        const uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES],
+                        Opaque_HotRecord *hot) {
+  Entry *set;
+  Shard *s = shard_of(cache, tag, &set);
+  int ret = -1;
+  pthread_mutex_lock(&s->lock);
+  Entry *e = find(set, tag);
+  if(e!=NULL && e->backend==ristretto_backend()) {
+    memcpy(hot, &e->hot, sizeof *hot);
+    e->used = ++s->clock;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&s->lock);
+  atomic_fetch_add_explicit((ret==0) ? &s->hits : &s->misses, 1, memory_order_relaxed);
+  return ret;
+}
+
+void opaque_hotcache_put(Opaque_HotCache *cache,
+                         const uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES],
+                         const Opaque_HotRecord *hot) {
+  Entry *set;
+  Shard *s = shard_of(cache, tag, &set);
+  size_t i;
+  pthread_mutex_lock(&s->lock);
+  // the entry of the same tag, else the least recently used, free
+  // entries have used==0
+  Entry *slot = find(set, tag);
+  if(slot==NULL) {
+    slot = &set[0];
+    for(i=1;i<HOTCACHE_WAYS;i++) {
+      if(set[i].used < slot->used) slot = &set[i];
+    }
+    if(slot->used!=0) atomic_fetch_add_explicit(&s->evictions, 1, memory_order_relaxed);
+    else s->entries++;
+  }
+  memcpy(slot->tag, tag, OPAQUE_HOTCACHE_TAGBYTES);
+  slot->backend = ristretto_backend();
+  memcpy(&slot->hot, hot, sizeof slot->hot);
+  slot->used = ++s->clock;
+  pthread_mutex_unlock(&s->lock);
+}
+
+int opaque_hotcache_evict(Opaque_HotCache *cache, const uint8_t rec[OPAQUE_USER_RECORD_LEN]) {
+  uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES];
+  Entry *set;
+  opaque_hotcache_tag(cache, rec, tag);
+  Shard *s = shard_of(cache, tag, &set);
+  pthread_mutex_lock(&s->lock);
+  Entry *e = find(set, tag);
+  if(e!=NULL) {
+    sodium_memzero(e, sizeof *e);
+    s->entries--;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return (e!=NULL) ? 0 : -1;
+}
+
+uint64_t opaque_hotcache_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+void opaque_hotcache_timing(Opaque_HotCache *cache,
+                            const uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES],
+                            const int hit, const uint64_t start) {
+  Entry *set;
+  Shard *s = shard_of(cache, tag, &set);
+  atomic_fetch_add_explicit(hit ? &s->hit_ns : &s->miss_ns, opaque_hotcache_clock() - start, memory_order_relaxed);
+}
+
+void opaque_hotcache_stats(Opaque_HotCache *cache, Opaque_HotCacheStats *stats) {
+  size_t i;
+  memset(stats, 0, sizeof *stats);
+  for(i=0;i<cache->shards;i++) {
+    Shard *s = &cache->shard[i];
+    stats->hits += atomic_load_explicit(&s->hits, memory_order_relaxed);
+    stats->misses += atomic_load_explicit(&s->misses, memory_order_relaxed);
+    stats->evictions += atomic_load_explicit(&s->evictions, memory_order_relaxed);
+    stats->hit_ns += atomic_load_explicit(&s->hit_ns, memory_order_relaxed);
+    stats->miss_ns += atomic_load_explicit(&s->miss_ns, memory_order_relaxed);
+    pthread_mutex_lock(&s->lock);
+    stats->entries += s->entries;
+    pthread_mutex_unlock(&s->lock);
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef HOTCACHE_H
+#define HOTCACHE_H
+
+#include <stdint.h>
+#include "opaque.h"
+#include "ristretto.h"
+
+/* the server side record cache of opaque.h
+ *
+ * An entry maps a keyed hash of a whole user record to the values a
+ * login derives from it alone. The cache is split into shards with a
+ * lock each, a shard is set associative with 4 entries per set, and
+ * the shard and the set are selected by the tag. The entries are in
+ * memory allocated with sodium_malloc() and locked with sodium_mlock().
+ * Tables are only valid for the ristretto backend that made them, an
+ * entry of another backend misses. */
+
+#define OPAQUE_HOTCACHE_TAGBYTES 32
+
+typedef struct {
+  // g^skS
+  uint8_t pkS[crypto_scalarmult_BYTES];
+  // the HKDF-Expand state keyed with the masking_key of the record
+  crypto_auth_hmacsha512_state masking_state;
+  // the multiples of the decoded client_public_key of the record
+  ristretto_table client_public_key;
+} Opaque_HotRecord;
+
+// the tag of a record
+void opaque_hotcache_tag(const Opaque_HotCache *cache,
+                         const uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                         uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES]);
+
+// copies the values of tag to hot and counts a hit, returns 0 then,
+// or counts a miss and returns -1
+int opaque_hotcache_get(Opaque_HotCache *cache,
+                        const uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES],
+                        Opaque_HotRecord *hot);
+
+// stores the values of tag, replacing the least recently used entry of
+// its set if that is full
+void opaque_hotcache_put(Opaque_HotCache *cache,
+                         const uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES],
+                         const Opaque_HotRecord *hot);
+
+// the monotonic clock in nanoseconds
+uint64_t opaque_hotcache_clock(void);
+
+// adds the time since start to the latency of hits or of misses
+void opaque_hotcache_timing(Opaque_HotCache *cache,
+                            const uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES],
+                            const int hit, const uint64_t start);
+
+#endif // HOTCACHE_H
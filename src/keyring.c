@@ -0,0 +1,151 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "common.h"
+#include "ristretto.h"
+#include "keyring.h"
+
+typedef struct {
+  uint8_t skS[crypto_scalarmult_SCALARBYTES];
+  uint8_t pkS[crypto_scalarmult_BYTES];
+  uint32_t id;
+  int used;
+} Slot;
+
+struct Opaque_Keyring {
+  // only taken for writing by add and remove
+  pthread_rwlock_t lock;
+  size_t max;
+  // sodium_malloc()ed
+  Slot *slots;
+};
+
+Opaque_Keyring *opaque_keyring_new(const size_t slots) {
+  if(slots==0 || slots > OPAQUE_KEYRING_MAX_SLOTS) return NULL;
+  Opaque_Keyring *keyring = calloc(1, sizeof *keyring);
+  if(keyring==NULL) return NULL;
+  if(0!=pthread_rwlock_init(&keyring->lock, NULL)) {
+    free(keyring);
+    return NULL;
+  }
+  keyring->slots = sodium_malloc(slots * sizeof(Slot));
+  if(keyring->slots==NULL) {
+    opaque_keyring_free(keyring);
+    return NULL;
+  }
+  memset(keyring->slots, 0, slots * sizeof(Slot));
+  keyring->max = slots;
+  return keyring;
+}
+
+void opaque_keyring_free(Opaque_Keyring *keyring) {
+  if(keyring==NULL) return;
+  // sodium_free wipes the keys
+  if(keyring->slots!=NULL) sodium_free(keyring->slots);
+  pthread_rwlock_destroy(&keyring->lock);
+  free(keyring);
+}
+
+int opaque_keyring_add(Opaque_Keyring *keyring, const uint32_t key_id,
+                       const uint8_t skS[crypto_scalarmult_SCALARBYTES]) {
+  Slot *slot = NULL;
+  size_t i;
+  int ret = 0;
+  pthread_rwlock_wrlock(&keyring->lock);
+  for(i=0;i<keyring->max;i++) {
+    Slot *s = &keyring->slots[i];
+    if(!s->used) {
+      if(slot==NULL) slot = s;
+      continue;
+    }
+    // an id names one key, and a key has one id so that converting
+    // records to v2 is unambiguous
+    if(s->id==key_id || 0==sodium_memcmp(s->skS, skS, crypto_scalarmult_SCALARBYTES)) {
+      ret = -1;
+      break;
+    }
+  }
+  if(ret==0 && (slot==NULL || 0!=ristretto_scalarmult_base(slot->pkS, skS))) ret = -1;
+  if(ret==0) {
+    memcpy(slot->skS, skS, crypto_scalarmult_SCALARBYTES);
+    slot->id = key_id;
+    slot->used = 1;
+  }
+  pthread_rwlock_unlock(&keyring->lock);
+  return ret;
+}
+
+int opaque_keyring_remove(Opaque_Keyring *keyring, const uint32_t key_id) {
+  size_t i;
+  int ret = -1;
+  pthread_rwlock_wrlock(&keyring->lock);
+  for(i=0;i<keyring->max;i++) {
+    Slot *s = &keyring->slots[i];
+    if(s->used && s->id==key_id) {
+      sodium_memzero(s, sizeof *s);
+      ret = 0;
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&keyring->lock);
+  return ret;
+}
+
+int opaque_keyring_get(const Opaque_Keyring *keyring, const uint32_t key_id,
+                       uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                       uint8_t pkS[crypto_scalarmult_BYTES]) {
+  // the lock is not part of the value of the keyring
+  pthread_rwlock_t *lock = (pthread_rwlock_t *) &keyring->lock;
+  size_t i;
+  int ret = -1;
+  pthread_rwlock_rdlock(lock);
+  for(i=0;i<keyring->max;i++) {
+    const Slot *s = &keyring->slots[i];
+    if(s->used && s->id==key_id) {
+      memcpy(skS, s->skS, crypto_scalarmult_SCALARBYTES);
+      memcpy(pkS, s->pkS, crypto_scalarmult_BYTES);
+      ret = 0;
+      break;
+    }
+  }
+  pthread_rwlock_unlock(lock);
+  return ret;
+}
+
+int opaque_keyring_find(const Opaque_Keyring *keyring,
+                        const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                        uint32_t *key_id) {
+  pthread_rwlock_t *lock = (pthread_rwlock_t *) &keyring->lock;
+  size_t i;
+  int ret = -1;
+  pthread_rwlock_rdlock(lock);
+  for(i=0;i<keyring->max;i++) {
+    const Slot *s = &keyring->slots[i];
+    if(s->used && 0==sodium_memcmp(s->skS, skS, crypto_scalarmult_SCALARBYTES)) {
+      *key_id = s->id;
+      ret = 0;
+      break;
+    }
+  }
+  pthread_rwlock_unlock(lock);
+  return ret;
+}
@@ -0,0 +1,25 @@
+#ifndef KEYRING_H
+#define KEYRING_H
+
+#include <stdint.h>
+#include "opaque.h"
+
+/* lookups in the server keyring of opaque.h
+ *
+ * A keyring holds up to a fixed number of long-term server keys, each
+ * with its pkS computed when it is added, in memory allocated with
+ * sodium_malloc(). Lookups copy the keys out under a read lock, so
+ * keys can be added and removed while logins run. */
+
+// copies skS and pkS of key_id, returns 0 then, -1 if there is no
+// such key
+int opaque_keyring_get(const Opaque_Keyring *keyring, const uint32_t key_id,
+                       uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                       uint8_t pkS[crypto_scalarmult_BYTES]);
+
+// the id of skS, returns 0 then, -1 if it is not in the keyring
+int opaque_keyring_find(const Opaque_Keyring *keyring,
+                        const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                        uint32_t *key_id);
+
+#endif // KEYRING_H
@@ -0,0 +1,243 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// SCHED_IDLE
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "common.h"
+#include "ristretto.h"
+#include "keyshares.h"
+
+#define KEYSHARES_MAX_CAPACITY (1 << 16)
+#define KEYSHARES_MAX_THREADS 16
+
+// the queue, head and tail count pushes and pops. A slot is free for
+// the push number pos when its seq is pos, and holds the tuple of push
+// pos when its seq is pos+1.
+static struct {
+  Opaque_Keyshare *slots;
+  atomic_size_t *seq;
+  size_t mask;
+  atomic_size_t head;
+  atomic_size_t tail;
+  // set while the queue may be used, cleared by stop and in the child
+  // of a fork
+  atomic_int enabled;
+  // number of pops and fills using the slots, stop waits for them
+  atomic_int users;
+  atomic_int running;
+  // number of producers waiting for the queue to drain to half
+  atomic_int waiting;
+  pthread_mutex_t lock;
+  pthread_cond_t drained;
+  pthread_t threads[KEYSHARES_MAX_THREADS];
+  size_t nthreads;
+} q = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .drained = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void forked_child(void) {
+  // the threads are gone, and the tuples are those of the parent
+  atomic_store(&q.enabled, 0);
+  atomic_store(&q.users, 0);
+  atomic_store(&q.running, 0);
+  atomic_store(&q.waiting, 0);
+  q.nthreads = 0;
+  // a producer might have held the lock
+  pthread_mutex_init(&q.lock, NULL);
+  pthread_cond_init(&q.drained, NULL);
+}
+
+static void atfork_init(void) {
+  pthread_atfork(NULL, NULL, forked_child);
+}
+
+// registers a user of the slots before checking enabled, stop clears
+// enabled before checking users, so either the user sees the queue
+// disabled or stop waits for it. Returns -1 if the queue is disabled.
+static int enter(void) {
+  atomic_fetch_add(&q.users, 1);
+  if(atomic_load(&q.enabled)) return 0;
+  atomic_fetch_sub(&q.users, 1);
+  return -1;
+}
+
+static void leave(void) {
+  atomic_fetch_sub(&q.users, 1);
+}
+
+static size_t queued(void) {
+  const size_t head = atomic_load(&q.head), tail = atomic_load(&q.tail);
+  return (head > tail) ? head - tail : 0;
+}
+
+static int push(const Opaque_Keyshare *ks) {
+  size_t pos = atomic_load_explicit(&q.head, memory_order_relaxed);
+  for(;;) {
+    const size_t seq = atomic_load_explicit(&q.seq[pos & q.mask], memory_order_acquire);
+    const intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+    if(diff==0) {
+      if(atomic_compare_exchange_weak_explicit(&q.head, &pos, pos + 1,
+                                               memory_order_relaxed, memory_order_relaxed)) break;
+    } else if(diff < 0) {
+      return -1; // full
+    } else {
+      pos = atomic_load_explicit(&q.head, memory_order_relaxed);
+    }
+  }
+  memcpy(&q.slots[pos & q.mask], ks, sizeof *ks);
+  atomic_store_explicit(&q.seq[pos & q.mask], pos + 1, memory_order_release);
+  return 0;
+}
+
+int opaque_keyshares_pop(Opaque_Keyshare *ks) {
+  if(0!=enter()) return -1;
+  size_t pos = atomic_load_explicit(&q.tail, memory_order_relaxed);
+  for(;;) {
+    const size_t seq = atomic_load_explicit(&q.seq[pos & q.mask], memory_order_acquire);
+    const intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+    if(diff==0) {
+      // seq_cst against the check of waiting below, see producer()
+      if(atomic_compare_exchange_weak_explicit(&q.tail, &pos, pos + 1,
+                                               memory_order_seq_cst, memory_order_relaxed)) break;
+    } else if(diff < 0) {
+      leave();
+      return -1; // empty
+    } else {
+      pos = atomic_load_explicit(&q.tail, memory_order_relaxed);
+    }
+  }
+  Opaque_Keyshare *slot = &q.slots[pos & q.mask];
+  memcpy(ks, slot, sizeof *ks);
+  sodium_memzero(slot, sizeof *slot);
+  atomic_store_explicit(&q.seq[pos & q.mask], pos + q.mask + 1, memory_order_release);
+
+  // wake the producers once half of the queue is gone
+  if(atomic_load(&q.waiting) > 0 && queued() <= (q.mask + 1) / 2) {
+    pthread_mutex_lock(&q.lock);
+    pthread_cond_broadcast(&q.drained);
+    pthread_mutex_unlock(&q.lock);
+  }
+  leave();
+  return 0;
+}
+
+static void make(Opaque_Keyshare *ks) {
+  randombytes((uint8_t*) &ks->rnd, sizeof ks->rnd);
+  ristretto_scalarmult_base(ks->X_s, ks->rnd.x_s);
+}
+
+size_t opaque_keyshares_fill(const size_t max) {
+  Opaque_Keyshare ks;
+  size_t n = 0;
+  if(0!=enter()) return 0;
+  while(n < max && queued() <= q.mask && atomic_load(&q.enabled)) {
+    make(&ks);
+    if(0!=push(&ks)) break;
+    n++;
+  }
+  leave();
+  sodium_memzero(&ks, sizeof ks);
+  return n;
+}
+
+size_t opaque_keyshares_available(void) {
+  if(!atomic_load(&q.enabled)) return 0;
+  return queued();
+}
+
+static void *producer(void *unused) {
+  (void) unused;
+#ifdef SCHED_IDLE
+  // only run when the cpu has nothing else to do
+  struct sched_param param = {0};
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+  while(atomic_load(&q.running)) {
+    opaque_keyshares_fill(SIZE_MAX);
+    // announces the wait before checking the queue, a pop either sees
+    // waiting or this check sees the pop
+    pthread_mutex_lock(&q.lock);
+    atomic_fetch_add(&q.waiting, 1);
+    while(atomic_load(&q.running) && queued() > (q.mask + 1) / 2) {
+      pthread_cond_wait(&q.drained, &q.lock);
+    }
+    atomic_fetch_sub(&q.waiting, 1);
+    pthread_mutex_unlock(&q.lock);
+  }
+  return NULL;
+}
+
+int opaque_keyshares_start(const size_t capacity, const size_t threads) {
+  size_t size = 2, i;
+  if(capacity < 2 || capacity > KEYSHARES_MAX_CAPACITY || threads > KEYSHARES_MAX_THREADS) return -1;
+  if(atomic_load(&q.enabled)) return -1;
+  pthread_once(&atfork_once, atfork_init);
+  // the queue inherited by the child of a fork
+  opaque_keyshares_stop();
+  while(size < capacity) size <<= 1;
+
+  q.slots = sodium_malloc(size * sizeof(Opaque_Keyshare));
+  q.seq = calloc(size, sizeof(atomic_size_t));
+  if(q.slots==NULL || q.seq==NULL) {
+    if(q.slots!=NULL) sodium_free(q.slots);
+    free(q.seq);
+    q.slots = NULL;
+    q.seq = NULL;
+    return -1;
+  }
+  for(i=0;i<size;i++) atomic_init(&q.seq[i], i);
+  q.mask = size - 1;
+  atomic_store(&q.head, 0);
+  atomic_store(&q.tail, 0);
+  atomic_store(&q.running, 1);
+  atomic_store(&q.enabled, 1);
+
+  // without thread support the caller fills the queue
+  for(q.nthreads=0;q.nthreads<threads;q.nthreads++) {
+    if(0!=pthread_create(&q.threads[q.nthreads], NULL, producer, NULL)) break;
+  }
+  return 0;
+}
+
+void opaque_keyshares_stop(void) {
+  size_t i;
+  if(q.slots==NULL) return;
+  atomic_store(&q.enabled, 0);
+  pthread_mutex_lock(&q.lock);
+  atomic_store(&q.running, 0);
+  pthread_cond_broadcast(&q.drained);
+  pthread_mutex_unlock(&q.lock);
+  for(i=0;i<q.nthreads;i++) pthread_join(q.threads[i], NULL);
+  q.nthreads = 0;
+  // the pops and fills that entered before enabled was cleared
+  while(atomic_load(&q.users) > 0) sched_yield();
+  // sodium_free wipes the tuples
+  sodium_free(q.slots);
+  free(q.seq);
+  q.slots = NULL;
+  q.seq = NULL;
+}
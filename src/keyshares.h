@@ -0,0 +1,34 @@
+#ifndef KEYSHARES_H
+#define KEYSHARES_H
+
+#include <stdint.h>
+#include "opaque.h"
+
+/* the precomputed server keyshares of opaque.h
+ *
+ * A bounded lock-free queue (Vyukov's MPMC ring) of the values of a
+ * server response that do not depend on the request of the client.
+ * Background threads at idle priority refill it to its capacity
+ * whenever responses have taken half of it. The tuples are in memory
+ * allocated with sodium_malloc(), a popped slot is wiped. The child
+ * of a fork() never pops the tuples it inherited, those are also in
+ * the queue of the parent. */
+
+// the random values needed by the server for one login
+typedef struct {
+  uint8_t masking_nonce[32];
+  uint8_t nonceS[OPAQUE_NONCE_BYTES];
+  uint8_t x_s[crypto_scalarmult_SCALARBYTES];
+} Opaque_ServerRandom;
+
+typedef struct {
+  Opaque_ServerRandom rnd;
+  // g^x_s
+  uint8_t X_s[crypto_scalarmult_BYTES];
+} Opaque_Keyshare;
+
+// pops a precomputed keyshare into ks, returns 0 then, or -1 if the
+// queue is not started or empty
+int opaque_keyshares_pop(Opaque_Keyshare *ks);
+
+#endif // KEYSHARES_H
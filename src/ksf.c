@@ -0,0 +1,222 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if _WIN32 == 1 || _WIN64 == 1
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "opaque.h"
+#include "common.h"
+#include "argon2.h"
+#include "pool.h"
+
+#define KSF_PROFILE_VERSION 1
+#define CALIBRATE_SAMPLES 5
+// the memory calibration starts at and is refined down to, in KiB
+#define CALIBRATE_MEM_MIN 1024
+#define CALIBRATE_PASSES_MAX 64
+
+static void store32_be(uint8_t *p, const uint32_t x) {
+  unsigned i;
+  for(i=0;i<4;i++) p[i] = (uint8_t) (x >> (24 - 8*i));
+}
+
+static void store64_be(uint8_t *p, const uint64_t x) {
+  unsigned i;
+  for(i=0;i<8;i++) p[i] = (uint8_t) (x >> (56 - 8*i));
+}
+
+static uint32_t load32_be(const uint8_t *p) {
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static uint64_t load64_be(const uint8_t *p) {
+  return ((uint64_t) load32_be(p) << 32) | load32_be(p + 4);
+}
+
+// version, alg, parallelism, ops, mem
+void opaque_SerializeKSF(const Opaque_KSF *ksf, uint8_t profile[OPAQUE_KSF_PROFILE_LEN]) {
+  profile[0] = KSF_PROFILE_VERSION;
+  profile[1] = (uint8_t) ksf->alg;
+  store32_be(profile + 2, ksf->parallelism);
+  store64_be(profile + 6, ksf->ops);
+  store64_be(profile + 14, ksf->mem);
+}
+
+int opaque_ParseKSF(const uint8_t profile[OPAQUE_KSF_PROFILE_LEN], Opaque_KSF *ksf) {
+  if(profile[0]!=KSF_PROFILE_VERSION) return -1;
+  if(profile[1]!=OPAQUE_KSF_IDENTITY && profile[1]!=OPAQUE_KSF_ARGON2ID &&
+     profile[1]!=OPAQUE_KSF_SCRYPT) return -1;
+  memset(ksf, 0, sizeof *ksf);
+  ksf->alg = profile[1];
+  ksf->parallelism = load32_be(profile + 2);
+  ksf->ops = load64_be(profile + 6);
+  ksf->mem = load64_be(profile + 14);
+  return 0;
+}
+
+static uint64_t now_us(void) {
+#if _WIN32 == 1 || _WIN64 == 1
+  LARGE_INTEGER f, c;
+  QueryPerformanceFrequency(&f);
+  QueryPerformanceCounter(&c);
+  return (uint64_t) (c.QuadPart / f.QuadPart) * 1000000ULL +
+    (uint64_t) (c.QuadPart % f.QuadPart) * 1000000ULL / (uint64_t) f.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000;
+#endif
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  const uint64_t x=*(const uint64_t*)a, y=*(const uint64_t*)b;
+  return (x>y) - (x<y);
+}
+
+typedef struct {
+  uint64_t target;
+  unsigned samples;
+  Opaque_KSF_Candidate *candidates;
+  size_t max;
+  size_t n;
+} Calibration;
+
+// times the Argon2id hardening of the clients with t passes over m
+// KiB in p lanes, returns 1 if its p95 meets the target, 0 if not, -1
+// if the parameters are invalid or out of memory. The median and p95
+// are stored in last.
+static int measure(Calibration *c, const uint32_t t, const uint32_t m, const uint32_t p,
+                   uint64_t last[2]) {
+  // the same input sizes and all zero salt as the hardening in opaque.c
+  const uint8_t salt[crypto_pwhash_SALTBYTES]={0};
+  uint8_t y[crypto_hash_sha512_BYTES], out[crypto_hash_sha512_BYTES];
+  uint64_t samples[32];
+  unsigned i;
+  randombytes_buf(y, sizeof y);
+  for(i=0;i<c->samples;i++) {
+    const uint64_t start = now_us();
+    if(0!=argon2id(out, sizeof out, y, sizeof y, salt, sizeof salt, NULL, 0, NULL, 0, t, m, p, NULL)) return -1;
+    samples[i] = now_us() - start;
+  }
+  sodium_memzero(out, sizeof out);
+  qsort(samples, c->samples, sizeof(uint64_t), cmp_u64);
+  const uint64_t median = samples[c->samples / 2];
+  // the nearest rank
+  const uint64_t p95 = samples[(c->samples * 95 + 99) / 100 - 1];
+  last[0] = median;
+  last[1] = p95;
+  if(c->n < c->max) {
+    Opaque_KSF_Candidate *cand = &c->candidates[c->n++];
+    memset(cand, 0, sizeof *cand);
+    cand->ksf.alg = OPAQUE_KSF_ARGON2ID;
+    cand->ksf.parallelism = p;
+    cand->ksf.ops = t;
+    cand->ksf.mem = m;
+    cand->median_us = median;
+    cand->p95_us = p95;
+    cand->meets_target = p95 <= c->target;
+  }
+  return p95 <= c->target;
+}
+
+int opaque_CalibrateKSF(const uint32_t target_ms, const uint64_t mem_max,
+                        const uint32_t parallelism, const unsigned samples,
+                        Opaque_KSF *ksf,
+                        Opaque_KSF_Candidate candidates[], const size_t max_candidates,
+                        size_t *ncandidates) {
+  Calibration c = {
+    .target = (uint64_t) target_ms * 1000,
+    .samples = (samples==0) ? CALIBRATE_SAMPLES : samples,
+    .candidates = candidates,
+    .max = (candidates!=NULL) ? max_candidates : 0,
+  };
+  if(ncandidates!=NULL) *ncandidates = 0;
+  if(target_ms==0 || c.samples > 32) return -1;
+  // one lane per thread the lanes can be filled on
+  const uint32_t p = (parallelism!=0) ? parallelism : (uint32_t) opaque_pool_threads();
+  if(p > ARGON2_LANES_MAX) return -1;
+  const uint64_t ceiling = (mem_max < UINT32_MAX) ? mem_max : UINT32_MAX;
+  uint32_t m = CALIBRATE_MEM_MIN, good = 0, bad = 0;
+  // median and p95 of the last measurement, the median of a single pass
+  // over good
+  uint64_t last[2], single = 1;
+  if(m < 8 * p) m = 8 * p;
+  if(m > ceiling) return -1;
+  int r;
+
+  // the most memory in a single pass that meets the target: doubling up
+  // to the ceiling, then bisecting until within 1/8th
+  for(;;) {
+    if((r=measure(&c, 1, m, p, last)) < 0) goto done;
+    if(!r) {
+      bad = m;
+      break;
+    }
+    good = m;
+    single = last[0];
+    if(m==ceiling) break;
+    m = (m > ceiling / 2) ? (uint32_t) ceiling : 2 * m;
+  }
+  if(good==0) {
+    // even the least memory is too slow for the target
+    r = -1;
+    goto done;
+  }
+  while(bad!=0 && bad - good > good / 8 && bad - good > CALIBRATE_MEM_MIN) {
+    m = good + (bad - good) / 2;
+    if((r=measure(&c, 1, m, p, last)) < 0) goto done;
+    if(r) {
+      good = m;
+      single = last[0];
+    } else {
+      bad = m;
+    }
+  }
+
+  // as many passes over it as fit into the target, estimated from the
+  // median of a single pass and then verified, scaling the estimate
+  // down by how much its p95 missed the target
+  uint32_t t = 1;
+  uint64_t est = c.target / (single ? single : 1);
+  if(est > CALIBRATE_PASSES_MAX) est = CALIBRATE_PASSES_MAX;
+  while(est > 1) {
+    if((r=measure(&c, (uint32_t) est, good, p, last)) < 0) goto done;
+    if(r) {
+      t = (uint32_t) est;
+      break;
+    }
+    const uint64_t scaled = est * c.target / last[1];
+    est = (scaled < est) ? scaled : est - 1;
+  }
+
+  memset(ksf, 0, sizeof *ksf);
+  ksf->alg = OPAQUE_KSF_ARGON2ID;
+  ksf->parallelism = p;
+  ksf->ops = t;
+  ksf->mem = good;
+  r = 0;
+
+done:
+  if(ncandidates!=NULL) *ncandidates = c.n;
+  return (r < 0) ? -1 : 0;
+}
@@ -25,6 +25,17 @@
 #include <arpa/inet.h>
 #endif
 #include "common.h"
+#include "sha512mb.h"
+#include "ristretto.h"
+#include "argon2.h"
+#include "workspace.h"
+#include "rwdcache.h"
+#include "tickets.h"
+#include "keyshares.h"
+#include "keyring.h"
+#include "oprfseed.h"
+#include "continuations.h"
+#include "hotcache.h"
 #ifdef CFRG_TEST_VEC
 #include "tests/cfrg_test_vector_decl.h"
 #endif
@@ -41,6 +52,8 @@
 #define OPAQUE_ENVELOPE_BYTES (OPAQUE_ENVELOPE_NONCEBYTES + crypto_auth_hmacsha512_BYTES)
 #define OPAQUE_HMAC_SHA512_BYTES 64
 #define OPAQUE_HMAC_SHA512_KEYBYTES 64
+// 2+1+7+255+1+64 would be the largest possible, our labels are short
+#define OPAQUE_HKDF_LABEL_MAX 96
 
 typedef struct {
   uint8_t nonce[OPAQUE_ENVELOPE_NONCEBYTES];
@@ -61,6 +74,20 @@ typedef struct {
   Opaque_RegistrationRecord recU;
 } __attribute((packed)) Opaque_UserRecord;
 
+// a record whose skS is in a keyring
+typedef struct {
+  uint8_t key_id[4];
+  uint8_t kU[crypto_core_ristretto255_SCALARBYTES];
+  Opaque_RegistrationRecord recU;
+} __attribute((packed)) Opaque_UserRecordV2;
+
+// a record whose skS is in a keyring and whose kU is derived from the
+// OPRF seed of the server
+typedef struct {
+  uint8_t key_id[4];
+  Opaque_RegistrationRecord recU;
+} __attribute((packed)) Opaque_UserRecordSeeded;
+
 typedef struct {
   uint8_t blinded[crypto_core_ristretto255_BYTES];
   uint8_t nonceU[OPAQUE_NONCE_BYTES];
@@ -68,7 +95,9 @@ typedef struct {
 } __attribute((packed)) Opaque_UserSession;
 
 typedef struct {
-  uint8_t blind[crypto_core_ristretto255_SCALARBYTES];
+  // 1/r, inverted when r is picked so that the unblinding does not
+  // need to
+  uint8_t blind_inv[crypto_core_ristretto255_SCALARBYTES];
   uint8_t x_u[crypto_scalarmult_SCALARBYTES];
   uint8_t nonceU[OPAQUE_NONCE_BYTES];
   uint8_t blinded[crypto_core_ristretto255_BYTES];
@@ -77,6 +106,15 @@ typedef struct {
   uint8_t pwdU[];
 } __attribute((packed)) Opaque_UserSession_Secret;
 
+// the password independent values of opaque_CreateCredentialRequest()
+typedef struct {
+  uint8_t blind[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t blind_inv[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t x_u[crypto_scalarmult_SCALARBYTES];
+  uint8_t X_u[crypto_scalarmult_BYTES];
+  uint8_t nonceU[OPAQUE_NONCE_BYTES];
+} __attribute((packed)) Opaque_UserPrecomputed;
+
 typedef struct {
   uint8_t Z[crypto_core_ristretto255_BYTES];
   uint8_t masking_nonce[32];
@@ -92,6 +130,27 @@ typedef struct {
   uint8_t pwdU[];
 } Opaque_RegisterUserSec;
 
+typedef struct {
+  uint8_t nonceU[OPAQUE_NONCE_BYTES];
+  // all zero without the ephemeral dh
+  uint8_t X_u[crypto_scalarmult_BYTES];
+  uint8_t ticket[];
+} __attribute((packed)) Opaque_ResumeRequest;
+
+typedef struct {
+  // all zero without the ephemeral dh
+  uint8_t x_u[crypto_scalarmult_SCALARBYTES];
+  uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES];
+  uint8_t req_hash[crypto_hash_sha512_BYTES];
+} __attribute((packed)) Opaque_ResumeSecret;
+
+typedef struct {
+  uint8_t nonceS[OPAQUE_NONCE_BYTES];
+  // all zero without the ephemeral dh
+  uint8_t X_s[crypto_scalarmult_BYTES];
+  uint8_t auth[crypto_auth_hmacsha512_BYTES];
+} __attribute((packed)) Opaque_ResumeResponse;
+
 typedef struct {
   uint8_t Z[crypto_core_ristretto255_BYTES];
   uint8_t pkS[crypto_scalarmult_BYTES];
@@ -102,6 +161,31 @@ typedef struct {
   uint8_t kU[crypto_core_ristretto255_SCALARBYTES];
 } __attribute((packed)) Opaque_RegisterSrvSec;
 
+typedef struct {
+  uint8_t skS[crypto_scalarmult_SCALARBYTES];
+  uint8_t pkS[crypto_scalarmult_BYTES];
+  // sha512 midstate after hashing "RFCXXXX" || I2OSP(len(ctx), 2) || ctx
+  crypto_hash_sha512_state preamble_prefix;
+} __attribute((packed)) Opaque_ServerSetup;
+
+// number of logins in a batch that share one draw of randomness, this
+// is bounded by the size of the scratch arena
+#define OPAQUE_BATCH_CHUNK 32
+
+// number of logins in a batch whose group operations are computed
+// together, the number of lanes of the batches of ristretto.h
+#define OPAQUE_BATCH_LANES 4
+
+// the results of the group operations of one login, computed for
+// several logins at once by server_group_ops()
+typedef struct {
+  uint8_t Z[crypto_core_ristretto255_BYTES];
+  uint8_t X_s[crypto_scalarmult_BYTES];
+  // the input of derive_keys()
+  uint8_t ikm[crypto_scalarmult_BYTES * 3];
+  int ret;
+} Opaque_ServerGroupOps;
+
 typedef struct {
   uint8_t sk[OPAQUE_SHARED_SECRETBYTES];
   uint8_t km2[OPAQUE_HMAC_SHA512_KEYBYTES];
@@ -137,99 +221,305 @@ static void oprf_KeyGen(uint8_t kU[crypto_core_ristretto255_SCALARBYTES]) {
 #endif
 }
 
+// the KSF used if none is given, the libsodium crypto_pwhash
+// INTERACTIVE limits that were hardcoded before KSFs were selectable
+static const Opaque_KSF ksf_default = {
+  .alg = OPAQUE_KSF_ARGON2ID,
+  .parallelism = 1,
+  .ops = 2,
+  .mem = 65536,
+};
+
+// N must be a power of 2 larger than 1, r*p < 2^30
+static int scrypt_valid(const Opaque_KSF *ksf) {
+  if(ksf->ops < 2 || (ksf->ops & (ksf->ops - 1))!=0) return 0;
+  if(ksf->mem==0 || ksf->parallelism==0 || ksf->mem >= (1UL << 30) ||
+     ksf->mem * ksf->parallelism >= (1UL << 30)) return 0;
+  return 1;
+}
+
 /**
- * This function computes the OPRF output using input x, N, and domain separation
- * tag info.
+ * Stretch(msg, params) from the RFC, hardens the OPRF output y with
+ * the KSF described by ksf, using an all zero salt.
  *
- * This is the Finalize OPRF function defined in the RFC.
- *
- * @param [in] x - a value used to compute OPRF (for OPAQUE, this is pwdU, the
- * user's password)
- * @param [in] x_len - the length of param x in bytes
- * @param [in] N - a serialized OPRF group element, a byte array of fixed length,
- * an output of oprf_Unblind
- * @param [in] info - a domain separation tag
- * @param [in] info_len - the length of param info in bytes
- * @param [out] y - an OPRF output
- * @return The function returns 0 if everything is correct.
+ * @param [in] ksf - the key stretching function, NULL for ksf_default
+ * @param [in] y - the OPRF output
+ * @param [out] hardened - the stretched y
+ * @return 0 on success, -1 on invalid parameters or if out of memory
  */
-static int oprf_Finalize(const uint8_t *x, const uint16_t x_len,
-                         const uint8_t N[crypto_core_ristretto255_BYTES],
-                         uint8_t rwdU[OPAQUE_RWDU_BYTES]) {
+static int ksf_harden(const Opaque_KSF *ksf,
+                      const uint8_t y[crypto_hash_sha512_BYTES],
+                      uint8_t hardened[crypto_hash_sha512_BYTES]) {
+  // salt - according to the irtf draft this could be all zeroes
+  const uint8_t salt[crypto_pwhash_SALTBYTES]={0};
+  if(ksf==NULL) ksf=&ksf_default;
+  switch(ksf->alg) {
+  case OPAQUE_KSF_IDENTITY:
+    memcpy(hardened, y, crypto_hash_sha512_BYTES);
+    return 0;
+  case OPAQUE_KSF_ARGON2ID: {
+    // the in-tree implementation, which runs the lanes in parallel,
+    // checks the remaining limits
+    if(ksf->ops > UINT32_MAX || ksf->mem > UINT32_MAX) return -1;
+    // without a workspace, or if it is busy, argon2id() allocates
+    void *memory = opaque_workspace_acquire(ksf->workspace,
+                                            argon2_memory_len((uint32_t) ksf->mem, ksf->parallelism));
+    const int ret = argon2id(hardened, crypto_hash_sha512_BYTES,
+                             y, crypto_hash_sha512_BYTES, salt, sizeof salt,
+                             NULL, 0, NULL, 0,
+                             (uint32_t) ksf->ops, (uint32_t) ksf->mem, ksf->parallelism,
+                             memory);
+    if(memory!=NULL) opaque_workspace_release(ksf->workspace);
+    return ret;
+  }
+  case OPAQUE_KSF_SCRYPT:
+    if(!scrypt_valid(ksf)) return -1;
+    return crypto_pwhash_scryptsalsa208sha256_ll(y, crypto_hash_sha512_BYTES,
+                                                 salt, sizeof salt,
+                                                 ksf->ops, (uint32_t) ksf->mem, ksf->parallelism,
+                                                 hardened, crypto_hash_sha512_BYTES);
+  default:
+    return -1;
+  }
+}
+
+// y = Finalize(x, N): the OPRF output before the key stretching
+static int oprf_output(const uint8_t *x, const uint16_t x_len,
+                       const uint8_t N[crypto_core_ristretto255_BYTES],
+                       uint8_t y[crypto_hash_sha512_BYTES]) {
   // according to paper: hash(pwd||H0^k)
   // acccording to voprf IRTF CFRG specification: hash(htons(len(pwd))||pwd||
   //                                              htons(len(H0_k))||H0_k|||
   //                                              htons(len("Finalize-"VOPRF"-\x00\x00\x01"))||"Finalize-"VOPRF"-\x00\x00\x01")
-  crypto_hash_sha512_state state;
-  if(-1==sodium_mlock(&state,sizeof state)) {
+  const size_t mark = opaque_scratch_mark();
+  crypto_hash_sha512_state *state = opaque_scratch_alloc(sizeof(crypto_hash_sha512_state));
+  if(state==NULL) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  crypto_hash_sha512_init(&state);
+  crypto_hash_sha512_init(state);
   // pwd
   uint16_t size=htons(x_len);
-  crypto_hash_sha512_update(&state, (uint8_t*) &size, 2);
-  crypto_hash_sha512_update(&state, x, x_len);
+  crypto_hash_sha512_update(state, (uint8_t*) &size, 2);
+  crypto_hash_sha512_update(state, x, x_len);
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(x,x_len,"finalize input");
 #endif
   // H0_k
   size=htons(crypto_core_ristretto255_BYTES);
-  crypto_hash_sha512_update(&state, (uint8_t*) &size, 2);
-  crypto_hash_sha512_update(&state, N, crypto_core_ristretto255_BYTES);
+  crypto_hash_sha512_update(state, (uint8_t*) &size, 2);
+  crypto_hash_sha512_update(state, N, crypto_core_ristretto255_BYTES);
   //const uint8_t DST[]="Finalize-"VOPRF"-\x00\x00\x01";
   const uint8_t DST[]="Finalize";
   const uint8_t DST_size=sizeof DST -1;
   //size=htons(DST_size);
-  //crypto_hash_sha512_update(&state, (uint8_t*) &size, 2);
-  crypto_hash_sha512_update(&state, DST, DST_size);
+  //crypto_hash_sha512_update(state, (uint8_t*) &size, 2);
+  crypto_hash_sha512_update(state, DST, DST_size);
 
-  // - concat(y, Harden(y, params))
-  uint8_t concated[2*crypto_hash_sha512_BYTES];
-  uint8_t *y=concated, *hardened=concated+crypto_hash_sha512_BYTES;
-  if(-1==sodium_mlock(&concated,sizeof concated)) {
-    sodium_munlock(&state, sizeof state);
-    return -1;
-  }
-  crypto_hash_sha512_final(&state, y);
-  sodium_munlock(&state, sizeof state);
+  crypto_hash_sha512_final(state, y);
 
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump((uint8_t*) y, crypto_hash_sha512_BYTES, "output ");
 #endif
+  opaque_scratch_release(mark);
+  return 0;
+}
 
-#ifdef CFRG_TEST_VEC
-  // testvectors use identity as MHF
-  memcpy(hardened, y, crypto_hash_sha512_BYTES);
-#else
-  // salt - according to the irtf draft this could be all zeroes
-  uint8_t salt[crypto_pwhash_SALTBYTES]={0};
-  if (crypto_pwhash(hardened, crypto_hash_sha512_BYTES,
-                    (const char*) y, crypto_hash_sha512_BYTES, salt,
-                    crypto_pwhash_OPSLIMIT_INTERACTIVE,
-                    crypto_pwhash_MEMLIMIT_INTERACTIVE,
-                    crypto_pwhash_ALG_DEFAULT) != 0) {
-    /* out of memory */
-    sodium_munlock(concated, sizeof(concated));
-    return -1;
-  }
-#endif
+// randomized_pwd = Extract("", concat(y, Harden(y, params)))
+static void rwdu_extract(const uint8_t concated[2*crypto_hash_sha512_BYTES],
+                         uint8_t rwdU[OPAQUE_RWDU_BYTES]) {
 #if (defined TRACE|| defined CFRG_TEST_VEC)
-  dump(concated, sizeof concated, "concated");
+  dump(concated, 2*crypto_hash_sha512_BYTES, "concated");
 #endif
-  crypto_kdf_hkdf_sha512_extract(rwdU, NULL, 0, concated, sizeof concated);
-  sodium_munlock(concated, sizeof(concated));
-
+  crypto_kdf_hkdf_sha512_extract(rwdU, NULL, 0, concated, 2*crypto_hash_sha512_BYTES);
 #if (defined TRACE|| defined CFRG_TEST_VEC)
   dump((uint8_t*) rwdU, OPAQUE_RWDU_BYTES, "rwdU ");
 #endif
+}
+
+/**
+ * This function computes the OPRF output using input x, N, and domain separation
+ * tag info.
+ *
+ * This is the Finalize OPRF function defined in the RFC.
+ *
+ * @param [in] x - a value used to compute OPRF (for OPAQUE, this is pwdU, the
+ * user's password)
+ * @param [in] x_len - the length of param x in bytes
+ * @param [in] N - a serialized OPRF group element, a byte array of fixed length,
+ * an output of oprf_Unblind
+ * @param [in] info - a domain separation tag
+ * @param [in] info_len - the length of param info in bytes
+ * @param [in] ksf - the key stretching function hardening the output,
+ * NULL for the default
+ * @param [out] y - an OPRF output
+ * @return The function returns 0 if everything is correct.
+ */
+static int oprf_Finalize(const uint8_t *x, const uint16_t x_len,
+                         const uint8_t N[crypto_core_ristretto255_BYTES],
+                         const Opaque_KSF *ksf,
+                         uint8_t rwdU[OPAQUE_RWDU_BYTES]) {
+  const size_t mark = opaque_scratch_mark();
+  // - concat(y, Harden(y, params))
+  uint8_t *concated = opaque_scratch_alloc(2*crypto_hash_sha512_BYTES);
+  if(concated==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  uint8_t *y=concated, *hardened=concated+crypto_hash_sha512_BYTES;
+  if(0!=oprf_output(x, x_len, N, y)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+
+  if(0!=ksf_harden(ksf, y, hardened)) {
+    /* invalid parameters or out of memory */
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  rwdu_extract(concated, rwdU);
+  opaque_scratch_release(mark);
+  return 0;
+}
+
+// the key stretching of oprf_Finalize() in steps, see
+// opaque_stretch_step()
+struct Opaque_Stretch {
+  // concat(y, Harden(y, params))
+  uint8_t concated[2*crypto_hash_sha512_BYTES];
+  Opaque_KSF ksf;
+  // Argon2id in progress, and the workspace memory it fills
+  Argon2_State *argon2;
+  void *memory;
+  int done;
+  // the cache entry of the result, rwdU is only set on a hit
+  uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES];
+  uint8_t rwdU[OPAQUE_RWDU_BYTES];
+  int cached;
+};
+
+static void stretch_free(Opaque_Stretch *st) {
+  argon2id_abort(st->argon2);
+  if(st->memory!=NULL) opaque_workspace_release(st->ksf.workspace);
+  // sodium_free wipes the state
+  sodium_free(st);
+}
+
+// oprf_Finalize() up to the key stretching, which is left to
+// opaque_stretch_step(). Returns NULL on invalid parameters or if out
+// of memory.
+static Opaque_Stretch *stretch_begin(const uint8_t *x, const uint16_t x_len,
+                                     const uint8_t N[crypto_core_ristretto255_BYTES],
+                                     const Opaque_KSF *ksf) {
+  // the same all zero salt as ksf_harden()
+  const uint8_t salt[crypto_pwhash_SALTBYTES]={0};
+  // sodium_malloc locks the state and excludes it from core dumps
+  Opaque_Stretch *st = sodium_malloc(sizeof(Opaque_Stretch));
+  if(st==NULL) return NULL;
+  memset(st, 0, sizeof(Opaque_Stretch));
+  st->ksf = (ksf!=NULL) ? *ksf : ksf_default;
+  if(st->ksf.cache!=NULL) {
+    opaque_rwdcache_tag(st->ksf.cache, N, &st->ksf, st->tag);
+    if(0==opaque_rwdcache_get(st->ksf.cache, st->tag, st->rwdU)) {
+      st->cached = 1;
+      st->done = 1;
+      return st;
+    }
+  }
+  if(0!=oprf_output(x, x_len, N, st->concated)) {
+    stretch_free(st);
+    return NULL;
+  }
+  // identity and scrypt run in one step, Argon2id is set up here
+  if(st->ksf.alg==OPAQUE_KSF_IDENTITY ||
+     (st->ksf.alg==OPAQUE_KSF_SCRYPT && scrypt_valid(&st->ksf))) return st;
+  if(st->ksf.alg!=OPAQUE_KSF_ARGON2ID) {
+    stretch_free(st);
+    return NULL;
+  }
+
+  if(st->ksf.ops > UINT32_MAX || st->ksf.mem > UINT32_MAX) {
+    stretch_free(st);
+    return NULL;
+  }
+  // held until the state is finished or cancelled
+  st->memory = opaque_workspace_acquire(st->ksf.workspace,
+                                        argon2_memory_len((uint32_t) st->ksf.mem, st->ksf.parallelism));
+  st->argon2 = argon2id_begin(crypto_hash_sha512_BYTES,
+                              st->concated, crypto_hash_sha512_BYTES, salt, sizeof salt,
+                              NULL, 0, NULL, 0,
+                              (uint32_t) st->ksf.ops, (uint32_t) st->ksf.mem, st->ksf.parallelism,
+                              st->memory);
+  if(st->argon2==NULL) {
+    stretch_free(st);
+    return NULL;
+  }
+  return st;
+}
+
+int opaque_stretch_step(Opaque_Stretch *st, const uint32_t budget) {
+  if(st->done) return OPAQUE_STRETCH_DONE;
+  if(st->argon2==NULL) {
+    // identity and scrypt are done in one step
+    if(0!=ksf_harden(&st->ksf, st->concated, st->concated+crypto_hash_sha512_BYTES)) return -1;
+    st->done = 1;
+    return OPAQUE_STRETCH_DONE;
+  }
+  if(argon2id_step(st->argon2, budget)!=0) return OPAQUE_STRETCH_MORE;
+  const int ret = argon2id_final(st->argon2, st->concated+crypto_hash_sha512_BYTES);
+  st->argon2 = NULL;
+  if(st->memory!=NULL) {
+    opaque_workspace_release(st->ksf.workspace);
+    st->memory = NULL;
+  }
+  if(ret!=0) return -1;
+  st->done = 1;
+  return OPAQUE_STRETCH_DONE;
+}
+
+void opaque_stretch_cancel(Opaque_Stretch *st) {
+  if(st!=NULL) stretch_free(st);
+}
 
+// rwdU of a finished state, which is freed in any case. If rwdU was
+// computed with a cache set, returns the cache and tag to store it
+// under in cache and tag, otherwise sets *cache to NULL.
+static int stretch_finish(Opaque_Stretch *st, uint8_t rwdU[OPAQUE_RWDU_BYTES],
+                          Opaque_RwdCache **cache, uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES]) {
+  if(cache!=NULL) *cache = NULL;
+  if(!st->done) {
+    stretch_free(st);
+    return -1;
+  }
+  if(st->cached) {
+    memcpy(rwdU, st->rwdU, OPAQUE_RWDU_BYTES);
+  } else {
+    rwdu_extract(st->concated, rwdU);
+    if(cache!=NULL && st->ksf.cache!=NULL) {
+      *cache = st->ksf.cache;
+      memcpy(tag, st->tag, OPAQUE_RWDCACHE_TAGBYTES);
+    }
+  }
+  stretch_free(st);
   return 0;
 }
 
+/* sha512 state after absorbing the Z_pad = I2OSP(0, 128) prefix of
+ * msg_prime in expand_message_xmd(), this is the same for every call
+ * so it is a constant instead of a compression per hash-to-curve */
+static const crypto_hash_sha512_state zpad_state = {
+  .state = {
+    0xcf7881d5774acbe8ULL, 0x533362e0fbc78070ULL, 0x0267639d87460edaULL, 0x3086cb40e85931b0ULL,
+    0x717dc95288a023a3ULL, 0x96bab2c14ce0b5e0ULL, 0x6fc4fe04eae33e0bULL, 0x91f4d80cbd668beeULL,
+  },
+  .count = { 0, 128 * 8 },
+  .buf = { 0 },
+};
+
 /* expand_loop
  10.    b_i = H(strxor(b_0, b_(i - 1)) || I2OSP(i, 1) || DST_prime)
  */
-static void expand_loop(const uint8_t *b_0, const uint8_t *b_i, const uint8_t i, const uint8_t *dst_prime, const uint8_t dst_prime_len, uint8_t *b_ii) {
+static void expand_loop(const uint8_t *b_0, const uint8_t *b_i, const uint8_t i, const uint8_t *dst, const uint8_t dst_len, uint8_t *b_ii) {
   uint8_t xored[crypto_hash_sha512_BYTES];
   unsigned j;
   for(j=0;j<sizeof xored;j++) xored[j]=b_0[j]^b_i[j];
@@ -238,7 +528,9 @@ static void expand_loop(const uint8_t *b_0, const uint8_t *b_i, const uint8_t i,
   crypto_hash_sha512_init(&state);
   crypto_hash_sha512_update(&state, xored, sizeof xored);
   crypto_hash_sha512_update(&state,(uint8_t*) &i, 1);
-  crypto_hash_sha512_update(&state, dst_prime, dst_prime_len);
+  // DST_prime = DST || I2OSP(len(DST), 1)
+  crypto_hash_sha512_update(&state, dst, dst_len);
+  crypto_hash_sha512_update(&state, &dst_len, 1);
   crypto_hash_sha512_final(&state, b_ii);
   sodium_memzero(&state,sizeof state);
 }
@@ -289,49 +581,37 @@ static int expand_message_xmd(const uint8_t *msg, const uint8_t msg_len, const u
   // 2.  ABORT if ell > 255
   if(ell>255) return -1;
   // 3.  DST_prime = DST || I2OSP(len(DST), 1)
-  uint8_t dst_prime[dst_len+1];
-  memcpy(dst_prime, dst, dst_len);
-  dst_prime[dst_len] = dst_len;
+  // DST_prime is never materialized, DST and its length are hashed
+  // directly after each other
 #ifdef TRACE
-  dump(dst_prime, sizeof dst_prime, "dst_prime");
+  dump(dst, dst_len, "dst_prime (without len)");
 #endif
   // 4.  Z_pad = I2OSP(0, r_in_bytes)
-  //const uint8_t r_in_bytes = 128; // for sha512
-  uint8_t z_pad[128 /*r_in_bytes*/] = {0}; // supress gcc error: variable-sized object may not be initialized
-#ifdef TRACE
-  dump(z_pad, sizeof z_pad, "z_pad");
-#endif
   // 5.  l_i_b_str = I2OSP(len_in_bytes, 2)
-  const uint16_t l_i_b = htons(len_in_bytes);
-  const uint8_t *l_i_b_str = (uint8_t*) &l_i_b;
+  const uint8_t l_i_b_str[2] = { 0, len_in_bytes };
   // 6.  msg_prime = Z_pad || msg || l_i_b_str || I2OSP(0, 1) || DST_prime
-  uint8_t msg_prime[sizeof z_pad + msg_len + sizeof l_i_b + 1 + sizeof dst_prime],
-    *ptr = msg_prime;
-  memcpy(ptr, z_pad, sizeof z_pad);
-  ptr += sizeof z_pad;
-  memcpy(ptr, msg, msg_len);
-  ptr += msg_len;
-  memcpy(ptr, l_i_b_str, sizeof l_i_b);
-  ptr += sizeof l_i_b;
-  *ptr = 0;
-  ptr++;
-  memcpy(ptr, dst_prime, sizeof dst_prime);
-#ifdef TRACE
-  dump(msg_prime, sizeof msg_prime, "msg_prime");
-#endif
   // 7.  b_0 = H(msg_prime)
+  // msg_prime is streamed into the hash, continuing from the midstate
+  // after Z_pad
+  crypto_hash_sha512_state state;
+  memcpy(&state, &zpad_state, sizeof state);
+  crypto_hash_sha512_update(&state, msg, msg_len);
+  crypto_hash_sha512_update(&state, l_i_b_str, sizeof l_i_b_str);
+  crypto_hash_sha512_update(&state, (const uint8_t*) "\x00", 1);
+  crypto_hash_sha512_update(&state, dst, dst_len);
+  crypto_hash_sha512_update(&state, &dst_len, 1);
   uint8_t b_0[crypto_hash_sha512_BYTES];
-  crypto_hash_sha512(b_0, msg_prime, sizeof msg_prime);
+  crypto_hash_sha512_final(&state, b_0);
 #ifdef TRACE
   dump(b_0, sizeof b_0, "b_0");
 #endif
   // 8.  b_1 = H(b_0 || I2OSP(1, 1) || DST_prime)
   uint8_t b_i[crypto_hash_sha512_BYTES];
-  crypto_hash_sha512_state state;
   crypto_hash_sha512_init(&state);
   crypto_hash_sha512_update(&state, b_0, sizeof b_0);
   crypto_hash_sha512_update(&state,(uint8_t*) &"\x01", 1);
-  crypto_hash_sha512_update(&state, dst_prime, sizeof dst_prime);
+  crypto_hash_sha512_update(&state, dst, dst_len);
+  crypto_hash_sha512_update(&state, &dst_len, 1);
   crypto_hash_sha512_final(&state, b_i);
 #ifdef TRACE
   dump(b_i, sizeof b_i, "b_1");
@@ -349,13 +629,13 @@ static int expand_message_xmd(const uint8_t *msg, const uint8_t msg_len, const u
     // 11. uniform_bytes = b_1 || ... || b_ell
     // 12. return substr(uniform_bytes, 0, len_in_bytes)
     // 10.    b_i = H(strxor(b_0, b_(i - 1)) || I2OSP(i, 1) || DST_prime)
-    expand_loop(b_0, b_i, i, dst_prime, sizeof dst_prime, b_ii);
+    expand_loop(b_0, b_i, i, dst, dst_len, b_ii);
     clen = (left>sizeof b_ii)?sizeof b_ii:left;
     memcpy(out, b_ii, clen);
     out+=clen;
     left-=clen;
     // unrolled next iteration so we don't have to swap b_i and b_ii
-    expand_loop(b_0, b_ii, i+1, dst_prime, sizeof dst_prime, b_i);
+    expand_loop(b_0, b_ii, i+1, dst, dst_len, b_i);
     clen = (left>sizeof b_i)?sizeof b_i:left;
     memcpy(out, b_i, clen);
     out+=clen;
@@ -372,24 +652,27 @@ static int expand_message_xmd(const uint8_t *msg, const uint8_t msg_len, const u
  * 2. P = ristretto255_map(uniform_bytes)
  * 3. return P
  */
-static int voprf_hash_to_group(const uint8_t *msg, const uint8_t msg_len, uint8_t p[crypto_core_ristretto255_BYTES]) {
+static int voprf_hash_to_group(const uint8_t *msg, const uint8_t msg_len, ristretto_point *p) {
   const uint8_t dst[] = "HashToGroup-"VOPRF"-\x00\x00\x01";
   const uint8_t dst_len = (sizeof dst) - 1;
-  uint8_t uniform_bytes[crypto_core_ristretto255_HASHBYTES]={0};
-  if(0!=sodium_mlock(uniform_bytes,sizeof uniform_bytes)) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *uniform_bytes = opaque_scratch_alloc(crypto_core_ristretto255_HASHBYTES);
+  if(uniform_bytes==NULL) {
     return -1;
   }
   if(0!=expand_message_xmd(msg, msg_len, dst, dst_len, crypto_core_ristretto255_HASHBYTES, uniform_bytes)) {
-    sodium_munlock(uniform_bytes,sizeof uniform_bytes);
+    opaque_scratch_release(mark);
     return -1;
   }
 #if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(uniform_bytes, sizeof uniform_bytes, "uniform_bytes");
+  dump(uniform_bytes, crypto_core_ristretto255_HASHBYTES, "uniform_bytes");
 #endif
-  crypto_core_ristretto255_from_hash(p, uniform_bytes);
-  sodium_munlock(uniform_bytes,sizeof uniform_bytes);
+  ristretto_from_hash(p, uniform_bytes);
+  opaque_scratch_release(mark);
 #if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(p, crypto_core_ristretto255_BYTES, "hashed-to-curve");
+  uint8_t encoded[crypto_core_ristretto255_BYTES];
+  ristretto_encode(encoded, p);
+  dump(encoded, sizeof encoded, "hashed-to-curve");
 #endif
   return 0;
 }
@@ -397,26 +680,28 @@ static int voprf_hash_to_group(const uint8_t *msg, const uint8_t msg_len, uint8_
 static int voprf_hash_to_scalar(const uint8_t *msg, const uint8_t msg_len, const uint8_t *dst, const uint8_t dst_len, uint8_t p[crypto_core_ristretto255_SCALARBYTES]) {
   //const uint8_t dst[] = "HashToScalar-"VOPRF"-\x00\x00\x01";
   //const uint8_t dst_len = (sizeof dst) - 1;
-  uint8_t uniform_bytes[crypto_core_ristretto255_HASHBYTES]={0};
-  if(0!=sodium_mlock(uniform_bytes,sizeof uniform_bytes)) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *uniform_bytes = opaque_scratch_alloc(crypto_core_ristretto255_HASHBYTES);
+  if(uniform_bytes==NULL) {
     return -1;
   }
   if(0!=expand_message_xmd(msg, msg_len, dst, dst_len, crypto_core_ristretto255_HASHBYTES, uniform_bytes)) {
-    sodium_munlock(uniform_bytes,sizeof uniform_bytes);
+    opaque_scratch_release(mark);
     return -1;
   }
 #if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(uniform_bytes, sizeof uniform_bytes, "uniform_bytes");
+  dump(uniform_bytes, crypto_core_ristretto255_HASHBYTES, "uniform_bytes");
 #endif
   crypto_core_ristretto255_scalar_reduce(p, uniform_bytes);
-  sodium_munlock(uniform_bytes,sizeof uniform_bytes);
+  opaque_scratch_release(mark);
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(p, crypto_core_ristretto255_BYTES, "hashed-to-scalar");
 #endif
   return 0;
 }
 
-static int deriveKeyPair(const uint8_t *seed, const size_t seed_len, const uint8_t *info, const uint16_t info_len, uint8_t skS[crypto_core_ristretto255_SCALARBYTES], uint8_t pkS[crypto_core_ristretto255_BYTES]) {
+// the private key of DeriveKeyPair(), without its public key
+static int deriveKey(const uint8_t *seed, const size_t seed_len, const uint8_t *info, const uint16_t info_len, uint8_t skS[crypto_core_ristretto255_SCALARBYTES]) {
   const uint8_t ctx[] = "DeriveKeyPair"VOPRF"-\x00\x00\x01";
   uint8_t hashinput[seed_len + 2 + info_len + 1], *ptr= hashinput;
   memcpy(ptr,seed,seed_len);
@@ -437,48 +722,96 @@ static int deriveKeyPair(const uint8_t *seed, const size_t seed_len, const uint8
     if(0!=voprf_hash_to_scalar(hashinput,sizeof hashinput, ctx, sizeof ctx -1,skS)) return -1;
     ptr[0]++;
   }
+  return 0;
+}
+
+static int deriveKeyPair(const uint8_t *seed, const size_t seed_len, const uint8_t *info, const uint16_t info_len, uint8_t skS[crypto_core_ristretto255_SCALARBYTES], uint8_t pkS[crypto_core_ristretto255_BYTES]) {
+  const int ret = deriveKey(seed, seed_len, info, info_len, skS);
+  if(ret!=0) return ret;
 
   // P_u := g^p_u
-  crypto_scalarmult_ristretto255_base(pkS, skS);
+  ristretto_scalarmult_base(pkS, skS);
+  return 0;
+}
+
+// HKDF-Expand(oprf_seed, credid || label, out_len)
+static int oprfseed_expand(const Opaque_OprfSeed *oprfseed,
+                           const uint8_t *credid, const uint16_t credid_len,
+                           const char *label, uint8_t *out, const size_t out_len) {
+  const size_t label_len = strlen(label);
+  const size_t mark = opaque_scratch_mark();
+  char *info = opaque_scratch_alloc(credid_len + label_len);
+  if(info==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  memcpy(info, credid, credid_len);
+  memcpy(info + credid_len, label, label_len);
+  const int ret = crypto_kdf_hkdf_sha512_expand(out, out_len, info, credid_len + label_len,
+                                                opaque_oprfseed_seed(oprfseed));
+  opaque_scratch_release(mark);
+  return ret;
+}
+
+// the OPRF key of credid as in the irtf cfrg rfc draft:
+//   seed = Expand(oprf_seed, credential_identifier || "OprfKey", Nok)
+//   (kU, _) = DeriveKeyPair(seed, "OPAQUE-DeriveKeyPair")
+// kU is taken from the cache of oprfseed if it is there.
+static int derive_oprf_key(Opaque_OprfSeed *oprfseed,
+                           const uint8_t *credid, const uint16_t credid_len,
+                           uint8_t kU[crypto_core_ristretto255_SCALARBYTES]) {
+  const uint8_t info[] = "OPAQUE-DeriveKeyPair";
+  uint8_t tag[OPAQUE_OPRFSEED_TAGBYTES];
+  if(oprfseed==NULL || credid==NULL || credid_len==0) return -1;
+  opaque_oprfseed_tag(oprfseed, credid, credid_len, tag);
+  if(0==opaque_oprfseed_get(oprfseed, tag, kU)) return 0;
+
+  uint8_t seed[crypto_core_ristretto255_SCALARBYTES];
+  if(0!=oprfseed_expand(oprfseed, credid, credid_len, "OprfKey", seed, sizeof seed) ||
+     0!=deriveKey(seed, sizeof seed, info, sizeof info - 1, kU)) {
+    sodium_memzero(seed, sizeof seed);
+    return -1;
+  }
+  sodium_memzero(seed, sizeof seed);
+  opaque_oprfseed_put(oprfseed, tag, kU);
   return 0;
 }
 
 static int prf(const uint8_t *pwdU, const uint16_t pwdU_len,
                const uint8_t kU[crypto_core_ristretto255_SCALARBYTES],
+               const Opaque_KSF *ksf,
                uint8_t rwdU[OPAQUE_RWDU_BYTES]) {
   // F_k(pwd) = H(pwd, (H0(pwd))^k) for key k ∈ Z_q
-  uint8_t H0[crypto_core_ristretto255_BYTES];
-  if(0!=sodium_mlock(H0,sizeof H0)) {
+  const size_t mark = opaque_scratch_mark();
+  ristretto_point *H0 = opaque_scratch_alloc(sizeof(ristretto_point));
+  ristretto_point *Np = opaque_scratch_alloc(sizeof(ristretto_point));
+  uint8_t *N = opaque_scratch_alloc(crypto_core_ristretto255_BYTES);
+  if(H0==NULL || Np==NULL || N==NULL) {
+    opaque_scratch_release(mark);
     return -1;
   }
   // sets α := (H^0(pw))^r
-  if(0!=voprf_hash_to_group(pwdU, pwdU_len, H0)) return -1;
-#ifdef TRACE
-  dump(H0,sizeof H0, "H0");
-#endif
-
-  // H0 ^ k
-  uint8_t N[crypto_core_ristretto255_BYTES];
-  if(0!=sodium_mlock(N,sizeof N)) {
-    sodium_munlock(H0,sizeof H0);
+  if(0!=voprf_hash_to_group(pwdU, pwdU_len, H0)) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  if (crypto_scalarmult_ristretto255(N, kU, H0) != 0) {
-    sodium_munlock(H0,sizeof H0);
-    sodium_munlock(N,sizeof N);
+
+  // H0 ^ k
+  if (ristretto_scalarmult(Np, kU, H0) != 0) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(H0,sizeof H0);
+  ristretto_encode(N, Np);
 #ifdef TRACE
-  dump(N, sizeof N, "N");
+  dump(N, crypto_core_ristretto255_BYTES, "N");
 #endif
 
   // 2. rwdU = Finalize(pwdU, N, "OPAQUE01")
-  if(0!=oprf_Finalize(pwdU, pwdU_len, N, rwdU)) {
-    sodium_munlock(N,sizeof N);
+  if(0!=oprf_Finalize(pwdU, pwdU_len, N, ksf, rwdU)) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(N,sizeof N);
+  opaque_scratch_release(mark);
 
   return 0;
 }
@@ -497,41 +830,52 @@ static int prf(const uint8_t *pwdU, const uint16_t pwdU_len,
  * the blinded version of x, an input to oprf_Evaluate
  * @return The function returns 0 if everything is correct.
  */
+static int oprf_blind_with(const uint8_t *x, const uint16_t x_len,
+                           const uint8_t r[crypto_core_ristretto255_SCALARBYTES],
+                           uint8_t blinded[crypto_core_ristretto255_BYTES]);
+
 static int oprf_Blind(const uint8_t *x, const uint16_t x_len,
                       uint8_t r[crypto_core_ristretto255_SCALARBYTES],
                       uint8_t blinded[crypto_core_ristretto255_BYTES]) {
+  // U picks r
+#ifdef CFRG_TEST_VEC
+  memcpy(r,blind_registration,blind_registration_len);
+#else
+  crypto_core_ristretto255_scalar_random(r);
+#endif
+  return oprf_blind_with(x, x_len, r, blinded);
+}
+
+// oprf_Blind() with a given r
+static int oprf_blind_with(const uint8_t *x, const uint16_t x_len,
+                           const uint8_t r[crypto_core_ristretto255_SCALARBYTES],
+                           uint8_t blinded[crypto_core_ristretto255_BYTES]) {
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(x, x_len, "input");
 #endif
-  uint8_t H0[crypto_core_ristretto255_BYTES];
-  if(0!=sodium_mlock(H0,sizeof H0)) {
+  const size_t mark = opaque_scratch_mark();
+  ristretto_point *H0 = opaque_scratch_alloc(sizeof(ristretto_point));
+  ristretto_point *B = opaque_scratch_alloc(sizeof(ristretto_point));
+  if(H0==NULL || B==NULL) {
+    opaque_scratch_release(mark);
     return -1;
   }
   // sets α := (H^0(pw))^r
-  if(0!=voprf_hash_to_group(x, x_len, H0)) return -1;
-#if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(H0,sizeof H0, "H0 ");
-#endif
-
-  // U picks r
-#ifdef CFRG_TEST_VEC
-  static int vecidx=0;
-  const unsigned char *rtest[2] = {blind_registration, blind_login};
-  const unsigned int rtest_len = 32;
-  memcpy(r,rtest[vecidx++ % 2],rtest_len);
-#else
-  crypto_core_ristretto255_scalar_random(r);
-#endif
+  if(0!=voprf_hash_to_group(x, x_len, H0)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
 
 #ifdef TRACE
   dump(r, crypto_core_ristretto255_SCALARBYTES, "r");
 #endif
   // H^0(pw)^r
-  if (crypto_scalarmult_ristretto255(blinded, r, H0) != 0) {
-    sodium_munlock(H0,sizeof H0);
+  if (ristretto_scalarmult(B, r, H0) != 0) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(H0,sizeof H0);
+  ristretto_encode(blinded, B);
+  opaque_scratch_release(mark);
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(blinded, crypto_core_ristretto255_BYTES, "blinded");
 #endif
@@ -551,12 +895,17 @@ static int oprf_Blind(const uint8_t *x, const uint16_t x_len,
  * password)
  * @param [out] Z - a serialized OPRF group element, a byte array of fixed length,
  * an input to oprf_Unblind
- * @return The function returns 0 if everything is correct.
+ * @return The function returns 0 if everything is correct, and -1 if
+ * blinded is not a valid group element or Z is the identity.
  */
 static int oprf_Evaluate(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
                          const uint8_t blinded[crypto_core_ristretto255_BYTES],
                          uint8_t Z[crypto_core_ristretto255_BYTES]) {
-  return crypto_scalarmult_ristretto255(Z, k, blinded);
+  ristretto_point B, P;
+  if(0!=ristretto_decode(&B, blinded)) return -1;
+  if(0!=ristretto_scalarmult(&P, k, &B)) return -1;
+  ristretto_encode(Z, &P);
+  return 0;
 }
 
 /**
@@ -571,44 +920,140 @@ static int oprf_Evaluate(const uint8_t k[crypto_core_ristretto255_SCALARBYTES],
  * a byte array of fixed length, an input to oprf_Finalize
  * @return The function returns 0 if everything is correct.
  */
+static int oprf_unblind_inv(const uint8_t ir[crypto_core_ristretto255_SCALARBYTES],
+                            const uint8_t Z[crypto_core_ristretto255_BYTES],
+                            uint8_t N[crypto_core_ristretto255_BYTES]);
+
 static int oprf_Unblind(const uint8_t r[crypto_core_ristretto255_SCALARBYTES],
                         const uint8_t Z[crypto_core_ristretto255_BYTES],
                         uint8_t N[crypto_core_ristretto255_BYTES]) {
 #ifdef TRACE
   dump((uint8_t*) r, crypto_core_ristretto255_SCALARBYTES, "r ");
+#endif
+  // invert r = 1/r
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *ir = opaque_scratch_alloc(crypto_core_ristretto255_SCALARBYTES);
+  if(ir==NULL || crypto_core_ristretto255_scalar_invert(ir, r) != 0) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  const int ret = oprf_unblind_inv(ir, Z, N);
+  opaque_scratch_release(mark);
+  return ret;
+}
+
+// oprf_Unblind() with r already inverted
+static int oprf_unblind_inv(const uint8_t ir[crypto_core_ristretto255_SCALARBYTES],
+                            const uint8_t Z[crypto_core_ristretto255_BYTES],
+                            uint8_t N[crypto_core_ristretto255_BYTES]) {
+#ifdef TRACE
+  dump((uint8_t*) ir, crypto_core_ristretto255_SCALARBYTES, "r^-1 ");
   dump((uint8_t*) Z, crypto_core_ristretto255_BYTES, "Z ");
 #endif
 
   // (a) Checks that β ∈ G ∗ . If not, outputs (abort, sid , ssid ) and halts;
-  if(crypto_core_ristretto255_is_valid_point(Z) != 1) return -1;
+  ristretto_point Zp;
+  if(0!=ristretto_decode(&Zp, Z)) return -1;
 
   // (b) Computes rw := H(pw, β^1/r );
-  // invert r = 1/r
-  uint8_t ir[crypto_core_ristretto255_SCALARBYTES];
-  if(-1==sodium_mlock(ir, sizeof ir)) return -1;
-  if (crypto_core_ristretto255_scalar_invert(ir, r) != 0) {
-    sodium_munlock(ir, sizeof ir);
+  const size_t mark = opaque_scratch_mark();
+  ristretto_point *Np = opaque_scratch_alloc(sizeof(ristretto_point));
+  if(Np==NULL) {
+    opaque_scratch_release(mark);
     return -1;
   }
-#ifdef TRACE
-  dump((uint8_t*) ir, sizeof ir, "r^-1 ");
-#endif
 
   // H0 = β^(1/r)
   // beta^(1/r) = h(pwd)^k
-  if (crypto_scalarmult_ristretto255(N, ir, Z) != 0) {
-    sodium_munlock(ir, sizeof ir);
+  if (ristretto_scalarmult(Np, ir, &Zp) != 0) {
+    opaque_scratch_release(mark);
     return -1;
   }
+  ristretto_encode(N, Np);
 #ifdef TRACE
   dump((uint8_t*) N, crypto_core_ristretto255_BYTES, "N ");
 #endif
 
-  sodium_munlock(ir, sizeof ir);
+  opaque_scratch_release(mark);
+  return 0;
+}
+
+// HKDF-Expand works on HMAC states keyed with the prk, so that
+// expanding several labels from the same prk only needs the ipad/opad
+// compressions once instead of once per label and output block.
+static void hkdf_keyed(crypto_auth_hmacsha512_state *prk_state,
+                       const uint8_t prk[crypto_kdf_hkdf_sha512_KEYBYTES]) {
+  crypto_auth_hmacsha512_state *states[1] = {prk_state};
+  const uint8_t *keys[1] = {prk};
+  // the inner and outer pad are compressed in parallel
+  sha512mb_hmac_init(1, states, keys, crypto_kdf_hkdf_sha512_KEYBYTES);
+}
+
+// same as crypto_kdf_hkdf_sha512_expand() but from a keyed prk_state,
+// which is not modified
+static int hkdf_expand(uint8_t *out, const size_t out_len,
+                       const uint8_t *info, const size_t info_len,
+                       const crypto_auth_hmacsha512_state *prk_state) {
+  crypto_auth_hmacsha512_state st;
+  uint8_t tmp[crypto_auth_hmacsha512_BYTES];
+  uint8_t counter = 1;
+  size_t i;
+  if(out_len > crypto_kdf_hkdf_sha512_BYTES_MAX) return -1;
+  for(i=0;i<out_len;i+=crypto_auth_hmacsha512_BYTES) {
+    memcpy(&st, prk_state, sizeof st);
+    if(i!=0) crypto_auth_hmacsha512_update(&st, &out[i - crypto_auth_hmacsha512_BYTES], crypto_auth_hmacsha512_BYTES);
+    crypto_auth_hmacsha512_update(&st, info, info_len);
+    crypto_auth_hmacsha512_update(&st, &counter, 1);
+    crypto_auth_hmacsha512_final(&st, tmp);
+    memcpy(&out[i], tmp, (out_len-i < sizeof tmp) ? out_len-i : sizeof tmp);
+    counter++;
+  }
+  sodium_memzero(&st, sizeof st);
+  sodium_memzero(tmp, sizeof tmp);
+  return 0;
+}
+
+// HKDF-Expand of n independent outputs of at most one hash length
+// each. Such an expand is a single HMAC(prk, info || 0x01), the HMACs
+// of all outputs are calculated in parallel lanes.
+static int hkdf_expand_mb(const size_t n,
+                          uint8_t *const res[], const size_t len[],
+                          const uint8_t *const info[], const size_t info_len[],
+                          const crypto_auth_hmacsha512_state *const prk_states[]) {
+  uint8_t msg[SHA512MB_MAX_LANES][OPAQUE_HKDF_LABEL_MAX+1];
+  const uint8_t *in[SHA512MB_MAX_LANES];
+  size_t inlen[SHA512MB_MAX_LANES];
+  uint8_t *out[SHA512MB_MAX_LANES];
+  size_t i;
+  if(n>SHA512MB_MAX_LANES) return -1;
+  if(n==1) {
+    // a single lane is faster with the libsodium implementation
+    return hkdf_expand(res[0], len[0], info[0], info_len[0], prk_states[0]);
+  }
+
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *tmp = opaque_scratch_alloc(n*crypto_auth_hmacsha512_BYTES);
+  if(tmp==NULL) return -1;
+  for(i=0;i<n;i++) {
+    if(len[i]>crypto_auth_hmacsha512_BYTES || info_len[i]>OPAQUE_HKDF_LABEL_MAX) {
+      opaque_scratch_release(mark);
+      return -1;
+    }
+    memcpy(msg[i], info[i], info_len[i]);
+    msg[i][info_len[i]] = 1; // counter
+    in[i] = msg[i];
+    inlen[i] = info_len[i]+1;
+    out[i] = tmp + i*crypto_auth_hmacsha512_BYTES;
+  }
+  sha512mb_hmac_final(n, prk_states, in, inlen, out);
+  for(i=0;i<n;i++) memcpy(res[i], out[i], len[i]);
+  opaque_scratch_release(mark);
   return 0;
 }
 
-static void hkdf_expand_label(uint8_t* res, const uint8_t secret[crypto_kdf_hkdf_sha512_KEYBYTES], const char *label, const char transcript[crypto_hash_sha512_BYTES], const size_t len) {
+// constructs the info of a HKDF-Expand-Label into hkdflabel, which
+// must have space for OPAQUE_HKDF_LABEL_MAX bytes, returns its length
+static size_t hkdf_label(uint8_t hkdflabel[OPAQUE_HKDF_LABEL_MAX], const char *label, const char transcript[crypto_hash_sha512_BYTES], const size_t len) {
   // construct a hkdf label
   // struct {
   //   uint16 length = Length;
@@ -616,9 +1061,10 @@ static void hkdf_expand_label(uint8_t* res, const uint8_t secret[crypto_kdf_hkdf
   //   opaque context<0..255> = Context;
   // } HkdfLabel;
   const size_t llen = strlen((const char*) label);
-  uint8_t hkdflabel[2+2+7/*"OPAQUE-"*/+llen+(transcript!=NULL?crypto_hash_sha512_BYTES:0)];
+  const size_t hkdflabel_len = 2+2+7/*"OPAQUE-"*/+llen+(transcript!=NULL?crypto_hash_sha512_BYTES:0);
 
-  *((uint16_t*) hkdflabel)=htons(len);
+  hkdflabel[0]=(uint8_t) (len >> 8);
+  hkdflabel[1]=(uint8_t) len;
 
   uint8_t *ptr=hkdflabel+2;
   *(ptr)=(7+llen);
@@ -639,50 +1085,58 @@ static void hkdf_expand_label(uint8_t* res, const uint8_t secret[crypto_kdf_hkdf
   }
 
 #if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(hkdflabel, sizeof(hkdflabel), "expanded label");
+  dump(hkdflabel, hkdflabel_len, "expanded label");
   if(transcript!=NULL) dump((const uint8_t*) transcript,crypto_hash_sha512_BYTES, "transcript: ");
 #endif
 
-  crypto_kdf_hkdf_sha512_expand(res, len, (const char*) hkdflabel, sizeof(hkdflabel), secret);
+  return hkdflabel_len;
 }
 
-// derive keys according to irtf cfrg draft
-static int derive_keys(Opaque_Keys* keys, const uint8_t ikm[crypto_scalarmult_BYTES * 3], const char info[crypto_hash_sha512_BYTES]) {
-  uint8_t prk[64];
-  if(-1==sodium_mlock(prk, sizeof prk)) return -1;
-#ifdef TRACE
-  dump(ikm, crypto_scalarmult_BYTES*3, "ikm ");
-  dump((uint8_t*) info, crypto_hash_sha512_BYTES, "info ");
-#endif
-  // 1. prk = HKDF-Extract(salt=0, IKM)
-  crypto_kdf_hkdf_sha512_extract(prk, NULL, 0, ikm, crypto_scalarmult_BYTES*3);
-#if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(prk, sizeof prk, "prk");
-#endif
-
-  // 2. handshake_secret = Derive-Secret(., "handshake secret", info)
-  uint8_t handshake_secret[OPAQUE_HANDSHAKE_SECRETBYTES];
-  if(-1==sodium_mlock(handshake_secret, sizeof handshake_secret)) {
-    sodium_munlock(prk,sizeof(prk));
+// the keys of derive_keys() from prk, with the labels of the
+// handshake and the session secret
+static int expand_keys(Opaque_Keys* keys, const uint8_t prk[crypto_kdf_hkdf_sha512_KEYBYTES],
+                       const char info[crypto_hash_sha512_BYTES],
+                       const char *handshake_label, const char *session_label) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *handshake_secret = opaque_scratch_alloc(OPAQUE_HANDSHAKE_SECRETBYTES);
+  crypto_auth_hmacsha512_state *prk_state = opaque_scratch_alloc(sizeof(crypto_auth_hmacsha512_state));
+  if(handshake_secret==NULL || prk_state==NULL) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  const char handshake_secret_label[]="HandshakeSecret";
-  hkdf_expand_label(handshake_secret, prk, handshake_secret_label, info, sizeof(handshake_secret));
 
+  uint8_t labels[2][OPAQUE_HKDF_LABEL_MAX];
+  const uint8_t *label_ptrs[2] = {labels[0], labels[1]};
+  size_t label_lens[2];
+
+  // 2. handshake_secret = Derive-Secret(., "handshake secret", info)
   // 3. keys->sk         = Derive-Secret(., "session secret", info)
-  const char session_key_label[]="SessionKey";
-  hkdf_expand_label(keys->sk, prk, session_key_label, info, OPAQUE_SHARED_SECRETBYTES);
-  sodium_munlock(prk,sizeof(prk));
+  // both are expanded from prk in parallel
+  label_lens[0] = hkdf_label(labels[0], handshake_label, info, OPAQUE_HANDSHAKE_SECRETBYTES);
+  label_lens[1] = hkdf_label(labels[1], session_label, info, OPAQUE_SHARED_SECRETBYTES);
+  uint8_t *secrets[2] = {handshake_secret, keys->sk};
+  const size_t secret_lens[2] = {OPAQUE_HANDSHAKE_SECRETBYTES, OPAQUE_SHARED_SECRETBYTES};
+  hkdf_keyed(prk_state, prk);
+  const crypto_auth_hmacsha512_state *prks[2] = {prk_state, prk_state};
+  if(0!=hkdf_expand_mb(2, secrets, secret_lens, label_ptrs, label_lens, prks)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
 
   // 4. Km2 = Derive-Secret(handshake_secret, "ServerMAC", "")
   //Km2 = HKDF-Expand-Label(handshake_secret, "server mac", "", Hash.length)
-  const char server_mac_label[]="ServerMAC";
-  hkdf_expand_label(keys->km2, handshake_secret, server_mac_label, NULL, OPAQUE_HMAC_SHA512_KEYBYTES);
   // 5. Km3 = Derive-Secret(handshake_secret, "ClientMAC", "")
   //Km3 = HKDF-Expand-Label(handshake_secret, "client mac", "", Hash.length)
-  const char client_mac_label[]="ClientMAC";
-  hkdf_expand_label(keys->km3, handshake_secret, client_mac_label, NULL, OPAQUE_HMAC_SHA512_KEYBYTES);
-  sodium_munlock(handshake_secret, sizeof handshake_secret);
+  label_lens[0] = hkdf_label(labels[0], "ServerMAC", NULL, OPAQUE_HMAC_SHA512_KEYBYTES);
+  label_lens[1] = hkdf_label(labels[1], "ClientMAC", NULL, OPAQUE_HMAC_SHA512_KEYBYTES);
+  uint8_t *macs[2] = {keys->km2, keys->km3};
+  const size_t mac_lens[2] = {OPAQUE_HMAC_SHA512_KEYBYTES, OPAQUE_HMAC_SHA512_KEYBYTES};
+  hkdf_keyed(prk_state, handshake_secret);
+  if(0!=hkdf_expand_mb(2, macs, mac_lens, label_ptrs, label_lens, prks)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  opaque_scratch_release(mark);
 #ifdef TRACE
   dump(keys->sk, OPAQUE_SHARED_SECRETBYTES, "keys->sk");
   dump(keys->km2, OPAQUE_HMAC_SHA512_KEYBYTES, "keys->km2");
@@ -691,6 +1145,28 @@ static int derive_keys(Opaque_Keys* keys, const uint8_t ikm[crypto_scalarmult_BY
   return 0;
 }
 
+// derive keys according to irtf cfrg draft
+static int derive_keys(Opaque_Keys* keys, const uint8_t ikm[crypto_scalarmult_BYTES * 3], const char info[crypto_hash_sha512_BYTES]) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *prk = opaque_scratch_alloc(crypto_kdf_hkdf_sha512_KEYBYTES);
+  if(prk==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+#ifdef TRACE
+  dump(ikm, crypto_scalarmult_BYTES*3, "ikm ");
+  dump((uint8_t*) info, crypto_hash_sha512_BYTES, "info ");
+#endif
+  // 1. prk = HKDF-Extract(salt=0, IKM)
+  crypto_kdf_hkdf_sha512_extract(prk, NULL, 0, ikm, crypto_scalarmult_BYTES*3);
+#if (defined TRACE || defined CFRG_TEST_VEC)
+  dump(prk, crypto_kdf_hkdf_sha512_KEYBYTES, "prk");
+#endif
+  const int ret = expand_keys(keys, prk, info, "HandshakeSecret", "SessionKey");
+  opaque_scratch_release(mark);
+  return ret;
+}
+
 /** if one of the peers ID is missing, set it to the peers public key */
 static void fix_ids(const uint8_t pkU[crypto_scalarmult_BYTES],
                     const uint8_t pkS[crypto_scalarmult_BYTES],
@@ -712,16 +1188,38 @@ static void fix_ids(const uint8_t pkU[crypto_scalarmult_BYTES],
   }
 }
 
+// the part of the preamble that only depends on the context, this can
+// be calculated once and reused for every session in the same context
+static void calc_preamble_prefix(crypto_hash_sha512_state *state,
+                                 const uint8_t *ctx, const uint16_t ctx_len) {
+  crypto_hash_sha512_init(state);
+
+#ifdef TRACE
+  dump(ctx, ctx_len, "ctx");
+#endif
+
+  //1. preamble = hash("RFCXXXX",
+  // note the spec it self does not say hash here, but
+  // https://github.com/cfrg/draft-irtf-cfrg-opaque/pull/147
+  // and later uses all hash this value
+  const uint8_t rfc[]="RFCXXXX";
+  const uint8_t rfc_len=sizeof rfc -1;
+  crypto_hash_sha512_update(state, rfc, rfc_len);
+
+  //                   I2OSP(len(context), 2), context,
+  uint16_t len = htons(ctx_len);
+  crypto_hash_sha512_update(state, (uint8_t*) &len, 2);
+  crypto_hash_sha512_update(state, ctx, ctx_len);
+}
+
+// continues the preamble from a state initialized by calc_preamble_prefix()
 static void calc_preamble(char preamble[crypto_hash_sha512_BYTES],
                           crypto_hash_sha512_state *state,
                           const uint8_t pkU[crypto_scalarmult_BYTES],
                           const uint8_t pkS[crypto_scalarmult_BYTES],
                           const uint8_t ke1[OPAQUE_USER_SESSION_PUBLIC_LEN],
                           const Opaque_ServerSession *ke2,
-                          const uint8_t *ctx, const uint16_t ctx_len,
                           const Opaque_Ids *ids0) {
-  crypto_hash_sha512_init(state);
-
   Opaque_Ids ids;
   fix_ids(pkU, pkS, ids0, &ids);
 
@@ -732,7 +1230,6 @@ static void calc_preamble(char preamble[crypto_hash_sha512_BYTES],
   dump(pkU, crypto_scalarmult_BYTES, "pkU");
   dump(pkS,crypto_scalarmult_BYTES, "pkS");
   dump(ke1, OPAQUE_USER_SESSION_PUBLIC_LEN, "ke1");
-  dump(ctx, ctx_len, "ctx");
   dump((uint8_t*)ke2,
        /* credential_response */
        /*Z*/ crypto_core_ristretto255_BYTES +
@@ -742,21 +1239,8 @@ static void calc_preamble(char preamble[crypto_hash_sha512_BYTES],
        /*X_s*/crypto_scalarmult_BYTES, "ke2");
 #endif
 
-  //1. preamble = hash("RFCXXXX",
-  // note the spec it self does not say hash here, but
-  // https://github.com/cfrg/draft-irtf-cfrg-opaque/pull/147
-  // and later uses all hash this value
-  const uint8_t rfc[]="RFCXXXX";
-  const uint8_t rfc_len=sizeof rfc -1;
-  crypto_hash_sha512_update(state, rfc, rfc_len);
-
-  //                   I2OSP(len(context), 2), context,
-  uint16_t len = htons(ctx_len);
-  crypto_hash_sha512_update(state, (uint8_t*) &len, 2);
-  crypto_hash_sha512_update(state, ctx, ctx_len);
-
   //                   I2OSP(len(client_identity), 2), client_identity,
-  len = htons(ids.idU_len);
+  uint16_t len = htons(ids.idU_len);
   crypto_hash_sha512_update(state, (uint8_t*) &len, 2);
   crypto_hash_sha512_update(state, ids.idU, ids.idU_len);
 
@@ -787,15 +1271,47 @@ static void calc_preamble(char preamble[crypto_hash_sha512_BYTES],
   crypto_hash_sha512_final(&copied_state, (uint8_t *) preamble);
 }
 
-// implements server end of triple-dh
+// out = n*P from the precomputed multiples of P
+static int dh(uint8_t out[crypto_scalarmult_BYTES],
+              const uint8_t n[crypto_scalarmult_SCALARBYTES],
+              const ristretto_table *P) {
+  const size_t mark = opaque_scratch_mark();
+  ristretto_point *Q = opaque_scratch_alloc(sizeof(ristretto_point));
+  if(Q==NULL) return -1;
+  if(0!=ristretto_scalarmult_table(Q, n, P)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  ristretto_encode(out, Q);
+  opaque_scratch_release(mark);
+  return 0;
+}
+
+// decodes the public keys of the peer once for the triple-dh, the
+// multiples of the ephemeral key are shared by both of its multiplications
+static int dh_tables(ristretto_table *I, ristretto_table *E,
+                     const uint8_t Ip[crypto_scalarmult_BYTES],
+                     const uint8_t Ep[crypto_scalarmult_BYTES]) {
+  ristretto_point P;
+  if(0!=ristretto_decode(&P, Ip)) return -1;
+  ristretto_table_init(I, &P);
+  if(0!=ristretto_decode(&P, Ep)) return -1;
+  ristretto_table_init(E, &P);
+  return 0;
+}
+
+// implements server end of triple-dh, It are the multiples of Ip if
+// they were computed already, or NULL
 static int server_3dh(Opaque_Keys *keys,
                const uint8_t ix[crypto_scalarmult_SCALARBYTES],
                const uint8_t ex[crypto_scalarmult_SCALARBYTES],
                const uint8_t Ip[crypto_scalarmult_BYTES],
+               const ristretto_table *It,
                const uint8_t Ep[crypto_scalarmult_BYTES],
                const char preamble[crypto_hash_sha512_BYTES]) {
-  uint8_t sec[crypto_scalarmult_BYTES * 3], *ptr = sec;
-  if(-1==sodium_mlock(sec, sizeof sec)) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *sec = opaque_scratch_alloc(crypto_scalarmult_BYTES * 3);
+  if(sec==NULL) {
     return -1;
   }
 
@@ -806,20 +1322,36 @@ static int server_3dh(Opaque_Keys *keys,
   dump(Ep, crypto_scalarmult_BYTES, "epkU");
 #endif
 
-  if(0!=crypto_scalarmult_ristretto255(ptr,ex,Ep)) return 1;
-  ptr+=crypto_scalarmult_BYTES;
-  if(0!=crypto_scalarmult_ristretto255(ptr,ix,Ep)) return 1;
-  ptr+=crypto_scalarmult_BYTES;
-  if(0!=crypto_scalarmult_ristretto255(ptr,ex,Ip)) return 1;
+  ristretto_table Itable, Et;
+  ristretto_point P;
+  if(It==NULL) {
+    if(0!=dh_tables(&Itable, &Et, Ip, Ep)) {
+      opaque_scratch_release(mark);
+      return 1;
+    }
+    It = &Itable;
+  } else {
+    if(0!=ristretto_decode(&P, Ep)) {
+      opaque_scratch_release(mark);
+      return 1;
+    }
+    ristretto_table_init(&Et, &P);
+  }
+  if(0!=dh(sec,ex,&Et) ||
+     0!=dh(sec+crypto_scalarmult_BYTES,ix,&Et) ||
+     0!=dh(sec+2*crypto_scalarmult_BYTES,ex,It)) {
+    opaque_scratch_release(mark);
+    return 1;
+  }
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(sec, 96, "3dh s ikm");
 #endif
 
   if(0!=derive_keys(keys, sec, preamble)) {
-    sodium_munlock(sec,sizeof(sec));
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(sec,sizeof(sec));
+  opaque_scratch_release(mark);
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump((uint8_t*) keys, sizeof(Opaque_Keys), "keys ");
 #endif
@@ -834,26 +1366,30 @@ static int user_3dh(Opaque_Keys *keys,
              const uint8_t Ip[crypto_scalarmult_BYTES],
              const uint8_t Ep[crypto_scalarmult_BYTES],
              const char preamble[crypto_hash_sha512_BYTES]) {
-  uint8_t sec[crypto_scalarmult_BYTES * 3], *ptr = sec;
-  if(-1==sodium_mlock(sec, sizeof sec)) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *sec = opaque_scratch_alloc(crypto_scalarmult_BYTES * 3);
+  if(sec==NULL) {
     return -1;
   }
 
-  if(0!=crypto_scalarmult_ristretto255(ptr,ex,Ep)) return 1;
-  ptr+=crypto_scalarmult_BYTES;
-  if(0!=crypto_scalarmult_ristretto255(ptr,ex,Ip)) return 1;
-  ptr+=crypto_scalarmult_BYTES;
-  if(0!=crypto_scalarmult_ristretto255(ptr,ix,Ep)) return 1;
+  ristretto_table It, Et;
+  if(0!=dh_tables(&It, &Et, Ip, Ep) ||
+     0!=dh(sec,ex,&Et) ||
+     0!=dh(sec+crypto_scalarmult_BYTES,ex,&It) ||
+     0!=dh(sec+2*crypto_scalarmult_BYTES,ix,&Et)) {
+    opaque_scratch_release(mark);
+    return 1;
+  }
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(sec, 96, "3dh u ikm");
 #endif
 
   // and hash for the result SK = f_K(0)
   if(0!=derive_keys(keys, sec, preamble)) {
-    sodium_munlock(sec,sizeof(sec));
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(sec,sizeof(sec));
+  opaque_scratch_release(mark);
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump((uint8_t*) keys, sizeof(Opaque_Keys), "keys ");
 #endif
@@ -861,26 +1397,6 @@ static int user_3dh(Opaque_Keys *keys,
   return 0;
 }
 
-static int skU_from_rwd(const uint8_t rwd[OPAQUE_RWDU_BYTES], const uint8_t nonce[OPAQUE_NONCE_BYTES], uint8_t skU[crypto_scalarmult_BYTES]) {
-  char info[OPAQUE_NONCE_BYTES+10];
-  memcpy(info, nonce, OPAQUE_NONCE_BYTES);
-  memcpy(info+OPAQUE_NONCE_BYTES, "PrivateKey", 10);
-  uint8_t seed[crypto_core_ristretto255_SCALARBYTES];
-  if(-1==sodium_mlock(seed, sizeof seed)) {
-    return -1;
-  }
-  crypto_kdf_hkdf_sha512_expand(seed, crypto_core_ristretto255_SCALARBYTES, info, sizeof info, rwd);
-
-  uint8_t dst[24]="OPAQUE-DeriveAuthKeyPair";
-  if(0!=voprf_hash_to_scalar(seed, sizeof seed, dst, sizeof dst, skU)) {
-    sodium_munlock(seed, sizeof seed);
-    return -1;
-  }
-
-  sodium_munlock(seed, sizeof seed);
-  return 0;
-}
-
 static int create_envelope(const uint8_t rwdU[OPAQUE_RWDU_BYTES],
                            const uint8_t server_public_key[crypto_scalarmult_BYTES],
                            const Opaque_Ids *ids,
@@ -896,78 +1412,64 @@ static int create_envelope(const uint8_t rwdU[OPAQUE_RWDU_BYTES],
   randombytes(env->nonce, OPAQUE_ENVELOPE_NONCEBYTES);
 #endif
 
-  uint8_t concated[OPAQUE_ENVELOPE_NONCEBYTES+10],
-    *label = concated+OPAQUE_ENVELOPE_NONCEBYTES;
-  memcpy(concated, env->nonce, OPAQUE_ENVELOPE_NONCEBYTES);
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *auth_key = opaque_scratch_alloc(OPAQUE_HMAC_SHA512_KEYBYTES);
+  uint8_t *seed = opaque_scratch_alloc(crypto_core_ristretto255_SCALARBYTES);
+  uint8_t *client_secret_key = opaque_scratch_alloc(crypto_scalarmult_SCALARBYTES);
+  crypto_auth_hmacsha512_state *rwd_state = opaque_scratch_alloc(sizeof(crypto_auth_hmacsha512_state));
+  if(auth_key==NULL || seed==NULL || client_secret_key==NULL || rwd_state==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  hkdf_keyed(rwd_state, rwdU);
 
   // 2. masking_key = HKDF-Expand(randomized_pwd, "MaskingKey", Nh)
+  // 3. auth_key = HKDF-Expand(randomized_pwd, concat(envelope_nonce, "AuthKey"), Nh)
+  // 4. export_key = HKDF-Expand(randomized_pwd, concat(envelope_nonce, "ExportKey"), Nh)
+  // 5. seed = Expand(randomized_pwd, concat(envelope_nonce, "PrivateKey"), Nseed)
+  // all of these are expanded from rwdU in parallel
   const uint8_t masking_key_info[10]="MaskingKey";
-  crypto_kdf_hkdf_sha512_expand(masking_key, crypto_hash_sha512_BYTES,
-                                (const char*) masking_key_info, sizeof masking_key_info,
-                                rwdU);
+  uint8_t auth_key_info[OPAQUE_ENVELOPE_NONCEBYTES+7],
+    seed_info[OPAQUE_ENVELOPE_NONCEBYTES+10],
+    export_key_info[OPAQUE_ENVELOPE_NONCEBYTES+9];
+  memcpy(auth_key_info, env->nonce, OPAQUE_ENVELOPE_NONCEBYTES);
+  memcpy(auth_key_info+OPAQUE_ENVELOPE_NONCEBYTES, "AuthKey", 7);
+  memcpy(seed_info, env->nonce, OPAQUE_ENVELOPE_NONCEBYTES);
+  memcpy(seed_info+OPAQUE_ENVELOPE_NONCEBYTES, "PrivateKey", 10);
+  memcpy(export_key_info, env->nonce, OPAQUE_ENVELOPE_NONCEBYTES);
+  memcpy(export_key_info+OPAQUE_ENVELOPE_NONCEBYTES, "ExportKey", 9);
+
+  uint8_t *res[4] = {masking_key, auth_key, seed, export_key};
+  const size_t len[4] = {crypto_hash_sha512_BYTES, OPAQUE_HMAC_SHA512_KEYBYTES,
+                         crypto_core_ristretto255_SCALARBYTES, crypto_hash_sha512_BYTES};
+  const uint8_t *info[4] = {masking_key_info, auth_key_info, seed_info, export_key_info};
+  const size_t info_len[4] = {sizeof masking_key_info, sizeof auth_key_info,
+                              sizeof seed_info, sizeof export_key_info};
+  const crypto_auth_hmacsha512_state *prk[4] = {rwd_state, rwd_state, rwd_state, rwd_state};
+  if(0!=hkdf_expand_mb((NULL!=export_key)?4:3, res, len, info, info_len, prk)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
 #if (defined CFRG_TEST_VEC || defined TRACE)
   dump(masking_key_info, sizeof masking_key_info, "masking_key_info");
   dump(rwdU, OPAQUE_RWDU_BYTES, "rwdU");
   dump(masking_key, crypto_hash_sha512_BYTES, "masking_key");
-#endif
-
-  // 3. auth_key = HKDF-Expand(randomized_pwd, concat(envelope_nonce, "AuthKey"), Nh)
-  uint8_t auth_key[OPAQUE_HMAC_SHA512_KEYBYTES];
-  if(-1==sodium_mlock(auth_key, sizeof auth_key)) {
-    return -1;
-  }
-  memcpy(label, "AuthKey", 7);
-  crypto_kdf_hkdf_sha512_expand(auth_key, sizeof auth_key,
-                                (const char*) concated, OPAQUE_ENVELOPE_NONCEBYTES+7,
-                                rwdU);
-
-#if (defined CFRG_TEST_VEC || defined TRACE)
-  dump(auth_key,sizeof auth_key, "auth_key ");
-#endif
-
-  // 4. export_key = HKDF-Expand(randomized_pwd, concat(envelope_nonce, "ExportKey"), Nh)
+  dump(auth_key,OPAQUE_HMAC_SHA512_KEYBYTES, "auth_key ");
   if(NULL!=export_key) {
-    memcpy(label, "ExportKey", 9);
-#if (defined CFRG_TEST_VEC || defined TRACE)
-    dump(concated, OPAQUE_ENVELOPE_NONCEBYTES+9, "export_key_info");
-#endif
-    crypto_kdf_hkdf_sha512_expand(export_key, crypto_hash_sha512_BYTES,
-                                  (const char*) concated, OPAQUE_ENVELOPE_NONCEBYTES+9,
-                                  rwdU);
-#if (defined CFRG_TEST_VEC || defined TRACE)
+    dump(export_key_info, sizeof export_key_info, "export_key_info");
     dump(export_key,crypto_hash_sha512_BYTES, "export_key ");
-#endif
-  }
-
-  // 5. seed = Expand(randomized_pwd, concat(envelope_nonce, "PrivateKey"), Nseed)
-  memcpy(label, "PrivateKey", 10);
-  uint8_t seed[crypto_core_ristretto255_SCALARBYTES];
-  if(-1==sodium_mlock(seed, sizeof seed)) {
-    sodium_munlock(auth_key, sizeof auth_key);
-    return -1;
   }
-  crypto_kdf_hkdf_sha512_expand(seed, crypto_core_ristretto255_SCALARBYTES,
-                                (const char*) concated, OPAQUE_ENVELOPE_NONCEBYTES+10,
-                                rwdU);
+#endif
 
   // 6. _, client_public_key = DeriveAuthKeyPair(seed)
-  uint8_t client_secret_key[crypto_scalarmult_SCALARBYTES];
-  if(-1==sodium_mlock(client_secret_key, sizeof client_secret_key)) {
-    sodium_munlock(auth_key, sizeof auth_key);
-    return -1;
-  }
   const uint8_t dst[24]="OPAQUE-DeriveAuthKeyPair";
-  if(0!=deriveKeyPair(seed, sizeof seed, dst, sizeof dst, client_secret_key, client_public_key)) {
-    sodium_munlock(seed, sizeof seed);
-    sodium_munlock(client_secret_key, sizeof client_secret_key);
-    sodium_munlock(auth_key, sizeof auth_key);
+  if(0!=deriveKeyPair(seed, crypto_core_ristretto255_SCALARBYTES, dst, sizeof dst, client_secret_key, client_public_key)) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(seed, sizeof seed);
 #if (defined CFRG_TEST_VEC || defined TRACE)
   dump(client_secret_key, crypto_scalarmult_SCALARBYTES, "client_secret_key");
 #endif
-  sodium_munlock(client_secret_key, sizeof client_secret_key);
 #if (defined CFRG_TEST_VEC || defined TRACE)
   dump(client_public_key, crypto_scalarmult_BYTES, "client_public_key");
 #endif
@@ -1007,10 +1509,10 @@ static int create_envelope(const uint8_t rwdU[OPAQUE_RWDU_BYTES],
 
 #if (defined CFRG_TEST_VEC || defined TRACE)
   dump(authenticated, sizeof authenticated, "authenticated");
-  dump(auth_key, sizeof auth_key, "auth_key");
+  dump(auth_key, OPAQUE_HMAC_SHA512_KEYBYTES, "auth_key");
   dump(env->auth_tag, crypto_auth_hmacsha512_BYTES, "auth_tag");
 #endif
-  sodium_munlock(auth_key, sizeof auth_key);
+  opaque_scratch_release(mark);
 
 #if (defined CFRG_TEST_VEC || defined TRACE)
   dump((uint8_t *)env, OPAQUE_ENVELOPE_BYTES, "envU");
@@ -1019,37 +1521,48 @@ static int create_envelope(const uint8_t rwdU[OPAQUE_RWDU_BYTES],
   return 0;
 }
 
+int opaque_init(void) {
+  if(sodium_init() < 0) return -1;
+  // select the kernels now instead of on their first use
+  sha512mb_impl();
+  ristretto_backend();
+  argon2_impl();
+#ifdef TRACE
+  fprintf(stderr, "sha512mb: %s, ristretto: %s, argon2: %s\n", sha512mb_impl(), ristretto_backend(), argon2_impl());
+#endif
+  if(opaque_cpu_max() < 0) return -1;
+  return 0;
+}
+
 // (StorePwdFile, sid , U, pw): S computes k_s ←_R Z_q , rw := F_k_s (pw),
 // p_s ←_R Z_q , p_u ←_R Z_q , P_s := g^p_s , P_u := g^p_u , c ← AuthEnc_rw (p_u, P_u, P_s);
 // it records file[sid] := {k_s, p_s, P_s, P_u, c}.
-int opaque_Register(const uint8_t *pwdU, const uint16_t pwdU_len,
-                    const uint8_t skS[crypto_scalarmult_SCALARBYTES],
-                    const Opaque_Ids *ids,
-                    uint8_t _rec[OPAQUE_USER_RECORD_LEN],
-                    uint8_t export_key[crypto_hash_sha512_BYTES]) {
-  Opaque_UserRecord *rec = (Opaque_UserRecord *)_rec;
-
+// opaque_Register() with the kU in rec
+static int register_user(const uint8_t *pwdU, const uint16_t pwdU_len,
+                         const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                         const Opaque_Ids *ids,
+                         const Opaque_KSF *ksf,
+                         Opaque_UserRecord *rec,
+                         uint8_t export_key[crypto_hash_sha512_BYTES]) {
 #ifdef TRACE
   dump(ids->idU, ids->idU_len,"idU ");
   dump(ids->idS, ids->idS_len,"idS ");
 #endif
 
-  // k_s ←_R Z_q
-  // 1. (kU, _) = KeyGen()
-  oprf_KeyGen(rec->kU);
-
   // rw := F_k_s (pw),
-  uint8_t rwdU[OPAQUE_RWDU_BYTES];
-  if(-1==sodium_mlock(rwdU,sizeof rwdU)) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *rwdU = opaque_scratch_alloc(OPAQUE_RWDU_BYTES);
+  if(rwdU==NULL) {
+    opaque_scratch_release(mark);
     return -1;
   }
 
-  if(prf(pwdU, pwdU_len, rec->kU, rwdU)!=0) {
-    sodium_munlock(rwdU,sizeof rwdU);
+  if(prf(pwdU, pwdU_len, rec->kU, ksf, rwdU)!=0) {
+    opaque_scratch_release(mark);
     return -1;
   }
 #ifdef TRACE
-  dump(rwdU, sizeof rwdU, "rwdU");
+  dump(rwdU, OPAQUE_RWDU_BYTES, "rwdU");
 #endif
 
   // p_s ←_R Z_q
@@ -1061,70 +1574,115 @@ int opaque_Register(const uint8_t *pwdU, const uint16_t pwdU_len,
 
   // P_s := g^p_s
   uint8_t server_public_key[crypto_scalarmult_BYTES];
-  crypto_scalarmult_ristretto255_base(server_public_key, rec->skS);
-
-  uint8_t client_private_key[crypto_scalarmult_SCALARBYTES];
-  if(-1==sodium_mlock(client_private_key,sizeof client_private_key)) {
-    sodium_munlock(rwdU,sizeof rwdU);
-    return -1;
-  }
-  if(0!=skU_from_rwd(rwdU, (uint8_t*) &rec->recU.envelope, client_private_key)) {
-    sodium_munlock(client_private_key,sizeof client_private_key);
-    sodium_munlock(rwdU, sizeof rwdU);
-    return -1;
-  }
-  // P_u := g^p_u
-  crypto_scalarmult_base(rec->recU.client_public_key, client_private_key);
-  sodium_munlock(client_private_key,sizeof client_private_key);
+  ristretto_scalarmult_base(server_public_key, rec->skS);
 
+  // p_u and P_u := g^p_u are derived from rwdU by create_envelope
   if(0!=create_envelope(rwdU, server_public_key, ids, &rec->recU.envelope, rec->recU.client_public_key, rec->recU.masking_key, export_key)) {
-    sodium_munlock(rwdU, sizeof rwdU);
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(rwdU, sizeof rwdU);
+  opaque_scratch_release(mark);
 
 #ifdef TRACE
-  dump(_rec, OPAQUE_USER_RECORD_LEN, "user rec");
+  dump((uint8_t*) rec, OPAQUE_USER_RECORD_LEN, "user rec");
 #endif
   return 0;
 }
 
-//(UsrSession, sid , ssid , S, pw): U picks r, x_u ←_R Z_q ; sets α := (H^0(pw))^r and
-//X_u := g^x_u ; sends α and X_u to S.
-// more or less corresponds to CreateCredentialRequest in the irtf draft
-int opaque_CreateCredentialRequest(const uint8_t *pwdU, const uint16_t pwdU_len, uint8_t _sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], uint8_t _pub[OPAQUE_USER_SESSION_PUBLIC_LEN]) {
-  Opaque_UserSession_Secret *sec = (Opaque_UserSession_Secret*) _sec;
-  Opaque_UserSession *pub = (Opaque_UserSession*) _pub;
-#ifdef TRACE
-  memset(_sec, 0, OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len);
-  memset(_pub, 0, OPAQUE_USER_SESSION_PUBLIC_LEN);
-#endif
+int opaque_Register(const uint8_t *pwdU, const uint16_t pwdU_len,
+                    const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                    const Opaque_Ids *ids,
+                    const Opaque_KSF *ksf,
+                    uint8_t _rec[OPAQUE_USER_RECORD_LEN],
+                    uint8_t export_key[crypto_hash_sha512_BYTES]) {
+  Opaque_UserRecord *rec = (Opaque_UserRecord *)_rec;
 
-  // 1. (blind, blinded) = Blind(pwdU)
-  if(0!=oprf_Blind(pwdU, pwdU_len, sec->blind, pub->blinded)) return -1;
-#ifdef TRACE
-  dump(_sec,OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len, "sec ");
-  dump(_pub,OPAQUE_USER_SESSION_PUBLIC_LEN, "pub ");
+  // k_s ←_R Z_q
+  // 1. (kU, _) = KeyGen()
+  oprf_KeyGen(rec->kU);
+
+  return register_user(pwdU, pwdU_len, skS, ids, ksf, rec, export_key);
+}
+
+int opaque_RegisterSeeded(const uint8_t *pwdU, const uint16_t pwdU_len,
+                          const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                          Opaque_OprfSeed *oprfseed,
+                          const uint8_t *credid, const uint16_t credid_len,
+                          const Opaque_Ids *ids,
+                          const Opaque_KSF *ksf,
+                          uint8_t _rec[OPAQUE_USER_RECORD_LEN],
+                          uint8_t export_key[crypto_hash_sha512_BYTES]) {
+  Opaque_UserRecord *rec = (Opaque_UserRecord *)_rec;
+
+  if(0!=derive_oprf_key(oprfseed, credid, credid_len, rec->kU)) return -1;
+
+  return register_user(pwdU, pwdU_len, skS, ids, ksf, rec, export_key);
+}
+
+// the password independent part of opaque_CreateCredentialRequest()
+int opaque_PrecomputeCredentialRequest(uint8_t _pre[OPAQUE_USER_PRECOMPUTED_LEN]) {
+  Opaque_UserPrecomputed *pre = (Opaque_UserPrecomputed*) _pre;
+
+  // U picks r
+#ifdef CFRG_TEST_VEC
+  memcpy(pre->blind, blind_login, blind_login_len);
+#else
+  crypto_core_ristretto255_scalar_random(pre->blind);
 #endif
-  memcpy(sec->blinded, pub->blinded, crypto_core_ristretto255_BYTES);
+  // and already inverts it for oprf_unblind_inv()
+  if(0!=crypto_core_ristretto255_scalar_invert(pre->blind_inv, pre->blind)) {
+    sodium_memzero(_pre, OPAQUE_USER_PRECOMPUTED_LEN);
+    return -1;
+  }
 
   // x_u ←_R Z_q
 #ifdef CFRG_TEST_VEC
-  memcpy(sec->x_u, client_private_keyshare, crypto_scalarmult_SCALARBYTES);
+  memcpy(pre->x_u, client_private_keyshare, crypto_scalarmult_SCALARBYTES);
 #else
-  randombytes(sec->x_u, crypto_scalarmult_SCALARBYTES);
+  randombytes(pre->x_u, crypto_scalarmult_SCALARBYTES);
 #endif
 
   // nonceU
 #ifdef CFRG_TEST_VEC
-  memcpy(sec->nonceU, client_nonce, OPAQUE_NONCE_BYTES);
+  memcpy(pre->nonceU, client_nonce, OPAQUE_NONCE_BYTES);
 #else
-  randombytes(sec->nonceU, OPAQUE_NONCE_BYTES);
+  randombytes(pre->nonceU, OPAQUE_NONCE_BYTES);
 #endif
-  memcpy(pub->nonceU, sec->nonceU, OPAQUE_NONCE_BYTES);
 
   // X_u := g^x_u
-  crypto_scalarmult_ristretto255_base(pub->X_u, sec->x_u);
+  ristretto_scalarmult_base(pre->X_u, pre->x_u);
+  return 0;
+}
+
+//(UsrSession, sid , ssid , S, pw): U picks r, x_u ←_R Z_q ; sets α := (H^0(pw))^r and
+//X_u := g^x_u ; sends α and X_u to S.
+// r, x_u and X_u come from opaque_PrecomputeCredentialRequest()
+int opaque_CreateCredentialRequestPrecomputed(uint8_t _pre[OPAQUE_USER_PRECOMPUTED_LEN],
+                                              const uint8_t *pwdU, const uint16_t pwdU_len,
+                                              uint8_t _sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len],
+                                              uint8_t _pub[OPAQUE_USER_SESSION_PUBLIC_LEN]) {
+  Opaque_UserPrecomputed *pre = (Opaque_UserPrecomputed*) _pre;
+  Opaque_UserSession_Secret *sec = (Opaque_UserSession_Secret*) _sec;
+  Opaque_UserSession *pub = (Opaque_UserSession*) _pub;
+#ifdef TRACE
+  memset(_sec, 0, OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len);
+  memset(_pub, 0, OPAQUE_USER_SESSION_PUBLIC_LEN);
+#endif
+  // wiped after use, a reused r or x_u would link the logins
+  if(sodium_is_zero(pre->blind, sizeof pre->blind)) return -1;
+
+  // 1. (blind, blinded) = Blind(pwdU)
+  if(0!=oprf_blind_with(pwdU, pwdU_len, pre->blind, pub->blinded)) {
+    sodium_memzero(_pre, OPAQUE_USER_PRECOMPUTED_LEN);
+    return -1;
+  }
+  memcpy(sec->blind_inv, pre->blind_inv, crypto_core_ristretto255_SCALARBYTES);
+  memcpy(sec->blinded, pub->blinded, crypto_core_ristretto255_BYTES);
+  memcpy(sec->x_u, pre->x_u, crypto_scalarmult_SCALARBYTES);
+  memcpy(sec->nonceU, pre->nonceU, OPAQUE_NONCE_BYTES);
+  memcpy(pub->nonceU, pre->nonceU, OPAQUE_NONCE_BYTES);
+  memcpy(pub->X_u, pre->X_u, crypto_scalarmult_BYTES);
+  sodium_memzero(_pre, OPAQUE_USER_PRECOMPUTED_LEN);
 
   sec->pwdU_len = pwdU_len;
   memcpy(sec->pwdU, pwdU, pwdU_len);
@@ -1139,6 +1697,103 @@ int opaque_CreateCredentialRequest(const uint8_t *pwdU, const uint16_t pwdU_len,
   return 0;
 }
 
+// more or less corresponds to CreateCredentialRequest in the irtf draft
+int opaque_CreateCredentialRequest(const uint8_t *pwdU, const uint16_t pwdU_len, uint8_t _sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], uint8_t _pub[OPAQUE_USER_SESSION_PUBLIC_LEN]) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *pre = opaque_scratch_alloc(OPAQUE_USER_PRECOMPUTED_LEN);
+  if(pre==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  int ret = opaque_PrecomputeCredentialRequest(pre);
+  if(ret==0) ret = opaque_CreateCredentialRequestPrecomputed(pre, pwdU, pwdU_len, _sec, _pub);
+  opaque_scratch_release(mark);
+  return ret;
+}
+
+// computes the group operations of m <= OPAQUE_BATCH_LANES logins of a
+// batch with the batches of ristretto.h: β := α^k_s, X_s := g^x_s and
+// the triple-dh of server_3dh(). ops[i].ret is -1 if α, X_u or P_u of
+// login i is invalid, or one of the products is the identity.
+static int server_group_ops(const size_t m,
+                            const uint8_t *const pubs[],
+                            const uint8_t *const recs[],
+                            const Opaque_ServerRandom rnd[],
+                            Opaque_ServerGroupOps ops[]) {
+  // the decoded inputs and β are public
+  ristretto_point in[3*OPAQUE_BATCH_LANES], Z[OPAQUE_BATCH_LANES];
+  ristretto_point *pts[4*OPAQUE_BATCH_LANES];
+  const uint8_t *scalars[4*OPAQUE_BATCH_LANES], *encoded[3*OPAQUE_BATCH_LANES];
+  uint8_t *out[4*OPAQUE_BATCH_LANES];
+  int rets[4*OPAQUE_BATCH_LANES];
+  size_t i;
+
+  const size_t mark = opaque_scratch_mark();
+  ristretto_point *sec = opaque_scratch_alloc(3*OPAQUE_BATCH_LANES*sizeof(ristretto_point));
+  if(sec==NULL) return -1;
+
+  // α, X_u and P_u of every login, the ristretto_points of invalid
+  // encodings are not written, but multiplied anyway
+  memset(in, 0, sizeof in);
+  for(i=0;i<m;i++) {
+    const Opaque_UserSession *pub = (const Opaque_UserSession *) pubs[i];
+    const Opaque_UserRecord *rec = (const Opaque_UserRecord *) recs[i];
+    encoded[i] = pub->blinded;
+    encoded[m+i] = pub->X_u;
+    encoded[2*m+i] = rec->recU.client_public_key;
+    pts[i] = &in[i];
+    pts[m+i] = &in[m+i];
+    pts[2*m+i] = &in[2*m+i];
+  }
+  ristretto_decode_batch(3*m, pts, encoded, rets);
+  for(i=0;i<m;i++) ops[i].ret = rets[i] | rets[m+i] | rets[2*m+i];
+
+  // Z = kU*α, and the shared secrets of the triple-dh in the order of
+  // server_3dh(): x_s*X_u, skS*X_u, x_s*P_u
+  const ristretto_point *factors[4*OPAQUE_BATCH_LANES];
+  for(i=0;i<m;i++) {
+    const Opaque_UserRecord *rec = (const Opaque_UserRecord *) recs[i];
+#ifdef CFRG_TEST_VEC
+    const uint8_t *x_s = server_private_keyshare;
+#else
+    const uint8_t *x_s = rnd[i].x_s;
+#endif
+    scalars[i] = rec->kU;
+    factors[i] = &in[i];
+    pts[i] = &Z[i];
+    out[i] = ops[i].Z;
+    scalars[m+3*i] = x_s;
+    factors[m+3*i] = &in[m+i];
+    scalars[m+3*i+1] = rec->skS;
+    factors[m+3*i+1] = &in[m+i];
+    scalars[m+3*i+2] = x_s;
+    factors[m+3*i+2] = &in[2*m+i];
+    pts[m+3*i] = &sec[3*i];
+    pts[m+3*i+1] = &sec[3*i+1];
+    pts[m+3*i+2] = &sec[3*i+2];
+    out[m+3*i] = ops[i].ikm;
+    out[m+3*i+1] = ops[i].ikm + crypto_scalarmult_BYTES;
+    out[m+3*i+2] = ops[i].ikm + 2*crypto_scalarmult_BYTES;
+  }
+  ristretto_scalarmult_batch(4*m, pts, scalars, factors, rets);
+  for(i=0;i<m;i++) ops[i].ret |= rets[i] | rets[m+3*i] | rets[m+3*i+1] | rets[m+3*i+2];
+  ristretto_encode_batch(4*m, out, (const ristretto_point *const *) pts);
+  opaque_scratch_release(mark);
+
+  // X_s := g^x_s
+  for(i=0;i<m;i++) {
+#ifdef CFRG_TEST_VEC
+    scalars[i] = server_private_keyshare;
+#else
+    scalars[i] = rnd[i].x_s;
+#endif
+    out[i] = ops[i].X_s;
+  }
+  ristretto_scalarmult_base_batch(m, out, scalars, rets);
+  for(i=0;i<m;i++) ops[i].ret |= rets[i];
+  return 0;
+}
+
 // more or less corresponds to CreateCredentialResponse in the irtf draft
 // 2. (SvrSession, sid , ssid ): On input α from U, S proceeds as follows:
 // (a) Checks that α ∈ G^∗ If not, outputs (abort, sid , ssid ) and halts;
@@ -1147,30 +1802,52 @@ int opaque_CreateCredentialRequest(const uint8_t *pwdU, const uint16_t pwdU_len,
 // (d) Computes K := KE(p_s, x_s, P_u, X_u) and SK := f K (0);
 // (e) Sends β, X s and c to U;
 // (f) Outputs (sid , ssid , SK).
-int opaque_CreateCredentialResponse(const uint8_t _pub[OPAQUE_USER_SESSION_PUBLIC_LEN], const uint8_t _rec[OPAQUE_USER_RECORD_LEN], const Opaque_Ids *ids, const uint8_t *ctx, const uint16_t ctx_len, uint8_t _resp[OPAQUE_SERVER_SESSION_LEN], uint8_t sk[OPAQUE_SHARED_SECRETBYTES], uint8_t authU[crypto_auth_hmacsha512_BYTES]) {
+//
+// skS and pkS are the servers long-term keypair, preamble_prefix is the
+// state calculated by calc_preamble_prefix() for the context of this
+// session, it is not modified. rnd holds the random values of this
+// session, so that batches can draw them with one call. Batches pass
+// the results of server_group_ops() in ops, otherwise ops is NULL and
+// the group operations are computed here. hot holds the values
+// derived from the record alone if they were cached, or is NULL.
+static int create_credential_response(const uint8_t _pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                      const uint8_t kU[crypto_core_ristretto255_SCALARBYTES],
+                                      const Opaque_RegistrationRecord *recU,
+                                      const Opaque_Ids *ids,
+                                      const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                                      const uint8_t pkS[crypto_scalarmult_BYTES],
+                                      const crypto_hash_sha512_state *preamble_prefix,
+                                      const Opaque_ServerRandom *rnd,
+                                      const uint8_t *X_s,
+                                      const Opaque_ServerGroupOps *ops,
+                                      const Opaque_HotRecord *hot,
+                                      uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
+                                      uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                      uint8_t authU[crypto_auth_hmacsha512_BYTES]) {
 
   Opaque_UserSession *pub = (Opaque_UserSession *) _pub;
-  Opaque_UserRecord *rec = (Opaque_UserRecord *) _rec;
   Opaque_ServerSession *resp = (Opaque_ServerSession *) _resp;
 
 #ifdef TRACE
   dump(_pub, sizeof(Opaque_UserSession), "session srv pub ");
-  dump(_rec, OPAQUE_USER_RECORD_LEN, "session srv rec ");
+  dump((const uint8_t*) recU, OPAQUE_REGISTRATION_RECORD_LEN, "session srv recU ");
 #endif
 
   // (a) Checks that α ∈ G^∗ . If not, outputs (abort, sid , ssid ) and halts;
-  if(crypto_core_ristretto255_is_valid_point(pub->blinded)!=1) return -1;
-
+  // done by oprf_Evaluate() when decoding α
   // (b) Retrieves file[sid] = {k_s, p_s, P_s, P_u, c};
-  // provided as parameter rec
+  // provided as parameters kU and recU
 #ifdef TRACE
-  dump(rec->kU, sizeof(rec->kU), "session srv kU ");
+  dump(kU, crypto_core_ristretto255_SCALARBYTES, "session srv kU ");
   dump(pub->blinded, sizeof(pub->blinded), "session srv blinded ");
 #endif
 
   // computes β := α^k_s
   // 1. Z = Evaluate(DeserializeScalar(credentialFile.kU), request.data)
-  if (oprf_Evaluate(rec->kU, pub->blinded, resp->Z) != 0) {
+  if(ops!=NULL) {
+    if(ops->ret!=0) return -1;
+    memcpy(resp->Z, ops->Z, sizeof resp->Z);
+  } else if (oprf_Evaluate(kU, pub->blinded, resp->Z) != 0) {
     return -1;
   }
 #if (defined TRACE || defined CFRG_TEST_VEC)
@@ -1179,48 +1856,43 @@ int opaque_CreateCredentialResponse(const uint8_t _pub[OPAQUE_USER_SESSION_PUBLI
 
   // 4. masking_nonce = random(Nn)
   // 5. credential_response_pad = Expand(record.masking_key, concat(masking_nonce, "CredentialResponsePad"), Npk + Ne)
-#ifdef CFRG_TEST_VEC
   struct {
     uint8_t nonce[32];
     uint8_t dst[21];
   } __attribute((packed)) masking_info = {
       .nonce = {0},
       .dst = "CredentialResponsePad"};
+#ifdef CFRG_TEST_VEC
   memcpy(masking_info.nonce, masking_nonce, masking_nonce_len);
 #else
-  struct {
-    uint8_t nonce[32];
-    uint8_t dst[21];
-  } __attribute((packed)) masking_info = {
-      .nonce = {0},
-      .dst = "CredentialResponsePad"};
-  randombytes(masking_info.nonce, sizeof masking_info.nonce);
-#endif
-  uint8_t response_pad[crypto_scalarmult_BYTES+sizeof(Opaque_Envelope)];
-  if(-1==sodium_mlock(response_pad, sizeof response_pad)) {
+  memcpy(masking_info.nonce, rnd->masking_nonce, sizeof masking_info.nonce);
+#endif
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *response_pad = opaque_scratch_alloc(crypto_scalarmult_BYTES+sizeof(Opaque_Envelope));
+  Opaque_Keys *keys = opaque_scratch_alloc(sizeof(Opaque_Keys));
+  crypto_auth_hmacsha512_state *masking_state = (hot!=NULL) ? NULL : opaque_scratch_alloc(sizeof(crypto_auth_hmacsha512_state));
+  if(response_pad==NULL || keys==NULL || (hot==NULL && masking_state==NULL)) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  crypto_kdf_hkdf_sha512_expand(response_pad, sizeof response_pad,
-                                (const char*) &masking_info, sizeof masking_info,
-                                rec->recU.masking_key);
+  if(hot==NULL) hkdf_keyed(masking_state, recU->masking_key);
+  hkdf_expand(response_pad, crypto_scalarmult_BYTES+sizeof(Opaque_Envelope),
+              (const uint8_t*) &masking_info, sizeof masking_info,
+              (hot!=NULL) ? &hot->masking_state : masking_state);
   memcpy(resp->masking_nonce, masking_info.nonce, sizeof masking_info.nonce);
 
-  // recalc server_public_key as we need it for the next step
-  uint8_t pkS[crypto_scalarmult_BYTES];
-  crypto_scalarmult_ristretto255_base(pkS, rec->skS);
 #if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(pkS, sizeof pkS, "server_public_key");
+  dump(pkS, crypto_scalarmult_BYTES, "server_public_key");
 #endif
 
-  memcpy(resp->masked_response, pkS, sizeof pkS);
+  memcpy(resp->masked_response, pkS, crypto_scalarmult_BYTES);
 
   // 6. masked_response = xor(credential_response_pad, concat(server_public_key, record.envelope))
   unsigned i;
   for(i=0;i<crypto_scalarmult_BYTES;i++)
     resp->masked_response[i] = response_pad[i] ^ resp->masked_response[i];
   for(;i<crypto_scalarmult_BYTES+sizeof(Opaque_Envelope);i++)
-    resp->masked_response[i] = response_pad[i] ^ ((uint8_t*)(&rec->recU.envelope))[i-crypto_scalarmult_BYTES];
-  sodium_munlock(response_pad, sizeof response_pad);
+    resp->masked_response[i] = response_pad[i] ^ ((const uint8_t*)(&recU->envelope))[i-crypto_scalarmult_BYTES];
 
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(_resp, sizeof (resp->Z) + crypto_scalarmult_BYTES+sizeof(Opaque_Envelope) + sizeof(masking_info.nonce), "resp(z+mn+mr)" );
@@ -1232,24 +1904,26 @@ int opaque_CreateCredentialResponse(const uint8_t _pub[OPAQUE_USER_SESSION_PUBLI
 #ifdef CFRG_TEST_VEC
   memcpy(resp->nonceS, server_nonce, OPAQUE_NONCE_BYTES);
 #else
-  randombytes(resp->nonceS, OPAQUE_NONCE_BYTES);
+  memcpy(resp->nonceS, rnd->nonceS, OPAQUE_NONCE_BYTES);
 #endif
 
   // 2. server_private_keyshare, server_keyshare = GenerateAuthKeyPair()
   // (c) Picks x_s ←_R Z_q
-  uint8_t x_s[crypto_scalarmult_SCALARBYTES];
-  if(-1==sodium_mlock(x_s,sizeof x_s)) return -1;
 #ifdef CFRG_TEST_VEC
-  memcpy(x_s, server_private_keyshare, sizeof x_s);
+  const uint8_t *x_s = server_private_keyshare;
 #else
-  randombytes(x_s, crypto_scalarmult_SCALARBYTES);
+  const uint8_t *x_s = rnd->x_s;
 #endif
 
 #ifdef TRACE
-  dump(x_s, sizeof(x_s), "session srv x_s ");
+  dump(x_s, crypto_scalarmult_SCALARBYTES, "session srv x_s ");
 #endif
   // X_s := g^x_s;
-  crypto_scalarmult_ristretto255_base(resp->X_s, x_s);
+  if(ops!=NULL) memcpy(resp->X_s, ops->X_s, sizeof resp->X_s);
+#ifndef CFRG_TEST_VEC
+  else if(X_s!=NULL) memcpy(resp->X_s, X_s, sizeof resp->X_s);
+#endif
+  else ristretto_scalarmult_base(resp->X_s, x_s);
 
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(resp->X_s, sizeof(resp->X_s), "server_keyshare");
@@ -1261,16 +1935,12 @@ int opaque_CreateCredentialResponse(const uint8_t _pub[OPAQUE_USER_SESSION_PUBLI
   // mixing in things from the irtf cfrg spec
   char preamble[crypto_hash_sha512_BYTES];
   crypto_hash_sha512_state preamble_state;
-  calc_preamble(preamble, &preamble_state, rec->recU.client_public_key, pkS, _pub, resp, ctx, ctx_len, (Opaque_Ids*) ids);
-  Opaque_Keys keys;
-  if(-1==sodium_mlock(&keys,sizeof(keys))) {
-    sodium_munlock(x_s,sizeof x_s);
-    return -1;
-  }
+  memcpy(&preamble_state, preamble_prefix, sizeof preamble_state);
+  calc_preamble(preamble, &preamble_state, recU->client_public_key, pkS, _pub, resp, (Opaque_Ids*) ids);
 
   // (d) Computes K := KE(p_s, x_s, P_u, X_u) and SK := f_K(0);
 #ifdef TRACE
-  dump(rec->skS,crypto_scalarmult_SCALARBYTES, "rec->skS ");
+  dump(skS,crypto_scalarmult_SCALARBYTES, "skS ");
   dump(x_s,crypto_scalarmult_SCALARBYTES, "x_s ");
   //dump(rec->pkU,crypto_scalarmult_BYTES, "rec->pkU ");
   dump(pub->X_u,crypto_scalarmult_BYTES, "pub->X_u ");
@@ -1279,26 +1949,27 @@ int opaque_CreateCredentialResponse(const uint8_t _pub[OPAQUE_USER_SESSION_PUBLI
   //                server_private_key, ke1.client_keyshare,
   //                server_secret, client_public_key)
   // 6. Km2, Km3, session_key = DeriveKeys(ikm, preamble)
-  if(0!=server_3dh(&keys, rec->skS, x_s, rec->recU.client_public_key, pub->X_u, preamble)) {
-    sodium_munlock(x_s, sizeof(x_s));
-    sodium_munlock(&keys,sizeof(keys));
+  const int ret = (ops!=NULL) ? derive_keys(keys, ops->ikm, preamble)
+                              : server_3dh(keys, skS, x_s, recU->client_public_key,
+                                           (hot!=NULL) ? &hot->client_public_key : NULL, pub->X_u, preamble);
+  if(0!=ret) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(x_s, sizeof(x_s));
 #if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(keys.sk, sizeof(keys.sk), "srv sk ");
-  dump(keys.km2,OPAQUE_HMAC_SHA512_KEYBYTES,"session srv km2 ");
-  dump(keys.km3,OPAQUE_HMAC_SHA512_KEYBYTES,"session srv km3 ");
+  dump(keys->sk, sizeof(keys->sk), "srv sk ");
+  dump(keys->km2,OPAQUE_HMAC_SHA512_KEYBYTES,"session srv km2 ");
+  dump(keys->km3,OPAQUE_HMAC_SHA512_KEYBYTES,"session srv km3 ");
 #endif
 
   // 7. server_mac = MAC(Km2, Hash(preamble))
-  opaque_hmacsha512(keys.km2,
+  opaque_hmacsha512(keys->km2,
                     (uint8_t*)preamble,                  // in
                     crypto_hash_sha512_BYTES,            // len(in)
                     resp->auth);                         // out
 #ifdef TRACE
   dump(resp->auth, sizeof resp->auth, "resp->auth ");
-  dump(keys.km2, sizeof keys.km2, "km2 ");
+  dump(keys->km2, sizeof keys->km2, "km2 ");
 #endif
 
   // 8. expected_client_mac = MAC(Km3, Hash(concat(preamble, server_mac))
@@ -1309,14 +1980,14 @@ int opaque_CreateCredentialResponse(const uint8_t _pub[OPAQUE_USER_SESSION_PUBLI
   dump((uint8_t*)preamble, sizeof preamble, "auth preamble");
 #endif
   if(NULL!=authU) {
-    opaque_hmacsha512(keys.km3,                       // key
+    opaque_hmacsha512(keys->km3,                      // key
                      (uint8_t*)preamble,              // in
                      crypto_hash_sha512_BYTES,        // len(in)
                      authU);                          // out
   }
 
-  memcpy(sk,keys.sk,sizeof(keys.sk));
-  sodium_munlock(&keys,sizeof(keys));
+  memcpy(sk,keys->sk,sizeof(keys->sk));
+  opaque_scratch_release(mark);
 
 #ifdef TRACE
   dump(resp->auth, sizeof(resp->auth), "session srv auth ");
@@ -1327,75 +1998,406 @@ int opaque_CreateCredentialResponse(const uint8_t _pub[OPAQUE_USER_SESSION_PUBLI
   return 0;
 }
 
-// more or less corresponds to RecoverCredentials in the irtf draft
-// 3. On β, X_s and c from S, U proceeds as follows:
-// (a) Checks that β ∈ G ∗ . If not, outputs (abort, sid , ssid ) and halts;
-// (b) Computes rw := H(key, pw|β^1/r );
-// (c) Computes AuthDec_rw(c). If the result is ⊥, outputs (abort, sid , ssid ) and halts.
-//     Otherwise sets (p_u, P_u, P_s ) := AuthDec_rw (c);
-// (d) Computes K := KE(p_u, x_u, P_s, X_s) and SK := f_K(0);
-// (e) Outputs (sid, ssid, SK).
-int opaque_RecoverCredentials(const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
-                              const uint8_t *_sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
-                              const uint8_t *ctx, const uint16_t ctx_len,
-                              const Opaque_Ids *ids0,
-                              uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
-                              uint8_t authU[crypto_auth_hmacsha512_BYTES],
-                              uint8_t export_key[crypto_hash_sha512_BYTES]) {
+int opaque_CreateCredentialResponse(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN], const uint8_t _rec[OPAQUE_USER_RECORD_LEN], const Opaque_Ids *ids, const uint8_t *ctx, const uint16_t ctx_len, uint8_t resp[OPAQUE_SERVER_SESSION_LEN], uint8_t sk[OPAQUE_SHARED_SECRETBYTES], uint8_t authU[crypto_auth_hmacsha512_BYTES]) {
+  Opaque_UserRecord *rec = (Opaque_UserRecord *) _rec;
 
-  Opaque_ServerSession *resp = (Opaque_ServerSession *) _resp;
-  Opaque_UserSession_Secret *sec = (Opaque_UserSession_Secret *) _sec;
+  // recalc server_public_key as we need it for the next step
+  uint8_t pkS[crypto_scalarmult_BYTES];
+  ristretto_scalarmult_base(pkS, rec->skS);
+
+  crypto_hash_sha512_state preamble_prefix;
+  calc_preamble_prefix(&preamble_prefix, ctx, ctx_len);
+
+  const size_t mark = opaque_scratch_mark();
+  Opaque_Keyshare *ks = opaque_scratch_alloc(sizeof(Opaque_Keyshare));
+  if(ks==NULL) return -1;
+  const uint8_t *X_s = ks->X_s;
+  if(0!=opaque_keyshares_pop(ks)) {
+    randombytes((uint8_t*) &ks->rnd, sizeof(Opaque_ServerRandom));
+    X_s = NULL;
+  }
+
+  const int ret = create_credential_response(pub, rec->kU, &rec->recU, ids, rec->skS, pkS, &preamble_prefix, &ks->rnd, X_s, NULL, NULL, resp, sk, authU);
+  opaque_scratch_release(mark);
+  return ret;
+}
+
+// the values a login derives from rec alone
+static int hot_record(const Opaque_UserRecord *rec, Opaque_HotRecord *hot) {
+  ristretto_point P;
+  if(0!=ristretto_decode(&P, rec->recU.client_public_key)) return -1;
+  ristretto_table_init(&hot->client_public_key, &P);
+  if(0!=ristretto_scalarmult_base(hot->pkS, rec->skS)) return -1;
+  hkdf_keyed(&hot->masking_state, rec->recU.masking_key);
+  return 0;
+}
+
+int opaque_CreateCredentialResponseCached(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                          const uint8_t _rec[OPAQUE_USER_RECORD_LEN],
+                                          const Opaque_Ids *ids,
+                                          Opaque_HotCache *cache,
+                                          const uint8_t *ctx, const uint16_t ctx_len,
+                                          uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                          uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                          uint8_t authU[crypto_auth_hmacsha512_BYTES]) {
+  const Opaque_UserRecord *rec = (const Opaque_UserRecord *) _rec;
+  const uint64_t start = opaque_hotcache_clock();
+  uint8_t tag[OPAQUE_HOTCACHE_TAGBYTES];
+  opaque_hotcache_tag(cache, _rec, tag);
+
+  const size_t mark = opaque_scratch_mark();
+  Opaque_HotRecord *hot = opaque_scratch_alloc(sizeof(Opaque_HotRecord));
+  Opaque_Keyshare *ks = opaque_scratch_alloc(sizeof(Opaque_Keyshare));
+  if(hot==NULL || ks==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  const int hit = (0==opaque_hotcache_get(cache, tag, hot));
+  if(!hit) {
+    if(0!=hot_record(rec, hot)) {
+      opaque_scratch_release(mark);
+      return -1;
+    }
+    opaque_hotcache_put(cache, tag, hot);
+  }
+
+  crypto_hash_sha512_state preamble_prefix;
+  calc_preamble_prefix(&preamble_prefix, ctx, ctx_len);
+
+  const uint8_t *X_s = ks->X_s;
+  if(0!=opaque_keyshares_pop(ks)) {
+    randombytes((uint8_t*) &ks->rnd, sizeof(Opaque_ServerRandom));
+    X_s = NULL;
+  }
+
+  const int ret = create_credential_response(pub, rec->kU, &rec->recU, ids, rec->skS, hot->pkS, &preamble_prefix, &ks->rnd, X_s, NULL, hot, resp, sk, authU);
+  opaque_scratch_release(mark);
+  opaque_hotcache_timing(cache, tag, hit, start);
+  return ret;
+}
+
+int opaque_CreateServerSetup(const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                             const uint8_t *ctx, const uint16_t ctx_len,
+                             uint8_t _setup[OPAQUE_SERVER_SETUP_LEN]) {
+  Opaque_ServerSetup *setup = (Opaque_ServerSetup *) _setup;
+
+  memcpy(setup->skS, skS, crypto_scalarmult_SCALARBYTES);
+  if(0!=ristretto_scalarmult_base(setup->pkS, skS)) return -1;
+
+  crypto_hash_sha512_state preamble_prefix;
+  calc_preamble_prefix(&preamble_prefix, ctx, ctx_len);
+  memcpy(&setup->preamble_prefix, &preamble_prefix, sizeof preamble_prefix);
+  sodium_memzero(&preamble_prefix, sizeof preamble_prefix);
 
 #ifdef TRACE
-  dump(sec->pwdU,sec->pwdU_len, "session user finish pwdU ");
-  dump(_sec,OPAQUE_USER_SESSION_SECRET_LEN, "session user finish sec ");
-  dump(_resp,OPAQUE_SERVER_SESSION_LEN, "session user finish resp ");
+  dump(setup->pkS, crypto_scalarmult_BYTES, "setup pkS ");
 #endif
+  return 0;
+}
 
-  // 1. (client_private_key, server_public_key, export_key) =
-  //  RecoverCredentials(state.password, state.blind, ke2.CredentialResponse,
-  //                     server_identity, client_identity)
-  // 1.1. y = Finalize(password, blind, response.data, nil)
-  // 1.2. randomized_pwd = Extract("", concat(y, Harden(y, params)))
-  uint8_t N[crypto_core_ristretto255_BYTES];
-  if(-1==sodium_mlock(N, sizeof N)) return -1;
-  // 1. N = Unblind(blind, response.data)
-  if(0!=oprf_Unblind(sec->blind, resp->Z, N)) {
-    sodium_munlock(N, sizeof N);
+int opaque_CreateCredentialResponseWithSetup(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                             const uint8_t _rec[OPAQUE_USER_RECORD_LEN],
+                                             const Opaque_Ids *ids,
+                                             const uint8_t _setup[OPAQUE_SERVER_SETUP_LEN],
+                                             uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                             uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                             uint8_t authU[crypto_auth_hmacsha512_BYTES]) {
+  Opaque_UserRecord *rec = (Opaque_UserRecord *) _rec;
+  const Opaque_ServerSetup *setup = (const Opaque_ServerSetup *) _setup;
+
+  // the record must have been created with the same server key
+  if(0!=sodium_memcmp(rec->skS, setup->skS, crypto_scalarmult_SCALARBYTES)) return -1;
+
+  // the setup buffer is packed and might be unaligned
+  crypto_hash_sha512_state preamble_prefix;
+  memcpy(&preamble_prefix, &setup->preamble_prefix, sizeof preamble_prefix);
+
+  const size_t mark = opaque_scratch_mark();
+  Opaque_Keyshare *ks = opaque_scratch_alloc(sizeof(Opaque_Keyshare));
+  if(ks==NULL) return -1;
+  const uint8_t *X_s = ks->X_s;
+  if(0!=opaque_keyshares_pop(ks)) {
+    randombytes((uint8_t*) &ks->rnd, sizeof(Opaque_ServerRandom));
+    X_s = NULL;
+  }
+
+  const int ret = create_credential_response(pub, rec->kU, &rec->recU, ids, setup->skS, setup->pkS, &preamble_prefix, &ks->rnd, X_s, NULL, NULL, resp, sk, authU);
+  opaque_scratch_release(mark);
+  return ret;
+}
+
+static void store_key_id(uint8_t out[4], const uint32_t key_id) {
+  out[0] = (uint8_t) (key_id >> 24);
+  out[1] = (uint8_t) (key_id >> 16);
+  out[2] = (uint8_t) (key_id >> 8);
+  out[3] = (uint8_t) key_id;
+}
+
+static uint32_t record_key_id(const uint8_t key_id[4]) {
+  return ((uint32_t) key_id[0] << 24) | ((uint32_t) key_id[1] << 16) |
+         ((uint32_t) key_id[2] << 8) | (uint32_t) key_id[3];
+}
+
+int opaque_UserRecordToV2(const Opaque_Keyring *keyring,
+                          const uint8_t _rec[OPAQUE_USER_RECORD_LEN],
+                          uint8_t _rec2[OPAQUE_USER_RECORD_V2_LEN]) {
+  const Opaque_UserRecord *rec = (const Opaque_UserRecord *) _rec;
+  Opaque_UserRecordV2 *rec2 = (Opaque_UserRecordV2 *) _rec2;
+  uint32_t key_id;
+  if(0!=opaque_keyring_find(keyring, rec->skS, &key_id)) return -1;
+  store_key_id(rec2->key_id, key_id);
+  memcpy(rec2->kU, rec->kU, sizeof rec2->kU);
+  memcpy(&rec2->recU, &rec->recU, sizeof rec2->recU);
+  return 0;
+}
+
+int opaque_UserRecordFromV2(const Opaque_Keyring *keyring,
+                            const uint8_t _rec2[OPAQUE_USER_RECORD_V2_LEN],
+                            uint8_t _rec[OPAQUE_USER_RECORD_LEN]) {
+  const Opaque_UserRecordV2 *rec2 = (const Opaque_UserRecordV2 *) _rec2;
+  Opaque_UserRecord *rec = (Opaque_UserRecord *) _rec;
+  uint8_t pkS[crypto_scalarmult_BYTES];
+  if(0!=opaque_keyring_get(keyring, record_key_id(rec2->key_id), rec->skS, pkS)) return -1;
+  memcpy(rec->kU, rec2->kU, sizeof rec->kU);
+  memcpy(&rec->recU, &rec2->recU, sizeof rec->recU);
+  return 0;
+}
+
+int opaque_CreateCredentialResponseV2(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                      const uint8_t _rec2[OPAQUE_USER_RECORD_V2_LEN],
+                                      const Opaque_Ids *ids,
+                                      const Opaque_Keyring *keyring,
+                                      const uint8_t *ctx, const uint16_t ctx_len,
+                                      uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                      uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                      uint8_t authU[crypto_auth_hmacsha512_BYTES]) {
+  const Opaque_UserRecordV2 *rec2 = (const Opaque_UserRecordV2 *) _rec2;
+
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *skS = opaque_scratch_alloc(crypto_scalarmult_SCALARBYTES);
+  Opaque_Keyshare *ks = opaque_scratch_alloc(sizeof(Opaque_Keyshare));
+  uint8_t pkS[crypto_scalarmult_BYTES];
+  if(skS==NULL || ks==NULL || 0!=opaque_keyring_get(keyring, record_key_id(rec2->key_id), skS, pkS)) {
+    opaque_scratch_release(mark);
     return -1;
   }
-#if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(N, sizeof N, "unblinded");
-#endif
 
-  // rw = H(pw, β^(1/r))
-  uint8_t rwdU[OPAQUE_RWDU_BYTES];
-  if(-1==sodium_mlock(rwdU,sizeof rwdU)) {
-    sodium_munlock(N, sizeof N);
+  crypto_hash_sha512_state preamble_prefix;
+  calc_preamble_prefix(&preamble_prefix, ctx, ctx_len);
+
+  const uint8_t *X_s = ks->X_s;
+  if(0!=opaque_keyshares_pop(ks)) {
+    randombytes((uint8_t*) &ks->rnd, sizeof(Opaque_ServerRandom));
+    X_s = NULL;
+  }
+
+  const int ret = create_credential_response(pub, rec2->kU, &rec2->recU, ids, skS, pkS, &preamble_prefix, &ks->rnd, X_s, NULL, NULL, resp, sk, authU);
+  opaque_scratch_release(mark);
+  return ret;
+}
+
+int opaque_UserRecordToSeeded(const Opaque_Keyring *keyring,
+                              Opaque_OprfSeed *oprfseed,
+                              const uint8_t *credid, const uint16_t credid_len,
+                              const uint8_t _rec[OPAQUE_USER_RECORD_LEN],
+                              uint8_t _rec3[OPAQUE_USER_RECORD_SEEDED_LEN]) {
+  const Opaque_UserRecord *rec = (const Opaque_UserRecord *) _rec;
+  Opaque_UserRecordSeeded *rec3 = (Opaque_UserRecordSeeded *) _rec3;
+  uint8_t kU[crypto_core_ristretto255_SCALARBYTES];
+  uint32_t key_id;
+  // a record with a random kU can not be converted
+  if(0!=derive_oprf_key(oprfseed, credid, credid_len, kU)) return -1;
+  const int same = sodium_memcmp(kU, rec->kU, sizeof kU);
+  sodium_memzero(kU, sizeof kU);
+  if(same!=0) return -1;
+  if(0!=opaque_keyring_find(keyring, rec->skS, &key_id)) return -1;
+  store_key_id(rec3->key_id, key_id);
+  memcpy(&rec3->recU, &rec->recU, sizeof rec3->recU);
+  return 0;
+}
+
+int opaque_UserRecordFromSeeded(const Opaque_Keyring *keyring,
+                                Opaque_OprfSeed *oprfseed,
+                                const uint8_t *credid, const uint16_t credid_len,
+                                const uint8_t _rec3[OPAQUE_USER_RECORD_SEEDED_LEN],
+                                uint8_t _rec[OPAQUE_USER_RECORD_LEN]) {
+  const Opaque_UserRecordSeeded *rec3 = (const Opaque_UserRecordSeeded *) _rec3;
+  Opaque_UserRecord *rec = (Opaque_UserRecord *) _rec;
+  uint8_t pkS[crypto_scalarmult_BYTES];
+  if(0!=derive_oprf_key(oprfseed, credid, credid_len, rec->kU) ||
+     0!=opaque_keyring_get(keyring, record_key_id(rec3->key_id), rec->skS, pkS)) {
+    sodium_memzero(rec, OPAQUE_USER_RECORD_LEN);
     return -1;
   }
-  // 1.2. y = Finalize(pwdU, N, "OPAQUE01")
-  if(0!=oprf_Finalize(sec->pwdU, sec->pwdU_len, N, rwdU)) {
-    sodium_munlock(N, sizeof N);
-    sodium_munlock(rwdU,sizeof rwdU);
+  memcpy(&rec->recU, &rec3->recU, sizeof rec->recU);
+  return 0;
+}
+
+int opaque_FakeUserRecordSeeded(const Opaque_OprfSeed *oprfseed,
+                                const uint32_t key_id,
+                                const uint8_t *credid, const uint16_t credid_len,
+                                uint8_t _rec3[OPAQUE_USER_RECORD_SEEDED_LEN]) {
+  Opaque_UserRecordSeeded *rec3 = (Opaque_UserRecordSeeded *) _rec3;
+  if(oprfseed==NULL || credid==NULL || credid_len==0) return -1;
+  // masking_key || client_public_key hash || envelope
+  uint8_t fake[crypto_hash_sha512_BYTES + crypto_core_ristretto255_HASHBYTES + sizeof(Opaque_Envelope)];
+  if(0!=oprfseed_expand(oprfseed, credid, credid_len, "FakeRecord", fake, sizeof fake)) return -1;
+  store_key_id(rec3->key_id, key_id);
+  memcpy(rec3->recU.masking_key, fake, sizeof rec3->recU.masking_key);
+  // a valid point without a scalar multiplication
+  ristretto_point P;
+  ristretto_from_hash(&P, fake + crypto_hash_sha512_BYTES);
+  ristretto_encode(rec3->recU.client_public_key, &P);
+  memcpy(&rec3->recU.envelope, fake + crypto_hash_sha512_BYTES + crypto_core_ristretto255_HASHBYTES,
+         sizeof rec3->recU.envelope);
+  sodium_memzero(fake, sizeof fake);
+  return 0;
+}
+
+int opaque_CreateCredentialResponseSeeded(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                          const uint8_t _rec3[OPAQUE_USER_RECORD_SEEDED_LEN],
+                                          const Opaque_Ids *ids,
+                                          const Opaque_Keyring *keyring,
+                                          Opaque_OprfSeed *oprfseed,
+                                          const uint8_t *credid, const uint16_t credid_len,
+                                          const uint8_t *ctx, const uint16_t ctx_len,
+                                          uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                          uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                          uint8_t authU[crypto_auth_hmacsha512_BYTES]) {
+  const Opaque_UserRecordSeeded *rec3 = (const Opaque_UserRecordSeeded *) _rec3;
+
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *skS = opaque_scratch_alloc(crypto_scalarmult_SCALARBYTES);
+  uint8_t *kU = opaque_scratch_alloc(crypto_core_ristretto255_SCALARBYTES);
+  Opaque_Keyshare *ks = opaque_scratch_alloc(sizeof(Opaque_Keyshare));
+  uint8_t pkS[crypto_scalarmult_BYTES];
+  if(skS==NULL || kU==NULL || ks==NULL ||
+     0!=opaque_keyring_get(keyring, record_key_id(rec3->key_id), skS, pkS) ||
+     0!=derive_oprf_key(oprfseed, credid, credid_len, kU)) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(N,sizeof N);
 
-#if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(rwdU, sizeof rwdU, "rwdU");
-#endif
+  crypto_hash_sha512_state preamble_prefix;
+  calc_preamble_prefix(&preamble_prefix, ctx, ctx_len);
 
-  // 1.3. masking_key = HKDF-Expand(randomized_pwd, "MaskingKey", Nh)
-  const uint8_t masking_key_info[10]="MaskingKey";
-  uint8_t masking_key[crypto_hash_sha512_BYTES];
-  if(-1==sodium_mlock(masking_key,sizeof masking_key)) {
-    sodium_munlock(rwdU,sizeof rwdU);
+  const uint8_t *X_s = ks->X_s;
+  if(0!=opaque_keyshares_pop(ks)) {
+    randombytes((uint8_t*) &ks->rnd, sizeof(Opaque_ServerRandom));
+    X_s = NULL;
+  }
+
+  const int ret = create_credential_response(pub, kU, &rec3->recU, ids, skS, pkS, &preamble_prefix, &ks->rnd, X_s, NULL, NULL, resp, sk, authU);
+  opaque_scratch_release(mark);
+  return ret;
+}
+
+int opaque_CreateCredentialResponseBatch(const size_t n,
+                                         const uint8_t *pubs,
+                                         const uint8_t *recs,
+                                         const Opaque_Ids ids[],
+                                         const uint8_t *ctx, const uint16_t ctx_len,
+                                         uint8_t *resps,
+                                         uint8_t *sks,
+                                         uint8_t *authUs,
+                                         int rets[]) {
+  // the context dependent part of the transcript is the same for the
+  // whole batch
+  crypto_hash_sha512_state preamble_prefix;
+  calc_preamble_prefix(&preamble_prefix, ctx, ctx_len);
+
+  // servers usually have only one long-term key, so pkS is only
+  // recalculated when a records skS differs from the previous one
+  uint8_t skS[crypto_scalarmult_SCALARBYTES];
+  uint8_t pkS[crypto_scalarmult_BYTES];
+  int have_pkS = 0;
+
+  size_t failed = 0, i, j;
+  for(i=0;i<n;i+=OPAQUE_BATCH_CHUNK) {
+    const size_t chunk = (n-i < OPAQUE_BATCH_CHUNK) ? n-i : OPAQUE_BATCH_CHUNK;
+
+    // draw the randomness of a whole chunk with one call
+    const size_t mark = opaque_scratch_mark();
+    Opaque_ServerRandom *rnd = opaque_scratch_alloc(chunk * sizeof(Opaque_ServerRandom));
+    Opaque_ServerGroupOps *ops = opaque_scratch_alloc(OPAQUE_BATCH_LANES * sizeof(Opaque_ServerGroupOps));
+    if(rnd!=NULL) randombytes((uint8_t*) rnd, chunk * sizeof(Opaque_ServerRandom));
+
+    int have_ops = 0;
+    for(j=i;j<i+chunk;j++) {
+      const uint8_t *_rec = recs + j*OPAQUE_USER_RECORD_LEN;
+      const Opaque_UserRecord *rec = (const Opaque_UserRecord *) _rec;
+      uint8_t *sk = sks + j*OPAQUE_SHARED_SECRETBYTES;
+      uint8_t *authU = (authUs==NULL) ? NULL : authUs + j*crypto_auth_hmacsha512_BYTES;
+
+      // the group operations of the next OPAQUE_BATCH_LANES logins
+      if((j-i) % OPAQUE_BATCH_LANES == 0 && rnd!=NULL && ops!=NULL) {
+        const size_t m = (i+chunk-j < OPAQUE_BATCH_LANES) ? i+chunk-j : OPAQUE_BATCH_LANES;
+        const uint8_t *gpubs[OPAQUE_BATCH_LANES], *grecs[OPAQUE_BATCH_LANES];
+        size_t k;
+        for(k=0;k<m;k++) {
+          gpubs[k] = pubs + (j+k)*OPAQUE_USER_SESSION_PUBLIC_LEN;
+          grecs[k] = recs + (j+k)*OPAQUE_USER_RECORD_LEN;
+        }
+        have_ops = (0==server_group_ops(m, gpubs, grecs, &rnd[j-i], ops));
+      }
+
+      int ret = -1;
+      if(rnd!=NULL && have_ops) {
+        if(!have_pkS || 0!=sodium_memcmp(skS, rec->skS, sizeof skS)) {
+          memcpy(skS, rec->skS, sizeof skS);
+          have_pkS = (0==ristretto_scalarmult_base(pkS, skS));
+        }
+        if(have_pkS) {
+          ret = create_credential_response(pubs + j*OPAQUE_USER_SESSION_PUBLIC_LEN, rec->kU, &rec->recU, &ids[j],
+                                           skS, pkS, &preamble_prefix, &rnd[j-i], NULL,
+                                           &ops[(j-i) % OPAQUE_BATCH_LANES], NULL, resps + j*OPAQUE_SERVER_SESSION_LEN, sk, authU);
+        }
+      }
+      if(ret!=0) {
+        sodium_memzero(sk, OPAQUE_SHARED_SECRETBYTES);
+        failed++;
+      }
+      if(rets!=NULL) rets[j] = ret;
+    }
+    opaque_scratch_release(mark);
+  }
+  sodium_memzero(skS, sizeof skS);
+
+  return (int) failed;
+}
+
+// RecoverCredentials and ClientFinalize from randomized_pwd on, the
+// part of opaque_RecoverCredentials() after the key stretching
+static int recover_credentials(const Opaque_ServerSession *resp,
+                               const Opaque_UserSession_Secret *sec,
+                               const uint8_t *ctx, const uint16_t ctx_len,
+                               const Opaque_Ids *ids0,
+                               const uint8_t rwdU[OPAQUE_RWDU_BYTES],
+                               uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                               uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                               uint8_t export_key[crypto_hash_sha512_BYTES]) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *masking_key = opaque_scratch_alloc(crypto_hash_sha512_BYTES);
+  uint8_t *response_pad = opaque_scratch_alloc(crypto_scalarmult_BYTES+sizeof(Opaque_Envelope));
+  Opaque_Envelope *env = opaque_scratch_alloc(sizeof(Opaque_Envelope));
+  uint8_t *auth_key = opaque_scratch_alloc(OPAQUE_HMAC_SHA512_KEYBYTES);
+  uint8_t *seed = opaque_scratch_alloc(crypto_core_ristretto255_SCALARBYTES);
+  uint8_t *client_secret_key = opaque_scratch_alloc(crypto_scalarmult_SCALARBYTES);
+  Opaque_Keys *keys = opaque_scratch_alloc(sizeof(Opaque_Keys));
+  crypto_auth_hmacsha512_state *rwd_state = opaque_scratch_alloc(sizeof(crypto_auth_hmacsha512_state));
+  crypto_auth_hmacsha512_state *masking_state = opaque_scratch_alloc(sizeof(crypto_auth_hmacsha512_state));
+  if(masking_key==NULL || response_pad==NULL || env==NULL ||
+     auth_key==NULL || seed==NULL || client_secret_key==NULL || keys==NULL ||
+     rwd_state==NULL || masking_state==NULL) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  crypto_kdf_hkdf_sha512_expand(masking_key, crypto_hash_sha512_BYTES,
-                                (const char*) masking_key_info, sizeof masking_key_info,
-                                rwdU);
+  // 1.3. masking_key = HKDF-Expand(randomized_pwd, "MaskingKey", Nh)
+  hkdf_keyed(rwd_state, rwdU);
+  const uint8_t masking_key_info[10]="MaskingKey";
+  hkdf_expand(masking_key, crypto_hash_sha512_BYTES,
+              masking_key_info, sizeof masking_key_info,
+              rwd_state);
 
   // 1.4. credential_response_pad = Expand(masking_key,
   //        concat(response.masking_nonce, "CredentialResponsePad"), Npk + Ne)
@@ -1409,105 +2411,71 @@ int opaque_RecoverCredentials(const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
       .dst = "CredentialResponsePad"};
   memcpy(masking_info.nonce, resp->masking_nonce, sizeof masking_info.nonce);
 
-  uint8_t response_pad[crypto_scalarmult_BYTES+sizeof(Opaque_Envelope)];
-  if(-1==sodium_mlock(response_pad,sizeof response_pad)) {
-    sodium_munlock(masking_key,sizeof masking_key);
-    sodium_munlock(rwdU,sizeof rwdU);
-    return -1;
-  }
-  crypto_kdf_hkdf_sha512_expand(response_pad, sizeof response_pad,
-                                (const char*) &masking_info, sizeof masking_info,
-                                masking_key);
-  sodium_munlock(masking_key,sizeof masking_key);
+  hkdf_keyed(masking_state, masking_key);
+  hkdf_expand(response_pad, crypto_scalarmult_BYTES+sizeof(Opaque_Envelope),
+              (const uint8_t*) &masking_info, sizeof masking_info,
+              masking_state);
 
   // 1.5. concat(server_public_key, envelope) = xor(credential_response_pad,
   //                                            response.masked_response)
-  Opaque_Envelope env;
-  if(-1==sodium_mlock(&env,sizeof env)) {
-    sodium_mlock(response_pad,sizeof response_pad);
-    sodium_munlock(rwdU,sizeof rwdU);
-    return -1;
-  }
-  uint8_t server_public_key[crypto_scalarmult_BYTES], *env_ptr=(uint8_t*) &env;
+  uint8_t server_public_key[crypto_scalarmult_BYTES], *env_ptr=(uint8_t*) env;
   unsigned i;
   for(i=0;i<crypto_scalarmult_BYTES;i++)
     server_public_key[i] = response_pad[i] ^ resp->masked_response[i];
   for(;i<crypto_scalarmult_BYTES+sizeof(Opaque_Envelope);i++)
     env_ptr[i-crypto_scalarmult_BYTES] = response_pad[i] ^ resp->masked_response[i];
-  sodium_mlock(response_pad,sizeof response_pad);
 
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(server_public_key, sizeof server_public_key, "server_public_key");
-  dump(env.nonce, sizeof env.nonce, "env.nonce");
-  dump(env.auth_tag, sizeof env.auth_tag, "env.auth_tag");
+  dump(env->nonce, sizeof env->nonce, "env.nonce");
+  dump(env->auth_tag, sizeof env->auth_tag, "env.auth_tag");
 #endif
 
   // 1.6. (client_private_key, export_key) =
   //  Recover(randomized_pwd, server_public_key, envelope,
   //                  server_identity, client_identity)
 
-  uint8_t concated[OPAQUE_ENVELOPE_NONCEBYTES+10],
-    *label = concated+OPAQUE_ENVELOPE_NONCEBYTES;
-  memcpy(concated, env.nonce, OPAQUE_ENVELOPE_NONCEBYTES);
-
   // 1.6.1. auth_key = Expand(randomized_pwd, concat(envelope.nonce, "AuthKey"), Nh)
-  uint8_t auth_key[OPAQUE_HMAC_SHA512_KEYBYTES];
-  if(-1==sodium_mlock(auth_key, sizeof auth_key)) {
-    sodium_munlock(rwdU,sizeof rwdU);
+  // 1.6.2. export_key = Expand(randomized_pwd, concat(envelope.nonce, "ExportKey", Nh)
+  // 1.6.3. seed = Expand(randomized_pwd, concat(envelope.nonce, "PrivateKey"), Nseed)
+  // all of these are expanded from rwdU in parallel
+  uint8_t auth_key_info[OPAQUE_ENVELOPE_NONCEBYTES+7],
+    seed_info[OPAQUE_ENVELOPE_NONCEBYTES+10],
+    export_key_info[OPAQUE_ENVELOPE_NONCEBYTES+9];
+  memcpy(auth_key_info, env->nonce, OPAQUE_ENVELOPE_NONCEBYTES);
+  memcpy(auth_key_info+OPAQUE_ENVELOPE_NONCEBYTES, "AuthKey", 7);
+  memcpy(seed_info, env->nonce, OPAQUE_ENVELOPE_NONCEBYTES);
+  memcpy(seed_info+OPAQUE_ENVELOPE_NONCEBYTES, "PrivateKey", 10);
+  memcpy(export_key_info, env->nonce, OPAQUE_ENVELOPE_NONCEBYTES);
+  memcpy(export_key_info+OPAQUE_ENVELOPE_NONCEBYTES, "ExportKey", 9);
+
+  uint8_t *res[3] = {auth_key, seed, export_key};
+  const size_t len[3] = {OPAQUE_HMAC_SHA512_KEYBYTES, crypto_core_ristretto255_SCALARBYTES,
+                         crypto_hash_sha512_BYTES};
+  const uint8_t *info[3] = {auth_key_info, seed_info, export_key_info};
+  const size_t info_len[3] = {sizeof auth_key_info, sizeof seed_info, sizeof export_key_info};
+  const crypto_auth_hmacsha512_state *prk[3] = {rwd_state, rwd_state, rwd_state};
+  if(0!=hkdf_expand_mb((NULL!=export_key)?3:2, res, len, info, info_len, prk)) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  memcpy(label, "AuthKey", 7);
-  crypto_kdf_hkdf_sha512_expand(auth_key, sizeof auth_key,
-                                (const char*) concated, OPAQUE_ENVELOPE_NONCEBYTES+7,
-                                rwdU);
-
 #ifdef TRACE
-  dump(auth_key,sizeof auth_key, "auth_key ");
+  dump(auth_key,OPAQUE_HMAC_SHA512_KEYBYTES, "auth_key ");
 #endif
-
-  if(NULL!=export_key) {
-    // 1.6.2. export_key = Expand(randomized_pwd, concat(envelope.nonce, "ExportKey", Nh)
-    memcpy(label, "ExportKey", 9);
 #if (defined TRACE || defined CFRG_TEST_VEC)
-    dump(concated, OPAQUE_ENVELOPE_NONCEBYTES+9, "export_key_info");
+  if(NULL!=export_key) dump(export_key_info, sizeof export_key_info, "export_key_info");
 #endif
-    crypto_kdf_hkdf_sha512_expand(export_key, crypto_hash_sha512_BYTES,
-                                  (const char*) concated, OPAQUE_ENVELOPE_NONCEBYTES+9,
-                                  rwdU);
 #ifdef TRACE
-    dump(export_key,crypto_hash_sha512_BYTES, "export_key ");
+  if(NULL!=export_key) dump(export_key,crypto_hash_sha512_BYTES, "export_key ");
 #endif
-  }
-
-  // 1.6.3. seed = Expand(randomized_pwd, concat(envelope.nonce, "PrivateKey"), Nseed)
-  memcpy(label, "PrivateKey", 10);
-  uint8_t seed[crypto_core_ristretto255_SCALARBYTES];
-  if(-1==sodium_mlock(seed, sizeof seed)) {
-    sodium_munlock(auth_key, sizeof auth_key);
-    sodium_munlock(rwdU,sizeof rwdU);
-    return -1;
-  }
-  crypto_kdf_hkdf_sha512_expand(seed, crypto_core_ristretto255_SCALARBYTES,
-                                (const char*) concated, OPAQUE_ENVELOPE_NONCEBYTES+10,
-                                rwdU);
-  sodium_munlock(rwdU,sizeof rwdU);
 
   // 1.6.4. client_private_key, client_public_key = DeriveAuthKeyPair(seed)
-  uint8_t client_secret_key[crypto_scalarmult_SCALARBYTES];
-  if(-1==sodium_mlock(client_secret_key, sizeof client_secret_key)) {
-    sodium_munlock(seed, sizeof seed);
-    sodium_munlock(auth_key, sizeof auth_key);
-    return -1;
-  }
   const uint8_t dst[24]="OPAQUE-DeriveAuthKeyPair";
   uint8_t client_public_key[crypto_scalarmult_BYTES];
-  if(0!=deriveKeyPair(seed, sizeof seed, dst, sizeof dst, client_secret_key, client_public_key)) {
-    sodium_munlock(seed, sizeof seed);
-    sodium_munlock(client_secret_key, sizeof client_secret_key);
-    sodium_munlock(auth_key, sizeof auth_key);
+  if(0!=deriveKeyPair(seed, crypto_core_ristretto255_SCALARBYTES, dst, sizeof dst, client_secret_key, client_public_key)) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(seed, sizeof seed);
 #if (defined CFRG_TEST_VEC || defined TRACE)
   dump(client_secret_key, crypto_scalarmult_SCALARBYTES, "client_secret_key");
 #endif
@@ -1527,7 +2495,7 @@ int opaque_RecoverCredentials(const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
          *ptr=authenticated;
 
   // nonce
-  memcpy(ptr, env.nonce, OPAQUE_NONCE_BYTES);
+  memcpy(ptr, env->nonce, OPAQUE_NONCE_BYTES);
   ptr+=OPAQUE_NONCE_BYTES;
   // server_public_key
   memcpy(ptr, server_public_key, crypto_scalarmult_BYTES);
@@ -1553,16 +2521,15 @@ int opaque_RecoverCredentials(const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
 
 #if (defined TRACE || defined CFRG_TEST_VEC)
   dump(authenticated, sizeof authenticated, "authenticated");
-  dump(auth_key, sizeof auth_key, "auth_key");
-  dump(env.auth_tag, crypto_auth_hmacsha512_BYTES, "env auth_tag");
+  dump(auth_key, OPAQUE_HMAC_SHA512_KEYBYTES, "auth_key");
+  dump(env->auth_tag, crypto_auth_hmacsha512_BYTES, "env auth_tag");
   dump(auth_tag, crypto_hash_sha512_BYTES, "auth tag ");
 #endif
-  sodium_munlock(auth_key, sizeof auth_key);
 
   // 1.6.7. If !ct_equal(envelope.auth_tag, expected_tag),
   //   raise KeyRecoveryError
-  if(0!=sodium_memcmp(env.auth_tag, auth_tag, sizeof auth_tag)) {
-    sodium_munlock(client_secret_key, sizeof client_secret_key);
+  if(0!=sodium_memcmp(env->auth_tag, auth_tag, sizeof auth_tag)) {
+    opaque_scratch_release(mark);
     return -1;
   }
 
@@ -1572,26 +2539,20 @@ int opaque_RecoverCredentials(const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
   // 2.2. preamble = Preamble(client_identity, state.ke1, server_identity, ke2.inner_ke2)
   char preamble[crypto_hash_sha512_BYTES];
   crypto_hash_sha512_state preamble_state;
-  calc_preamble(preamble, &preamble_state, client_public_key, server_public_key, sec->ke1, resp, ctx, ctx_len, &ids);
+  calc_preamble_prefix(&preamble_state, ctx, ctx_len);
+  calc_preamble(preamble, &preamble_state, client_public_key, server_public_key, sec->ke1, resp, &ids);
 
-  Opaque_Keys keys;
-  if(-1==sodium_mlock(&keys,sizeof(keys))) {
-    sodium_munlock(client_secret_key, sizeof client_secret_key);
-    return -1;
-  }
   // 2.1. ikm = TripleDHIKM(state.client_secret, ke2.server_keyshare,
   //  state.client_secret, server_public_key, client_private_key, ke2.server_keyshare)
   // 2.3. Km2, Km3, session_key = DeriveKeys(ikm, preamble)
-  if(0!=user_3dh(&keys, client_secret_key, sec->x_u, server_public_key, resp->X_s, preamble)) {
-    sodium_munlock(client_secret_key, sizeof client_secret_key);
-    sodium_munlock(&keys, sizeof(keys));
+  if(0!=user_3dh(keys, client_secret_key, sec->x_u, server_public_key, resp->X_s, preamble)) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(client_secret_key, sizeof client_secret_key);
 
   // 2.4. expected_server_mac = MAC(Km2, Hash(preamble))
   uint8_t authS[crypto_auth_hmacsha512_BYTES];
-  opaque_hmacsha512(keys.km2,
+  opaque_hmacsha512(keys->km2,
                     (uint8_t*)preamble,                  // in
                     crypto_hash_sha512_BYTES,            // len(in)
                     authS);                              // out
@@ -1599,7 +2560,7 @@ int opaque_RecoverCredentials(const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
   // 2.5. If !ct_equal(ke2.server_mac, expected_server_mac),
   //   raise HandshakeError
   if (sodium_memcmp(authS, resp->auth, sizeof authS)!=0) {
-    sodium_munlock(&keys, sizeof(keys));
+    opaque_scratch_release(mark);
     return -1;
   }
 
@@ -1607,7 +2568,7 @@ int opaque_RecoverCredentials(const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
   crypto_hash_sha512_update(&preamble_state, authS, crypto_auth_hmacsha512_BYTES);
   crypto_hash_sha512_final(&preamble_state, (uint8_t *) preamble);
   if(NULL!=authU) {
-    opaque_hmacsha512(keys.km3,                         // key
+    opaque_hmacsha512(keys->km3,                        // key
                       (uint8_t*)preamble,               // in
                       crypto_hash_sha512_BYTES,         // len(in)
                       authU);                           // out
@@ -1615,17 +2576,362 @@ int opaque_RecoverCredentials(const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
 
   // 2.7. Create KE3 ke3 with client_mac
   // 2.8. Output (ke3, session_key)
-  memcpy(sk,keys.sk,sizeof(keys.sk));
+  memcpy(sk,keys->sk,sizeof(keys->sk));
 
-  sodium_munlock(&keys, sizeof(keys));
+  opaque_scratch_release(mark);
   return 0;
 }
 
+// more or less corresponds to RecoverCredentials in the irtf draft
+// 3. On β, X_s and c from S, U proceeds as follows:
+// (a) Checks that β ∈ G ∗ . If not, outputs (abort, sid , ssid ) and halts;
+// (b) Computes rw := H(key, pw|β^1/r );
+// (c) Computes AuthDec_rw(c). If the result is ⊥, outputs (abort, sid , ssid ) and halts.
+//     Otherwise sets (p_u, P_u, P_s ) := AuthDec_rw (c);
+// (d) Computes K := KE(p_u, x_u, P_s, X_s) and SK := f_K(0);
+// (e) Outputs (sid, ssid, SK).
+int opaque_RecoverCredentials(const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
+                              const uint8_t *_sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
+                              const uint8_t *ctx, const uint16_t ctx_len,
+                              const Opaque_Ids *ids0,
+                              const Opaque_KSF *ksf,
+                              uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                              uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                              uint8_t export_key[crypto_hash_sha512_BYTES]) {
+
+  Opaque_ServerSession *resp = (Opaque_ServerSession *) _resp;
+  Opaque_UserSession_Secret *sec = (Opaque_UserSession_Secret *) _sec;
+
+#ifdef TRACE
+  dump(sec->pwdU,sec->pwdU_len, "session user finish pwdU ");
+  dump(_sec,OPAQUE_USER_SESSION_SECRET_LEN, "session user finish sec ");
+  dump(_resp,OPAQUE_SERVER_SESSION_LEN, "session user finish resp ");
+#endif
+
+  // 1. (client_private_key, server_public_key, export_key) =
+  //  RecoverCredentials(state.password, state.blind, ke2.CredentialResponse,
+  //                     server_identity, client_identity)
+  // 1.1. y = Finalize(password, blind, response.data, nil)
+  // 1.2. randomized_pwd = Extract("", concat(y, Harden(y, params)))
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *N = opaque_scratch_alloc(crypto_core_ristretto255_BYTES);
+  uint8_t *rwdU = opaque_scratch_alloc(OPAQUE_RWDU_BYTES);
+  if(N==NULL || rwdU==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  // 1. N = Unblind(blind, response.data)
+  if(0!=oprf_unblind_inv(sec->blind_inv, resp->Z, N)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+#if (defined TRACE || defined CFRG_TEST_VEC)
+  dump(N, crypto_core_ristretto255_BYTES, "unblinded");
+#endif
+
+  // a cached rwdU skips the key stretching
+  uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES];
+  Opaque_RwdCache *cache = (ksf!=NULL) ? ksf->cache : NULL;
+  int hit = 0;
+  if(cache!=NULL) {
+    opaque_rwdcache_tag(cache, N, ksf, tag);
+    hit = (0==opaque_rwdcache_get(cache, tag, rwdU));
+  }
+
+  // rw = H(pw, β^(1/r))
+  // 1.2. y = Finalize(pwdU, N, "OPAQUE01")
+  if(!hit && 0!=oprf_Finalize(sec->pwdU, sec->pwdU_len, N, ksf, rwdU)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+
+#if (defined TRACE || defined CFRG_TEST_VEC)
+  dump(rwdU, OPAQUE_RWDU_BYTES, "rwdU");
+#endif
+
+  const int ret = recover_credentials(resp, sec, ctx, ctx_len, ids0, rwdU, sk, authU, export_key);
+  // only a password that opened the envelope is cached
+  if(ret==0 && cache!=NULL && !hit) opaque_rwdcache_put(cache, tag, rwdU);
+  opaque_scratch_release(mark);
+  return ret;
+}
+
+// the first half of opaque_RecoverCredentials()
+Opaque_Stretch *opaque_RecoverCredentialsBegin(const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
+                                               const uint8_t *_sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
+                                               const Opaque_KSF *ksf) {
+  const Opaque_ServerSession *resp = (const Opaque_ServerSession *) _resp;
+  const Opaque_UserSession_Secret *sec = (const Opaque_UserSession_Secret *) _sec;
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *N = opaque_scratch_alloc(crypto_core_ristretto255_BYTES);
+  if(N==NULL || 0!=oprf_unblind_inv(sec->blind_inv, resp->Z, N)) {
+    opaque_scratch_release(mark);
+    return NULL;
+  }
+  Opaque_Stretch *st = stretch_begin(sec->pwdU, sec->pwdU_len, N, ksf);
+  opaque_scratch_release(mark);
+  return st;
+}
+
+// the second half of opaque_RecoverCredentials()
+int opaque_RecoverCredentialsFinish(Opaque_Stretch *st,
+                                    const uint8_t _resp[OPAQUE_SERVER_SESSION_LEN],
+                                    const uint8_t *_sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
+                                    const uint8_t *ctx, const uint16_t ctx_len,
+                                    const Opaque_Ids *ids0,
+                                    uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                    uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                                    uint8_t export_key[crypto_hash_sha512_BYTES]) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *rwdU = opaque_scratch_alloc(OPAQUE_RWDU_BYTES);
+  if(rwdU==NULL) {
+    opaque_scratch_release(mark);
+    opaque_stretch_cancel(st);
+    return -1;
+  }
+  uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES];
+  Opaque_RwdCache *cache;
+  if(0!=stretch_finish(st, rwdU, &cache, tag)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  const int ret = recover_credentials((const Opaque_ServerSession *) _resp,
+                                      (const Opaque_UserSession_Secret *) _sec,
+                                      ctx, ctx_len, ids0, rwdU, sk, authU, export_key);
+  if(ret==0 && cache!=NULL) opaque_rwdcache_put(cache, tag, rwdU);
+  opaque_scratch_release(mark);
+  return ret;
+}
+
 // extra function to implement the hmac based auth as defined in the irtf cfrg draft
 int opaque_UserAuth(const uint8_t authU0[crypto_auth_hmacsha512_BYTES], const uint8_t authU[crypto_auth_hmacsha512_BYTES]) {
     return sodium_memcmp(authU0, authU, crypto_auth_hmacsha512_BYTES);
 }
 
+int opaque_SealContinuation(Opaque_Continuations *continuations,
+                            const uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                            const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                            uint8_t token[OPAQUE_CONTINUATION_LEN]) {
+  return opaque_continuations_seal(continuations, authU, sk, token);
+}
+
+int opaque_UserAuthContinuation(Opaque_Continuations *continuations,
+                                const uint8_t token[OPAQUE_CONTINUATION_LEN],
+                                const uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                                uint8_t sk[OPAQUE_SHARED_SECRETBYTES]) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *authU0 = opaque_scratch_alloc(crypto_auth_hmacsha512_BYTES);
+  uint8_t *sk0 = opaque_scratch_alloc(OPAQUE_SHARED_SECRETBYTES);
+  uint64_t expires;
+  // a wrong authU does not redeem the token
+  if(authU0==NULL || sk0==NULL ||
+     0!=opaque_continuations_open(continuations, token, authU0, sk0, &expires) ||
+     0!=opaque_UserAuth(authU0, authU) ||
+     0!=opaque_continuations_redeem(continuations, token, expires)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  memcpy(sk, sk0, OPAQUE_SHARED_SECRETBYTES);
+  opaque_scratch_release(mark);
+  return 0;
+}
+
+// session resumption
+
+void opaque_ResumptionSecret(const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                             uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES]) {
+  // rs = HKDF-Expand-Label(sk, "ResumptionSecret", "", Nh)
+  crypto_auth_hmacsha512_state state;
+  uint8_t label[OPAQUE_HKDF_LABEL_MAX];
+  const size_t label_len = hkdf_label(label, "ResumptionSecret", NULL, OPAQUE_RESUMPTION_SECRETBYTES);
+  hkdf_keyed(&state, sk);
+  hkdf_expand(rs, OPAQUE_RESUMPTION_SECRETBYTES, label, label_len, &state);
+  sodium_memzero(&state, sizeof state);
+}
+
+int opaque_IssueTicket(const Opaque_Tickets *tickets,
+                       const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                       const uint8_t *idU, const uint16_t idU_len,
+                       uint8_t *ticket/*[OPAQUE_TICKET_LEN+idU_len]*/) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *rs = opaque_scratch_alloc(OPAQUE_RESUMPTION_SECRETBYTES);
+  if(rs==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  opaque_ResumptionSecret(sk, rs);
+  const int ret = opaque_tickets_seal(tickets, rs, idU, idU_len, ticket);
+  opaque_scratch_release(mark);
+  return ret;
+}
+
+int opaque_CreateResumptionRequest(const uint8_t *ticket, const uint16_t ticket_len,
+                                   const uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES],
+                                   const int dh,
+                                   uint8_t _sec[OPAQUE_RESUME_SECRET_LEN],
+                                   uint8_t *_req/*[OPAQUE_RESUME_REQUEST_LEN+ticket_len]*/) {
+  Opaque_ResumeSecret *sec = (Opaque_ResumeSecret *) _sec;
+  Opaque_ResumeRequest *req = (Opaque_ResumeRequest *) _req;
+  if(ticket_len < OPAQUE_TICKET_LEN) return -1;
+  randombytes(req->nonceU, OPAQUE_NONCE_BYTES);
+  if(dh) {
+    crypto_core_ristretto255_scalar_random(sec->x_u);
+    if(0!=ristretto_scalarmult_base(req->X_u, sec->x_u)) return -1;
+  } else {
+    memset(sec->x_u, 0, sizeof sec->x_u);
+    memset(req->X_u, 0, sizeof req->X_u);
+  }
+  memcpy(req->ticket, ticket, ticket_len);
+  memcpy(sec->rs, rs, OPAQUE_RESUMPTION_SECRETBYTES);
+  crypto_hash_sha512(sec->req_hash, _req, OPAQUE_RESUME_REQUEST_LEN+ticket_len);
+  return 0;
+}
+
+// the keys of a resumption: info = H("OPAQUE-Resume" || I2OSP(len(ctx), 2) ||
+// ctx || H(req) || nonceS || X_s), prk = HKDF-Extract(rs, dh), where
+// dh is empty without the ephemeral dh
+static int resume_keys(Opaque_Keys *keys, char info[crypto_hash_sha512_BYTES],
+                       const uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES],
+                       const uint8_t *dh, const size_t dh_len,
+                       const uint8_t *ctx, const uint16_t ctx_len,
+                       const uint8_t req_hash[crypto_hash_sha512_BYTES],
+                       const Opaque_ResumeResponse *resp) {
+  crypto_hash_sha512_state state;
+  const uint8_t dst[13]="OPAQUE-Resume";
+  const uint16_t len=htons(ctx_len);
+  crypto_hash_sha512_init(&state);
+  crypto_hash_sha512_update(&state, dst, sizeof dst);
+  crypto_hash_sha512_update(&state, (const uint8_t*) &len, sizeof len);
+  crypto_hash_sha512_update(&state, ctx, ctx_len);
+  crypto_hash_sha512_update(&state, req_hash, crypto_hash_sha512_BYTES);
+  crypto_hash_sha512_update(&state, resp->nonceS, OPAQUE_NONCE_BYTES);
+  crypto_hash_sha512_update(&state, resp->X_s, crypto_scalarmult_BYTES);
+  crypto_hash_sha512_final(&state, (uint8_t*) info);
+
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *prk = opaque_scratch_alloc(crypto_kdf_hkdf_sha512_KEYBYTES);
+  if(prk==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  crypto_kdf_hkdf_sha512_extract(prk, rs, OPAQUE_RESUMPTION_SECRETBYTES, dh, dh_len);
+  const int ret = expand_keys(keys, prk, info, "ResumeHandshake", "ResumeSessionKey");
+  opaque_scratch_release(mark);
+  return ret;
+}
+
+// out = n*P for an encoded P
+static int dh_point(uint8_t out[crypto_scalarmult_BYTES],
+                    const uint8_t n[crypto_scalarmult_SCALARBYTES],
+                    const uint8_t P[crypto_scalarmult_BYTES]) {
+  const size_t mark = opaque_scratch_mark();
+  ristretto_point *p = opaque_scratch_alloc(sizeof(ristretto_point));
+  ristretto_point *q = opaque_scratch_alloc(sizeof(ristretto_point));
+  if(p==NULL || q==NULL || 0!=ristretto_decode(p, P) || 0!=ristretto_scalarmult(q, n, p)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  ristretto_encode(out, q);
+  opaque_scratch_release(mark);
+  return 0;
+}
+
+int opaque_CreateResumptionResponse(Opaque_Tickets *tickets,
+                                    const uint8_t *_req, const size_t req_len,
+                                    const uint8_t *ctx, const uint16_t ctx_len,
+                                    uint8_t _resp[OPAQUE_RESUME_RESPONSE_LEN],
+                                    uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                    uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                                    uint8_t *idU) {
+  const Opaque_ResumeRequest *req = (const Opaque_ResumeRequest *) _req;
+  Opaque_ResumeResponse *resp = (Opaque_ResumeResponse *) _resp;
+  if(req_len < OPAQUE_RESUME_REQUEST_LEN + OPAQUE_TICKET_LEN) return -1;
+  const size_t idU_len = req_len - OPAQUE_RESUME_REQUEST_LEN - OPAQUE_TICKET_LEN;
+  if(idU==NULL && idU_len!=0) return -1;
+
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *rs = opaque_scratch_alloc(OPAQUE_RESUMPTION_SECRETBYTES);
+  uint8_t *x_s = opaque_scratch_alloc(crypto_scalarmult_SCALARBYTES);
+  uint8_t *dh = opaque_scratch_alloc(crypto_scalarmult_BYTES);
+  uint8_t *req_hash = opaque_scratch_alloc(crypto_hash_sha512_BYTES);
+  Opaque_Keys *keys = opaque_scratch_alloc(sizeof(Opaque_Keys));
+  uint8_t *info = opaque_scratch_alloc(crypto_hash_sha512_BYTES + crypto_auth_hmacsha512_BYTES);
+  if(rs==NULL || x_s==NULL || dh==NULL || req_hash==NULL || keys==NULL || info==NULL ||
+     0!=opaque_tickets_open(tickets, req->ticket, req_len - OPAQUE_RESUME_REQUEST_LEN, rs, idU)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  crypto_hash_sha512(req_hash, _req, req_len);
+
+  randombytes(resp->nonceS, OPAQUE_NONCE_BYTES);
+  const int with_dh = !sodium_is_zero(req->X_u, crypto_scalarmult_BYTES);
+  if(with_dh) {
+    crypto_core_ristretto255_scalar_random(x_s);
+    if(0!=ristretto_scalarmult_base(resp->X_s, x_s) || 0!=dh_point(dh, x_s, req->X_u)) {
+      opaque_scratch_release(mark);
+      return -1;
+    }
+  } else {
+    memset(resp->X_s, 0, crypto_scalarmult_BYTES);
+  }
+  if(0!=resume_keys(keys, (char*) info, rs, dh, with_dh ? crypto_scalarmult_BYTES : 0,
+                    ctx, ctx_len, req_hash, resp)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  // auth = HMAC(Km2, info), authU = HMAC(Km3, info || auth)
+  opaque_hmacsha512(keys->km2, info, crypto_hash_sha512_BYTES, resp->auth);
+  memcpy(info + crypto_hash_sha512_BYTES, resp->auth, crypto_auth_hmacsha512_BYTES);
+  opaque_hmacsha512(keys->km3, info, crypto_hash_sha512_BYTES + crypto_auth_hmacsha512_BYTES, authU);
+  memcpy(sk, keys->sk, OPAQUE_SHARED_SECRETBYTES);
+  opaque_scratch_release(mark);
+  return 0;
+}
+
+int opaque_RecoverResumption(const uint8_t _resp[OPAQUE_RESUME_RESPONSE_LEN],
+                             const uint8_t _sec[OPAQUE_RESUME_SECRET_LEN],
+                             const uint8_t *ctx, const uint16_t ctx_len,
+                             uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                             uint8_t authU[crypto_auth_hmacsha512_BYTES]) {
+  const Opaque_ResumeResponse *resp = (const Opaque_ResumeResponse *) _resp;
+  const Opaque_ResumeSecret *sec = (const Opaque_ResumeSecret *) _sec;
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *dh = opaque_scratch_alloc(crypto_scalarmult_BYTES);
+  Opaque_Keys *keys = opaque_scratch_alloc(sizeof(Opaque_Keys));
+  uint8_t *info = opaque_scratch_alloc(crypto_hash_sha512_BYTES + crypto_auth_hmacsha512_BYTES);
+  uint8_t *auth = opaque_scratch_alloc(crypto_auth_hmacsha512_BYTES);
+  if(dh==NULL || keys==NULL || info==NULL || auth==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  // the server must answer the ephemeral dh if and only if it was asked to
+  const int with_dh = !sodium_is_zero(sec->x_u, crypto_scalarmult_SCALARBYTES);
+  if(with_dh) {
+    if(0!=dh_point(dh, sec->x_u, resp->X_s)) {
+      opaque_scratch_release(mark);
+      return -1;
+    }
+  } else if(!sodium_is_zero(resp->X_s, crypto_scalarmult_BYTES)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  if(0!=resume_keys(keys, (char*) info, sec->rs, dh, with_dh ? crypto_scalarmult_BYTES : 0,
+                    ctx, ctx_len, sec->req_hash, resp)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  opaque_hmacsha512(keys->km2, info, crypto_hash_sha512_BYTES, auth);
+  if(0!=sodium_memcmp(auth, resp->auth, crypto_auth_hmacsha512_BYTES)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  memcpy(info + crypto_hash_sha512_BYTES, resp->auth, crypto_auth_hmacsha512_BYTES);
+  opaque_hmacsha512(keys->km3, info, crypto_hash_sha512_BYTES + crypto_auth_hmacsha512_BYTES, authU);
+  memcpy(sk, keys->sk, OPAQUE_SHARED_SECRETBYTES);
+  opaque_scratch_release(mark);
+  return 0;
+}
+
 // variant where the secrets of U never touch S unencrypted
 
 // U computes: blinded PW
@@ -1644,16 +2950,10 @@ int opaque_CreateRegistrationRequest(const uint8_t *pwdU, const uint16_t pwdU_le
 // (3) computes: β := α^k_s,
 // (4) finally generates: p_s ←_R Z_q, P_s := g^p_s;
 // called CreateRegistrationResponse in the irtf cfrg rfc draft
-int opaque_CreateRegistrationResponse(const uint8_t blinded[crypto_core_ristretto255_BYTES], const uint8_t skS[crypto_scalarmult_SCALARBYTES], uint8_t _sec[OPAQUE_REGISTER_SECRET_LEN], uint8_t _pub[OPAQUE_REGISTER_PUBLIC_LEN]) {
-  Opaque_RegisterSrvSec *sec = (Opaque_RegisterSrvSec *) _sec;
-  Opaque_RegisterSrvPub *pub = (Opaque_RegisterSrvPub *) _pub;
-
+// opaque_CreateRegistrationResponse() with the kU in sec
+static int create_registration_response(const uint8_t blinded[crypto_core_ristretto255_BYTES], const uint8_t skS[crypto_scalarmult_SCALARBYTES], Opaque_RegisterSrvSec *sec, Opaque_RegisterSrvPub *pub) {
   // (a) Checks that α ∈ G^∗ . If not, outputs (abort, sid , ssid ) and halts;
-  if(crypto_core_ristretto255_is_valid_point(blinded)!=1) return -1;
-
-  // k_s ←_R Z_q
-  // 1. (kU, _) = KeyGen()
-  oprf_KeyGen(sec->kU);
+  // done by oprf_Evaluate() when decoding α
 
   // computes β := α^k_s
   // 2. Z = Evaluate(kU, request.data)
@@ -1675,7 +2975,7 @@ int opaque_CreateRegistrationResponse(const uint8_t blinded[crypto_core_ristrett
   dump((uint8_t*) sec->skS, sizeof sec->skS, "skS ");
 #endif
   // P_s := g^p_s
-  crypto_scalarmult_ristretto255_base(pub->pkS, sec->skS);
+  ristretto_scalarmult_base(pub->pkS, sec->skS);
 
 #ifdef TRACE
   dump((uint8_t*) pub->pkS, sizeof pub->pkS, "pkS ");
@@ -1684,6 +2984,52 @@ int opaque_CreateRegistrationResponse(const uint8_t blinded[crypto_core_ristrett
   return 0;
 }
 
+int opaque_CreateRegistrationResponse(const uint8_t blinded[crypto_core_ristretto255_BYTES], const uint8_t skS[crypto_scalarmult_SCALARBYTES], uint8_t _sec[OPAQUE_REGISTER_SECRET_LEN], uint8_t _pub[OPAQUE_REGISTER_PUBLIC_LEN]) {
+  Opaque_RegisterSrvSec *sec = (Opaque_RegisterSrvSec *) _sec;
+  Opaque_RegisterSrvPub *pub = (Opaque_RegisterSrvPub *) _pub;
+
+  // k_s ←_R Z_q
+  // 1. (kU, _) = KeyGen()
+  oprf_KeyGen(sec->kU);
+
+  return create_registration_response(blinded, skS, sec, pub);
+}
+
+int opaque_CreateRegistrationResponseSeeded(const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                                            const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                                            Opaque_OprfSeed *oprfseed,
+                                            const uint8_t *credid, const uint16_t credid_len,
+                                            uint8_t _sec[OPAQUE_REGISTER_SECRET_LEN],
+                                            uint8_t _pub[OPAQUE_REGISTER_PUBLIC_LEN]) {
+  Opaque_RegisterSrvSec *sec = (Opaque_RegisterSrvSec *) _sec;
+  Opaque_RegisterSrvPub *pub = (Opaque_RegisterSrvPub *) _pub;
+
+  if(0!=derive_oprf_key(oprfseed, credid, credid_len, sec->kU)) return -1;
+
+  return create_registration_response(blinded, skS, sec, pub);
+}
+
+// the part of opaque_FinalizeRequest() after the key stretching
+static int finalize_request(const uint8_t rwdU[OPAQUE_RWDU_BYTES],
+                            const Opaque_RegisterSrvPub *pub,
+                            const Opaque_Ids *ids,
+                            Opaque_RegistrationRecord *rec,
+                            uint8_t export_key[crypto_hash_sha512_BYTES]) {
+  if(0!=create_envelope(rwdU, pub->pkS, ids, &rec->envelope, rec->client_public_key, rec->masking_key, export_key)) {
+    return -1;
+  }
+
+#if (defined TRACE || defined CFRG_TEST_VEC)
+  dump((const uint8_t*) rec, OPAQUE_REGISTRATION_RECORD_LEN, "record");
+#endif
+
+#ifdef TRACE
+  dump((const uint8_t*) rec, OPAQUE_REGISTRATION_RECORD_LEN, "registration rec ");
+#endif
+
+  return 0;
+}
+
 // user computes:
 // (a) Checks that β ∈ G ∗ . If not, outputs (abort, sid , ssid ) and halts;
 // (b) Computes rw := H(key, pw | β^1/r );
@@ -1694,6 +3040,7 @@ int opaque_CreateRegistrationResponse(const uint8_t blinded[crypto_core_ristrett
 int opaque_FinalizeRequest(const uint8_t *_sec/*[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len]*/,
                            const uint8_t _pub[OPAQUE_REGISTER_PUBLIC_LEN],
                            const Opaque_Ids *ids,
+                           const Opaque_KSF *ksf,
                            uint8_t _rec[OPAQUE_REGISTRATION_RECORD_LEN],
                            uint8_t export_key[crypto_hash_sha512_BYTES]) {
 
@@ -1701,45 +3048,71 @@ int opaque_FinalizeRequest(const uint8_t *_sec/*[OPAQUE_REGISTER_USER_SEC_LEN+pw
   Opaque_RegisterSrvPub *pub = (Opaque_RegisterSrvPub *) _pub;
   Opaque_RegistrationRecord *rec = (Opaque_RegistrationRecord *) _rec;
 
-  uint8_t N[crypto_core_ristretto255_BYTES];
-  if(-1==sodium_mlock(N, sizeof N)) return -1;
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *N = opaque_scratch_alloc(crypto_core_ristretto255_BYTES);
+  uint8_t *rwdU = opaque_scratch_alloc(OPAQUE_RWDU_BYTES);
+  if(N==NULL || rwdU==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
   // 1. N = Unblind(blind, response.data)
   if(0!=oprf_Unblind(sec->blind, pub->Z, N)) {
-    sodium_munlock(N, sizeof N);
+    opaque_scratch_release(mark);
     return -1;
   }
 #if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(N, sizeof N, "unblinded");
+  dump(N, crypto_core_ristretto255_BYTES, "unblinded");
 #endif
 
-  uint8_t rwdU[OPAQUE_RWDU_BYTES];
-  if(-1==sodium_mlock(rwdU, sizeof rwdU)) {
-    sodium_munlock(N, sizeof N);
-    return -1;
-  }
   // 2. y = Finalize(pwdU, N, "OPAQUE01")
-  if(0!=oprf_Finalize(sec->pwdU, sec->pwdU_len, N, rwdU)) {
-    sodium_munlock(N, sizeof N);
-    sodium_munlock(rwdU, sizeof(rwdU));
+  if(0!=oprf_Finalize(sec->pwdU, sec->pwdU_len, N, ksf, rwdU)) {
+    opaque_scratch_release(mark);
     return -1;
   }
-  sodium_munlock(N,sizeof N);
 
-  if(0!=create_envelope(rwdU, pub->pkS, ids, &rec->envelope, rec->client_public_key, rec->masking_key, export_key)) {
-    sodium_munlock(rwdU, sizeof rwdU);
-    return -1;
-  }
-  sodium_munlock(rwdU, sizeof rwdU);
-
-#if (defined TRACE || defined CFRG_TEST_VEC)
-  dump(_rec, OPAQUE_REGISTRATION_RECORD_LEN, "record");
-#endif
+  const int ret = finalize_request(rwdU, pub, ids, rec, export_key);
+  opaque_scratch_release(mark);
+  return ret;
+}
 
-#ifdef TRACE
-  dump(_rec, OPAQUE_REGISTRATION_RECORD_LEN, "registration rec ");
-#endif
+// the first half of opaque_FinalizeRequest()
+Opaque_Stretch *opaque_FinalizeRequestBegin(const uint8_t *_sec/*[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len]*/,
+                                            const uint8_t _pub[OPAQUE_REGISTER_PUBLIC_LEN],
+                                            const Opaque_KSF *ksf) {
+  const Opaque_RegisterUserSec *sec = (const Opaque_RegisterUserSec *) _sec;
+  const Opaque_RegisterSrvPub *pub = (const Opaque_RegisterSrvPub *) _pub;
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *N = opaque_scratch_alloc(crypto_core_ristretto255_BYTES);
+  if(N==NULL || 0!=oprf_Unblind(sec->blind, pub->Z, N)) {
+    opaque_scratch_release(mark);
+    return NULL;
+  }
+  Opaque_Stretch *st = stretch_begin(sec->pwdU, sec->pwdU_len, N, ksf);
+  opaque_scratch_release(mark);
+  return st;
+}
 
-  return 0;
+// the second half of opaque_FinalizeRequest()
+int opaque_FinalizeRequestFinish(Opaque_Stretch *st,
+                                 const uint8_t _pub[OPAQUE_REGISTER_PUBLIC_LEN],
+                                 const Opaque_Ids *ids,
+                                 uint8_t _rec[OPAQUE_REGISTRATION_RECORD_LEN],
+                                 uint8_t export_key[crypto_hash_sha512_BYTES]) {
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *rwdU = opaque_scratch_alloc(OPAQUE_RWDU_BYTES);
+  if(rwdU==NULL) {
+    opaque_scratch_release(mark);
+    opaque_stretch_cancel(st);
+    return -1;
+  }
+  if(0!=stretch_finish(st, rwdU, NULL, NULL)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  const int ret = finalize_request(rwdU, (const Opaque_RegisterSrvPub *) _pub, ids,
+                                   (Opaque_RegistrationRecord *) _rec, export_key);
+  opaque_scratch_release(mark);
+  return ret;
 }
 
 // S records file[sid ] := {k_s, p_s, P_s, P_u, c}.
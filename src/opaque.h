@@ -29,19 +29,41 @@
    /* skS */ crypto_scalarmult_SCALARBYTES+            \
    OPAQUE_REGISTRATION_RECORD_LEN)
 
+#define OPAQUE_USER_RECORD_V2_LEN (                    \
+   /* key_id */ 4+                                     \
+   /* kU */ crypto_core_ristretto255_SCALARBYTES+      \
+   OPAQUE_REGISTRATION_RECORD_LEN)
+
+#define OPAQUE_USER_RECORD_SEEDED_LEN (                \
+   /* key_id */ 4+                                     \
+   OPAQUE_REGISTRATION_RECORD_LEN)
+
+/** the size of the server OPRF seed the per-user keys are derived from */
+#define OPAQUE_OPRF_SEEDBYTES 64
+
+/** the number of server keys a keyring can hold at most */
+#define OPAQUE_KEYRING_MAX_SLOTS 256
+
 #define OPAQUE_USER_SESSION_PUBLIC_LEN (               \
    /* blinded */ crypto_core_ristretto255_BYTES+       \
    /* X_u */ crypto_scalarmult_BYTES+                  \
    /* nonceU */ OPAQUE_NONCE_BYTES)
 
 #define OPAQUE_USER_SESSION_SECRET_LEN (               \
-   /* r */ crypto_core_ristretto255_SCALARBYTES+       \
+   /* 1/r */ crypto_core_ristretto255_SCALARBYTES+     \
    /* x_u */ crypto_scalarmult_SCALARBYTES+            \
    /* nonceU */ OPAQUE_NONCE_BYTES+                    \
    /* blinded */  crypto_core_ristretto255_BYTES+      \
    /* ke1 */ OPAQUE_USER_SESSION_PUBLIC_LEN+           \
    /* pwdU_len */ sizeof(uint16_t))
 
+#define OPAQUE_USER_PRECOMPUTED_LEN (                  \
+   /* r */ crypto_core_ristretto255_SCALARBYTES+       \
+   /* 1/r */ crypto_core_ristretto255_SCALARBYTES+     \
+   /* x_u */ crypto_scalarmult_SCALARBYTES+            \
+   /* X_u */ crypto_scalarmult_BYTES+                  \
+   /* nonceU */ OPAQUE_NONCE_BYTES)
+
 #define OPAQUE_SERVER_SESSION_LEN (                    \
    /* Z */ crypto_core_ristretto255_BYTES+             \
    /* masking_nonce */ 32+                             \
@@ -52,6 +74,53 @@
    /* envelope nonce */    OPAQUE_ENVELOPE_NONCEBYTES+ \
    /* envelope mac */      crypto_auth_hmacsha512_BYTES)
 
+#define OPAQUE_SERVER_SETUP_LEN (                      \
+   /* skS */ crypto_scalarmult_SCALARBYTES+            \
+   /* pkS */ crypto_scalarmult_BYTES+                  \
+   /* preamble prefix */ sizeof(crypto_hash_sha512_state))
+
+#define OPAQUE_TICKET_KEYBYTES 32
+#define OPAQUE_RESUMPTION_SECRETBYTES 64
+/** the longest user id a resumption ticket can carry */
+#define OPAQUE_TICKET_IDU_MAX 1024
+
+/** the length of a resumption ticket without the user id */
+#define OPAQUE_TICKET_LEN (                                           \
+   /* nonce */ crypto_aead_xchacha20poly1305_ietf_NPUBBYTES+          \
+   /* idU_len */ sizeof(uint16_t)+                                    \
+   /* expires */ sizeof(uint64_t)+                                    \
+   /* rs */ OPAQUE_RESUMPTION_SECRETBYTES+                            \
+   /* mac */ crypto_aead_xchacha20poly1305_ietf_ABYTES)
+
+#define OPAQUE_CONTINUATION_KEYBYTES 32
+
+/** the length of a continuation token */
+#define OPAQUE_CONTINUATION_LEN (                                     \
+   /* key_id */ 4+                                                    \
+   /* nonce */ crypto_aead_xchacha20poly1305_ietf_NPUBBYTES+          \
+   /* expires */ sizeof(uint64_t)+                                    \
+   /* authU */ crypto_auth_hmacsha512_BYTES+                          \
+   /* sk */ OPAQUE_SHARED_SECRETBYTES+                                \
+   /* mac */ crypto_aead_xchacha20poly1305_ietf_ABYTES)
+
+/** returned by the opaque_async_*() calls when depth calls are pending */
+#define OPAQUE_ASYNC_FULL 1
+
+/** the length of a resumption request without the ticket */
+#define OPAQUE_RESUME_REQUEST_LEN (                    \
+   /* nonceU */ OPAQUE_NONCE_BYTES+                    \
+   /* X_u */ crypto_scalarmult_BYTES)
+
+#define OPAQUE_RESUME_SECRET_LEN (                     \
+   /* x_u */ crypto_scalarmult_SCALARBYTES+            \
+   /* rs */ OPAQUE_RESUMPTION_SECRETBYTES+             \
+   /* request hash */ crypto_hash_sha512_BYTES)
+
+#define OPAQUE_RESUME_RESPONSE_LEN (                   \
+   /* nonceS */ OPAQUE_NONCE_BYTES+                    \
+   /* X_s */ crypto_scalarmult_BYTES+                  \
+   /* auth */ crypto_auth_hmacsha512_BYTES)
+
 #define OPAQUE_REGISTER_USER_SEC_LEN (                 \
    /* r */ crypto_core_ristretto255_SCALARBYTES+       \
    /* pwdU_len */ sizeof(uint16_t))
@@ -81,6 +150,317 @@ typedef struct {
   uint8_t *idS;        /**< pointer to the id of the server in the opaque protocol */
 } Opaque_Ids;
 
+/**
+   opaque handle of a reusable memory workspace for the key stretching
+   function, see opaque_workspace_new()
+ */
+typedef struct Opaque_Workspace Opaque_Workspace;
+
+/**
+   opaque handle of a client side cache of hardened passwords, see
+   opaque_rwdcache_new()
+ */
+typedef struct Opaque_RwdCache Opaque_RwdCache;
+
+/**
+   opaque handle of the key and the replay protection of the
+   resumption tickets of a server, see opaque_tickets_new()
+ */
+typedef struct Opaque_Tickets Opaque_Tickets;
+
+/**
+   opaque handle of the long-term keys of a server, see
+   opaque_keyring_new()
+ */
+typedef struct Opaque_Keyring Opaque_Keyring;
+
+/**
+   opaque handle of the keys and the replay protection of the
+   continuation tokens of a server, see opaque_continuations_new()
+ */
+typedef struct Opaque_Continuations Opaque_Continuations;
+
+/**
+   opaque handle of a pool running the asynchronous calls, see
+   opaque_async_new()
+ */
+typedef struct Opaque_Async Opaque_Async;
+
+/**
+   the callback of an asynchronous call, run on a thread of the pool
+   with the user pointer of the call and the return value of the
+   synchronous function
+ */
+typedef void (*Opaque_AsyncDone)(void *user, int ret);
+
+/**
+   a completed asynchronous call without a callback, see
+   opaque_async_complete()
+ */
+typedef struct {
+  void *user; /**< the user pointer of the call */
+  int ret;    /**< the return value of the synchronous function */
+} Opaque_AsyncResult;
+
+/**
+   opaque handle of the OPRF seed of a server and its cache of derived
+   keys, see opaque_oprfseed_new()
+ */
+typedef struct Opaque_OprfSeed Opaque_OprfSeed;
+
+/**
+   opaque handle of the cache of the values a server derives from a
+   user record, see opaque_hotcache_new()
+ */
+typedef struct Opaque_HotCache Opaque_HotCache;
+
+/**
+   the counters of a record cache, see opaque_hotcache_stats()
+ */
+typedef struct {
+  uint64_t hits;      /**< logins served from an entry */
+  uint64_t misses;    /**< logins that derived the values */
+  uint64_t evictions; /**< entries replaced by another record */
+  uint64_t entries;   /**< records cached now */
+  uint64_t hit_ns;    /**< the time of the logins that hit, in nanoseconds */
+  uint64_t miss_ns;   /**< the time of the logins that missed, in nanoseconds */
+} Opaque_HotCacheStats;
+
+/**
+   key stretching functions hardening the OPRF output into rwdU
+ */
+typedef enum {
+  OPAQUE_KSF_IDENTITY = 0, /**< no stretching, only for testing, like the RFC test vectors */
+  OPAQUE_KSF_ARGON2ID = 1, /**< Argon2id version 0x13 (RFC 9106) */
+  OPAQUE_KSF_SCRYPT = 2,   /**< scrypt (RFC 7914) */
+} Opaque_KSF_Alg;
+
+/**
+   struct describing the key stretching function and its cost
+   parameters.
+
+   Client and server must agree on it, a password registered with one
+   KSF cannot be recovered with another. Passing NULL instead of a
+   descriptor selects Argon2id with t=2, m=65536 (64MB) and p=1, the
+   libsodium crypto_pwhash_OPSLIMIT_INTERACTIVE and
+   crypto_pwhash_MEMLIMIT_INTERACTIVE limits. The salt is always all
+   zeroes, the output 64 bytes. For OPAQUE_KSF_IDENTITY the cost
+   parameters are ignored.
+
+   Argon2id fills its lanes in parallel on an internal thread pool, so
+   with p>1 the memory cost can be raised at the same wall-clock time.
+   With p=1 it is the same as libsodiums crypto_pwhash().
+
+   Without a workspace Argon2id allocates its memory, and faults it in,
+   on every call. Code hardening many passwords in a row should set
+   workspace, see opaque_workspace_new(). Clients logging in repeatedly
+   can set a cache to skip the key stretching, see
+   opaque_rwdcache_new().
+ */
+typedef struct {
+  uint32_t alg;          /**< one of Opaque_KSF_Alg */
+  uint32_t parallelism;  /**< Argon2id: lanes p, scrypt: parallelization p */
+  uint64_t ops;          /**< Argon2id: passes t, scrypt: cost N, a power of 2 */
+  uint64_t mem;          /**< Argon2id: memory m in KiB, scrypt: block size r */
+  Opaque_Workspace *workspace; /**< Argon2id: memory reused across calls, or NULL */
+  Opaque_RwdCache *cache;      /**< client: hardened passwords of earlier calls, or NULL */
+} Opaque_KSF;
+
+/**
+   Initializes the library and selects the implementations of its
+   vectorized kernels (SHA-512, ristretto255 field arithmetic,
+   Argon2id block mixing) for the cpu it runs on.
+
+   Calling this is optional, the first use of a kernel selects it
+   otherwise. It is safe to call it several times and from several
+   threads.
+
+   The environment variable OPAQUE_CPU limits the instruction set the
+   kernels may use to "baseline", "avx2" or "avx512", e.g. for
+   benchmarking the variants on one host. Levels not supported by the
+   cpu fall back to the highest supported one below.
+
+   @return 0 on success, -1 if libsodium could not be initialized or
+        OPAQUE_CPU names no known level
+ */
+int opaque_init(void);
+
+/**
+   Allocates a workspace, the memory Argon2id fills, to be reused by
+   the hardening calls of the KSFs pointing to it.
+
+   Allocating the memory of Argon2id and faulting it in page by page
+   takes a significant part of each hardening call, with the defaults
+   64MB in 4KB pages. A workspace is mapped once, with huge pages
+   where the system provides them (MAP_HUGETLB, or transparent huge
+   pages via madvise()), faulted in right away and excluded from core
+   dumps. It grows if a call needs more memory. Each call wipes the
+   memory it used before returning.
+
+   A workspace serves one call at a time, a call finding it in use by
+   another thread allocates its own memory instead. scrypt uses
+   libsodiums own allocation and ignores the workspace.
+
+   @param [in] mem - the memory to allocate now in KiB, the mem of the
+        Argon2id KSF it is used with, or 0 to allocate on first use
+   @return the workspace, or NULL if out of memory
+ */
+Opaque_Workspace *opaque_workspace_new(const uint64_t mem);
+
+/**
+   Frees a workspace allocated with opaque_workspace_new(), no call
+   may use it anymore. NULL is ignored.
+ */
+void opaque_workspace_free(Opaque_Workspace *ws);
+
+/**
+   Allocates a cache for the hardened passwords of a client, to be set
+   in the KSF passed to opaque_RecoverCredentials() (and its Begin
+   function).
+
+   For a user and password the unblinded OPRF output, and thus the
+   hardened password rwdU, is the same on every login. With a cache, a
+   login whose OPRF output matches an entry skips the key stretching,
+   and only the key stretching: the envelope is opened and the key
+   exchange is run in full. An entry maps a keyed hash of the OPRF
+   output and the KSF parameters to rwdU. The key is random per cache,
+   the key and the entries are kept in locked memory excluded from core
+   dumps. Only rwdU that opened the envelope is stored, wrong passwords
+   and re-registrations give different OPRF outputs and miss.
+
+   Anyone able to call the client with this cache logs in without the
+   cost of the key stretching, for the lifetime of an entry. That is
+   the point for the legitimate user, so bound it with ttl and purge
+   the cache on logout or password change.
+
+   @param [in] max_entries - the number of entries, at most 4096, the
+        least recently used entry of a set of 4 is replaced when the
+        set is full
+   @param [in] ttl - the lifetime of an entry in seconds since it was
+        stored
+   @return the cache, or NULL on invalid parameters or if out of memory
+ */
+Opaque_RwdCache *opaque_rwdcache_new(const size_t max_entries, const uint32_t ttl);
+
+/**
+   Wipes all entries of a cache. NULL is ignored.
+ */
+void opaque_rwdcache_purge(Opaque_RwdCache *cache);
+
+/**
+   Wipes and frees a cache allocated with opaque_rwdcache_new(), no
+   call may use it anymore. NULL is ignored.
+ */
+void opaque_rwdcache_free(Opaque_RwdCache *cache);
+
+#define OPAQUE_KSF_PROFILE_LEN 22
+
+/**
+   Serializes the algorithm and cost parameters of a KSF into a
+   profile, e.g. one chosen by opaque_CalibrateKSF(), to be stored or
+   distributed to the clients. The workspace is not part of it.
+ */
+void opaque_SerializeKSF(const Opaque_KSF *ksf, uint8_t profile[OPAQUE_KSF_PROFILE_LEN]);
+
+/**
+   Parses a profile of opaque_SerializeKSF() into a KSF descriptor
+   with no workspace, for the registration and login functions.
+
+   @return 0 on success, -1 if the profile has an unknown version or
+        algorithm. The cost parameters are checked by the functions
+        using the KSF.
+ */
+int opaque_ParseKSF(const uint8_t profile[OPAQUE_KSF_PROFILE_LEN], Opaque_KSF *ksf);
+
+/**
+   a parameter set measured by opaque_CalibrateKSF()
+ */
+typedef struct {
+  Opaque_KSF ksf;        /**< the parameters, always Argon2id */
+  uint64_t median_us;    /**< median wall time of the hardening in microseconds */
+  uint64_t p95_us;       /**< 95th percentile of the wall time in microseconds */
+  int meets_target;      /**< p95_us is within the target latency */
+} Opaque_KSF_Candidate;
+
+/**
+   Benchmarks the Argon2id hardening on this machine and picks the
+   strongest parameters whose 95th percentile latency meets the target.
+
+   Following RFC 9106 the memory comes first: a single pass over
+   doubling amounts of memory, from 1MB up to mem_max, bisected between
+   the last one meeting the target and the first one missing it. Then
+   as many passes over that memory as still fit into the target. Each
+   candidate is hashed samples times, the time of a calibration is
+   roughly the number of candidates times samples times the target.
+
+   The result holds for this machine and its load only, run it on the
+   slowest class of devices the clients use.
+
+   @param [in] target_ms - the latency of the hardening to aim for
+   @param [in] mem_max - the memory ceiling in KiB
+   @param [in] parallelism - the lanes p, 0 for one per cpu, or as
+        many as the OPAQUE_THREADS environment variable sets
+   @param [in] samples - the number of hashes per candidate, at most
+        32, 0 for the default of 5
+   @param [out] ksf - the strongest Argon2id parameters meeting the target
+   @param [out] candidates - the measured parameter sets in order, or NULL
+   @param [in] max_candidates - the number of elements of candidates,
+        further ones are not recorded
+   @param [out] ncandidates - the number of recorded candidates, or NULL
+   @return 0 on success, -1 if no parameters meet the target within
+        the ceiling, on invalid parameters or if out of memory
+ */
+int opaque_CalibrateKSF(const uint32_t target_ms, const uint64_t mem_max,
+                        const uint32_t parallelism, const unsigned samples,
+                        Opaque_KSF *ksf,
+                        Opaque_KSF_Candidate candidates[], const size_t max_candidates,
+                        size_t *ncandidates);
+
+/**
+   opaque handle of a key stretching in progress, see
+   opaque_stretch_step()
+ */
+typedef struct Opaque_Stretch Opaque_Stretch;
+
+#define OPAQUE_STRETCH_DONE 0
+#define OPAQUE_STRETCH_MORE 1
+
+/**
+   Does a bounded part of the key stretching started by
+   opaque_RecoverCredentialsBegin() or opaque_FinalizeRequestBegin().
+
+   The key stretching of opaque_RecoverCredentials() and
+   opaque_FinalizeRequest() blocks the calling thread for the whole
+   run, e.g. about 40ms with the default Argon2id parameters. Event
+   loops, like a browser main thread, an erlang scheduler or an
+   OpenResty worker, can split these calls in three: Begin, which
+   returns a state, opaque_stretch_step() called until it returns
+   OPAQUE_STRETCH_DONE, interleaved with other work, and Finish, which
+   completes the call and frees the state. opaque_stretch_cancel()
+   drops a state that is not needed anymore, e.g. of a stale login.
+   Begin, the steps and Finish or cancel may each run on a different
+   thread, but never two of them at once on the same state.
+
+   Argon2id fills budget blocks of 1KiB per step, at most, on the
+   calling thread, a budget covering a whole slice of the memory runs
+   its lanes in parallel. The identity and scrypt KSFs are done in one
+   step. A step with a budget of 0 does nothing.
+
+   @param [in] state - the state returned by a Begin function
+   @param [in] budget - the number of Argon2id blocks to fill at most
+   @return OPAQUE_STRETCH_MORE if there is work left,
+        OPAQUE_STRETCH_DONE if the state can be passed to the Finish
+        function, -1 on error, the state has to be cancelled then
+ */
+int opaque_stretch_step(Opaque_Stretch *state, const uint32_t budget);
+
+/**
+   Wipes and frees a state of opaque_RecoverCredentialsBegin() or
+   opaque_FinalizeRequestBegin() that is not passed to the Finish
+   function. NULL is ignored.
+ */
+void opaque_stretch_cancel(Opaque_Stretch *state);
+
 /**
    This function implements the storePwdFile function from the paper
    it is not specified by the RFC. This function runs on the server
@@ -94,6 +474,8 @@ typedef struct {
         private key, should be set to NULL if per/user keys are to be
         generated
    @param [in] ids - the ids of the user and server, see Opaque_Ids
+   @param [in] ksf - the key stretching function hardening the
+        password, see Opaque_KSF, NULL for the default
    @param [out] rec - the opaque record the server needs to
         store. this is a pointer to memory allocated by the caller,
         and must be large enough to hold the record and take into
@@ -107,6 +489,7 @@ typedef struct {
 int opaque_Register(const uint8_t *pwdU, const uint16_t pwdU_len,
                     const uint8_t skS[crypto_scalarmult_SCALARBYTES],
                     const Opaque_Ids *ids,
+                    const Opaque_KSF *ksf,
                     uint8_t rec[OPAQUE_USER_RECORD_LEN],
                     uint8_t export_key[crypto_hash_sha512_BYTES]);
 
@@ -127,6 +510,34 @@ int opaque_CreateCredentialRequest(const uint8_t *pwdU, const uint16_t pwdU_len,
                                    uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len],
                                    uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN]);
 
+/**
+   Computes the password independent values of a login ahead of time:
+   the blinding scalar r and its inverse, the ephemeral key x_u with
+   X_u = g^x_u and the nonce. A client can run this before the user
+   entered the password, leaving only the hashing and blinding of the
+   password to opaque_CreateCredentialRequestPrecomputed(), and saving
+   opaque_RecoverCredentials() the inversion of r.
+
+   @param [out] pre - the precomputed values, these are as sensitive
+        as sec of opaque_CreateCredentialRequest()
+   @return the function returns 0 if everything is correct
+ */
+int opaque_PrecomputeCredentialRequest(uint8_t pre[OPAQUE_USER_PRECOMPUTED_LEN]);
+
+/**
+   Same as opaque_CreateCredentialRequest() but with the values of
+   opaque_PrecomputeCredentialRequest(). pre is wiped, each can be
+   used for one login only.
+
+   @param [in,out] pre - output of opaque_PrecomputeCredentialRequest()
+   @return the function returns 0 if everything is correct, and -1 if
+        pre was used before
+ */
+int opaque_CreateCredentialRequestPrecomputed(uint8_t pre[OPAQUE_USER_PRECOMPUTED_LEN],
+                                              const uint8_t *pwdU, const uint16_t pwdU_len,
+                                              uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len],
+                                              uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN]);
+
 /**
    This is the same function as defined in the paper with name
    srvSession name. This function runs on the server and
@@ -158,6 +569,423 @@ int opaque_CreateCredentialResponse(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC
                                     uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
                                     uint8_t authU[crypto_auth_hmacsha512_BYTES]);
 
+/**
+   Precomputes the per-server state for servers that use one global
+   long-term key and one context for all their users.
+
+   The result can be passed to
+   opaque_CreateCredentialResponseWithSetup() for every login, which
+   then does not need to recompute the servers public key and the
+   context dependent part of the transcript hash.
+
+   @param [in] skS - the servers long-term private key
+   @param [in] ctx - a context of this instantiation of this protocol, e.g. "AppABCv12.34"
+   @param [in] ctx_len - a context of this instantiation of this protocol
+   @param [out] setup - the precomputed server state, it contains skS
+   and must be protected just like skS.
+   @return the function returns 0 if everything is correct
+ */
+int opaque_CreateServerSetup(const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                             const uint8_t *ctx, const uint16_t ctx_len,
+                             uint8_t setup[OPAQUE_SERVER_SETUP_LEN]);
+
+/**
+   Same as opaque_CreateCredentialResponse() but takes the servers
+   key and the context from a setup created by
+   opaque_CreateServerSetup().
+
+   @param [in] pub - the pub output of the opaque_CreateCredentialRequest()
+   @param [in] rec - the recorded created during "registration" and
+   stored by the server, it must have been created with the same skS
+   that was used for the setup, otherwise the function fails.
+   @param [in] ids - the id if the client and server
+   @param [in] setup - output of opaque_CreateServerSetup()
+   @param [out] resp - servers response to be sent to the client where
+   it is used as input into opaque_RecoverCredentials()
+   @param [out] sk - the shared secret established between the user & server
+   @param [out] authU - the expected authentication token of the
+   user, see opaque_CreateCredentialResponse()
+   @return the function returns 0 if everything is correct
+ */
+int opaque_CreateCredentialResponseWithSetup(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                             const uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                                             const Opaque_Ids *ids,
+                                             const uint8_t setup[OPAQUE_SERVER_SETUP_LEN],
+                                             uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                             uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                             uint8_t authU[crypto_auth_hmacsha512_BYTES]);
+
+/**
+   Allocates a cache for the values a server derives from a user
+   record on every login, for accounts that log in many times a minute
+   with the same record, like service accounts and devices.
+
+   An entry maps a keyed hash of the whole record to the servers public
+   key, the HKDF-Expand state keyed with the masking_key of the record,
+   and the decoded client_public_key with its precomputed multiples for
+   the triple-dh. The key is random per cache, the key and the entries
+   are kept in locked memory excluded from core dumps. A record that
+   changed, e.g. by a new registration, hashes to another entry and
+   misses, the entry of the old record is only replaced when its set is
+   full, evict it with opaque_hotcache_evict() to wipe it right away.
+
+   The cache is split into shards with a lock each, the logins of
+   different records rarely wait for each other. An entry takes about
+   3 KiB of locked memory, the number of entries is rounded up to a
+   power of 2 and at least 4 per shard. A cache of 65536 entries takes
+   about 200 MiB, more than the default RLIMIT_MEMLOCK of most
+   systems, which has to be raised for it.
+
+   @param [in] max_entries - the number of entries, at most 65536, the
+        least recently used entry of a set of 4 is replaced when the
+        set is full
+   @param [in] shards - the number of shards, rounded up to a power of
+        2, at most 64, e.g. the number of threads running logins
+   @return the cache, or NULL on invalid parameters, if out of memory
+        or if the memory cannot be locked
+ */
+Opaque_HotCache *opaque_hotcache_new(const size_t max_entries, const size_t shards);
+
+/**
+   Wipes the entry of a record, e.g. when the record is replaced or
+   deleted.
+
+   @return 0 if the record was cached, -1 otherwise
+ */
+int opaque_hotcache_evict(Opaque_HotCache *cache, const uint8_t rec[OPAQUE_USER_RECORD_LEN]);
+
+/**
+   Wipes all entries of a cache, the counters are kept. NULL is
+   ignored.
+ */
+void opaque_hotcache_purge(Opaque_HotCache *cache);
+
+/**
+   Reads the counters of a cache, the sum of the counters of its
+   shards. The mean latency of a login from the cache is
+   hit_ns / hits, of one that missed miss_ns / misses.
+ */
+void opaque_hotcache_stats(Opaque_HotCache *cache, Opaque_HotCacheStats *stats);
+
+/**
+   Wipes and frees a cache allocated with opaque_hotcache_new(), no
+   call may use it anymore. NULL is ignored.
+ */
+void opaque_hotcache_free(Opaque_HotCache *cache);
+
+/**
+   Same as opaque_CreateCredentialResponse() but takes the values
+   derived from rec from cache, or derives them and stores them in
+   cache. The response is the same as without the cache.
+
+   @param [in] cache - a cache allocated with opaque_hotcache_new()
+   @return the function returns 0 if everything is correct
+ */
+int opaque_CreateCredentialResponseCached(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                          const uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                                          const Opaque_Ids *ids,
+                                          Opaque_HotCache *cache,
+                                          const uint8_t *ctx, const uint16_t ctx_len,
+                                          uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                          uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                          uint8_t authU[crypto_auth_hmacsha512_BYTES]);
+
+/**
+   Starts precomputing the parts of server responses that do not
+   depend on the request of the client: the nonces, the ephemeral key
+   x_s and its keyshare X_s = g^x_s.
+
+   The precomputed tuples are kept in a lock-free queue in locked
+   memory. opaque_CreateCredentialResponse() and
+   opaque_CreateCredentialResponseWithSetup() take one each, and only
+   generate their own when the queue is empty. threads background
+   threads with idle priority refill the queue to its capacity when
+   half of it is used, so bursts of logins are served from values
+   computed while the cpu was idle. Each tuple is used once. The child
+   of a fork() does not use the queue of its parent and has to start
+   its own.
+
+   @param [in] capacity - the number of tuples to hold, rounded up to
+        a power of 2, at most 65536
+   @param [in] threads - the number of background threads, at most 16,
+        with 0 the queue is only filled by opaque_keyshares_fill()
+   @return 0 on success, -1 if already started, on invalid parameters
+        or if out of memory
+ */
+int opaque_keyshares_start(const size_t capacity, const size_t threads);
+
+/**
+   Adds at most max tuples to the queue of opaque_keyshares_start() on
+   the calling thread, e.g. from the idle callback of an event loop.
+
+   @return the number of tuples added
+ */
+size_t opaque_keyshares_fill(const size_t max);
+
+/**
+   @return the number of precomputed tuples in the queue
+ */
+size_t opaque_keyshares_available(void);
+
+/**
+   Stops the background threads and wipes the queue, after waiting
+   for the responses that are taking a tuple from it. Responses
+   running concurrently generate their own.
+ */
+void opaque_keyshares_stop(void);
+
+/**
+   Server keyring and records without skS
+
+   A record of OPAQUE_USER_RECORD_LEN bytes carries its own copy of
+   the servers long-term key skS, which is the same in most records of
+   a server. A v2 record of OPAQUE_USER_RECORD_V2_LEN bytes replaces it
+   with a 4 byte key id, resolved on each login in a keyring that holds
+   skS and the precomputed pkS of every key of the server. Rotating the
+   key adds a new id to the keyring, records of the old id keep working
+   until it is removed.
+
+   Creates a keyring.
+
+   @param [in] slots - the number of keys it can hold, at most
+        OPAQUE_KEYRING_MAX_SLOTS
+   @return the keyring, or NULL on invalid parameters or if out of
+        memory
+ */
+Opaque_Keyring *opaque_keyring_new(const size_t slots);
+
+/**
+   Adds skS as key_id to a keyring, computing its public key.
+
+   @return 0 on success, -1 if key_id or skS is already in the keyring,
+        if the keyring is full or skS is invalid
+ */
+int opaque_keyring_add(Opaque_Keyring *keyring, const uint32_t key_id,
+                       const uint8_t skS[crypto_scalarmult_SCALARBYTES]);
+
+/**
+   Removes and wipes key_id from a keyring, logins with records of it
+   fail from then on.
+
+   @return 0 on success, -1 if there is no such key
+ */
+int opaque_keyring_remove(Opaque_Keyring *keyring, const uint32_t key_id);
+
+/**
+   Wipes and frees a keyring allocated with opaque_keyring_new(), no
+   call may use it anymore. NULL is ignored.
+ */
+void opaque_keyring_free(Opaque_Keyring *keyring);
+
+/**
+   Converts a record to v2 with the id of its skS in keyring.
+
+   @param [in] keyring - must hold the skS of rec
+   @param [in] rec - a record of opaque_Register() or opaque_StoreUserRecord()
+   @param [out] rec2 - the v2 record
+   @return 0 on success, -1 if the skS of rec is not in keyring
+ */
+int opaque_UserRecordToV2(const Opaque_Keyring *keyring,
+                          const uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                          uint8_t rec2[OPAQUE_USER_RECORD_V2_LEN]);
+
+/**
+   Converts a v2 record back, filling in skS from keyring.
+
+   @return 0 on success, -1 if the key of rec2 is not in keyring
+ */
+int opaque_UserRecordFromV2(const Opaque_Keyring *keyring,
+                            const uint8_t rec2[OPAQUE_USER_RECORD_V2_LEN],
+                            uint8_t rec[OPAQUE_USER_RECORD_LEN]);
+
+/**
+   Same as opaque_CreateCredentialResponse() but with a v2 record,
+   taking skS and pkS from keyring.
+
+   @return the function returns 0 if everything is correct, -1 also if
+        the key of rec2 is not in keyring
+ */
+int opaque_CreateCredentialResponseV2(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                      const uint8_t rec2[OPAQUE_USER_RECORD_V2_LEN],
+                                      const Opaque_Ids *ids,
+                                      const Opaque_Keyring *keyring,
+                                      const uint8_t *ctx, const uint16_t ctx_len,
+                                      uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                      uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                      uint8_t authU[crypto_auth_hmacsha512_BYTES]);
+
+/**
+   Server OPRF seed and records without kU
+
+   Instead of a random OPRF key kU per user, stored in each record, the
+   key can be derived from a secret seed of the server and an
+   identifier of the credential, as described in the irtf cfrg rfc
+   draft:
+
+     seed = Expand(oprf_seed, credid || "OprfKey", 32)
+     (kU, _) = DeriveKeyPair(seed, "OPAQUE-DeriveKeyPair")
+
+   A seeded record of OPAQUE_USER_RECORD_SEEDED_LEN bytes carries
+   neither kU nor skS, only the key id of skS in a keyring, see
+   opaque_keyring_new(). The credential identifier must be unique per
+   user and stable, e.g. the user id, and is passed to every call that
+   needs kU. Since kU is known for any identifier, a server can answer
+   logins of unknown users with a fake record derived from the seed,
+   see opaque_FakeUserRecordSeeded(), instead of a stored one.
+
+   Creates an OPRF seed.
+
+   @param [in] seed - the OPAQUE_OPRF_SEEDBYTES secret seed, the same
+        on all servers of a deployment, or NULL for a random one. The
+        seed must be kept as long as records derived from it are used.
+   @param [in] cache_entries - the number of derived keys to cache,
+        0 disables the cache, at most 1048576. A cached key saves the
+        derivation, about a hash to scalar, on each login. The cache
+        is split into up to 64 shards with a lock each, so that logins
+        on many threads rarely wait for each other.
+   @return the seed, or NULL on invalid parameters or if out of memory
+ */
+Opaque_OprfSeed *opaque_oprfseed_new(const uint8_t seed[OPAQUE_OPRF_SEEDBYTES],
+                                     const size_t cache_entries);
+
+/**
+   Wipes and frees a seed allocated with opaque_oprfseed_new() and its
+   cached keys, no call may use it anymore. NULL is ignored.
+ */
+void opaque_oprfseed_free(Opaque_OprfSeed *oprfseed);
+
+/**
+   Same as opaque_Register() but with the kU of credid derived from
+   oprfseed.
+
+   @param [in] credid - the credential identifier, not empty
+   @param [in] credid_len - the length of credid
+   @return the function returns 0 if everything is correct
+ */
+int opaque_RegisterSeeded(const uint8_t *pwdU, const uint16_t pwdU_len,
+                          const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                          Opaque_OprfSeed *oprfseed,
+                          const uint8_t *credid, const uint16_t credid_len,
+                          const Opaque_Ids *ids,
+                          const Opaque_KSF *ksf,
+                          uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                          uint8_t export_key[crypto_hash_sha512_BYTES]);
+
+/**
+   Same as opaque_CreateRegistrationResponse() but with the kU of
+   credid derived from oprfseed.
+
+   @return the function returns 0 if everything is correct
+ */
+int opaque_CreateRegistrationResponseSeeded(const uint8_t blinded[crypto_core_ristretto255_BYTES],
+                                            const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                                            Opaque_OprfSeed *oprfseed,
+                                            const uint8_t *credid, const uint16_t credid_len,
+                                            uint8_t sec[OPAQUE_REGISTER_SECRET_LEN],
+                                            uint8_t pub[OPAQUE_REGISTER_PUBLIC_LEN]);
+
+/**
+   Converts a record with a kU derived from oprfseed for credid to a
+   seeded record, with the id of its skS in keyring.
+
+   @param [in] rec - a record of opaque_RegisterSeeded() or of
+        opaque_StoreUserRecord() after
+        opaque_CreateRegistrationResponseSeeded()
+   @param [out] rec3 - the seeded record
+   @return 0 on success, -1 if the kU of rec is not the one of credid
+        or the skS of rec is not in keyring
+ */
+int opaque_UserRecordToSeeded(const Opaque_Keyring *keyring,
+                              Opaque_OprfSeed *oprfseed,
+                              const uint8_t *credid, const uint16_t credid_len,
+                              const uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                              uint8_t rec3[OPAQUE_USER_RECORD_SEEDED_LEN]);
+
+/**
+   Converts a seeded record back, filling in kU and skS.
+
+   @return 0 on success, -1 if the key of rec3 is not in keyring
+ */
+int opaque_UserRecordFromSeeded(const Opaque_Keyring *keyring,
+                                Opaque_OprfSeed *oprfseed,
+                                const uint8_t *credid, const uint16_t credid_len,
+                                const uint8_t rec3[OPAQUE_USER_RECORD_SEEDED_LEN],
+                                uint8_t rec[OPAQUE_USER_RECORD_LEN]);
+
+/**
+   Creates the seeded record of an unknown credid, for a response to a
+   login that looks like the one for a registered user, which the
+   client can not open. The record only depends on oprfseed and
+   credid, repeated logins of an unknown user get consistent responses
+   without storing anything for it.
+
+   @param [in] key_id - the key id the record names, e.g. the one of
+        the current key of the server
+   @param [out] rec3 - the fake record
+   @return 0 on success, -1 on error
+ */
+int opaque_FakeUserRecordSeeded(const Opaque_OprfSeed *oprfseed,
+                                const uint32_t key_id,
+                                const uint8_t *credid, const uint16_t credid_len,
+                                uint8_t rec3[OPAQUE_USER_RECORD_SEEDED_LEN]);
+
+/**
+   Same as opaque_CreateCredentialResponse() but with a seeded record,
+   taking skS and pkS from keyring and deriving kU from oprfseed.
+
+   @return the function returns 0 if everything is correct, -1 also if
+        the key of rec3 is not in keyring
+ */
+int opaque_CreateCredentialResponseSeeded(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                          const uint8_t rec3[OPAQUE_USER_RECORD_SEEDED_LEN],
+                                          const Opaque_Ids *ids,
+                                          const Opaque_Keyring *keyring,
+                                          Opaque_OprfSeed *oprfseed,
+                                          const uint8_t *credid, const uint16_t credid_len,
+                                          const uint8_t *ctx, const uint16_t ctx_len,
+                                          uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                          uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                          uint8_t authU[crypto_auth_hmacsha512_BYTES]);
+
+/**
+   Runs opaque_CreateCredentialResponse() for a batch of n logins
+   that share the same context.
+
+   Work that is the same for all logins in the batch - the context
+   dependent part of the transcript hash and the servers public key
+   for records sharing the same skS - is only calculated once, and
+   the random values of the batch are drawn together. The group
+   operations of four logins at a time are computed together, which
+   CPUs with AVX2 run in parallel.
+
+   The array parameters are the concatenation of n values of the
+   corresponding opaque_CreateCredentialResponse() parameter, e.g.
+   pubs is n*OPAQUE_USER_SESSION_PUBLIC_LEN bytes long.
+
+   @param [in] n - the number of logins in the batch
+   @param [in] pubs - n pub outputs of opaque_CreateCredentialRequest()
+   @param [in] recs - n records created during "registration"
+   @param [in] ids - array of n ids of the clients and server
+   @param [in] ctx - a context of this instantiation of this protocol, e.g. "AppABCv12.34"
+   @param [in] ctx_len - a context of this instantiation of this protocol
+   @param [out] resps - n responses to be sent to the clients
+   @param [out] sks - n shared secrets, zeroed for failed logins
+   @param [out] authUs - n expected authentication tokens of the
+   users, may be NULL
+   @param [out] rets - if not NULL, the return value of each login
+   @return the function returns the number of failed logins, 0 if
+   everything is correct
+ */
+int opaque_CreateCredentialResponseBatch(const size_t n,
+                                         const uint8_t *pubs/*[n*OPAQUE_USER_SESSION_PUBLIC_LEN]*/,
+                                         const uint8_t *recs/*[n*OPAQUE_USER_RECORD_LEN]*/,
+                                         const Opaque_Ids ids[],
+                                         const uint8_t *ctx, const uint16_t ctx_len,
+                                         uint8_t *resps/*[n*OPAQUE_SERVER_SESSION_LEN]*/,
+                                         uint8_t *sks/*[n*OPAQUE_SHARED_SECRETBYTES]*/,
+                                         uint8_t *authUs/*[n*crypto_auth_hmacsha512_BYTES]*/,
+                                         int rets[]);
+
 /**
    This is the same function as defined in the paper with the
    usrSessionEnd name. It is run by the user and receives as input the
@@ -175,6 +1003,8 @@ int opaque_CreateCredentialResponse(const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC
    @param [in] ctx - a context of this instantiation of this protocol, e.g. "AppABCv12.34"
    @param [in] ctx_len - a context of this instantiation of this protocol
    @param [in] ids - The ids of the server/client in case they are not the default.
+   @param [in] ksf - the key stretching function the password was
+   registered with, see Opaque_KSF, NULL for the default
    @param [out] sk - the shared secret established between the user & server
    @param [out] authU - the authentication code to be sent to the
    server in case explicit user authentication is required, optional
@@ -187,10 +1017,46 @@ int opaque_RecoverCredentials(const uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
                               const uint8_t *sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
                               const uint8_t *ctx, const uint16_t ctx_len,
                               const Opaque_Ids *ids,
+                              const Opaque_KSF *ksf,
                               uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
                               uint8_t authU[crypto_auth_hmacsha512_BYTES],
                               uint8_t export_key[crypto_hash_sha512_BYTES]);
 
+/**
+   opaque_RecoverCredentials() in steps, see opaque_stretch_step().
+   Unblinds the OPRF evaluation in resp and starts the key stretching.
+
+   @param [in] resp - the response sent from the server running opaque_CreateCredentialResponse()
+   @param [in] sec - the private sec output of opaque_CreateCredentialRequest()
+   @param [in] ksf - the key stretching function the password was
+   registered with, see Opaque_KSF, NULL for the default. The
+   descriptor is copied, its workspace is in use until the state is
+   done or cancelled.
+   @return the state, or NULL if resp is invalid, on invalid ksf
+        parameters or if out of memory
+*/
+Opaque_Stretch *opaque_RecoverCredentialsBegin(const uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                               const uint8_t *sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
+                                               const Opaque_KSF *ksf);
+
+/**
+   Completes opaque_RecoverCredentials() with a state of
+   opaque_RecoverCredentialsBegin() for which opaque_stretch_step()
+   returned OPAQUE_STRETCH_DONE. The state is freed, also on failure.
+   All other parameters are those of opaque_RecoverCredentials(), resp
+   and sec must be the same as passed to the Begin function.
+
+   @return the function returns 0 if the protocol is executed correctly
+*/
+int opaque_RecoverCredentialsFinish(Opaque_Stretch *state,
+                                    const uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                    const uint8_t *sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
+                                    const uint8_t *ctx, const uint16_t ctx_len,
+                                    const Opaque_Ids *ids,
+                                    uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                    uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                                    uint8_t export_key[crypto_hash_sha512_BYTES]);
+
 /**
    Explicit User Authentication.
 
@@ -206,6 +1072,233 @@ int opaque_RecoverCredentials(const uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
 int opaque_UserAuth(const uint8_t authU0[crypto_auth_hmacsha512_BYTES],
                     const uint8_t authU[crypto_auth_hmacsha512_BYTES]);
 
+/**
+   Stateless continuation tokens
+
+   Between opaque_CreateCredentialResponse() and opaque_UserAuth() the
+   server has to keep authU and sk. Instead of a shared session store
+   or sticky sessions, the server can seal them into a token for the
+   client, which returns it with its authU, so that any server sharing
+   the token keys can complete the login.
+
+   Allocates the token keys and the replay protection of a server.
+
+   A token is accepted once per server, the redeemed tokens are
+   remembered until they expire. Servers sharing the keys do not share
+   this set, a token replayed to another server within its lifetime
+   is accepted there, lifetime should be short, e.g. a minute.
+
+   @param [in] key - the key to seal tokens with, or NULL for a random
+        one. Servers that complete each others logins share it.
+   @param [in] key_id - the id of key, carried by the tokens
+   @param [in] lifetime - the seconds a token is valid after sealing
+   @param [in] max_used - the number of redeemed tokens to remember,
+        at most 1048576. A server that completes more logins within
+        lifetime may reject some of the excess.
+   @return the handle, or NULL on invalid parameters or if out of memory
+ */
+Opaque_Continuations *opaque_continuations_new(const uint8_t key[OPAQUE_CONTINUATION_KEYBYTES],
+                                               const uint32_t key_id,
+                                               const uint32_t lifetime, const size_t max_used);
+
+/**
+   Replaces the key tokens are sealed with. Tokens of the replaced key
+   are still accepted until the next rotation, so rotating at most
+   once per lifetime keeps every valid token working.
+
+   @param [in] key - the new key, or NULL for a random one
+   @param [in] key_id - the id of the new key, not the current one
+   @return 0 on success, -1 if key_id is the current id
+ */
+int opaque_continuations_rotate(Opaque_Continuations *continuations,
+                                const uint8_t key[OPAQUE_CONTINUATION_KEYBYTES],
+                                const uint32_t key_id);
+
+/**
+   Wipes and frees a handle allocated with opaque_continuations_new().
+   NULL is ignored.
+ */
+void opaque_continuations_free(Opaque_Continuations *continuations);
+
+/**
+   Seals the authU and sk of opaque_CreateCredentialResponse() or
+   opaque_CreateResumptionResponse() into a token for the client, which
+   sends it back with its own authU.
+
+   @param [in] authU - the authU0 to check the client against
+   @param [in] sk - the shared secret
+   @param [out] token - the token for the client
+   @return 0 on success
+ */
+int opaque_SealContinuation(Opaque_Continuations *continuations,
+                            const uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                            const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                            uint8_t token[OPAQUE_CONTINUATION_LEN]);
+
+/**
+   opaque_UserAuth() with the authU0 of a token of
+   opaque_SealContinuation().
+
+   @param [in] token - the token returned by the client
+   @param [in] authU - the authentication token sent by the user
+   @param [out] sk - the shared secret of the login, if authU verifies
+   @return 0 if the token is authentic, has not expired, was not
+        redeemed before and authU verifies, the token is redeemed then
+ */
+int opaque_UserAuthContinuation(Opaque_Continuations *continuations,
+                                const uint8_t token[OPAQUE_CONTINUATION_LEN],
+                                const uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                                uint8_t sk[OPAQUE_SHARED_SECRETBYTES]);
+
+/**
+   Session resumption
+
+   After a login that passed opaque_UserAuth() both parties can derive
+   a resumption secret from sk. The server seals it into a ticket only
+   it can open, which the client stores along with the secret. To
+   reconnect the client sends the ticket in a resumption request, and
+   the two parties run a key exchange authenticated by the resumption
+   secret instead of the full OPAQUE login: no OPRF, no key stretching
+   and at most one ephemeral Diffie-Hellman, with the same sk and authU
+   outputs as a login. The new sk can be used to issue the next ticket.
+
+   The exchange is:
+
+   - client: opaque_ResumptionSecret(), stores the ticket from the server
+   - client: opaque_CreateResumptionRequest() -> req
+   - server: opaque_CreateResumptionResponse() -> resp
+   - client: opaque_RecoverResumption() -> authU
+   - server: opaque_UserAuth()
+ */
+
+/**
+   Allocates the ticket key and the replay protection of a server.
+
+   A ticket can be redeemed once, while it is valid it is remembered
+   in a table sized for max_used entries. A server that sees more
+   resumptions within lifetime than max_used forgets some redeemed
+   tickets before they expire, first those expiring first, and these
+   could be replayed until they expire. The table is in the memory of
+   the process only: a ticket redeemed before a restart of a server
+   keeping its key is accepted again after it, and servers sharing a
+   key do not share the table, a ticket replayed to another server
+   within its lifetime is accepted there. lifetime bounds this window,
+   it should be no longer than needed.
+
+   @param [in] key - the key to seal tickets with, or NULL for a
+        random one
+   @param [in] lifetime - the seconds a ticket is valid after issuing
+   @param [in] max_used - the number of redeemed tickets to remember,
+        at most 1048576, e.g. the resumptions expected within lifetime
+   @return the handle, or NULL on invalid parameters or if out of memory
+ */
+Opaque_Tickets *opaque_tickets_new(const uint8_t key[OPAQUE_TICKET_KEYBYTES],
+                                   const uint32_t lifetime, const size_t max_used);
+
+/**
+   Wipes and frees a handle allocated with opaque_tickets_new(). NULL is
+   ignored.
+ */
+void opaque_tickets_free(Opaque_Tickets *tickets);
+
+/**
+   Derives the resumption secret from the shared secret of a login or
+   a resumption, run by the client after the server accepted authU.
+
+   @param [in] sk - the shared secret
+   @param [out] rs - the resumption secret, to be protected and stored
+        along with the ticket
+ */
+void opaque_ResumptionSecret(const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                             uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES]);
+
+/**
+   Issues a ticket for the resumption secret of sk, run by the server
+   after opaque_UserAuth() succeeded.
+
+   @param [in] tickets - the ticket key
+   @param [in] sk - the shared secret of the login or resumption
+   @param [in] idU - the user id returned by the resumption, may be NULL
+   @param [in] idU_len - the length of idU, at most OPAQUE_TICKET_IDU_MAX
+   @param [out] ticket - OPAQUE_TICKET_LEN+idU_len bytes for the client
+   @return 0 on success
+ */
+int opaque_IssueTicket(const Opaque_Tickets *tickets,
+                       const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                       const uint8_t *idU, const uint16_t idU_len,
+                       uint8_t *ticket/*[OPAQUE_TICKET_LEN+idU_len]*/);
+
+/**
+   Starts a resumption on the client.
+
+   @param [in] ticket - a ticket from opaque_IssueTicket()
+   @param [in] ticket_len - the length of ticket
+   @param [in] rs - the resumption secret of the ticket
+   @param [in] dh - non-zero to add an ephemeral Diffie-Hellman, so
+        that the new sk stays secret if the ticket key and rs leak
+        later. Without it the resumption is symmetric only.
+   @param [out] sec - the secret state of the client
+   @param [out] req - OPAQUE_RESUME_REQUEST_LEN+ticket_len bytes for the server
+   @return 0 on success
+ */
+int opaque_CreateResumptionRequest(const uint8_t *ticket, const uint16_t ticket_len,
+                                   const uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES],
+                                   const int dh,
+                                   uint8_t sec[OPAQUE_RESUME_SECRET_LEN],
+                                   uint8_t *req/*[OPAQUE_RESUME_REQUEST_LEN+ticket_len]*/);
+
+/**
+   Answers a resumption request on the server.
+
+   Fails if the ticket is not authentic, has expired, or was redeemed
+   before, the client should then run a full login.
+
+   The ticket is redeemed here, before the client proved that it knows
+   the resumption secret with the authU checked by opaque_UserAuth().
+   Anyone who captured a request can send it first, this fails the
+   key exchange but redeems the ticket, and the request of the client
+   is then refused. The client falls back to a full login, which is
+   not affected.
+
+   @param [in] tickets - the ticket key of opaque_IssueTicket()
+   @param [in] req - the request of the client
+   @param [in] req_len - the length of req
+   @param [in] ctx - the context, as for opaque_CreateCredentialResponse()
+   @param [in] ctx_len - the length of ctx
+   @param [out] resp - the response for the client
+   @param [out] sk - the shared secret
+   @param [out] authU - the authU the client must send, to be checked
+        with opaque_UserAuth()
+   @param [out] idU - the user id of the ticket, with space for
+        req_len-OPAQUE_RESUME_REQUEST_LEN-OPAQUE_TICKET_LEN bytes, may
+        be NULL if the ticket carries none
+   @return 0 on success
+ */
+int opaque_CreateResumptionResponse(Opaque_Tickets *tickets,
+                                    const uint8_t *req, const size_t req_len,
+                                    const uint8_t *ctx, const uint16_t ctx_len,
+                                    uint8_t resp[OPAQUE_RESUME_RESPONSE_LEN],
+                                    uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                    uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                                    uint8_t *idU);
+
+/**
+   Completes a resumption on the client.
+
+   @param [in] resp - the response of the server
+   @param [in] sec - the state of opaque_CreateResumptionRequest()
+   @param [in] ctx - the context, must be the same as the servers
+   @param [in] ctx_len - the length of ctx
+   @param [out] sk - the shared secret
+   @param [out] authU - the authentication token to send to the server
+   @return 0 if the server proved knowledge of the resumption secret
+ */
+int opaque_RecoverResumption(const uint8_t resp[OPAQUE_RESUME_RESPONSE_LEN],
+                             const uint8_t sec[OPAQUE_RESUME_SECRET_LEN],
+                             const uint8_t *ctx, const uint16_t ctx_len,
+                             uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                             uint8_t authU[crypto_auth_hmacsha512_BYTES]);
+
 /**
    Alternative user initialization, user registration as specified by the RFC
  */
@@ -277,6 +1370,9 @@ int opaque_CreateRegistrationResponse(const uint8_t request[crypto_core_ristrett
    @param [in] pub - response from the server running
    opaque_CreateRegistrationResponse()
    @param [in] ids - if ids are not the default value
+   @param [in] ksf - the key stretching function hardening the
+   password, see Opaque_KSF, NULL for the default. The same KSF must
+   be passed to opaque_RecoverCredentials() later.
    @param [out] reg_rec - the opaque registration record containing
    the users data.
    @param [out] export_key - key used to encrypt/authenticate extra
@@ -288,9 +1384,42 @@ int opaque_CreateRegistrationResponse(const uint8_t request[crypto_core_ristrett
 int opaque_FinalizeRequest(const uint8_t *sec/*[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len]*/,
                            const uint8_t pub[OPAQUE_REGISTER_PUBLIC_LEN],
                            const Opaque_Ids *ids,
+                           const Opaque_KSF *ksf,
                            uint8_t reg_rec[OPAQUE_REGISTRATION_RECORD_LEN],
                            uint8_t export_key[crypto_hash_sha512_BYTES]);
 
+/**
+   opaque_FinalizeRequest() in steps, see opaque_stretch_step().
+   Unblinds the OPRF evaluation in pub and starts the key stretching.
+
+   @param [in] sec - the private context of opaque_CreateRegistrationRequest()
+   @param [in] pub - the response of opaque_CreateRegistrationResponse()
+   @param [in] ksf - the key stretching function to register the
+   password with, see Opaque_KSF, NULL for the default. The descriptor
+   is copied, its workspace is in use until the state is done or
+   cancelled.
+   @return the state, or NULL if pub is invalid, on invalid ksf
+        parameters or if out of memory
+*/
+Opaque_Stretch *opaque_FinalizeRequestBegin(const uint8_t *sec/*[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len]*/,
+                                            const uint8_t pub[OPAQUE_REGISTER_PUBLIC_LEN],
+                                            const Opaque_KSF *ksf);
+
+/**
+   Completes opaque_FinalizeRequest() with a state of
+   opaque_FinalizeRequestBegin() for which opaque_stretch_step()
+   returned OPAQUE_STRETCH_DONE. The state is freed, also on failure.
+   All other parameters are those of opaque_FinalizeRequest(), pub must
+   be the same as passed to the Begin function.
+
+   @return the function returns 0 if everything is correct
+*/
+int opaque_FinalizeRequestFinish(Opaque_Stretch *state,
+                                 const uint8_t pub[OPAQUE_REGISTER_PUBLIC_LEN],
+                                 const Opaque_Ids *ids,
+                                 uint8_t reg_rec[OPAQUE_REGISTRATION_RECORD_LEN],
+                                 uint8_t export_key[crypto_hash_sha512_BYTES]);
+
 /**
    Final Registration step - server adds own info to the record to be stored.
 
@@ -314,4 +1443,140 @@ void opaque_StoreUserRecord(const uint8_t sec[OPAQUE_REGISTER_SECRET_LEN],
                             const uint8_t recU[OPAQUE_REGISTRATION_RECORD_LEN],
                             uint8_t rec[OPAQUE_USER_RECORD_LEN]);
 
+/**
+   Asynchronous calls
+
+   The opaque_async_*() functions submit one of the functions of the
+   same name to a pool of threads and return immediately, so that an
+   event loop can drive many registrations and logins at once without
+   a thread per request. The parameters are the same as for the
+   synchronous function, all buffers and the ids must stay valid and
+   untouched until the call completed; the Opaque_Ids and Opaque_KSF
+   structs themselves are copied.
+
+   A call completes either by running done(user, ret) on a thread of
+   the pool, which may submit the next call, or, if done is NULL, by
+   queueing its result for opaque_async_complete(), while a file
+   descriptor is readable, see opaque_async_fd().
+
+   Each thread of the pool has a queue of calls, an idle thread takes
+   calls from the others. At most depth calls are pending at a time -
+   from their submission until their callback is run or their result
+   was taken by opaque_async_complete() -, a submission beyond that
+   returns OPAQUE_ASYNC_FULL, and should be retried after some calls
+   completed.
+
+   Creates a pool.
+
+   @param [in] threads - the number of threads, 0 for one per online cpu,
+        at most 64
+   @param [in] depth - the number of calls that can be pending, at most
+        65536
+   @return the pool, or NULL on invalid parameters or if out of resources
+ */
+Opaque_Async *opaque_async_new(const size_t threads, const size_t depth);
+
+/**
+   A file descriptor that is readable while completed calls without a
+   callback wait for opaque_async_complete(), for poll(), epoll or
+   the event loop of a binding. It must not be read or closed.
+ */
+int opaque_async_fd(const Opaque_Async *async);
+
+/**
+   Takes the results of at most max completed calls without a callback,
+   in the order they completed, and makes their places available for
+   new calls.
+
+   @return the number of results stored in results, 0 if none completed
+ */
+size_t opaque_async_complete(Opaque_Async *async, Opaque_AsyncResult *results, const size_t max);
+
+/**
+   Waits until all submitted calls ran, including their callbacks.
+ */
+void opaque_async_drain(Opaque_Async *async);
+
+/**
+   Runs the submitted calls, stops the threads and frees the pool, the
+   results not taken yet are discarded. No call may use it anymore.
+   NULL is ignored.
+ */
+void opaque_async_free(Opaque_Async *async);
+
+/**
+   opaque_Register() on the pool.
+
+   @param [in] async - the pool
+   @param [in] done - the callback, or NULL to complete with
+        opaque_async_complete()
+   @param [in] user - passed to done or returned by
+        opaque_async_complete()
+   @return 0 if submitted, OPAQUE_ASYNC_FULL if depth calls are
+        pending, -1 if the pool is stopping
+ */
+int opaque_async_Register(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                          const uint8_t *pwdU, const uint16_t pwdU_len,
+                          const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                          const Opaque_Ids *ids,
+                          const Opaque_KSF *ksf,
+                          uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                          uint8_t export_key[crypto_hash_sha512_BYTES]);
+
+/**
+   opaque_CreateRegistrationResponse() on the pool, see
+   opaque_async_Register().
+ */
+int opaque_async_CreateRegistrationResponse(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                                            const uint8_t request[crypto_core_ristretto255_BYTES],
+                                            const uint8_t skS[crypto_scalarmult_SCALARBYTES],
+                                            uint8_t sec[OPAQUE_REGISTER_SECRET_LEN],
+                                            uint8_t pub[OPAQUE_REGISTER_PUBLIC_LEN]);
+
+/**
+   opaque_FinalizeRequest() on the pool, see opaque_async_Register().
+ */
+int opaque_async_FinalizeRequest(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                                 const uint8_t *sec/*[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len]*/,
+                                 const uint8_t pub[OPAQUE_REGISTER_PUBLIC_LEN],
+                                 const Opaque_Ids *ids,
+                                 const Opaque_KSF *ksf,
+                                 uint8_t reg_rec[OPAQUE_REGISTRATION_RECORD_LEN],
+                                 uint8_t export_key[crypto_hash_sha512_BYTES]);
+
+/**
+   opaque_CreateCredentialRequest() on the pool, see
+   opaque_async_Register().
+ */
+int opaque_async_CreateCredentialRequest(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                                         const uint8_t *pwdU, const uint16_t pwdU_len,
+                                         uint8_t *sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
+                                         uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN]);
+
+/**
+   opaque_CreateCredentialResponse() on the pool, see
+   opaque_async_Register().
+ */
+int opaque_async_CreateCredentialResponse(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                                          const uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN],
+                                          const uint8_t rec[OPAQUE_USER_RECORD_LEN],
+                                          const Opaque_Ids *ids,
+                                          const uint8_t *ctx, const uint16_t ctx_len,
+                                          uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                          uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                          uint8_t authU[crypto_auth_hmacsha512_BYTES]);
+
+/**
+   opaque_RecoverCredentials() on the pool, see opaque_async_Register().
+ */
+int opaque_async_RecoverCredentials(Opaque_Async *async, const Opaque_AsyncDone done, void *user,
+                                    const uint8_t resp[OPAQUE_SERVER_SESSION_LEN],
+                                    const uint8_t *sec/*[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len]*/,
+                                    const uint8_t *ctx, const uint16_t ctx_len,
+                                    const Opaque_Ids *ids,
+                                    const Opaque_KSF *ksf,
+                                    uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                                    uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                                    uint8_t export_key[crypto_hash_sha512_BYTES]);
+
 #endif // opaque_h
@@ -0,0 +1,179 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "common.h"
+#include "oprfseed.h"
+
+#define OPRFSEED_MAX_ENTRIES (1 << 20)
+#define OPRFSEED_WAYS 4
+#define OPRFSEED_MAX_SHARDS 64
+
+typedef struct {
+  uint8_t tag[OPAQUE_OPRFSEED_TAGBYTES];
+  uint8_t kU[crypto_core_ristretto255_SCALARBYTES];
+  // the lookup counter of the last use, 0 for a free entry
+  uint64_t used;
+  uint64_t pad;
+} Entry;
+
+// sodium_malloc()ed, the size of both is a multiple of 16 so that the
+// guard page aligned end of the allocation keeps the fields aligned
+typedef struct {
+  uint8_t seed[OPAQUE_OPRF_SEEDBYTES];
+  uint8_t key[crypto_generichash_KEYBYTES];
+  Entry entries[];
+} Secrets;
+
+// a cache line each, so that logins on different shards do not share
+// the line of a lock
+typedef struct {
+  pthread_mutex_t lock;
+  uint64_t clock;
+} __attribute((aligned(64))) Shard;
+
+struct Opaque_OprfSeed {
+  // the number of sets, a power of 2, 0 without a cache
+  size_t sets;
+  // a power of 2 of at most sets, set i is in shard i % shards
+  size_t shards;
+  Shard *shard;
+  Secrets *secrets;
+};
+
+Opaque_OprfSeed *opaque_oprfseed_new(const uint8_t seed[OPAQUE_OPRF_SEEDBYTES],
+                                     const size_t cache_entries) {
+  size_t sets = 0;
+  if(cache_entries > OPRFSEED_MAX_ENTRIES) return NULL;
+  if(cache_entries > 0) {
+    sets = 1;
+    while(sets * OPRFSEED_WAYS < cache_entries) sets <<= 1;
+  }
+  Opaque_OprfSeed *oprfseed = calloc(1, sizeof *oprfseed);
+  if(oprfseed==NULL) return NULL;
+  const size_t entries = sets * OPRFSEED_WAYS;
+  oprfseed->secrets = sodium_malloc(sizeof(Secrets) + entries * sizeof(Entry));
+  if(oprfseed->secrets==NULL) {
+    free(oprfseed);
+    return NULL;
+  }
+  if(sets > 0) {
+    size_t nshards = (sets < OPRFSEED_MAX_SHARDS) ? sets : OPRFSEED_MAX_SHARDS, i;
+    void *mem = NULL;
+    if(0!=posix_memalign(&mem, 64, nshards * sizeof(Shard))) {
+      opaque_oprfseed_free(oprfseed);
+      return NULL;
+    }
+    memset(mem, 0, nshards * sizeof(Shard));
+    oprfseed->shard = mem;
+    for(i=0;i<nshards;i++) {
+      if(0!=pthread_mutex_init(&oprfseed->shard[i].lock, NULL)) {
+        opaque_oprfseed_free(oprfseed);
+        return NULL;
+      }
+      // counts the shards to free
+      oprfseed->shards++;
+    }
+  }
+  memset(oprfseed->secrets->entries, 0, entries * sizeof(Entry));
+  if(seed!=NULL) memcpy(oprfseed->secrets->seed, seed, OPAQUE_OPRF_SEEDBYTES);
+  else randombytes(oprfseed->secrets->seed, OPAQUE_OPRF_SEEDBYTES);
+  randombytes(oprfseed->secrets->key, sizeof oprfseed->secrets->key);
+  oprfseed->sets = sets;
+  return oprfseed;
+}
+
+void opaque_oprfseed_free(Opaque_OprfSeed *oprfseed) {
+  size_t i;
+  if(oprfseed==NULL) return;
+  // sodium_free wipes the seed and the cached keys
+  sodium_free(oprfseed->secrets);
+  for(i=0;i<oprfseed->shards;i++) pthread_mutex_destroy(&oprfseed->shard[i].lock);
+  free(oprfseed->shard);
+  free(oprfseed);
+}
+
+const uint8_t *opaque_oprfseed_seed(const Opaque_OprfSeed *oprfseed) {
+  return oprfseed->secrets->seed;
+}
+
+void opaque_oprfseed_tag(const Opaque_OprfSeed *oprfseed,
+                         const uint8_t *credid, const uint16_t credid_len,
+                         uint8_t tag[OPAQUE_OPRFSEED_TAGBYTES]) {
+  crypto_generichash(tag, OPAQUE_OPRFSEED_TAGBYTES, credid, credid_len,
+                     oprfseed->secrets->key, sizeof oprfseed->secrets->key);
+}
+
+// the set of tag from its first bytes, and the shard holding it
+static Shard *shard_of(const Opaque_OprfSeed *oprfseed, const uint8_t tag[OPAQUE_OPRFSEED_TAGBYTES], Entry **set) {
+  size_t i, idx = 0;
+  for(i=0;i<sizeof idx;i++) idx = (idx << 8) | tag[i];
+  idx &= oprfseed->sets - 1;
+  *set = &oprfseed->secrets->entries[idx * OPRFSEED_WAYS];
+  return &oprfseed->shard[idx & (oprfseed->shards - 1)];
+}
+
+int opaque_oprfseed_get(Opaque_OprfSeed *oprfseed,
+                        const uint8_t tag[OPAQUE_OPRFSEED_TAGBYTES],
+                        uint8_t kU[crypto_core_ristretto255_SCALARBYTES]) {
+  if(oprfseed->sets==0) return -1;
+  Entry *set;
+  Shard *s = shard_of(oprfseed, tag, &set);
+  int ret = -1;
+  size_t i;
+  pthread_mutex_lock(&s->lock);
+  for(i=0;i<OPRFSEED_WAYS;i++) {
+    Entry *e = &set[i];
+    if(e->used!=0 && 0==sodium_memcmp(e->tag, tag, OPAQUE_OPRFSEED_TAGBYTES)) {
+      memcpy(kU, e->kU, crypto_core_ristretto255_SCALARBYTES);
+      e->used = ++s->clock;
+      ret = 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  return ret;
+}
+
+void opaque_oprfseed_put(Opaque_OprfSeed *oprfseed,
+                         const uint8_t tag[OPAQUE_OPRFSEED_TAGBYTES],
+                         const uint8_t kU[crypto_core_ristretto255_SCALARBYTES]) {
+  if(oprfseed->sets==0) return;
+  Entry *set;
+  Shard *s = shard_of(oprfseed, tag, &set);
+  size_t i;
+  pthread_mutex_lock(&s->lock);
+  // the entry of the same tag, else the least recently used, free
+  // entries have used==0
+  Entry *slot = &set[0];
+  for(i=0;i<OPRFSEED_WAYS;i++) {
+    Entry *e = &set[i];
+    if(e->used!=0 && 0==sodium_memcmp(e->tag, tag, OPAQUE_OPRFSEED_TAGBYTES)) {
+      slot = e;
+      break;
+    }
+    if(e->used < slot->used) slot = e;
+  }
+  memcpy(slot->tag, tag, OPAQUE_OPRFSEED_TAGBYTES);
+  memcpy(slot->kU, kU, crypto_core_ristretto255_SCALARBYTES);
+  slot->used = ++s->clock;
+  pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,36 @@
+#ifndef OPRFSEED_H
+#define OPRFSEED_H
+
+#include <stdint.h>
+#include "opaque.h"
+
+/* the server OPRF seed of opaque.h and its cache of derived keys
+ *
+ * The seed and the cache are in memory allocated with sodium_malloc().
+ * The cache is set associative with 4 entries per set, a set is
+ * selected by the tag of the credential identifier, a keyed hash with
+ * a key random per seed, and replaces its least recently used entry.
+ * The sets are spread over up to 64 shards with a lock each. */
+
+#define OPAQUE_OPRFSEED_TAGBYTES 32
+
+// the seed the keys are derived from
+const uint8_t *opaque_oprfseed_seed(const Opaque_OprfSeed *oprfseed);
+
+// the tag of a credential identifier
+void opaque_oprfseed_tag(const Opaque_OprfSeed *oprfseed,
+                         const uint8_t *credid, const uint16_t credid_len,
+                         uint8_t tag[OPAQUE_OPRFSEED_TAGBYTES]);
+
+// copies the kU of tag to kU, returns 0 then, -1 if it is not cached
+// or the seed has no cache
+int opaque_oprfseed_get(Opaque_OprfSeed *oprfseed,
+                        const uint8_t tag[OPAQUE_OPRFSEED_TAGBYTES],
+                        uint8_t kU[crypto_core_ristretto255_SCALARBYTES]);
+
+// caches kU for tag, if the seed has a cache
+void opaque_oprfseed_put(Opaque_OprfSeed *oprfseed,
+                         const uint8_t tag[OPAQUE_OPRFSEED_TAGBYTES],
+                         const uint8_t kU[crypto_core_ristretto255_SCALARBYTES]);
+
+#endif // OPRFSEED_H
@@ -0,0 +1,130 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#if _WIN32 == 1 || _WIN64 == 1
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "pool.h"
+
+// the current job, all fields are protected by lock. A job is done
+// when next reached n and no worker is running any of its calls.
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  void (*fn)(void *arg, const size_t i);
+  void *arg;
+  size_t n;
+  size_t next;
+  size_t running;
+  uint64_t job;
+} pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .work = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+};
+
+// held by the thread whose job the pool is running
+static pthread_mutex_t busy = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static size_t workers = 0;
+
+// runs calls of the current job until none are left, called and
+// returns with lock held
+static void run_calls(void) {
+  while(pool.next < pool.n) {
+    const size_t i = pool.next++;
+    void (*fn)(void *arg, const size_t i) = pool.fn;
+    void *arg = pool.arg;
+    pthread_mutex_unlock(&pool.lock);
+    fn(arg, i);
+    pthread_mutex_lock(&pool.lock);
+  }
+}
+
+static void *worker(void *unused) {
+  (void) unused;
+  uint64_t seen = 0;
+  pthread_mutex_lock(&pool.lock);
+  for(;;) {
+    while(pool.job==seen) pthread_cond_wait(&pool.work, &pool.lock);
+    seen = pool.job;
+    pool.running++;
+    run_calls();
+    if(--pool.running==0) pthread_cond_signal(&pool.done);
+  }
+  return NULL;
+}
+
+static size_t online_cpus(void) {
+#if _WIN32 == 1 || _WIN64 == 1
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  const long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0) ? (size_t) n : 1;
+#else
+  return 1;
+#endif
+}
+
+static void pool_init(void) {
+  const char *env = getenv("OPAQUE_THREADS");
+  size_t n = (env!=NULL && env[0]!=0) ? strtoul(env, NULL, 10) : online_cpus();
+  if(n > OPAQUE_POOL_MAX_THREADS) n = OPAQUE_POOL_MAX_THREADS;
+  pthread_attr_t attr;
+  if(0!=pthread_attr_init(&attr)) return;
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  // without thread support (e.g. emscripten) the caller does it all
+  for(;workers+1<n;workers++) {
+    pthread_t t;
+    if(0!=pthread_create(&t, &attr, worker, NULL)) break;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+size_t opaque_pool_threads(void) {
+  pthread_once(&pool_once, pool_init);
+  return workers + 1;
+}
+
+void opaque_pool_run(const size_t n, void (*fn)(void *arg, const size_t i), void *arg) {
+  size_t i;
+  pthread_once(&pool_once, pool_init);
+  if(n<2 || workers==0 || 0!=pthread_mutex_trylock(&busy)) {
+    for(i=0;i<n;i++) fn(arg, i);
+    return;
+  }
+  pthread_mutex_lock(&pool.lock);
+  pool.fn = fn;
+  pool.arg = arg;
+  pool.n = n;
+  pool.next = 0;
+  pool.job++;
+  pthread_cond_broadcast(&pool.work);
+  run_calls();
+  while(pool.running > 0) pthread_cond_wait(&pool.done, &pool.lock);
+  pthread_mutex_unlock(&pool.lock);
+  pthread_mutex_unlock(&busy);
+}
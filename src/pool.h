@@ -0,0 +1,28 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/* small internal thread pool for the data parallel kernels
+ *
+ * opaque_pool_run(n, fn, arg) calls fn(arg, i) for every i < n, on the
+ * calling thread and on the worker threads of the pool, and returns
+ * when all the calls have returned. The workers are started on first
+ * use, one less than the number of online cpus (at most
+ * OPAQUE_POOL_MAX_THREADS in total), and live until the process exits.
+ * The environment variable OPAQUE_THREADS overrides the number of
+ * threads, e.g. for benchmarking, "1" disables the workers.
+ *
+ * The pool runs one job at a time, a caller finding it busy - another
+ * thread, or fn itself calling opaque_pool_run() - runs all of its
+ * calls on its own thread. So does the child of a fork(), which has
+ * no workers. */
+
+#define OPAQUE_POOL_MAX_THREADS 16
+
+// number of threads a job can run on, including the caller
+size_t opaque_pool_threads(void);
+
+void opaque_pool_run(const size_t n, void (*fn)(void *arg, const size_t i), void *arg);
+
+#endif // POOL_H
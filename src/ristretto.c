@@ -0,0 +1,1197 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ristretto255 as specified in
+ * https://datatracker.ietf.org/doc/draft-irtf-cfrg-ristretto255-decaf448/
+ * on the twisted edwards curve -x^2+y^2 = 1+dx^2y^2, using the field
+ * arithmetic and the point formulas of the ref10 implementation in
+ * libsodium. Everything depending on secret data is constant time. */
+
+#include <string.h>
+#include <pthread.h>
+#include "ristretto.h"
+#include "common.h"
+
+#ifdef __SIZEOF_INT128__
+#define RISTRETTO_FE51 1
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__) && (defined(__GNUC__) || defined(__clang__))
+#define RISTRETTO_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#ifdef RISTRETTO_FE51
+
+typedef unsigned __int128 uint128_t;
+// field element in radix 2^51
+typedef uint64_t fe[5];
+
+#define MASK51 0x7ffffffffffffULL
+// the limb loops are unrolled also at -O2, so that the limbs stay in
+// registers
+#define UNROLL _Pragma("GCC unroll 10")
+
+static const fe fe_d = { 0x34dca135978a3ULL, 0x1a8283b156ebdULL, 0x5e7a26001c029ULL, 0x739c663a03cbbULL, 0x52036cee2b6ffULL };
+static const fe fe_d2 = { 0x69b9426b2f159ULL, 0x35050762add7aULL, 0x3cf44c0038052ULL, 0x6738cc7407977ULL, 0x2406d9dc56dffULL };
+static const fe fe_sqrtm1 = { 0x61b274a0ea0b0ULL, 0x0d5a5fc8f189dULL, 0x7ef5e9cbd0c60ULL, 0x78595a6804c9eULL, 0x2b8324804fc1dULL };
+// 1/sqrt(a-d)
+static const fe fe_invsqrtamd = { 0x0fdaa805d40eaULL, 0x2eb482e57d339ULL, 0x007610274bc58ULL, 0x6510b613dc8ffULL, 0x786c8905cfaffULL };
+// sqrt(a*d-1)
+static const fe fe_sqrtadm1 = { 0x7f6a0497b2e1bULL, 0x1836f0a97afd2ULL, 0x7d747f6be7638ULL, 0x456079e7e6498ULL, 0x376931bf2b834ULL };
+// 1-d^2
+static const fe fe_onemsqd = { 0x409c1945fc176ULL, 0x719abc6a1fc4fULL, 0x1c37f90b20684ULL, 0x06bccca55eedfULL, 0x029072a8b2b3eULL };
+// (d-1)^2
+static const fe fe_sqdmone = { 0x55aaa44ed4d20ULL, 0x59603c3332635ULL, 0x26d3baf4a7928ULL, 0x120a66e6997a9ULL, 0x5968b37af66c2ULL };
+
+static uint64_t load64_le(const uint8_t *p) {
+  uint64_t x=0;
+  int i;
+  for(i=7;i>=0;i--) x = (x << 8) | p[i];
+  return x;
+}
+
+static void store64_le(uint8_t *p, const uint64_t x) {
+  unsigned i;
+  for(i=0;i<8;i++) p[i] = (uint8_t) (x >> (8*i));
+}
+
+static void fe_0(fe h) {
+  memset(h, 0, sizeof(fe));
+}
+
+static void fe_1(fe h) {
+  fe_0(h);
+  h[0] = 1;
+}
+
+static inline void fe_copy(fe h, const fe f) {
+  memcpy(h, f, sizeof(fe));
+}
+
+// limbs of the result are at most 2^51 larger than the sum of the inputs
+static inline void fe_add(fe h, const fe f, const fe g) {
+  unsigned i;
+  UNROLL
+  for(i=0;i<5;i++) h[i] = f[i] + g[i];
+}
+
+// one carry chain, the limbs of h are below 2^51 except h[0] which
+// can be 19*2^13 larger
+static inline void fe_carry_weak(fe h, const fe f) {
+  uint64_t h0=f[0], h1=f[1], h2=f[2], h3=f[3], h4=f[4];
+  h1 += h0 >> 51; h0 &= MASK51;
+  h2 += h1 >> 51; h1 &= MASK51;
+  h3 += h2 >> 51; h2 &= MASK51;
+  h4 += h3 >> 51; h3 &= MASK51;
+  h0 += 19ULL * (h4 >> 51); h4 &= MASK51;
+  h[0] = h0; h[1] = h1; h[2] = h2; h[3] = h3; h[4] = h4;
+}
+
+// g is carried first, so that adding 2p to f always covers it
+static inline void fe_sub(fe h, const fe f, const fe g) {
+  fe t;
+  fe_carry_weak(t, g);
+  h[0] = (f[0] + 0xfffffffffffdaULL) - t[0];
+  h[1] = (f[1] + 0xffffffffffffeULL) - t[1];
+  h[2] = (f[2] + 0xffffffffffffeULL) - t[2];
+  h[3] = (f[3] + 0xffffffffffffeULL) - t[3];
+  h[4] = (f[4] + 0xffffffffffffeULL) - t[4];
+}
+
+static inline void fe_neg(fe h, const fe f) {
+  fe zero;
+  fe_0(zero);
+  fe_sub(h, zero, f);
+}
+
+// carries the two halves of the limbs in parallel, this is shorter
+// than one chain from r0 to r4 and back
+static inline void fe_carry(fe h, uint128_t r0, uint128_t r1, const uint128_t r2, uint128_t r3, uint128_t r4) {
+  uint64_t h0, h1, h2, h3, h4;
+  r1 += (uint64_t) (r0 >> 51); h0 = (uint64_t) r0 & MASK51;
+  r4 += (uint64_t) (r3 >> 51); h3 = (uint64_t) r3 & MASK51;
+  const uint128_t c2 = r2 + (uint64_t) (r1 >> 51); h1 = (uint64_t) r1 & MASK51;
+  h0 += 19ULL * (uint64_t) (r4 >> 51); h4 = (uint64_t) r4 & MASK51;
+  h3 += (uint64_t) (c2 >> 51); h2 = (uint64_t) c2 & MASK51;
+  h1 += h0 >> 51; h0 &= MASK51;
+  h4 += h3 >> 51; h3 &= MASK51;
+  h[0] = h0; h[1] = h1; h[2] = h2; h[3] = h3; h[4] = h4;
+}
+
+static inline void fe_mul(fe h, const fe f, const fe g) {
+  const uint64_t f0=f[0], f1=f[1], f2=f[2], f3=f[3], f4=f[4];
+  const uint64_t g0=g[0], g1=g[1], g2=g[2], g3=g[3], g4=g[4];
+  const uint64_t g1_19=19ULL*g1, g2_19=19ULL*g2, g3_19=19ULL*g3, g4_19=19ULL*g4;
+  const uint128_t r0 = (uint128_t) f0*g0 + (uint128_t) f1*g4_19 + (uint128_t) f2*g3_19 + (uint128_t) f3*g2_19 + (uint128_t) f4*g1_19;
+  const uint128_t r1 = (uint128_t) f0*g1 + (uint128_t) f1*g0 + (uint128_t) f2*g4_19 + (uint128_t) f3*g3_19 + (uint128_t) f4*g2_19;
+  const uint128_t r2 = (uint128_t) f0*g2 + (uint128_t) f1*g1 + (uint128_t) f2*g0 + (uint128_t) f3*g4_19 + (uint128_t) f4*g3_19;
+  const uint128_t r3 = (uint128_t) f0*g3 + (uint128_t) f1*g2 + (uint128_t) f2*g1 + (uint128_t) f3*g0 + (uint128_t) f4*g4_19;
+  const uint128_t r4 = (uint128_t) f0*g4 + (uint128_t) f1*g3 + (uint128_t) f2*g2 + (uint128_t) f3*g1 + (uint128_t) f4*g0;
+  fe_carry(h, r0, r1, r2, r3, r4);
+}
+
+static inline void fe_sq(fe h, const fe f) {
+  const uint64_t f0=f[0], f1=f[1], f2=f[2], f3=f[3], f4=f[4];
+  const uint64_t f0_2=2ULL*f0, f1_2=2ULL*f1;
+  const uint64_t f1_38=38ULL*f1, f2_38=38ULL*f2, f3_38=38ULL*f3;
+  const uint64_t f3_19=19ULL*f3, f4_19=19ULL*f4;
+  const uint128_t r0 = (uint128_t) f0*f0 + (uint128_t) f1_38*f4 + (uint128_t) f2_38*f3;
+  const uint128_t r1 = (uint128_t) f0_2*f1 + (uint128_t) f2_38*f4 + (uint128_t) f3_19*f3;
+  const uint128_t r2 = (uint128_t) f0_2*f2 + (uint128_t) f1*f1 + (uint128_t) f3_38*f4;
+  const uint128_t r3 = (uint128_t) f0_2*f3 + (uint128_t) f1_2*f2 + (uint128_t) f4_19*f4;
+  const uint128_t r4 = (uint128_t) f0_2*f4 + (uint128_t) f1_2*f3 + (uint128_t) f2*f2;
+  fe_carry(h, r0, r1, r2, r3, r4);
+}
+
+// h = 2*f^2
+static inline void fe_sq2(fe h, const fe f) {
+  unsigned i;
+  fe_sq(h, f);
+  UNROLL
+  for(i=0;i<5;i++) h[i] += h[i];
+}
+
+static void fe_frombytes(fe h, const uint8_t s[32]) {
+  h[0] = load64_le(s) & MASK51;
+  h[1] = (load64_le(s + 6) >> 3) & MASK51;
+  h[2] = (load64_le(s + 12) >> 6) & MASK51;
+  h[3] = (load64_le(s + 19) >> 1) & MASK51;
+  h[4] = (load64_le(s + 24) >> 12) & MASK51;
+}
+
+// fully reduces f modulo p
+static void fe_reduce(uint64_t t[5], const fe f) {
+  int i;
+  memcpy(t, f, sizeof(fe));
+  for(i=0;i<2;i++) {
+    t[1] += t[0] >> 51; t[0] &= MASK51;
+    t[2] += t[1] >> 51; t[1] &= MASK51;
+    t[3] += t[2] >> 51; t[2] &= MASK51;
+    t[4] += t[3] >> 51; t[3] &= MASK51;
+    t[0] += 19ULL * (t[4] >> 51); t[4] &= MASK51;
+  }
+  // t < 2^255, add 19 to find out if it is >= p
+  t[0] += 19ULL;
+  t[1] += t[0] >> 51; t[0] &= MASK51;
+  t[2] += t[1] >> 51; t[1] &= MASK51;
+  t[3] += t[2] >> 51; t[2] &= MASK51;
+  t[4] += t[3] >> 51; t[3] &= MASK51;
+  t[0] += 19ULL * (t[4] >> 51); t[4] &= MASK51;
+  // add 2^255-19 and drop the 2^255
+  t[0] += 0x8000000000000ULL - 19ULL;
+  t[1] += 0x8000000000000ULL - 1ULL;
+  t[2] += 0x8000000000000ULL - 1ULL;
+  t[3] += 0x8000000000000ULL - 1ULL;
+  t[4] += 0x8000000000000ULL - 1ULL;
+  t[1] += t[0] >> 51; t[0] &= MASK51;
+  t[2] += t[1] >> 51; t[1] &= MASK51;
+  t[3] += t[2] >> 51; t[2] &= MASK51;
+  t[4] += t[3] >> 51; t[3] &= MASK51;
+  t[4] &= MASK51;
+}
+
+static void fe_tobytes(uint8_t s[32], const fe f) {
+  uint64_t t[5];
+  fe_reduce(t, f);
+  store64_le(s, t[0] | (t[1] << 51));
+  store64_le(s + 8, (t[1] >> 13) | (t[2] << 38));
+  store64_le(s + 16, (t[2] >> 26) | (t[3] << 25));
+  store64_le(s + 24, (t[3] >> 39) | (t[4] << 12));
+}
+
+static int fe_isnegative(const fe f) {
+  uint8_t s[32];
+  fe_tobytes(s, f);
+  return s[0] & 1;
+}
+
+static int fe_iszero(const fe f) {
+  uint8_t s[32];
+  fe_tobytes(s, f);
+  return sodium_is_zero(s, sizeof s);
+}
+
+// f = g if b, b must be 0 or 1
+static inline void fe_cmov(fe f, const fe g, const unsigned int b) {
+  const uint64_t mask = (uint64_t) (-(int64_t) b);
+  unsigned i;
+  UNROLL
+  for(i=0;i<5;i++) f[i] ^= (f[i] ^ g[i]) & mask;
+}
+
+static void fe_cneg(fe h, const fe f, const unsigned int b) {
+  fe negf;
+  fe_neg(negf, f);
+  fe_copy(h, f);
+  fe_cmov(h, negf, b);
+}
+
+static void fe_abs(fe h, const fe f) {
+  fe_cneg(h, f, (unsigned int) fe_isnegative(f));
+}
+
+// out = z^(2^252-3)
+static void fe_pow22523(fe out, const fe z) {
+  fe t0, t1, t2;
+  int i;
+  fe_sq(t0, z);
+  fe_sq(t1, t0);
+  fe_sq(t1, t1);
+  fe_mul(t1, z, t1);
+  fe_mul(t0, t0, t1);
+  fe_sq(t0, t0);
+  fe_mul(t0, t1, t0);
+  fe_sq(t1, t0);
+  for(i=1;i<5;i++) fe_sq(t1, t1);
+  fe_mul(t0, t1, t0);
+  fe_sq(t1, t0);
+  for(i=1;i<10;i++) fe_sq(t1, t1);
+  fe_mul(t1, t1, t0);
+  fe_sq(t2, t1);
+  for(i=1;i<20;i++) fe_sq(t2, t2);
+  fe_mul(t1, t2, t1);
+  for(i=0;i<10;i++) fe_sq(t1, t1);
+  fe_mul(t0, t1, t0);
+  fe_sq(t1, t0);
+  for(i=1;i<50;i++) fe_sq(t1, t1);
+  fe_mul(t1, t1, t0);
+  fe_sq(t2, t1);
+  for(i=1;i<100;i++) fe_sq(t2, t2);
+  fe_mul(t1, t2, t1);
+  for(i=0;i<50;i++) fe_sq(t1, t1);
+  fe_mul(t0, t1, t0);
+  fe_sq(t0, t0);
+  fe_sq(t0, t0);
+  fe_mul(out, t0, z);
+}
+
+// out = 1/z = z^(p-2) = (z^(2^252-3))^8 * z^3
+static void fe_invert(fe out, const fe z) {
+  fe t0, t1;
+  fe_pow22523(t0, z);
+  fe_sq(t0, t0);
+  fe_sq(t0, t0);
+  fe_sq(t0, t0);
+  fe_sq(t1, z);
+  fe_mul(t1, t1, z);
+  fe_mul(out, t0, t1);
+}
+
+/* SQRT_RATIO_M1(u, v) is split around the exponentiation, so that the
+ * exponentiations of several decodings or encodings can be computed
+ * together */
+
+// x = u*v^7, the input of fe_pow22523(), and v3 = v^3
+static void sqrt_ratio_pre(fe x, fe v3, const fe u, const fe v) {
+  fe_sq(v3, v);
+  fe_mul(v3, v3, v);
+  fe_sq(x, v3);
+  fe_mul(x, x, v);
+  fe_mul(x, x, u);
+}
+
+// r = SQRT_RATIO_M1(u, v) from x = (u*v^7)^((p-5)/8), returns was_square
+static int sqrt_ratio_post(fe r, const fe x, const fe v3, const fe u, const fe v) {
+  fe vxx, m_root_check, p_root_check, f_root_check, r_prime, negu;
+  fe_mul(r, x, v3);
+  fe_mul(r, r, u);          // u*v^3*(u*v^7)^((p-5)/8)
+
+  fe_sq(vxx, r);
+  fe_mul(vxx, vxx, v);      // v*r^2
+  fe_neg(negu, u);
+  fe_sub(m_root_check, vxx, u);
+  fe_add(p_root_check, vxx, u);
+  fe_mul(f_root_check, negu, fe_sqrtm1);
+  fe_sub(f_root_check, vxx, f_root_check);
+  const int has_m_root = fe_iszero(m_root_check);
+  const int has_p_root = fe_iszero(p_root_check);
+  const int has_f_root = fe_iszero(f_root_check);
+
+  fe_mul(r_prime, r, fe_sqrtm1);
+  fe_cmov(r, r_prime, (unsigned int) (has_p_root | has_f_root));
+  fe_abs(r, r);
+  return has_m_root | has_p_root;
+}
+
+// SQRT_RATIO_M1(u, v), returns was_square
+static int fe_sqrt_ratio_m1(fe r, const fe u, const fe v) {
+  fe x, v3;
+  sqrt_ratio_pre(x, v3, u, v);
+  fe_pow22523(x, x);
+  return sqrt_ratio_post(r, x, v3, u, v);
+}
+
+// extended coordinates x=X/Z, y=Y/Z, x*y=T/Z
+typedef struct {
+  fe X, Y, Z, T;
+} ge_p3;
+
+typedef struct {
+  fe YplusX, YminusX, Z, T2d;
+} ge_cached;
+
+// completed point (X:Z, Y:T), the result of an addition or doubling
+typedef struct {
+  fe X, Y, Z, T;
+} ge_p1p1;
+
+// affine point of the fixed-base tables
+typedef struct {
+  fe yplusx, yminusx, xy2d;
+} ge_precomp;
+
+_Static_assert(sizeof(ge_p3) <= sizeof(ristretto_point), "ristretto_point too small");
+_Static_assert(8 * sizeof(ge_cached) <= sizeof(ristretto_table), "ristretto_table too small");
+
+#define P3(p) ((ge_p3 *) (p)->v)
+#define CP3(p) ((const ge_p3 *) (p)->v)
+
+static void ge_0(ge_p3 *h) {
+  fe_0(h->X);
+  fe_1(h->Y);
+  fe_1(h->Z);
+  fe_0(h->T);
+}
+
+static void ge_to_cached(ge_cached *r, const ge_p3 *p) {
+  fe_add(r->YplusX, p->Y, p->X);
+  fe_sub(r->YminusX, p->Y, p->X);
+  fe_copy(r->Z, p->Z);
+  fe_mul(r->T2d, p->T, fe_d2);
+}
+
+static void ge_add(ge_p1p1 *r, const ge_p3 *p, const ge_cached *q) {
+  fe t0;
+  fe_add(r->X, p->Y, p->X);
+  fe_sub(r->Y, p->Y, p->X);
+  fe_mul(r->Z, r->X, q->YplusX);
+  fe_mul(r->Y, r->Y, q->YminusX);
+  fe_mul(r->T, q->T2d, p->T);
+  fe_mul(r->X, p->Z, q->Z);
+  fe_add(t0, r->X, r->X);
+  fe_sub(r->X, r->Z, r->Y);
+  fe_add(r->Y, r->Z, r->Y);
+  fe_add(r->Z, t0, r->T);
+  fe_sub(r->T, t0, r->T);
+}
+
+// same as ge_add() for an affine q, saves the multiplication by q->Z
+static void ge_madd(ge_p1p1 *r, const ge_p3 *p, const ge_precomp *q) {
+  fe t0;
+  fe_add(r->X, p->Y, p->X);
+  fe_sub(r->Y, p->Y, p->X);
+  fe_mul(r->Z, r->X, q->yplusx);
+  fe_mul(r->Y, r->Y, q->yminusx);
+  fe_mul(r->T, q->xy2d, p->T);
+  fe_add(t0, p->Z, p->Z);
+  fe_sub(r->X, r->Z, r->Y);
+  fe_add(r->Y, r->Z, r->Y);
+  fe_add(r->Z, t0, r->T);
+  fe_sub(r->T, t0, r->T);
+}
+
+// p->T is not used, so this also doubles points without T
+static void ge_dbl(ge_p1p1 *r, const ge_p3 *p) {
+  fe t0;
+  fe_sq(r->X, p->X);
+  fe_sq(r->Z, p->Y);
+  fe_sq2(r->T, p->Z);
+  fe_add(r->Y, p->X, p->Y);
+  fe_sq(t0, r->Y);
+  fe_add(r->Y, r->Z, r->X);
+  fe_sub(r->Z, r->Z, r->X);
+  fe_sub(r->X, t0, r->Y);
+  fe_sub(r->T, r->T, r->Z);
+}
+
+static void ge_p1p1_to_p3(ge_p3 *r, const ge_p1p1 *p) {
+  fe_mul(r->X, p->X, p->T);
+  fe_mul(r->Y, p->Y, p->Z);
+  fe_mul(r->Z, p->Z, p->T);
+  fe_mul(r->T, p->X, p->Y);
+}
+
+// without T, only for doubling
+static void ge_p1p1_to_p2(ge_p3 *r, const ge_p1p1 *p) {
+  fe_mul(r->X, p->X, p->T);
+  fe_mul(r->Y, p->Y, p->Z);
+  fe_mul(r->Z, p->Z, p->T);
+}
+
+// the points with x=0 or y=0 are the identity of the ristretto group
+static int ge_is_identity(const ge_p3 *p) {
+  return fe_iszero(p->X) | fe_iszero(p->Y);
+}
+
+static void ge_cached_cmov(ge_cached *t, const ge_cached *u, const unsigned int b) {
+  fe_cmov(t->YplusX, u->YplusX, b);
+  fe_cmov(t->YminusX, u->YminusX, b);
+  fe_cmov(t->Z, u->Z, b);
+  fe_cmov(t->T2d, u->T2d, b);
+}
+
+static void ge_precomp_cmov(ge_precomp *t, const ge_precomp *u, const unsigned int b) {
+  fe_cmov(t->yplusx, u->yplusx, b);
+  fe_cmov(t->yminusx, u->yminusx, b);
+  fe_cmov(t->xy2d, u->xy2d, b);
+}
+
+static unsigned int equal(const int8_t b, const int8_t c) {
+  const uint8_t x = (uint8_t) b ^ (uint8_t) c;
+  return (unsigned int) (((uint32_t) x - 1U) >> 31);
+}
+
+static unsigned int negative(const int8_t b) {
+  return (unsigned int) ((uint8_t) b >> 7);
+}
+
+static int8_t absolute(const int8_t b) {
+  return (int8_t) (b - (int8_t) (((-(int) negative(b)) & b) * 2));
+}
+
+// t = b*P from the table of multiples, for -8 <= b <= 8
+static void ge_select(ge_cached *t, const ge_cached tbl[8], const int8_t b) {
+  const int8_t babs = absolute(b);
+  ge_cached minust;
+  int i;
+  fe_1(t->YplusX);
+  fe_1(t->YminusX);
+  fe_1(t->Z);
+  fe_0(t->T2d);
+  UNROLL
+  for(i=0;i<8;i++) ge_cached_cmov(t, &tbl[i], equal(babs, (int8_t) (i + 1)));
+  fe_copy(minust.YplusX, t->YminusX);
+  fe_copy(minust.YminusX, t->YplusX);
+  fe_copy(minust.Z, t->Z);
+  fe_neg(minust.T2d, t->T2d);
+  ge_cached_cmov(t, &minust, negative(b));
+}
+
+static void ge_select_precomp(ge_precomp *t, const ge_precomp tbl[8], const int8_t b) {
+  const int8_t babs = absolute(b);
+  ge_precomp minust;
+  int i;
+  fe_1(t->yplusx);
+  fe_1(t->yminusx);
+  fe_0(t->xy2d);
+  UNROLL
+  for(i=0;i<8;i++) ge_precomp_cmov(t, &tbl[i], equal(babs, (int8_t) (i + 1)));
+  fe_copy(minust.yplusx, t->yminusx);
+  fe_copy(minust.yminusx, t->yplusx);
+  fe_neg(minust.xy2d, t->xy2d);
+  ge_precomp_cmov(t, &minust, negative(b));
+}
+
+// signed 4 bit windows -8 <= e[i] <= 8, n = sum(e[i]*16^i), the top
+// bit of n is ignored
+static void scalar_digits(int8_t e[64], const uint8_t n[crypto_core_ristretto255_SCALARBYTES]) {
+  int8_t carry = 0;
+  int i;
+  for(i=0;i<32;i++) {
+    e[2*i] = (int8_t) (n[i] & 15);
+    e[2*i+1] = (int8_t) ((n[i] >> 4) & 15);
+  }
+  e[63] &= 7;
+  for(i=0;i<63;i++) {
+    e[i] = (int8_t) (e[i] + carry);
+    carry = (int8_t) ((e[i] + 8) >> 4);
+    e[i] = (int8_t) (e[i] - carry * 16);
+  }
+  e[63] = (int8_t) (e[63] + carry);
+}
+
+// m[i] = (i+1)P, even multiples are doublings, odd ones additions of P
+static void ge_multiples(ge_p3 m[8], const ge_p3 *p) {
+  ge_cached c;
+  ge_p1p1 r;
+  int i;
+  memcpy(&m[0], p, sizeof m[0]);
+  ge_to_cached(&c, p);
+  for(i=1;i<8;i++) {
+    if(i & 1) ge_dbl(&r, &m[i/2]);
+    else ge_add(&r, &m[i-1], &c);
+    ge_p1p1_to_p3(&m[i], &r);
+  }
+}
+
+// a decoding or encoding around its inverse square root, x is the
+// input and the output of fe_pow22523()
+typedef struct {
+  fe s, u1, u2, v, uv, v3, x;
+  int canonical;
+} ge_coding;
+
+static void decode_pre(ge_coding *d, const uint8_t s[crypto_core_ristretto255_BYTES]) {
+  fe ss, u2u2, one;
+  uint8_t check[32];
+
+  fe_frombytes(d->s, s);
+  fe_tobytes(check, d->s);
+  // non-canonical or negative s
+  d->canonical = (memcmp(check, s, sizeof check)==0) & !(s[0] & 1);
+
+  fe_1(one);
+  fe_sq(ss, d->s);
+  fe_sub(d->u1, one, ss);    // 1 + as^2
+  fe_add(d->u2, one, ss);    // 1 - as^2
+  fe_sq(u2u2, d->u2);
+  fe_sq(d->v, d->u1);
+  fe_mul(d->v, fe_d, d->v);
+  fe_neg(d->v, d->v);
+  fe_sub(d->v, d->v, u2u2);  // v = -(d*u1^2) - u2^2
+  fe_mul(d->uv, d->v, u2u2);
+  sqrt_ratio_pre(d->x, d->v3, one, d->uv);
+}
+
+static int decode_post(ge_p3 *p, const ge_coding *d) {
+  fe inv_sqrt, one;
+
+  fe_1(one);
+  const int was_square = sqrt_ratio_post(inv_sqrt, d->x, d->v3, one, d->uv);
+  fe_mul(p->X, inv_sqrt, d->u2);        // den_x
+  fe_mul(p->Y, inv_sqrt, p->X);
+  fe_mul(p->Y, p->Y, d->v);             // den_y
+  fe_mul(p->X, p->X, d->s);
+  fe_add(p->X, p->X, p->X);
+  fe_abs(p->X, p->X);                   // x = |2*s*den_x|
+  fe_mul(p->Y, d->u1, p->Y);            // y = u1*den_y
+  fe_1(p->Z);
+  fe_mul(p->T, p->X, p->Y);
+
+  if(!d->canonical || !was_square || fe_isnegative(p->T) || fe_iszero(p->Y)) return -1;
+  return 0;
+}
+
+static int ge_frombytes(ge_p3 *p, const uint8_t s[crypto_core_ristretto255_BYTES]) {
+  ge_coding d;
+  decode_pre(&d, s);
+  if(!d.canonical) return -1;
+  fe_pow22523(d.x, d.x);
+  return decode_post(p, &d);
+}
+
+static void encode_pre(ge_coding *d, const ge_p3 *p) {
+  fe t, one;
+
+  fe_add(d->u1, p->Z, p->Y);
+  fe_sub(t, p->Z, p->Y);
+  fe_mul(d->u1, d->u1, t);              // u1 = (z+y)*(z-y)
+  fe_mul(d->u2, p->X, p->Y);            // u2 = x*y
+  fe_sq(d->uv, d->u2);
+  fe_mul(d->uv, d->u1, d->uv);
+  fe_1(one);
+  sqrt_ratio_pre(d->x, d->v3, one, d->uv);
+}
+
+static void encode_post(uint8_t s[crypto_core_ristretto255_BYTES], const ge_coding *d, const ge_p3 *p) {
+  fe inv_sqrt, one, den1, den2, z_inv, ix, iy, eden, x, y, den_inv, t;
+
+  fe_1(one);
+  (void) sqrt_ratio_post(inv_sqrt, d->x, d->v3, one, d->uv);
+  fe_mul(den1, inv_sqrt, d->u1);
+  fe_mul(den2, inv_sqrt, d->u2);
+  fe_mul(z_inv, den1, den2);
+  fe_mul(z_inv, z_inv, p->T);
+
+  fe_mul(ix, p->X, fe_sqrtm1);
+  fe_mul(iy, p->Y, fe_sqrtm1);
+  fe_mul(eden, den1, fe_invsqrtamd);
+  fe_mul(t, p->T, z_inv);
+  const unsigned int rotate = (unsigned int) fe_isnegative(t);
+
+  fe_copy(x, p->X);
+  fe_copy(y, p->Y);
+  fe_copy(den_inv, den2);
+  fe_cmov(x, iy, rotate);
+  fe_cmov(y, ix, rotate);
+  fe_cmov(den_inv, eden, rotate);
+
+  fe_mul(t, x, z_inv);
+  fe_cneg(y, y, (unsigned int) fe_isnegative(t));
+
+  fe_sub(t, p->Z, y);
+  fe_mul(t, den_inv, t);
+  fe_abs(t, t);
+  fe_tobytes(s, t);
+}
+
+static void ge_tobytes(uint8_t s[crypto_core_ristretto255_BYTES], const ge_p3 *p) {
+  ge_coding d;
+  encode_pre(&d, p);
+  fe_pow22523(d.x, d.x);
+  encode_post(s, &d, p);
+}
+
+// MAP(t) of the element derivation
+static void elligator(ge_p3 *p, const fe t) {
+  fe one, r, u, v, rd, s, s_prime, c, n, w0, w1, w2, w3, negone;
+
+  fe_1(one);
+  fe_neg(negone, one);
+  fe_sq(r, t);
+  fe_mul(r, fe_sqrtm1, r);              // r = sqrt(-1)*t^2
+  fe_add(u, r, one);
+  fe_mul(u, u, fe_onemsqd);             // u = (r+1)*(1-d^2)
+  fe_mul(rd, r, fe_d);
+  fe_sub(v, negone, rd);
+  fe_add(rd, r, fe_d);
+  fe_mul(v, v, rd);                     // v = (-1-r*d)*(r+d)
+
+  const unsigned int was_square = (unsigned int) fe_sqrt_ratio_m1(s, u, v);
+  fe_mul(s_prime, s, t);
+  fe_abs(s_prime, s_prime);
+  fe_neg(s_prime, s_prime);             // s' = -|s*t|
+  fe_cmov(s, s_prime, was_square ^ 1);
+  fe_copy(c, r);
+  fe_cmov(c, negone, was_square);
+
+  fe_sub(n, r, one);
+  fe_mul(n, c, n);
+  fe_mul(n, n, fe_sqdmone);
+  fe_sub(n, n, v);                      // N = c*(r-1)*(d-1)^2 - v
+
+  fe_mul(w0, s, v);
+  fe_add(w0, w0, w0);                   // w0 = 2*s*v
+  fe_mul(w1, n, fe_sqrtadm1);           // w1 = N*sqrt(ad-1)
+  fe_sq(w3, s);
+  fe_sub(w2, one, w3);                  // w2 = 1-s^2
+  fe_add(w3, one, w3);                  // w3 = 1+s^2
+
+  fe_mul(p->X, w0, w3);
+  fe_mul(p->Y, w2, w1);
+  fe_mul(p->Z, w1, w3);
+  fe_mul(p->T, w0, w2);
+}
+
+static int ref51_decode(ristretto_point *p, const uint8_t s[crypto_core_ristretto255_BYTES]) {
+  return ge_frombytes(P3(p), s);
+}
+
+static void ref51_encode(uint8_t s[crypto_core_ristretto255_BYTES], const ristretto_point *p) {
+  ge_tobytes(s, CP3(p));
+}
+
+static void ref51_from_hash(ristretto_point *p, const uint8_t h[crypto_core_ristretto255_HASHBYTES]) {
+  fe r0, r1;
+  ge_p3 p1;
+  ge_cached c1;
+  ge_p1p1 sum;
+  ge_p3 *p0 = P3(p);
+
+  // the top bit of each half is ignored by fe_frombytes()
+  fe_frombytes(r0, h);
+  fe_frombytes(r1, h + 32);
+  elligator(p0, r0);
+  elligator(&p1, r1);
+  ge_to_cached(&c1, &p1);
+  ge_add(&sum, p0, &c1);
+  ge_p1p1_to_p3(p0, &sum);
+}
+
+static void ref51_table_init(ristretto_table *t, const ristretto_point *p) {
+  ge_cached *c = (ge_cached *) t->v;
+  ge_p3 m[8];
+  int i;
+  ge_multiples(m, CP3(p));
+  for(i=0;i<8;i++) ge_to_cached(&c[i], &m[i]);
+}
+
+static int ref51_scalarmult_table(ristretto_point *q,
+                                  const uint8_t n[crypto_core_ristretto255_SCALARBYTES],
+                                  const ristretto_table *t) {
+  const ge_cached *tbl = (const ge_cached *) t->v;
+  ge_p3 *h = P3(q);
+  int8_t e[64];
+  ge_cached c;
+  ge_p1p1 r;
+  int i, j;
+
+  scalar_digits(e, n);
+  ge_0(h);
+  for(i=63;i>0;i--) {
+    ge_select(&c, tbl, e[i]);
+    ge_add(&r, h, &c);
+    for(j=0;j<4;j++) {
+      ge_p1p1_to_p2(h, &r);
+      ge_dbl(&r, h);
+    }
+    ge_p1p1_to_p3(h, &r);
+  }
+  ge_select(&c, tbl, e[0]);
+  ge_add(&r, h, &c);
+  ge_p1p1_to_p3(h, &r);
+  sodium_memzero(e, sizeof e);
+
+  if(ge_is_identity(h)) return -1;
+  return 0;
+}
+
+/* fixed-base multiplication, as in ref10: the table holds the affine
+ * multiples 1..8 of 16^(2i)*G for each pair of windows, so that n*G
+ * needs no doublings besides the four between the odd and the even
+ * windows, and additions with z=1. */
+
+// the generator of ristretto255
+static const uint8_t base_point[crypto_core_ristretto255_BYTES] = {
+  0xe2, 0xf2, 0xae, 0x0a, 0x6a, 0xbc, 0x4e, 0x71, 0xa8, 0x84, 0xa9, 0x61, 0xc5, 0x00, 0x51, 0x5f,
+  0x58, 0xe3, 0x0b, 0x6a, 0xa5, 0x82, 0xdd, 0x8d, 0xb6, 0xa6, 0x59, 0x45, 0xe0, 0x8d, 0x2d, 0x76
+};
+
+// base_table[i][j] = (j+1)*256^i*G
+static ge_precomp base_table[32][8];
+static pthread_once_t base_once = PTHREAD_ONCE_INIT;
+
+static void base_table_init(void) {
+  ge_p3 b, m[8];
+  ge_p1p1 r;
+  fe acc[8], inv, zinv, x, y;
+  int i, j;
+
+  (void) ge_frombytes(&b, base_point);
+  for(i=0;i<32;i++) {
+    ge_multiples(m, &b);
+    // one inversion for the 8 multiples
+    fe_copy(acc[0], m[0].Z);
+    for(j=1;j<8;j++) fe_mul(acc[j], acc[j-1], m[j].Z);
+    fe_invert(inv, acc[7]);
+    for(j=7;j>=0;j--) {
+      if(j>0) {
+        fe_mul(zinv, inv, acc[j-1]);
+        fe_mul(inv, inv, m[j].Z);
+      } else {
+        fe_copy(zinv, inv);
+      }
+      fe_mul(x, m[j].X, zinv);
+      fe_mul(y, m[j].Y, zinv);
+      fe_add(base_table[i][j].yplusx, y, x);
+      fe_sub(base_table[i][j].yminusx, y, x);
+      fe_mul(base_table[i][j].xy2d, x, y);
+      fe_mul(base_table[i][j].xy2d, base_table[i][j].xy2d, fe_d2);
+    }
+    for(j=0;j<8;j++) {
+      ge_dbl(&r, &b);
+      ge_p1p1_to_p3(&b, &r);
+    }
+  }
+}
+
+static int ref51_scalarmult_base(uint8_t q[crypto_core_ristretto255_BYTES],
+                                 const uint8_t n[crypto_core_ristretto255_SCALARBYTES]) {
+  int8_t e[64];
+  ge_precomp t;
+  ge_p1p1 r;
+  ge_p3 h;
+  int i;
+
+  pthread_once(&base_once, base_table_init);
+  scalar_digits(e, n);
+  ge_0(&h);
+  for(i=1;i<64;i+=2) {
+    ge_select_precomp(&t, base_table[i/2], e[i]);
+    ge_madd(&r, &h, &t);
+    ge_p1p1_to_p3(&h, &r);
+  }
+  for(i=0;i<4;i++) {
+    ge_dbl(&r, &h);
+    if(i<3) ge_p1p1_to_p2(&h, &r);
+    else ge_p1p1_to_p3(&h, &r);
+  }
+  for(i=0;i<64;i+=2) {
+    ge_select_precomp(&t, base_table[i/2], e[i]);
+    ge_madd(&r, &h, &t);
+    ge_p1p1_to_p3(&h, &r);
+  }
+  sodium_memzero(e, sizeof e);
+
+  ge_tobytes(q, &h);
+  if(sodium_is_zero(q, crypto_core_ristretto255_BYTES)) return -1;
+  return 0;
+}
+
+static int have_fe51(void) {
+  return 1;
+}
+
+#ifdef RISTRETTO_AVX2
+
+/* the "avx512" and "avx2" backends compute the four coordinates
+ * (X, Y, Z, T) of a point in the four lanes of a vector register, using the parallel
+ * formulas of Hisil, Wong, Carter and Dawson as in the AVX2 backend of
+ * curve25519-dalek. The field elements are in radix 2^25.5, ten limbs
+ * of alternating 26 and 25 bits, so that vpmuludq multiplies four
+ * limbs at once.
+ *
+ * Carried limbs are below 2^26 and 2^25 plus at most 2^18, sums of two
+ * carried elements are fine as inputs of fe4_mul() and fe4_sq().
+ *
+ * The functions are in ristretto_fe4.h, compiled once for each of the
+ * two backends. */
+
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+// v[i] holds limb i of the four lanes
+typedef struct {
+  u64x4 v[10];
+} fe4;
+
+_Static_assert(8 * sizeof(fe4) <= sizeof(ristretto_table), "ristretto_table too small");
+
+#define MUL(a, b) ((u64x4) _mm256_mul_epu32((__m256i) (a), (__m256i) (b)))
+// lane k of the result is lane lk of the input
+#define PERM(l0, l1, l2, l3) _MM_SHUFFLE(l3, l2, l1, l0)
+#define FE4_PERMUTE(o, a, imm) do {                                            \
+    int i_;                                                                    \
+    UNROLL                                                                     \
+    for(i_=0;i_<10;i_++)                                                       \
+      (o)->v[i_] = (u64x4) _mm256_permute4x64_epi64((__m256i) (a)->v[i_], (imm)); \
+  } while(0)
+// the lanes in the mask from b, the others from a
+#define LANE0 0x03
+#define LANE1 0x0c
+#define LANE2 0x30
+#define LANE3 0xc0
+#define FE4_BLEND(o, a, b, lanes) do {                                         \
+    int i_;                                                                    \
+    UNROLL                                                                     \
+    for(i_=0;i_<10;i_++)                                                       \
+      (o)->v[i_] = (u64x4) _mm256_blend_epi32((__m256i) (a)->v[i_], (__m256i) (b)->v[i_], (lanes)); \
+  } while(0)
+
+static const u64x4 M26 = { 0x3ffffff, 0x3ffffff, 0x3ffffff, 0x3ffffff };
+static const u64x4 M25 = { 0x1ffffff, 0x1ffffff, 0x1ffffff, 0x1ffffff };
+// 4p, added by fe4_sub() to stay positive
+static const u64x4 P4_0 = { 0xfffffb4, 0xfffffb4, 0xfffffb4, 0xfffffb4 };
+static const u64x4 P4_EVEN = { 0xffffffc, 0xffffffc, 0xffffffc, 0xffffffc };
+static const u64x4 P4_ODD = { 0x7fffffc, 0x7fffffc, 0x7fffffc, 0x7fffffc };
+static const fe4 fe4_zero;
+
+// the ten limbs of f in radix 2^25.5
+static void fe_limbs(uint64_t l[10], const fe f) {
+  fe t;
+  int i;
+  fe_carry_weak(t, f);
+  for(i=0;i<5;i++) {
+    l[2*i] = t[i] & 0x3ffffff;
+    l[2*i+1] = t[i] >> 26;
+  }
+}
+
+/* batches of four operations compute one operation in each lane, with
+ * the same formulas as "ref51". Unlike ge4_add() and ge4_dbl() this
+ * needs no shuffles between the lanes, and the inverse square roots of
+ * decoding and encoding are vectorized too. */
+
+typedef struct {
+  fe4 X, Y, Z, T;
+} ge_p3x4;
+
+typedef struct {
+  fe4 YplusX, YminusX, Z, T2d;
+} ge_cachedx4;
+
+typedef struct {
+  fe4 X, Y, Z, T;
+} ge_p1p1x4;
+
+typedef struct {
+  fe4 yplusx, yminusx, xy2d;
+} ge_precompx4;
+
+// base_table in the limbs of fe4, base_table4[i][j][k] is yplusx,
+// yminusx and xy2d of base_table[i][j] for k = 0, 1, 2
+static uint64_t base_table4[32][8][3][10];
+static pthread_once_t base4_once = PTHREAD_ONCE_INIT;
+
+static void base_table4_init(void) {
+  int i, j;
+  pthread_once(&base_once, base_table_init);
+  for(i=0;i<32;i++) {
+    for(j=0;j<8;j++) {
+      fe_limbs(base_table4[i][j][0], base_table[i][j].yplusx);
+      fe_limbs(base_table4[i][j][1], base_table[i][j].yminusx);
+      fe_limbs(base_table4[i][j][2], base_table[i][j].xy2d);
+    }
+  }
+}
+
+// with only 16 vector registers fe4_mul() spills, the "avx2" backend
+// only uses the kernels that are still faster than "ref51"
+#define FE4_TARGET __attribute__((target("avx2"), unused))
+#define FE4(name) name##_avx2
+#include "ristretto_fe4.h"
+
+#define FE4_TARGET __attribute__((target("avx2,avx512f,avx512vl")))
+#define FE4(name) name##_avx512
+#include "ristretto_fe4.h"
+
+static int have_avx2(void) {
+  return __builtin_cpu_supports("avx2");
+}
+
+static int have_avx512(void) {
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512f")
+    && __builtin_cpu_supports("avx512vl");
+}
+
+#endif // RISTRETTO_AVX2
+
+#endif // RISTRETTO_FE51
+
+// the "sodium" backend keeps the points encoded
+
+static int sodium_backend_decode(ristretto_point *p, const uint8_t s[crypto_core_ristretto255_BYTES]) {
+  if((s[31] & 0x80) || crypto_core_ristretto255_is_valid_point(s)!=1) return -1;
+  memcpy(p->v, s, crypto_core_ristretto255_BYTES);
+  return 0;
+}
+
+static void sodium_backend_encode(uint8_t s[crypto_core_ristretto255_BYTES], const ristretto_point *p) {
+  memcpy(s, p->v, crypto_core_ristretto255_BYTES);
+}
+
+static void sodium_backend_from_hash(ristretto_point *p, const uint8_t h[crypto_core_ristretto255_HASHBYTES]) {
+  crypto_core_ristretto255_from_hash((uint8_t *) p->v, h);
+}
+
+static void sodium_backend_table_init(ristretto_table *t, const ristretto_point *p) {
+  memcpy(t->v, p->v, crypto_core_ristretto255_BYTES);
+}
+
+static int sodium_backend_scalarmult_table(ristretto_point *q,
+                                           const uint8_t n[crypto_core_ristretto255_SCALARBYTES],
+                                           const ristretto_table *t) {
+  return crypto_scalarmult_ristretto255((uint8_t *) q->v, n, (const uint8_t *) t->v);
+}
+
+static int have_sodium(void) {
+  return 1;
+}
+
+typedef struct {
+  const char *name;
+  // OPAQUE_CPU_*
+  int level;
+  int (*supported)(void);
+  int (*decode)(ristretto_point *p, const uint8_t s[crypto_core_ristretto255_BYTES]);
+  void (*encode)(uint8_t s[crypto_core_ristretto255_BYTES], const ristretto_point *p);
+  void (*from_hash)(ristretto_point *p, const uint8_t h[crypto_core_ristretto255_HASHBYTES]);
+  void (*table_init)(ristretto_table *t, const ristretto_point *p);
+  int (*scalarmult_table)(ristretto_point *q,
+                          const uint8_t n[crypto_core_ristretto255_SCALARBYTES],
+                          const ristretto_table *t);
+  int (*scalarmult_base)(uint8_t q[crypto_core_ristretto255_BYTES],
+                         const uint8_t n[crypto_core_ristretto255_SCALARBYTES]);
+  // four operations at once, NULL if the batches loop over the single
+  // operations
+  void (*decode4)(ristretto_point *const p[4], const uint8_t *const s[4], int rets[4]);
+  void (*encode4)(uint8_t *const s[4], const ristretto_point *const p[4]);
+  void (*scalarmult4)(ristretto_point *const q[4], const uint8_t *const n[4],
+                      const ristretto_point *const p[4], int rets[4]);
+  void (*scalarmult_base4)(uint8_t *const q[4], const uint8_t *const n[4], int rets[4]);
+} Ristretto_Backend;
+
+// in order of preference
+static const Ristretto_Backend backends[] = {
+#ifdef RISTRETTO_AVX2
+  {"avx512", OPAQUE_CPU_AVX512, have_avx512, ref51_decode, ref51_encode, ref51_from_hash,
+   table_init_avx512, scalarmult_table_avx512, ref51_scalarmult_base,
+   decode4_avx512, encode4_avx512, scalarmult4_avx512, scalarmult_base4_avx512},
+  {"avx2", OPAQUE_CPU_AVX2, have_avx2, ref51_decode, ref51_encode, ref51_from_hash,
+   ref51_table_init, ref51_scalarmult_table, ref51_scalarmult_base,
+   decode4_avx2, encode4_avx2, scalarmult4_avx2, NULL},
+#endif
+#ifdef RISTRETTO_FE51
+  {"ref51", OPAQUE_CPU_BASELINE, have_fe51, ref51_decode, ref51_encode, ref51_from_hash,
+   ref51_table_init, ref51_scalarmult_table, ref51_scalarmult_base,
+   NULL, NULL, NULL, NULL},
+#endif
+  {"sodium", OPAQUE_CPU_BASELINE, have_sodium, sodium_backend_decode, sodium_backend_encode, sodium_backend_from_hash,
+   sodium_backend_table_init, sodium_backend_scalarmult_table, crypto_scalarmult_ristretto255_base,
+   NULL, NULL, NULL, NULL},
+};
+
+static const Ristretto_Backend *backend = NULL;
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+
+static void backend_init(void) {
+#ifdef RISTRETTO_AVX2
+  __builtin_cpu_init();
+#endif
+  // an unknown OPAQUE_CPU is reported by opaque_init() and ignored here
+  const int max = opaque_cpu_max();
+  size_t i;
+  for(i=0;i<sizeof backends / sizeof backends[0];i++) {
+    if((max<0 || backends[i].level<=max) && backends[i].supported()) {
+      backend = &backends[i];
+      return;
+    }
+  }
+}
+
+static const Ristretto_Backend *get_backend(void) {
+  pthread_once(&backend_once, backend_init);
+  return backend;
+}
+
+const char *ristretto_backend(void) {
+  return get_backend()->name;
+}
+
+int ristretto_select(const char *name) {
+  get_backend();
+  size_t i;
+  for(i=0;i<sizeof backends / sizeof backends[0];i++) {
+    if(strcmp(backends[i].name, name)==0 && backends[i].supported()) {
+      backend = &backends[i];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int ristretto_decode(ristretto_point *p, const uint8_t s[crypto_core_ristretto255_BYTES]) {
+  return get_backend()->decode(p, s);
+}
+
+void ristretto_encode(uint8_t s[crypto_core_ristretto255_BYTES], const ristretto_point *p) {
+  get_backend()->encode(s, p);
+}
+
+void ristretto_from_hash(ristretto_point *p, const uint8_t h[crypto_core_ristretto255_HASHBYTES]) {
+  get_backend()->from_hash(p, h);
+}
+
+void ristretto_table_init(ristretto_table *t, const ristretto_point *p) {
+  get_backend()->table_init(t, p);
+}
+
+int ristretto_scalarmult_table(ristretto_point *q,
+                               const uint8_t n[crypto_core_ristretto255_SCALARBYTES],
+                               const ristretto_table *t) {
+  return get_backend()->scalarmult_table(q, n, t);
+}
+
+int ristretto_scalarmult(ristretto_point *q,
+                         const uint8_t n[crypto_core_ristretto255_SCALARBYTES],
+                         const ristretto_point *p) {
+  ristretto_table t;
+  ristretto_table_init(&t, p);
+  return ristretto_scalarmult_table(q, n, &t);
+}
+
+int ristretto_scalarmult_base(uint8_t q[crypto_core_ristretto255_BYTES],
+                              const uint8_t n[crypto_core_ristretto255_SCALARBYTES]) {
+  return get_backend()->scalarmult_base(q, n);
+}
+
+/* the batches run groups of four operations through the kernels of the
+ * backend. The lanes of the last group past the end of the batch repeat
+ * the first operation of the group, and write the same results to the
+ * same place. A single remaining operation runs on its own. */
+
+// index of lane l of the group starting at i
+static size_t lane(const size_t i, const size_t l, const size_t n) {
+  return (i + l < n) ? i + l : i;
+}
+
+void ristretto_decode_batch(const size_t n,
+                            ristretto_point *const p[],
+                            const uint8_t *const s[],
+                            int rets[]) {
+  const Ristretto_Backend *b = get_backend();
+  ristretto_point *pl[4];
+  const uint8_t *sl[4];
+  int r[4];
+  size_t i = 0, l;
+  if(b->decode4!=NULL) {
+    for(;i+1<n;i+=4) {
+      for(l=0;l<4;l++) {
+        pl[l] = p[lane(i, l, n)];
+        sl[l] = s[lane(i, l, n)];
+      }
+      b->decode4(pl, sl, r);
+      for(l=0;l<4 && i+l<n;l++) rets[i+l] = r[l];
+    }
+  }
+  for(;i<n;i++) rets[i] = b->decode(p[i], s[i]);
+}
+
+void ristretto_encode_batch(const size_t n,
+                            uint8_t *const s[],
+                            const ristretto_point *const p[]) {
+  const Ristretto_Backend *b = get_backend();
+  uint8_t *sl[4];
+  const ristretto_point *pl[4];
+  size_t i = 0, l;
+  if(b->encode4!=NULL) {
+    for(;i+1<n;i+=4) {
+      for(l=0;l<4;l++) {
+        sl[l] = s[lane(i, l, n)];
+        pl[l] = p[lane(i, l, n)];
+      }
+      b->encode4(sl, pl);
+    }
+  }
+  for(;i<n;i++) b->encode(s[i], p[i]);
+}
+
+void ristretto_scalarmult_batch(const size_t n,
+                                ristretto_point *const q[],
+                                const uint8_t *const k[],
+                                const ristretto_point *const p[],
+                                int rets[]) {
+  const Ristretto_Backend *b = get_backend();
+  ristretto_point *ql[4];
+  const uint8_t *kl[4];
+  const ristretto_point *pl[4];
+  int r[4];
+  size_t i = 0, l;
+  if(b->scalarmult4!=NULL) {
+    for(;i+1<n;i+=4) {
+      for(l=0;l<4;l++) {
+        ql[l] = q[lane(i, l, n)];
+        kl[l] = k[lane(i, l, n)];
+        pl[l] = p[lane(i, l, n)];
+      }
+      b->scalarmult4(ql, kl, pl, r);
+      for(l=0;l<4 && i+l<n;l++) rets[i+l] = r[l];
+    }
+  }
+  for(;i<n;i++) rets[i] = ristretto_scalarmult(q[i], k[i], p[i]);
+}
+
+void ristretto_scalarmult_base_batch(const size_t n,
+                                     uint8_t *const q[],
+                                     const uint8_t *const k[],
+                                     int rets[]) {
+  const Ristretto_Backend *b = get_backend();
+  uint8_t *ql[4];
+  const uint8_t *kl[4];
+  int r[4];
+  size_t i = 0, l;
+  if(b->scalarmult_base4!=NULL) {
+    for(;i+1<n;i+=4) {
+      for(l=0;l<4;l++) {
+        ql[l] = q[lane(i, l, n)];
+        kl[l] = k[lane(i, l, n)];
+      }
+      b->scalarmult_base4(ql, kl, r);
+      for(l=0;l<4 && i+l<n;l++) rets[i+l] = r[l];
+    }
+  }
+  for(;i<n;i++) rets[i] = b->scalarmult_base(q[i], k[i]);
+}
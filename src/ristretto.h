@@ -0,0 +1,110 @@
+#ifndef RISTRETTO_H
+#define RISTRETTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sodium.h>
+
+/* ristretto255 on decoded points
+ *
+ * libsodium only operates on encoded points, every scalar
+ * multiplication decodes its input and encodes its output, which costs
+ * an inverse square root each. These functions keep the points
+ * decoded, so that a point can be decoded once and used in several
+ * multiplications, and only has to be encoded when it goes on the wire
+ * or into a transcript.
+ *
+ * The group operations are implemented by one of several backends,
+ * selected at runtime in order of preference, up to the level set by
+ * the OPAQUE_CPU environment variable (see common.h):
+ *
+ *  - "avx512": the variable-base multiplication computes the four
+ *    coordinates of a point in the lanes of one vector register, the
+ *    batches compute four operations at once, one in each lane,
+ *    everything else as "ref51". Only uses the 256 bit registers, but
+ *    needs the 32 of them that AVX-512VL has.
+ *  - "avx2": the batches of "avx512" except the fixed-base ones, with 16
+ *    registers, everything else as "ref51"
+ *  - "ref51": field arithmetic in radix 2^51, needs 128 bit
+ *    multiplication, and fixed-base multiplication from precomputed
+ *    multiples of the generator
+ *  - "sodium": keeps the points encoded and calls libsodium
+ *
+ * Points and tables can only be used with the backend they were
+ * created by. */
+
+// a decoded point, the representation depends on the backend
+typedef struct {
+  uint64_t v[20];
+} ristretto_point;
+
+// precomputed multiples of a point for ristretto_scalarmult_table()
+typedef struct {
+  uint64_t v[320];
+} ristretto_table;
+
+// name of the selected backend: "avx512", "avx2", "ref51" or "sodium"
+const char *ristretto_backend(void);
+
+// selects a backend by name, returns -1 if it is not supported by
+// this CPU or build. Only meant for testing and benchmarking.
+int ristretto_select(const char *backend);
+
+// decodes a point, returns -1 if s is not a canonical encoding of a
+// valid point. Unlike crypto_core_ristretto255_is_valid_point() in
+// libsodium 1.0.18 this also rejects encodings with the top bit set.
+int ristretto_decode(ristretto_point *p, const uint8_t s[crypto_core_ristretto255_BYTES]);
+
+void ristretto_encode(uint8_t s[crypto_core_ristretto255_BYTES], const ristretto_point *p);
+
+// same as crypto_core_ristretto255_from_hash()
+void ristretto_from_hash(ristretto_point *p, const uint8_t h[crypto_core_ristretto255_HASHBYTES]);
+
+// precomputes the multiples of p, for multiplying p with several scalars
+void ristretto_table_init(ristretto_table *t, const ristretto_point *p);
+
+// q = n*P in constant time, the top bit of n is ignored. Returns -1
+// if q is the identity, like crypto_scalarmult_ristretto255()
+int ristretto_scalarmult_table(ristretto_point *q,
+                               const uint8_t n[crypto_core_ristretto255_SCALARBYTES],
+                               const ristretto_table *t);
+
+int ristretto_scalarmult(ristretto_point *q,
+                         const uint8_t n[crypto_core_ristretto255_SCALARBYTES],
+                         const ristretto_point *p);
+
+// same as crypto_scalarmult_ristretto255_base(), q = n*G encoded
+int ristretto_scalarmult_base(uint8_t q[crypto_core_ristretto255_BYTES],
+                              const uint8_t n[crypto_core_ristretto255_SCALARBYTES]);
+
+/* batches of independent operations, on arrays of pointers to their
+ * arguments, with the same results as the single operations. Backends
+ * with vector units compute several operations of a batch at once;
+ * the others loop over the single operations. Every result may be
+ * written more than once, an output must not overlap another output or
+ * the input of another operation of the batch, unless they are
+ * identical. */
+
+void ristretto_decode_batch(size_t n,
+                            ristretto_point *const p[],
+                            const uint8_t *const s[],
+                            int rets[]);
+
+void ristretto_encode_batch(size_t n,
+                            uint8_t *const s[],
+                            const ristretto_point *const p[]);
+
+// q[i] = k[i]*p[i]
+void ristretto_scalarmult_batch(size_t n,
+                                ristretto_point *const q[],
+                                const uint8_t *const k[],
+                                const ristretto_point *const p[],
+                                int rets[]);
+
+// q[i] = k[i]*G encoded
+void ristretto_scalarmult_base_batch(size_t n,
+                                     uint8_t *const q[],
+                                     const uint8_t *const k[],
+                                     int rets[]);
+
+#endif // RISTRETTO_H
@@ -0,0 +1,685 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* the vector kernels of ristretto.c, which includes this file once for
+ * each instruction set it compiles them for. The includer defines
+ * FE4_TARGET, the target attribute of the functions, and FE4(name),
+ * the name of a function in this instance. Both are undefined at the
+ * end of this file. */
+
+#if !defined(FE4_TARGET) || !defined(FE4)
+#error "only to be included by ristretto.c"
+#endif
+
+// every instance has its own names for the functions below
+#define fe4_carry FE4(fe4_carry)
+#define fe4_add FE4(fe4_add)
+#define fe4_sub FE4(fe4_sub)
+#define fe4_mul FE4(fe4_mul)
+#define fe4_sq FE4(fe4_sq)
+#define fe4_from51 FE4(fe4_from51)
+#define fe4_to51 FE4(fe4_to51)
+#define ge4_finish FE4(ge4_finish)
+#define ge4_add FE4(ge4_add)
+#define ge4_dbl FE4(ge4_dbl)
+#define ge4_select FE4(ge4_select)
+#define table_init FE4(table_init)
+#define scalarmult_table FE4(scalarmult_table)
+#define fe4_cmov FE4(fe4_cmov)
+#define fe4_1 FE4(fe4_1)
+#define fe4_broadcast FE4(fe4_broadcast)
+#define fe4_pow22523 FE4(fe4_pow22523)
+#define ge_0x4 FE4(ge_0x4)
+#define ge_to_cachedx4 FE4(ge_to_cachedx4)
+#define ge_addx4 FE4(ge_addx4)
+#define ge_maddx4 FE4(ge_maddx4)
+#define ge_dblx4 FE4(ge_dblx4)
+#define ge_p1p1_to_p3x4 FE4(ge_p1p1_to_p3x4)
+#define ge_p1p1_to_p2x4 FE4(ge_p1p1_to_p2x4)
+#define ge_loadx4 FE4(ge_loadx4)
+#define ge_storex4 FE4(ge_storex4)
+#define lanes_equal FE4(lanes_equal)
+#define lanes_negative FE4(lanes_negative)
+#define ge_selectx4 FE4(ge_selectx4)
+#define ge_select_basex4 FE4(ge_select_basex4)
+#define sqrt_ratio_powx4 FE4(sqrt_ratio_powx4)
+#define decode4 FE4(decode4)
+#define ge_tobytesx4 FE4(ge_tobytesx4)
+#define encode4 FE4(encode4)
+#define scalarmult4 FE4(scalarmult4)
+#define scalarmult_base4 FE4(scalarmult_base4)
+
+// the carries of the two halves are interleaved
+FE4_TARGET static inline void fe4_carry(fe4 *o, u64x4 h[10]) {
+  u64x4 c;
+  int i;
+  c = h[0] >> 26; h[1] += c; h[0] &= M26;
+  c = h[4] >> 26; h[5] += c; h[4] &= M26;
+  c = h[1] >> 25; h[2] += c; h[1] &= M25;
+  c = h[5] >> 25; h[6] += c; h[5] &= M25;
+  c = h[2] >> 26; h[3] += c; h[2] &= M26;
+  c = h[6] >> 26; h[7] += c; h[6] &= M26;
+  c = h[3] >> 25; h[4] += c; h[3] &= M25;
+  c = h[7] >> 25; h[8] += c; h[7] &= M25;
+  c = h[4] >> 26; h[5] += c; h[4] &= M26;
+  c = h[8] >> 26; h[9] += c; h[8] &= M26;
+  c = h[9] >> 25; h[0] += (c << 4) + (c << 1) + c; h[9] &= M25;
+  c = h[0] >> 26; h[1] += c; h[0] &= M26;
+  UNROLL
+  for(i=0;i<10;i++) o->v[i] = h[i];
+}
+
+FE4_TARGET static inline void fe4_add(fe4 *o, const fe4 *a, const fe4 *b) {
+  int i;
+  UNROLL
+  for(i=0;i<10;i++) o->v[i] = a->v[i] + b->v[i];
+}
+
+// b must be carried or the sum of at most three carried elements
+FE4_TARGET static inline void fe4_sub(fe4 *o, const fe4 *a, const fe4 *b) {
+  u64x4 h[10];
+  int i;
+  h[0] = (a->v[0] + P4_0) - b->v[0];
+  UNROLL
+  for(i=1;i<10;i++) h[i] = (a->v[i] + ((i & 1) ? P4_ODD : P4_EVEN)) - b->v[i];
+  fe4_carry(o, h);
+}
+
+FE4_TARGET static void fe4_mul(fe4 *o, const fe4 *F, const fe4 *G) {
+  const u64x4 *f=F->v, *g=G->v;
+  u64x4 f2[10], g19[10], h[10];
+  int i;
+  UNROLL
+  for(i=1;i<10;i+=2) f2[i] = f[i] + f[i];
+  UNROLL
+  for(i=1;i<10;i++) g19[i] = (g[i] << 4) + (g[i] << 1) + g[i];
+  h[0] = MUL(f[0], g[0]) + MUL(f2[1], g19[9]) + MUL(f[2], g19[8])
+         + MUL(f2[3], g19[7]) + MUL(f[4], g19[6]) + MUL(f2[5], g19[5])
+         + MUL(f[6], g19[4]) + MUL(f2[7], g19[3]) + MUL(f[8], g19[2])
+         + MUL(f2[9], g19[1]);
+  h[1] = MUL(f[0], g[1]) + MUL(f[1], g[0]) + MUL(f[2], g19[9])
+         + MUL(f[3], g19[8]) + MUL(f[4], g19[7]) + MUL(f[5], g19[6])
+         + MUL(f[6], g19[5]) + MUL(f[7], g19[4]) + MUL(f[8], g19[3])
+         + MUL(f[9], g19[2]);
+  h[2] = MUL(f[0], g[2]) + MUL(f2[1], g[1]) + MUL(f[2], g[0])
+         + MUL(f2[3], g19[9]) + MUL(f[4], g19[8]) + MUL(f2[5], g19[7])
+         + MUL(f[6], g19[6]) + MUL(f2[7], g19[5]) + MUL(f[8], g19[4])
+         + MUL(f2[9], g19[3]);
+  h[3] = MUL(f[0], g[3]) + MUL(f[1], g[2]) + MUL(f[2], g[1])
+         + MUL(f[3], g[0]) + MUL(f[4], g19[9]) + MUL(f[5], g19[8])
+         + MUL(f[6], g19[7]) + MUL(f[7], g19[6]) + MUL(f[8], g19[5])
+         + MUL(f[9], g19[4]);
+  h[4] = MUL(f[0], g[4]) + MUL(f2[1], g[3]) + MUL(f[2], g[2])
+         + MUL(f2[3], g[1]) + MUL(f[4], g[0]) + MUL(f2[5], g19[9])
+         + MUL(f[6], g19[8]) + MUL(f2[7], g19[7]) + MUL(f[8], g19[6])
+         + MUL(f2[9], g19[5]);
+  h[5] = MUL(f[0], g[5]) + MUL(f[1], g[4]) + MUL(f[2], g[3])
+         + MUL(f[3], g[2]) + MUL(f[4], g[1]) + MUL(f[5], g[0])
+         + MUL(f[6], g19[9]) + MUL(f[7], g19[8]) + MUL(f[8], g19[7])
+         + MUL(f[9], g19[6]);
+  h[6] = MUL(f[0], g[6]) + MUL(f2[1], g[5]) + MUL(f[2], g[4])
+         + MUL(f2[3], g[3]) + MUL(f[4], g[2]) + MUL(f2[5], g[1])
+         + MUL(f[6], g[0]) + MUL(f2[7], g19[9]) + MUL(f[8], g19[8])
+         + MUL(f2[9], g19[7]);
+  h[7] = MUL(f[0], g[7]) + MUL(f[1], g[6]) + MUL(f[2], g[5])
+         + MUL(f[3], g[4]) + MUL(f[4], g[3]) + MUL(f[5], g[2])
+         + MUL(f[6], g[1]) + MUL(f[7], g[0]) + MUL(f[8], g19[9])
+         + MUL(f[9], g19[8]);
+  h[8] = MUL(f[0], g[8]) + MUL(f2[1], g[7]) + MUL(f[2], g[6])
+         + MUL(f2[3], g[5]) + MUL(f[4], g[4]) + MUL(f2[5], g[3])
+         + MUL(f[6], g[2]) + MUL(f2[7], g[1]) + MUL(f[8], g[0])
+         + MUL(f2[9], g19[9]);
+  h[9] = MUL(f[0], g[9]) + MUL(f[1], g[8]) + MUL(f[2], g[7])
+         + MUL(f[3], g[6]) + MUL(f[4], g[5]) + MUL(f[5], g[4])
+         + MUL(f[6], g[3]) + MUL(f[7], g[2]) + MUL(f[8], g[1])
+         + MUL(f[9], g[0]);
+  fe4_carry(o, h);
+}
+
+FE4_TARGET static void fe4_sq(fe4 *o, const fe4 *F) {
+  const u64x4 *f=F->v;
+  u64x4 f2[10], f4[10], f19[10], h[10];
+  int i;
+  UNROLL
+  for(i=0;i<10;i++) f2[i] = f[i] + f[i];
+  UNROLL
+  for(i=1;i<10;i+=2) f4[i] = f2[i] + f2[i];
+  UNROLL
+  for(i=5;i<10;i++) f19[i] = (f[i] << 4) + f2[i] + f[i];
+  h[0] = MUL(f[0], f[0]) + MUL(f4[1], f19[9]) + MUL(f2[2], f19[8])
+         + MUL(f4[3], f19[7]) + MUL(f2[4], f19[6]) + MUL(f2[5], f19[5]);
+  h[1] = MUL(f2[0], f[1]) + MUL(f2[2], f19[9]) + MUL(f2[3], f19[8])
+         + MUL(f2[4], f19[7]) + MUL(f2[5], f19[6]);
+  h[2] = MUL(f2[0], f[2]) + MUL(f2[1], f[1]) + MUL(f4[3], f19[9])
+         + MUL(f2[4], f19[8]) + MUL(f4[5], f19[7]) + MUL(f[6], f19[6]);
+  h[3] = MUL(f2[0], f[3]) + MUL(f2[1], f[2]) + MUL(f2[4], f19[9])
+         + MUL(f2[5], f19[8]) + MUL(f2[6], f19[7]);
+  h[4] = MUL(f2[0], f[4]) + MUL(f4[1], f[3]) + MUL(f[2], f[2])
+         + MUL(f4[5], f19[9]) + MUL(f2[6], f19[8]) + MUL(f2[7], f19[7]);
+  h[5] = MUL(f2[0], f[5]) + MUL(f2[1], f[4]) + MUL(f2[2], f[3])
+         + MUL(f2[6], f19[9]) + MUL(f2[7], f19[8]);
+  h[6] = MUL(f2[0], f[6]) + MUL(f4[1], f[5]) + MUL(f2[2], f[4])
+         + MUL(f2[3], f[3]) + MUL(f4[7], f19[9]) + MUL(f[8], f19[8]);
+  h[7] = MUL(f2[0], f[7]) + MUL(f2[1], f[6]) + MUL(f2[2], f[5])
+         + MUL(f2[3], f[4]) + MUL(f2[8], f19[9]);
+  h[8] = MUL(f2[0], f[8]) + MUL(f4[1], f[7]) + MUL(f2[2], f[6])
+         + MUL(f4[3], f[5]) + MUL(f[4], f[4]) + MUL(f2[9], f19[9]);
+  h[9] = MUL(f2[0], f[9]) + MUL(f2[1], f[8]) + MUL(f2[2], f[7])
+         + MUL(f2[3], f[6]) + MUL(f2[4], f[5]);
+  fe4_carry(o, h);
+}
+
+// lane l of o = f[l]
+FE4_TARGET static void fe4_from51(fe4 *o, const uint64_t *const f[4]) {
+  uint64_t t[10];
+  int i, l;
+  for(l=0;l<4;l++) {
+    fe_limbs(t, f[l]);
+    for(i=0;i<10;i++) o->v[i][l] = t[i];
+  }
+}
+
+FE4_TARGET static void fe4_to51(uint64_t *const f[4], const fe4 *a) {
+  int i, l;
+  for(l=0;l<4;l++) {
+    for(i=0;i<5;i++) f[l][i] = a->v[2*i][l] + (a->v[2*i+1][l] << 26);
+  }
+}
+
+// (E, H, F, G) -> (E*F, G*H, F*G, E*H)
+FE4_TARGET static inline void ge4_finish(fe4 *r, const fe4 *ehfg) {
+  fe4 a, b;
+  FE4_PERMUTE(&a, ehfg, PERM(0, 3, 2, 0));
+  FE4_PERMUTE(&b, ehfg, PERM(2, 1, 3, 1));
+  fe4_mul(r, &a, &b);
+}
+
+// r = p + q, with q cached as (Y-X, Y+X, 2Z, 2dT)
+FE4_TARGET static void ge4_add(fe4 *r, const fe4 *p, const fe4 *q) {
+  fe4 sw, d, s, t, m;
+  FE4_PERMUTE(&sw, p, PERM(1, 0, 2, 3));
+  fe4_sub(&d, &sw, p);
+  fe4_add(&s, &sw, p);
+  FE4_BLEND(&t, &d, &s, LANE1);
+  FE4_BLEND(&t, &t, p, LANE2 | LANE3);  // (Y-X, Y+X, Z, T)
+  fe4_mul(&m, &t, q);                   // (A, B, D, C)
+  FE4_PERMUTE(&sw, &m, PERM(1, 0, 3, 2));
+  FE4_BLEND(&t, &sw, &m, LANE2);        // (B, ., D, .)
+  FE4_BLEND(&d, &m, &sw, LANE2);        // (A, ., C, .)
+  fe4_sub(&d, &t, &d);
+  fe4_add(&s, &m, &sw);
+  FE4_BLEND(&t, &d, &s, LANE1 | LANE3); // (B-A, A+B, D-C, C+D)
+  ge4_finish(r, &t);
+}
+
+// r = 2p, p->T is not used
+FE4_TARGET static void ge4_dbl(fe4 *r, const fe4 *p) {
+  fe4 a, b, s, neg, pos;
+  FE4_PERMUTE(&a, p, PERM(0, 1, 2, 1));
+  FE4_PERMUTE(&b, p, PERM(0, 1, 2, 0));
+  fe4_add(&b, &a, &b);
+  FE4_BLEND(&a, &a, &b, LANE3);         // (X, Y, Z, X+Y)
+  fe4_sq(&s, &a);                       // (S0, S1, S2, S3)
+  FE4_PERMUTE(&a, &s, PERM(1, 1, 2, 2));
+  fe4_add(&b, &a, &a);
+  FE4_BLEND(&a, &a, &b, LANE2);
+  FE4_BLEND(&a, &a, &fe4_zero, LANE3);
+  FE4_PERMUTE(&b, &s, PERM(0, 0, 0, 0));
+  fe4_add(&neg, &a, &b);                // (S0+S1, S0+S1, S0+2S2, S0)
+  FE4_PERMUTE(&pos, &s, PERM(3, 3, 1, 1));
+  FE4_BLEND(&pos, &pos, &fe4_zero, LANE1);
+  fe4_sub(&a, &pos, &neg);              // (E, -H, -F, G)
+  ge4_finish(r, &a);
+}
+
+// t = b*P from the cached multiples in tbl, for -8 <= b <= 8
+FE4_TARGET static void ge4_select(fe4 *t, const uint64_t *tbl, const int8_t b) {
+  const int8_t babs = absolute(b);
+  fe4 minust, n;
+  u64x4 mask;
+  uint64_t m;
+  int i, j;
+  *t = fe4_zero;
+  t->v[0] = (u64x4) { 1, 1, 2, 0 };
+  for(j=0;j<8;j++) {
+    m = -(uint64_t) equal(babs, (int8_t) (j + 1));
+    mask = (u64x4) { m, m, m, m };
+    UNROLL
+    for(i=0;i<10;i++) {
+      const u64x4 x = (u64x4) _mm256_loadu_si256((const __m256i *) (tbl + 40*j + 4*i));
+      t->v[i] ^= (t->v[i] ^ x) & mask;
+    }
+  }
+  FE4_PERMUTE(&minust, t, PERM(1, 0, 2, 3));
+  fe4_sub(&n, &fe4_zero, t);
+  FE4_BLEND(&minust, &minust, &n, LANE3);
+  m = -(uint64_t) negative(b);
+  mask = (u64x4) { m, m, m, m };
+  UNROLL
+  for(i=0;i<10;i++) t->v[i] ^= (t->v[i] ^ minust.v[i]) & mask;
+}
+
+FE4_TARGET static void table_init(ristretto_table *t, const ristretto_point *p) {
+  ge_p3 m[8];
+  fe c[4];
+  fe4 c4;
+  int i, j;
+  ge_multiples(m, CP3(p));
+  for(i=0;i<8;i++) {
+    fe_sub(c[0], m[i].Y, m[i].X);
+    fe_add(c[1], m[i].Y, m[i].X);
+    fe_add(c[2], m[i].Z, m[i].Z);
+    fe_mul(c[3], m[i].T, fe_d2);
+    fe4_from51(&c4, (const uint64_t *const[4]) { c[0], c[1], c[2], c[3] });
+    for(j=0;j<10;j++) _mm256_storeu_si256((__m256i *) (t->v + 40*i + 4*j), (__m256i) c4.v[j]);
+  }
+}
+
+FE4_TARGET static int scalarmult_table(ristretto_point *q,
+                                      const uint8_t n[crypto_core_ristretto255_SCALARBYTES],
+                                      const ristretto_table *t) {
+  ge_p3 *h = P3(q);
+  int8_t e[64];
+  fe4 p, c;
+  int i;
+
+  scalar_digits(e, n);
+  p = fe4_zero;
+  p.v[0] = (u64x4) { 0, 1, 1, 0 };
+  for(i=63;i>0;i--) {
+    ge4_select(&c, t->v, e[i]);
+    ge4_add(&p, &p, &c);
+    ge4_dbl(&p, &p);
+    ge4_dbl(&p, &p);
+    ge4_dbl(&p, &p);
+    ge4_dbl(&p, &p);
+  }
+  ge4_select(&c, t->v, e[0]);
+  ge4_add(&p, &p, &c);
+  sodium_memzero(e, sizeof e);
+
+  fe4_to51((uint64_t *const[4]) { h->X, h->Y, h->Z, h->T }, &p);
+  if(ge_is_identity(h)) return -1;
+  return 0;
+}
+
+FE4_TARGET static inline void fe4_cmov(fe4 *f, const fe4 *g, const u64x4 mask) {
+  int i;
+  UNROLL
+  for(i=0;i<10;i++) f->v[i] ^= (f->v[i] ^ g->v[i]) & mask;
+}
+
+FE4_TARGET static void fe4_1(fe4 *o) {
+  *o = fe4_zero;
+  o->v[0] = (u64x4) { 1, 1, 1, 1 };
+}
+
+// o = f in every lane
+FE4_TARGET static void fe4_broadcast(fe4 *o, const fe f) {
+  fe4_from51(o, (const uint64_t *const[4]) { f, f, f, f });
+}
+
+FE4_TARGET static void fe4_pow22523(fe4 *out, const fe4 *z) {
+  fe4 t0, t1, t2;
+  int i;
+  fe4_sq(&t0, z);
+  fe4_sq(&t1, &t0);
+  fe4_sq(&t1, &t1);
+  fe4_mul(&t1, z, &t1);
+  fe4_mul(&t0, &t0, &t1);
+  fe4_sq(&t0, &t0);
+  fe4_mul(&t0, &t1, &t0);
+  fe4_sq(&t1, &t0);
+  for(i=1;i<5;i++) fe4_sq(&t1, &t1);
+  fe4_mul(&t0, &t1, &t0);
+  fe4_sq(&t1, &t0);
+  for(i=1;i<10;i++) fe4_sq(&t1, &t1);
+  fe4_mul(&t1, &t1, &t0);
+  fe4_sq(&t2, &t1);
+  for(i=1;i<20;i++) fe4_sq(&t2, &t2);
+  fe4_mul(&t1, &t2, &t1);
+  for(i=0;i<10;i++) fe4_sq(&t1, &t1);
+  fe4_mul(&t0, &t1, &t0);
+  fe4_sq(&t1, &t0);
+  for(i=1;i<50;i++) fe4_sq(&t1, &t1);
+  fe4_mul(&t1, &t1, &t0);
+  fe4_sq(&t2, &t1);
+  for(i=1;i<100;i++) fe4_sq(&t2, &t2);
+  fe4_mul(&t1, &t2, &t1);
+  for(i=0;i<50;i++) fe4_sq(&t1, &t1);
+  fe4_mul(&t0, &t1, &t0);
+  fe4_sq(&t0, &t0);
+  fe4_sq(&t0, &t0);
+  fe4_mul(out, &t0, z);
+}
+
+FE4_TARGET static void ge_0x4(ge_p3x4 *h) {
+  h->X = fe4_zero;
+  fe4_1(&h->Y);
+  fe4_1(&h->Z);
+  h->T = fe4_zero;
+}
+
+FE4_TARGET static void ge_to_cachedx4(ge_cachedx4 *r, const ge_p3x4 *p, const fe4 *d2) {
+  fe4_add(&r->YplusX, &p->Y, &p->X);
+  fe4_sub(&r->YminusX, &p->Y, &p->X);
+  r->Z = p->Z;
+  fe4_mul(&r->T2d, &p->T, d2);
+}
+
+// r->Z is the sum of three carried elements, which is still fine as
+// input of fe4_mul() in ge_p1p1_to_p3x4()
+FE4_TARGET static void ge_addx4(ge_p1p1x4 *r, const ge_p3x4 *p, const ge_cachedx4 *q) {
+  fe4 t0;
+  fe4_add(&r->X, &p->Y, &p->X);
+  fe4_sub(&r->Y, &p->Y, &p->X);
+  fe4_mul(&r->Z, &r->X, &q->YplusX);
+  fe4_mul(&r->Y, &r->Y, &q->YminusX);
+  fe4_mul(&r->T, &q->T2d, &p->T);
+  fe4_mul(&r->X, &p->Z, &q->Z);
+  fe4_add(&t0, &r->X, &r->X);
+  fe4_sub(&r->X, &r->Z, &r->Y);
+  fe4_add(&r->Y, &r->Z, &r->Y);
+  fe4_add(&r->Z, &t0, &r->T);
+  fe4_sub(&r->T, &t0, &r->T);
+}
+
+FE4_TARGET static void ge_maddx4(ge_p1p1x4 *r, const ge_p3x4 *p, const ge_precompx4 *q) {
+  fe4 t0;
+  fe4_add(&r->X, &p->Y, &p->X);
+  fe4_sub(&r->Y, &p->Y, &p->X);
+  fe4_mul(&r->Z, &r->X, &q->yplusx);
+  fe4_mul(&r->Y, &r->Y, &q->yminusx);
+  fe4_mul(&r->T, &q->xy2d, &p->T);
+  fe4_add(&t0, &p->Z, &p->Z);
+  fe4_sub(&r->X, &r->Z, &r->Y);
+  fe4_add(&r->Y, &r->Z, &r->Y);
+  fe4_add(&r->Z, &t0, &r->T);
+  fe4_sub(&r->T, &t0, &r->T);
+}
+
+FE4_TARGET static void ge_dblx4(ge_p1p1x4 *r, const ge_p3x4 *p) {
+  fe4 t0;
+  fe4_sq(&r->X, &p->X);
+  fe4_sq(&r->Z, &p->Y);
+  fe4_sq(&r->T, &p->Z);
+  fe4_add(&r->T, &r->T, &r->T);
+  fe4_add(&r->Y, &p->X, &p->Y);
+  fe4_sq(&t0, &r->Y);
+  fe4_add(&r->Y, &r->Z, &r->X);
+  fe4_sub(&r->Z, &r->Z, &r->X);
+  fe4_sub(&r->X, &t0, &r->Y);
+  fe4_sub(&r->T, &r->T, &r->Z);
+}
+
+FE4_TARGET static void ge_p1p1_to_p3x4(ge_p3x4 *r, const ge_p1p1x4 *p) {
+  fe4_mul(&r->X, &p->X, &p->T);
+  fe4_mul(&r->Y, &p->Y, &p->Z);
+  fe4_mul(&r->Z, &p->Z, &p->T);
+  fe4_mul(&r->T, &p->X, &p->Y);
+}
+
+FE4_TARGET static void ge_p1p1_to_p2x4(ge_p3x4 *r, const ge_p1p1x4 *p) {
+  fe4_mul(&r->X, &p->X, &p->T);
+  fe4_mul(&r->Y, &p->Y, &p->Z);
+  fe4_mul(&r->Z, &p->Z, &p->T);
+}
+
+FE4_TARGET static void ge_loadx4(ge_p3x4 *r, const ristretto_point *const p[4]) {
+  const ge_p3 *q[4];
+  int l;
+  for(l=0;l<4;l++) q[l] = CP3(p[l]);
+  fe4_from51(&r->X, (const uint64_t *const[4]) { q[0]->X, q[1]->X, q[2]->X, q[3]->X });
+  fe4_from51(&r->Y, (const uint64_t *const[4]) { q[0]->Y, q[1]->Y, q[2]->Y, q[3]->Y });
+  fe4_from51(&r->Z, (const uint64_t *const[4]) { q[0]->Z, q[1]->Z, q[2]->Z, q[3]->Z });
+  fe4_from51(&r->T, (const uint64_t *const[4]) { q[0]->T, q[1]->T, q[2]->T, q[3]->T });
+}
+
+FE4_TARGET static void ge_storex4(ge_p3 *const q[4], const ge_p3x4 *p) {
+  fe4_to51((uint64_t *const[4]) { q[0]->X, q[1]->X, q[2]->X, q[3]->X }, &p->X);
+  fe4_to51((uint64_t *const[4]) { q[0]->Y, q[1]->Y, q[2]->Y, q[3]->Y }, &p->Y);
+  fe4_to51((uint64_t *const[4]) { q[0]->Z, q[1]->Z, q[2]->Z, q[3]->Z }, &p->Z);
+  fe4_to51((uint64_t *const[4]) { q[0]->T, q[1]->T, q[2]->T, q[3]->T }, &p->T);
+}
+
+// all ones in the lanes l with b[l] == c
+FE4_TARGET static inline u64x4 lanes_equal(const int8_t b[4], const int8_t c) {
+  return (u64x4) { -(uint64_t) equal(b[0], c), -(uint64_t) equal(b[1], c),
+                   -(uint64_t) equal(b[2], c), -(uint64_t) equal(b[3], c) };
+}
+
+// all ones in the lanes l with b[l] < 0
+FE4_TARGET static inline u64x4 lanes_negative(const int8_t b[4]) {
+  return (u64x4) { -(uint64_t) negative(b[0]), -(uint64_t) negative(b[1]),
+                   -(uint64_t) negative(b[2]), -(uint64_t) negative(b[3]) };
+}
+
+// lane l of t = b[l]*P[l] from the multiples in tbl, for -8 <= b[l] <= 8
+FE4_TARGET static void ge_selectx4(ge_cachedx4 *t, const ge_cachedx4 tbl[8], const int8_t b[4]) {
+  const int8_t babs[4] = { absolute(b[0]), absolute(b[1]), absolute(b[2]), absolute(b[3]) };
+  ge_cachedx4 minust;
+  u64x4 mask;
+  int j;
+  fe4_1(&t->YplusX);
+  fe4_1(&t->YminusX);
+  fe4_1(&t->Z);
+  t->T2d = fe4_zero;
+  for(j=0;j<8;j++) {
+    mask = lanes_equal(babs, (int8_t) (j + 1));
+    fe4_cmov(&t->YplusX, &tbl[j].YplusX, mask);
+    fe4_cmov(&t->YminusX, &tbl[j].YminusX, mask);
+    fe4_cmov(&t->Z, &tbl[j].Z, mask);
+    fe4_cmov(&t->T2d, &tbl[j].T2d, mask);
+  }
+  minust.YplusX = t->YminusX;
+  minust.YminusX = t->YplusX;
+  fe4_sub(&minust.T2d, &fe4_zero, &t->T2d);
+  mask = lanes_negative(b);
+  fe4_cmov(&t->YplusX, &minust.YplusX, mask);
+  fe4_cmov(&t->YminusX, &minust.YminusX, mask);
+  fe4_cmov(&t->T2d, &minust.T2d, mask);
+}
+
+// lane l of t = b[l]*256^i*G from base_table4[i], for -8 <= b[l] <= 8
+FE4_TARGET static void ge_select_basex4(ge_precompx4 *t, const int i, const int8_t b[4]) {
+  const int8_t babs[4] = { absolute(b[0]), absolute(b[1]), absolute(b[2]), absolute(b[3]) };
+  fe4 *const f[3] = { &t->yplusx, &t->yminusx, &t->xy2d };
+  fe4 minus;
+  u64x4 mask;
+  int j, k, m;
+  fe4_1(&t->yplusx);
+  fe4_1(&t->yminusx);
+  t->xy2d = fe4_zero;
+  for(j=0;j<8;j++) {
+    mask = lanes_equal(babs, (int8_t) (j + 1));
+    for(k=0;k<3;k++) {
+      UNROLL
+      for(m=0;m<10;m++) {
+        const uint64_t x = base_table4[i][j][k][m];
+        f[k]->v[m] ^= (f[k]->v[m] ^ (u64x4) { x, x, x, x }) & mask;
+      }
+    }
+  }
+  mask = lanes_negative(b);
+  minus = t->yplusx;
+  fe4_cmov(&t->yplusx, &t->yminusx, mask);
+  fe4_cmov(&t->yminusx, &minus, mask);
+  fe4_sub(&minus, &fe4_zero, &t->xy2d);
+  fe4_cmov(&t->xy2d, &minus, mask);
+}
+
+// the exponentiations of four decodings or encodings in the lanes
+FE4_TARGET static void sqrt_ratio_powx4(ge_coding d[4]) {
+  fe4 x;
+  fe4_from51(&x, (const uint64_t *const[4]) { d[0].x, d[1].x, d[2].x, d[3].x });
+  fe4_pow22523(&x, &x);
+  fe4_to51((uint64_t *const[4]) { d[0].x, d[1].x, d[2].x, d[3].x }, &x);
+}
+
+FE4_TARGET static void decode4(ristretto_point *const p[4],
+                              const uint8_t *const s[4],
+                              int rets[4]) {
+  ge_coding d[4];
+  int l;
+  for(l=0;l<4;l++) decode_pre(&d[l], s[l]);
+  sqrt_ratio_powx4(d);
+  for(l=0;l<4;l++) rets[l] = decode_post(P3(p[l]), &d[l]);
+}
+
+FE4_TARGET static void ge_tobytesx4(uint8_t *const s[4], const ge_p3 *const p[4]) {
+  ge_coding d[4];
+  int l;
+  for(l=0;l<4;l++) encode_pre(&d[l], p[l]);
+  sqrt_ratio_powx4(d);
+  for(l=0;l<4;l++) encode_post(s[l], &d[l], p[l]);
+  sodium_memzero(d, sizeof d);
+}
+
+FE4_TARGET static void encode4(uint8_t *const s[4], const ristretto_point *const p[4]) {
+  ge_tobytesx4(s, (const ge_p3 *const[4]) { CP3(p[0]), CP3(p[1]), CP3(p[2]), CP3(p[3]) });
+}
+
+FE4_TARGET static void scalarmult4(ristretto_point *const q[4],
+                                  const uint8_t *const n[4],
+                                  const ristretto_point *const p[4],
+                                  int rets[4]) {
+  ge_cachedx4 tbl[8], t;
+  ge_p3x4 h;
+  ge_p1p1x4 r;
+  fe4 d2;
+  int8_t e[4][64], b[4];
+  int i, l;
+
+  // the multiples 1..8 of each lane, as in ge_multiples()
+  fe4_broadcast(&d2, fe_d2);
+  ge_loadx4(&h, p);
+  ge_to_cachedx4(&tbl[0], &h, &d2);
+  ge_dblx4(&r, &h);
+  for(i=1;i<8;i++) {
+    ge_p1p1_to_p3x4(&h, &r);
+    ge_to_cachedx4(&tbl[i], &h, &d2);
+    if(i<7) ge_addx4(&r, &h, &tbl[0]);
+  }
+
+  for(l=0;l<4;l++) scalar_digits(e[l], n[l]);
+  ge_0x4(&h);
+  for(i=63;i>=0;i--) {
+    for(l=0;l<4;l++) b[l] = e[l][i];
+    ge_selectx4(&t, tbl, b);
+    ge_addx4(&r, &h, &t);
+    if(i==0) break;
+    ge_p1p1_to_p2x4(&h, &r);
+    ge_dblx4(&r, &h);
+    ge_p1p1_to_p2x4(&h, &r);
+    ge_dblx4(&r, &h);
+    ge_p1p1_to_p2x4(&h, &r);
+    ge_dblx4(&r, &h);
+    ge_p1p1_to_p2x4(&h, &r);
+    ge_dblx4(&r, &h);
+    ge_p1p1_to_p3x4(&h, &r);
+  }
+  ge_p1p1_to_p3x4(&h, &r);
+  sodium_memzero(e, sizeof e);
+  sodium_memzero(b, sizeof b);
+  sodium_memzero(tbl, sizeof tbl);
+  sodium_memzero(&t, sizeof t);
+
+  ge_storex4((ge_p3 *const[4]) { P3(q[0]), P3(q[1]), P3(q[2]), P3(q[3]) }, &h);
+  sodium_memzero(&h, sizeof h);
+  for(l=0;l<4;l++) rets[l] = ge_is_identity(CP3(q[l])) ? -1 : 0;
+}
+
+FE4_TARGET static void scalarmult_base4(uint8_t *const q[4],
+                                       const uint8_t *const n[4],
+                                       int rets[4]) {
+  int8_t e[4][64], b[4];
+  ge_precompx4 t;
+  ge_p1p1x4 r;
+  ge_p3x4 h;
+  ge_p3 out[4];
+  int i, l;
+
+  pthread_once(&base4_once, base_table4_init);
+  for(l=0;l<4;l++) scalar_digits(e[l], n[l]);
+  ge_0x4(&h);
+  for(i=1;i<64;i+=2) {
+    for(l=0;l<4;l++) b[l] = e[l][i];
+    ge_select_basex4(&t, i/2, b);
+    ge_maddx4(&r, &h, &t);
+    ge_p1p1_to_p3x4(&h, &r);
+  }
+  for(i=0;i<4;i++) {
+    ge_dblx4(&r, &h);
+    if(i<3) ge_p1p1_to_p2x4(&h, &r);
+    else ge_p1p1_to_p3x4(&h, &r);
+  }
+  for(i=0;i<64;i+=2) {
+    for(l=0;l<4;l++) b[l] = e[l][i];
+    ge_select_basex4(&t, i/2, b);
+    ge_maddx4(&r, &h, &t);
+    ge_p1p1_to_p3x4(&h, &r);
+  }
+  sodium_memzero(e, sizeof e);
+  sodium_memzero(b, sizeof b);
+  sodium_memzero(&t, sizeof t);
+
+  ge_storex4((ge_p3 *const[4]) { &out[0], &out[1], &out[2], &out[3] }, &h);
+  sodium_memzero(&h, sizeof h);
+  ge_tobytesx4(q, (const ge_p3 *const[4]) { &out[0], &out[1], &out[2], &out[3] });
+  sodium_memzero(out, sizeof out);
+  for(l=0;l<4;l++) rets[l] = sodium_is_zero(q[l], crypto_core_ristretto255_BYTES) ? -1 : 0;
+}
+
+#undef fe4_carry
+#undef fe4_add
+#undef fe4_sub
+#undef fe4_mul
+#undef fe4_sq
+#undef fe4_from51
+#undef fe4_to51
+#undef ge4_finish
+#undef ge4_add
+#undef ge4_dbl
+#undef ge4_select
+#undef table_init
+#undef scalarmult_table
+#undef fe4_cmov
+#undef fe4_1
+#undef fe4_broadcast
+#undef fe4_pow22523
+#undef ge_0x4
+#undef ge_to_cachedx4
+#undef ge_addx4
+#undef ge_maddx4
+#undef ge_dblx4
+#undef ge_p1p1_to_p3x4
+#undef ge_p1p1_to_p2x4
+#undef ge_loadx4
+#undef ge_storex4
+#undef lanes_equal
+#undef lanes_negative
+#undef ge_selectx4
+#undef ge_select_basex4
+#undef sqrt_ratio_powx4
+#undef decode4
+#undef ge_tobytesx4
+#undef encode4
+#undef scalarmult4
+#undef scalarmult_base4
+#undef FE4_TARGET
+#undef FE4
@@ -0,0 +1,181 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if _WIN32 == 1 || _WIN64 == 1
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "common.h"
+#include "rwdcache.h"
+
+// the entries are in locked memory
+#define RWDCACHE_MAX_ENTRIES 4096
+#define RWDCACHE_WAYS 4
+
+typedef struct {
+  uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES];
+  uint8_t rwdU[crypto_hash_sha512_BYTES];
+  // seconds of now_s(), an entry with expires==0 is free
+  uint64_t expires;
+  uint64_t used;
+} Entry;
+
+// sodium_malloc()ed, the size of both is a multiple of 16 so that the
+// guard page aligned end of the allocation keeps the fields aligned
+typedef struct {
+  uint8_t key[crypto_generichash_KEYBYTES];
+  Entry entries[];
+} Secrets;
+
+struct Opaque_RwdCache {
+  pthread_mutex_t lock;
+  uint32_t ttl;
+  // the number of sets, a power of 2
+  size_t sets;
+  // the lookup counter for the least recently used entry
+  uint64_t clock;
+  Secrets *secrets;
+  Entry *entries;
+};
+
+static uint64_t now_s(void) {
+#if _WIN32 == 1 || _WIN64 == 1
+  return (uint64_t) GetTickCount64() / 1000;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec;
+#endif
+}
+
+Opaque_RwdCache *opaque_rwdcache_new(const size_t max_entries, const uint32_t ttl) {
+  size_t sets = 1;
+  if(max_entries==0 || max_entries > RWDCACHE_MAX_ENTRIES || ttl==0) return NULL;
+  while(sets * RWDCACHE_WAYS < max_entries) sets <<= 1;
+  Opaque_RwdCache *cache = calloc(1, sizeof *cache);
+  if(cache==NULL) return NULL;
+  if(0!=pthread_mutex_init(&cache->lock, NULL)) {
+    free(cache);
+    return NULL;
+  }
+  cache->secrets = sodium_malloc(sizeof(Secrets) + sets * RWDCACHE_WAYS * sizeof(Entry));
+  if(cache->secrets==NULL) {
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+    return NULL;
+  }
+  cache->entries = cache->secrets->entries;
+  memset(cache->entries, 0, sets * RWDCACHE_WAYS * sizeof(Entry));
+  randombytes(cache->secrets->key, sizeof cache->secrets->key);
+  cache->ttl = ttl;
+  cache->sets = sets;
+  return cache;
+}
+
+void opaque_rwdcache_purge(Opaque_RwdCache *cache) {
+  if(cache==NULL) return;
+  pthread_mutex_lock(&cache->lock);
+  sodium_memzero(cache->entries, cache->sets * RWDCACHE_WAYS * sizeof(Entry));
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void opaque_rwdcache_free(Opaque_RwdCache *cache) {
+  if(cache==NULL) return;
+  // sodium_free wipes the key and the entries
+  sodium_free(cache->secrets);
+  pthread_mutex_destroy(&cache->lock);
+  sodium_memzero(cache, sizeof *cache);
+  free(cache);
+}
+
+void opaque_rwdcache_tag(const Opaque_RwdCache *cache,
+                         const uint8_t N[crypto_core_ristretto255_BYTES],
+                         const Opaque_KSF *ksf,
+                         uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES]) {
+  uint8_t profile[OPAQUE_KSF_PROFILE_LEN];
+  crypto_generichash_blake2b_state st;
+  opaque_SerializeKSF(ksf, profile);
+  crypto_generichash_blake2b_init(&st, cache->secrets->key, sizeof cache->secrets->key,
+                                  OPAQUE_RWDCACHE_TAGBYTES);
+  crypto_generichash_blake2b_update(&st, N, crypto_core_ristretto255_BYTES);
+  crypto_generichash_blake2b_update(&st, profile, sizeof profile);
+  crypto_generichash_blake2b_final(&st, tag, OPAQUE_RWDCACHE_TAGBYTES);
+  sodium_memzero(&st, sizeof st);
+}
+
+static Entry *set_of(const Opaque_RwdCache *cache, const uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES]) {
+  size_t i, idx = 0;
+  for(i=0;i<sizeof idx;i++) idx = (idx << 8) | tag[i];
+  return &cache->entries[(idx & (cache->sets - 1)) * RWDCACHE_WAYS];
+}
+
+int opaque_rwdcache_get(Opaque_RwdCache *cache,
+                        const uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES],
+                        uint8_t rwdU[crypto_hash_sha512_BYTES]) {
+  const uint64_t now = now_s();
+  Entry *set = set_of(cache, tag);
+  int ret = -1;
+  size_t i;
+  pthread_mutex_lock(&cache->lock);
+  for(i=0;i<RWDCACHE_WAYS;i++) {
+    Entry *e = &set[i];
+    if(e->expires==0) continue;
+    if(e->expires <= now) {
+      sodium_memzero(e, sizeof *e);
+      continue;
+    }
+    if(ret!=0 && 0==sodium_memcmp(e->tag, tag, OPAQUE_RWDCACHE_TAGBYTES)) {
+      memcpy(rwdU, e->rwdU, crypto_hash_sha512_BYTES);
+      e->used = ++cache->clock;
+      ret = 0;
+    }
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return ret;
+}
+
+void opaque_rwdcache_put(Opaque_RwdCache *cache,
+                         const uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES],
+                         const uint8_t rwdU[crypto_hash_sha512_BYTES]) {
+  const uint64_t now = now_s();
+  Entry *set = set_of(cache, tag);
+  size_t i;
+  pthread_mutex_lock(&cache->lock);
+  Entry *slot = &set[0];
+  for(i=0;i<RWDCACHE_WAYS;i++) {
+    Entry *e = &set[i];
+    // the entry of the same tag, else a free or expired one, else the
+    // least recently used of the set
+    if(e->expires!=0 && 0==sodium_memcmp(e->tag, tag, OPAQUE_RWDCACHE_TAGBYTES)) {
+      slot = e;
+      break;
+    }
+    if(slot->expires <= now) continue;
+    if(e->expires <= now || e->used < slot->used) slot = e;
+  }
+  memcpy(slot->tag, tag, OPAQUE_RWDCACHE_TAGBYTES);
+  memcpy(slot->rwdU, rwdU, crypto_hash_sha512_BYTES);
+  slot->expires = now + cache->ttl;
+  slot->used = ++cache->clock;
+  pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,36 @@
+#ifndef RWDCACHE_H
+#define RWDCACHE_H
+
+#include <stdint.h>
+#include "opaque.h"
+
+/* lookups and insertions of the client side rwdU cache of opaque.h
+ *
+ * An entry maps a keyed hash of the unblinded OPRF evaluation N, and
+ * of the algorithm and cost parameters of the KSF, to rwdU. The cache
+ * is set associative with 4 entries per set selected by the tag. The
+ * hash key is random per cache, the entries are in memory allocated
+ * with sodium_malloc(), which locks it and excludes it from core
+ * dumps. */
+
+#define OPAQUE_RWDCACHE_TAGBYTES 32
+
+// the tag of N hardened with ksf in cache
+void opaque_rwdcache_tag(const Opaque_RwdCache *cache,
+                         const uint8_t N[crypto_core_ristretto255_BYTES],
+                         const Opaque_KSF *ksf,
+                         uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES]);
+
+// copies the rwdU of tag to rwdU if there is an entry that has not
+// expired, returns 0 then, -1 otherwise
+int opaque_rwdcache_get(Opaque_RwdCache *cache,
+                        const uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES],
+                        uint8_t rwdU[crypto_hash_sha512_BYTES]);
+
+// stores rwdU for tag, replacing an expired or else the least
+// recently used entry if its set is full
+void opaque_rwdcache_put(Opaque_RwdCache *cache,
+                         const uint8_t tag[OPAQUE_RWDCACHE_TAGBYTES],
+                         const uint8_t rwdU[crypto_hash_sha512_BYTES]);
+
+#endif // RWDCACHE_H
@@ -0,0 +1,417 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <pthread.h>
+#include "sha512mb.h"
+#include "common.h"
+
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__) && (defined(__GNUC__) || defined(__clang__))
+#define SHA512MB_X86 1
+#include <immintrin.h>
+#endif
+
+static const uint64_t IV[8] = {
+  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint64_t K[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static uint64_t load64_be(const uint8_t *p) {
+  return ((uint64_t) p[0] << 56) | ((uint64_t) p[1] << 48) | ((uint64_t) p[2] << 40) | ((uint64_t) p[3] << 32) |
+         ((uint64_t) p[4] << 24) | ((uint64_t) p[5] << 16) | ((uint64_t) p[6] << 8) | (uint64_t) p[7];
+}
+
+static void store64_be(uint8_t *p, const uint64_t x) {
+  unsigned i;
+  for(i=0;i<8;i++) p[i] = (uint8_t) (x >> (56 - 8*i));
+}
+
+#ifdef SHA512MB_X86
+#define AVX2_ROR(x,n) _mm256_or_si256(_mm256_srli_epi64((x), (n)), _mm256_slli_epi64((x), 64 - (n)))
+
+#define COMPRESS4_TARGET __attribute__((target("avx2")))
+#define COMPRESS4 compress_avx2
+#include "sha512mb_compress4.h"
+
+// the same with the rotations of AVX-512VL, for groups of at most 4
+// lanes of the "avx512" implementation
+#define COMPRESS4_TARGET __attribute__((target("avx2,avx512f,avx512vl")))
+#define COMPRESS4 compress_avx512vl
+#include "sha512mb_compress4.h"
+
+__attribute__((target("avx512f")))
+static void compress_avx512(const size_t m, uint64_t *const h[], const uint8_t *const blk[]) {
+  // unused lanes hash a copy of lane 0 into a dummy state
+  uint64_t dummy[8];
+  uint64_t *hs[8];
+  const uint8_t *bs[8];
+  size_t i;
+  memcpy(dummy, h[0], sizeof dummy);
+  for(i=0;i<8;i++) {
+    hs[i] = (i<m) ? h[i] : dummy;
+    bs[i] = (i<m) ? blk[i] : blk[0];
+  }
+
+  __m512i s[8], w[16];
+  unsigned t;
+  for(t=0;t<8;t++) s[t] = _mm512_set_epi64((long long) hs[7][t], (long long) hs[6][t], (long long) hs[5][t], (long long) hs[4][t],
+                                           (long long) hs[3][t], (long long) hs[2][t], (long long) hs[1][t], (long long) hs[0][t]);
+  __m512i a=s[0], b=s[1], c=s[2], d=s[3], e=s[4], f=s[5], g=s[6], hh=s[7];
+  for(t=0;t<80;t++) {
+    if(t<16) {
+      w[t] = _mm512_set_epi64((long long) load64_be(bs[7] + 8*t), (long long) load64_be(bs[6] + 8*t),
+                              (long long) load64_be(bs[5] + 8*t), (long long) load64_be(bs[4] + 8*t),
+                              (long long) load64_be(bs[3] + 8*t), (long long) load64_be(bs[2] + 8*t),
+                              (long long) load64_be(bs[1] + 8*t), (long long) load64_be(bs[0] + 8*t));
+    } else {
+      const __m512i w15 = w[(t+1)&15], w2 = w[(t+14)&15];
+      // 0x96 is a three-way xor
+      const __m512i s0 = _mm512_ternarylogic_epi64(_mm512_ror_epi64(w15, 1), _mm512_ror_epi64(w15, 8), _mm512_srli_epi64(w15, 7), 0x96);
+      const __m512i s1 = _mm512_ternarylogic_epi64(_mm512_ror_epi64(w2, 19), _mm512_ror_epi64(w2, 61), _mm512_srli_epi64(w2, 6), 0x96);
+      w[t&15] = _mm512_add_epi64(_mm512_add_epi64(w[t&15], s0), _mm512_add_epi64(w[(t+9)&15], s1));
+    }
+    const __m512i S1 = _mm512_ternarylogic_epi64(_mm512_ror_epi64(e, 14), _mm512_ror_epi64(e, 18), _mm512_ror_epi64(e, 41), 0x96);
+    // 0xca is e ? f : g
+    const __m512i ch = _mm512_ternarylogic_epi64(e, f, g, 0xca);
+    const __m512i t1 = _mm512_add_epi64(_mm512_add_epi64(hh, S1),
+                                        _mm512_add_epi64(_mm512_add_epi64(ch, _mm512_set1_epi64((long long) K[t])), w[t&15]));
+    const __m512i S0 = _mm512_ternarylogic_epi64(_mm512_ror_epi64(a, 28), _mm512_ror_epi64(a, 34), _mm512_ror_epi64(a, 39), 0x96);
+    // 0xe8 is the majority function
+    const __m512i maj = _mm512_ternarylogic_epi64(a, b, c, 0xe8);
+    const __m512i t2 = _mm512_add_epi64(S0, maj);
+    hh = g; g = f; f = e; e = _mm512_add_epi64(d, t1);
+    d = c; c = b; b = a; a = _mm512_add_epi64(t1, t2);
+  }
+  s[0]=_mm512_add_epi64(s[0], a); s[1]=_mm512_add_epi64(s[1], b);
+  s[2]=_mm512_add_epi64(s[2], c); s[3]=_mm512_add_epi64(s[3], d);
+  s[4]=_mm512_add_epi64(s[4], e); s[5]=_mm512_add_epi64(s[5], f);
+  s[6]=_mm512_add_epi64(s[6], g); s[7]=_mm512_add_epi64(s[7], hh);
+
+  uint64_t out[8];
+  for(t=0;t<8;t++) {
+    _mm512_storeu_si512((void*) out, s[t]);
+    for(i=0;i<8;i++) hs[i][t] = out[i];
+  }
+  sodium_memzero(w, sizeof w);
+  sodium_memzero(out, sizeof out);
+  sodium_memzero(dummy, sizeof dummy);
+}
+
+static int have_avx2(void) {
+  return __builtin_cpu_supports("avx2");
+}
+
+static int have_avx512(void) {
+  return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")
+    && __builtin_cpu_supports("avx2");
+}
+#endif // SHA512MB_X86
+
+static int have_scalar(void) {
+  return 1;
+}
+
+// libsodiums sha512 is faster than a portable C version of the
+// compression function for any number of lanes, so without SIMD each
+// lane is simply hashed by libsodium
+
+typedef void (*SHA512MB_Compress)(const size_t m, uint64_t *const h[], const uint8_t *const blk[]);
+
+typedef struct {
+  const char *name;
+  // OPAQUE_CPU_*
+  int level;
+  size_t width;
+  SHA512MB_Compress compress;
+  // used for groups of at most 4 lanes, where the wide registers do
+  // not pay off
+  SHA512MB_Compress compress4;
+  int (*supported)(void);
+} SHA512MB_Impl;
+
+// in order of preference
+static const SHA512MB_Impl impls[] = {
+#ifdef SHA512MB_X86
+  {"avx512", OPAQUE_CPU_AVX512, 8, compress_avx512, compress_avx512vl, have_avx512},
+  {"avx2", OPAQUE_CPU_AVX2, 4, compress_avx2, compress_avx2, have_avx2},
+#endif
+  {"scalar", OPAQUE_CPU_BASELINE, 1, NULL, NULL, have_scalar},
+};
+
+static const SHA512MB_Impl *impl = NULL;
+static pthread_once_t impl_once = PTHREAD_ONCE_INIT;
+
+static void impl_init(void) {
+#ifdef SHA512MB_X86
+  __builtin_cpu_init();
+#endif
+  // an unknown OPAQUE_CPU is reported by opaque_init() and ignored here
+  const int max = opaque_cpu_max();
+  size_t i;
+  for(i=0;i<sizeof impls / sizeof impls[0];i++) {
+    if((max<0 || impls[i].level<=max) && impls[i].supported()) {
+      impl = &impls[i];
+      return;
+    }
+  }
+}
+
+static const SHA512MB_Impl *get_impl(void) {
+  pthread_once(&impl_once, impl_init);
+  return impl;
+}
+
+const char *sha512mb_impl(void) {
+  return get_impl()->name;
+}
+
+int sha512mb_select(const char *name) {
+  get_impl();
+  size_t i;
+  for(i=0;i<sizeof impls / sizeof impls[0];i++) {
+    if(strcmp(impls[i].name, name)==0 && impls[i].supported()) {
+      impl = &impls[i];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// compresses one block into each of the m states
+static void compress_n(const size_t m, uint64_t *const h[], const uint8_t *const blk[]) {
+  const SHA512MB_Impl *im = get_impl();
+  size_t i;
+  for(i=0;i<m;i+=im->width) {
+    const size_t c = (m-i < im->width) ? m-i : im->width;
+    if(c<=4) im->compress4(c, &h[i], &blk[i]);
+    else im->compress(c, &h[i], &blk[i]);
+  }
+}
+
+// one message being finalized: the blocks it still needs to absorb
+// are the head (buffered bytes of the state completed from the
+// input), the full blocks read directly from the input, and the
+// padded tail
+typedef struct {
+  uint64_t h[8];
+  const uint8_t *in;
+  size_t nblocks;
+  size_t total;
+  int has_head;
+  uint8_t head[128];
+  uint8_t tail[256];
+} Lane;
+
+static void lane_init(Lane *l, const crypto_hash_sha512_state *st, const uint8_t *in, size_t inlen) {
+  memcpy(l->h, st->state, sizeof l->h);
+
+  uint64_t count[2] = { st->count[0], st->count[1] };
+  const uint64_t bits = (uint64_t) inlen << 3;
+  if((count[1] += bits) < bits) count[0]++;
+  count[0] += (uint64_t) inlen >> 61;
+
+  const size_t r = (size_t) ((st->count[1] >> 3) & 0x7f);
+  size_t t = 0;
+  l->has_head = 0;
+  if(r > 0) {
+    if(r + inlen >= 128) {
+      memcpy(l->head, st->buf, r);
+      memcpy(l->head + r, in, 128 - r);
+      in += 128 - r;
+      inlen -= 128 - r;
+      l->has_head = 1;
+    } else {
+      memcpy(l->tail, st->buf, r);
+      t = r;
+    }
+  }
+  l->in = in;
+  l->nblocks = inlen / 128;
+  if(inlen % 128) {
+    memcpy(l->tail + t, in + l->nblocks * 128, inlen % 128);
+    t += inlen % 128;
+  }
+
+  l->tail[t++] = 0x80;
+  const size_t tlen = (t <= 112) ? 128 : 256;
+  memset(l->tail + t, 0, tlen - 16 - t);
+  store64_be(l->tail + tlen - 16, count[0]);
+  store64_be(l->tail + tlen - 8, count[1]);
+
+  l->total = (size_t) l->has_head + l->nblocks + tlen / 128;
+}
+
+static const uint8_t *lane_block(const Lane *l, size_t k) {
+  if(l->has_head) {
+    if(k==0) return l->head;
+    k--;
+  }
+  if(k < l->nblocks) return l->in + k * 128;
+  return l->tail + (k - l->nblocks) * 128;
+}
+
+void sha512mb_final(const size_t n,
+                    const crypto_hash_sha512_state *const states[],
+                    const uint8_t *const in[], const size_t inlen[],
+                    uint8_t *const out[]) {
+  Lane lanes[SHA512MB_MAX_LANES];
+  uint64_t *h[SHA512MB_MAX_LANES];
+  const uint8_t *blk[SHA512MB_MAX_LANES];
+  size_t i, j, k;
+
+  if(get_impl()->compress==NULL) {
+    crypto_hash_sha512_state st;
+    for(i=0;i<n;i++) {
+      memcpy(&st, states[i], sizeof st);
+      crypto_hash_sha512_update(&st, in[i], inlen[i]);
+      crypto_hash_sha512_final(&st, out[i]);
+    }
+    sodium_memzero(&st, sizeof st);
+    return;
+  }
+
+  for(i=0;i<n;i+=SHA512MB_MAX_LANES) {
+    const size_t m = (n-i < SHA512MB_MAX_LANES) ? n-i : SHA512MB_MAX_LANES;
+    size_t steps = 0;
+    for(j=0;j<m;j++) {
+      lane_init(&lanes[j], states[i+j], in[i+j], inlen[i+j]);
+      if(lanes[j].total > steps) steps = lanes[j].total;
+    }
+    // lanes that are done drop out of the later steps
+    for(k=0;k<steps;k++) {
+      size_t active = 0;
+      for(j=0;j<m;j++) {
+        if(k >= lanes[j].total) continue;
+        h[active] = lanes[j].h;
+        blk[active] = lane_block(&lanes[j], k);
+        active++;
+      }
+      compress_n(active, h, blk);
+    }
+    for(j=0;j<m;j++) {
+      for(k=0;k<8;k++) store64_be(out[i+j] + 8*k, lanes[j].h[k]);
+    }
+  }
+  sodium_memzero(lanes, sizeof lanes);
+}
+
+void sha512mb_hmac_init(const size_t n,
+                        crypto_auth_hmacsha512_state *const states[],
+                        const uint8_t *const keys[], const size_t keylen) {
+  if(keylen > 128 || get_impl()->compress==NULL) {
+    // long keys are hashed first, this is not worth vectorizing
+    size_t i;
+    for(i=0;i<n;i++) crypto_auth_hmacsha512_init(states[i], keys[i], keylen);
+    return;
+  }
+
+  // the inner and outer pad of each key is one lane
+  uint8_t pads[SHA512MB_MAX_LANES][128];
+  uint64_t *h[SHA512MB_MAX_LANES];
+  const uint8_t *blk[SHA512MB_MAX_LANES];
+  size_t i, j, k;
+  for(i=0;i<n;i+=SHA512MB_MAX_LANES/2) {
+    const size_t m = (n-i < SHA512MB_MAX_LANES/2) ? n-i : SHA512MB_MAX_LANES/2;
+    for(j=0;j<m;j++) {
+      crypto_auth_hmacsha512_state *st = states[i+j];
+      uint8_t *ipad = pads[2*j], *opad = pads[2*j+1];
+      memset(ipad, 0x36, 128);
+      memset(opad, 0x5c, 128);
+      for(k=0;k<keylen;k++) {
+        ipad[k] ^= keys[i+j][k];
+        opad[k] ^= keys[i+j][k];
+      }
+      memset(st, 0, sizeof *st);
+      memcpy(st->ictx.state, IV, sizeof IV);
+      memcpy(st->octx.state, IV, sizeof IV);
+      st->ictx.count[1] = st->octx.count[1] = 128 * 8;
+      h[2*j] = st->ictx.state;
+      h[2*j+1] = st->octx.state;
+      blk[2*j] = ipad;
+      blk[2*j+1] = opad;
+    }
+    compress_n(2*m, h, blk);
+  }
+  sodium_memzero(pads, sizeof pads);
+}
+
+void sha512mb_hmac_final(const size_t n,
+                         const crypto_auth_hmacsha512_state *const states[],
+                         const uint8_t *const in[], const size_t inlen[],
+                         uint8_t *const out[]) {
+  uint8_t ihash[SHA512MB_MAX_LANES][crypto_hash_sha512_BYTES];
+  const crypto_hash_sha512_state *st[SHA512MB_MAX_LANES];
+  const uint8_t *iptr[SHA512MB_MAX_LANES];
+  uint8_t *optr[SHA512MB_MAX_LANES];
+  size_t ilen[SHA512MB_MAX_LANES];
+  size_t i, j;
+  for(i=0;i<n;i+=SHA512MB_MAX_LANES) {
+    const size_t m = (n-i < SHA512MB_MAX_LANES) ? n-i : SHA512MB_MAX_LANES;
+    for(j=0;j<m;j++) {
+      st[j] = &states[i+j]->ictx;
+      optr[j] = ihash[j];
+    }
+    sha512mb_final(m, st, &in[i], &inlen[i], optr);
+    for(j=0;j<m;j++) {
+      st[j] = &states[i+j]->octx;
+      iptr[j] = ihash[j];
+      ilen[j] = crypto_hash_sha512_BYTES;
+    }
+    sha512mb_final(m, st, iptr, ilen, &out[i]);
+  }
+  sodium_memzero(ihash, sizeof ihash);
+}
+
+void sha512mb_hmac(const size_t n,
+                   const uint8_t *const keys[], const size_t keylen,
+                   const uint8_t *const in[], const size_t inlen[],
+                   uint8_t *const out[]) {
+  crypto_auth_hmacsha512_state states[SHA512MB_MAX_LANES];
+  crypto_auth_hmacsha512_state *st[SHA512MB_MAX_LANES];
+  size_t i, j;
+  for(j=0;j<SHA512MB_MAX_LANES;j++) st[j] = &states[j];
+  for(i=0;i<n;i+=SHA512MB_MAX_LANES) {
+    const size_t m = (n-i < SHA512MB_MAX_LANES) ? n-i : SHA512MB_MAX_LANES;
+    sha512mb_hmac_init(m, st, &keys[i], keylen);
+    sha512mb_hmac_final(m, (const crypto_auth_hmacsha512_state *const *) st, &in[i], &inlen[i], &out[i]);
+  }
+  sodium_memzero(states, sizeof states);
+}
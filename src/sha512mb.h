@@ -0,0 +1,52 @@
+#ifndef SHA512MB_H
+#define SHA512MB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sodium.h>
+
+/* multi-buffer sha512 and hmac-sha512
+ *
+ * Computes n independent hashes at once by running the compression
+ * function of up to 4 (AVX2) or 8 (AVX-512) messages in the lanes of
+ * one vector register. The implementation is selected at runtime, up
+ * to the level set by the OPAQUE_CPU environment variable (see
+ * common.h), on other CPUs each lane is hashed by libsodium. The states are the
+ * libsodium types, so they can be created or continued by libsodium.
+ *
+ * All functions accept any n, lanes are processed in groups of the
+ * width of the selected implementation. */
+
+#define SHA512MB_MAX_LANES 8
+
+// name of the selected implementation: "avx512", "avx2" or "scalar"
+const char *sha512mb_impl(void);
+
+// selects an implementation by name, returns -1 if it is not
+// supported by this CPU. Only meant for testing and benchmarking.
+int sha512mb_select(const char *impl);
+
+// out[i] = final(states[i] || in[i]), the states are not modified
+void sha512mb_final(const size_t n,
+                    const crypto_hash_sha512_state *const states[],
+                    const uint8_t *const in[], const size_t inlen[],
+                    uint8_t *const out[]);
+
+// keys each state with the corresponding key of at most 128 bytes
+void sha512mb_hmac_init(const size_t n,
+                        crypto_auth_hmacsha512_state *const states[],
+                        const uint8_t *const keys[], const size_t keylen);
+
+// out[i] = hmac(states[i], in[i]), the states are not modified
+void sha512mb_hmac_final(const size_t n,
+                         const crypto_auth_hmacsha512_state *const states[],
+                         const uint8_t *const in[], const size_t inlen[],
+                         uint8_t *const out[]);
+
+// out[i] = hmac(keys[i], in[i]) with keys of at most 128 bytes
+void sha512mb_hmac(const size_t n,
+                   const uint8_t *const keys[], const size_t keylen,
+                   const uint8_t *const in[], const size_t inlen[],
+                   uint8_t *const out[]);
+
+#endif // SHA512MB_H
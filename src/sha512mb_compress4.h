@@ -0,0 +1,81 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* the 4 lane compression function of sha512mb.c, which includes this
+ * file once for each instruction set it compiles it for. The includer
+ * defines COMPRESS4_TARGET, the target attribute, and COMPRESS4, the
+ * name of the function. Both are undefined at the end of this file. */
+
+#if !defined(COMPRESS4_TARGET) || !defined(COMPRESS4)
+#error "only to be included by sha512mb.c"
+#endif
+
+COMPRESS4_TARGET
+static void COMPRESS4(const size_t m, uint64_t *const h[], const uint8_t *const blk[]) {
+  // unused lanes hash a copy of lane 0 into a dummy state
+  uint64_t dummy[8];
+  uint64_t *hs[4];
+  const uint8_t *bs[4];
+  size_t i;
+  memcpy(dummy, h[0], sizeof dummy);
+  for(i=0;i<4;i++) {
+    hs[i] = (i<m) ? h[i] : dummy;
+    bs[i] = (i<m) ? blk[i] : blk[0];
+  }
+
+  __m256i s[8], w[16];
+  unsigned t;
+  for(t=0;t<8;t++) s[t] = _mm256_set_epi64x((long long) hs[3][t], (long long) hs[2][t], (long long) hs[1][t], (long long) hs[0][t]);
+  __m256i a=s[0], b=s[1], c=s[2], d=s[3], e=s[4], f=s[5], g=s[6], hh=s[7];
+  for(t=0;t<80;t++) {
+    if(t<16) {
+      w[t] = _mm256_set_epi64x((long long) load64_be(bs[3] + 8*t), (long long) load64_be(bs[2] + 8*t),
+                               (long long) load64_be(bs[1] + 8*t), (long long) load64_be(bs[0] + 8*t));
+    } else {
+      const __m256i w15 = w[(t+1)&15], w2 = w[(t+14)&15];
+      const __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(w15, 1), AVX2_ROR(w15, 8)), _mm256_srli_epi64(w15, 7));
+      const __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(w2, 19), AVX2_ROR(w2, 61)), _mm256_srli_epi64(w2, 6));
+      w[t&15] = _mm256_add_epi64(_mm256_add_epi64(w[t&15], s0), _mm256_add_epi64(w[(t+9)&15], s1));
+    }
+    const __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(e, 14), AVX2_ROR(e, 18)), AVX2_ROR(e, 41));
+    const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+    const __m256i t1 = _mm256_add_epi64(_mm256_add_epi64(hh, S1),
+                                        _mm256_add_epi64(_mm256_add_epi64(ch, _mm256_set1_epi64x((long long) K[t])), w[t&15]));
+    const __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(a, 28), AVX2_ROR(a, 34)), AVX2_ROR(a, 39));
+    const __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+    const __m256i t2 = _mm256_add_epi64(S0, maj);
+    hh = g; g = f; f = e; e = _mm256_add_epi64(d, t1);
+    d = c; c = b; b = a; a = _mm256_add_epi64(t1, t2);
+  }
+  s[0]=_mm256_add_epi64(s[0], a); s[1]=_mm256_add_epi64(s[1], b);
+  s[2]=_mm256_add_epi64(s[2], c); s[3]=_mm256_add_epi64(s[3], d);
+  s[4]=_mm256_add_epi64(s[4], e); s[5]=_mm256_add_epi64(s[5], f);
+  s[6]=_mm256_add_epi64(s[6], g); s[7]=_mm256_add_epi64(s[7], hh);
+
+  uint64_t out[4];
+  for(t=0;t<8;t++) {
+    _mm256_storeu_si256((__m256i*) out, s[t]);
+    for(i=0;i<4;i++) hs[i][t] = out[i];
+  }
+  sodium_memzero(w, sizeof w);
+  sodium_memzero(out, sizeof out);
+  sodium_memzero(dummy, sizeof dummy);
+}
+
+#undef COMPRESS4_TARGET
+#undef COMPRESS4
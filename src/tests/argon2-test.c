@@ -0,0 +1,201 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* checks every Argon2id implementation supported by this cpu against
+   the RFC 9106 test vector and libsodium, and against each other for
+   more than one lane */
+
+#include <stdio.h>
+#include <string.h>
+#include <sodium.h>
+#include "../argon2.h"
+#include "../workspace.h"
+
+#define ROUNDS 20
+
+static const char *impls[] = {"avx512", "avx2", "scalar"};
+
+// RFC 9106 section 5.3
+static int test_vector(void) {
+  uint8_t pwd[32], salt[16], secret[8], ad[12], out[32];
+  const uint8_t tag[32] = {
+    0x0d, 0x64, 0x0d, 0xf5, 0x8d, 0x78, 0x76, 0x6c, 0x08, 0xc0, 0x37, 0xa3, 0x4a, 0x8b, 0x53, 0xc9,
+    0xd0, 0x1e, 0xf0, 0x45, 0x2d, 0x75, 0xb6, 0x5e, 0xb5, 0x25, 0x20, 0xe9, 0x6b, 0x01, 0xe6, 0x59
+  };
+  memset(pwd, 1, sizeof pwd);
+  memset(salt, 2, sizeof salt);
+  memset(secret, 3, sizeof secret);
+  memset(ad, 4, sizeof ad);
+  if(0!=argon2id(out, sizeof out, pwd, sizeof pwd, salt, sizeof salt,
+                 secret, sizeof secret, ad, sizeof ad, 3, 32, 4, NULL)) {
+    fprintf(stderr, "test vector failed\n");
+    return 1;
+  }
+  if(memcmp(out, tag, sizeof tag)!=0) {
+    fprintf(stderr, "test vector mismatch\n");
+    return 1;
+  }
+  return 0;
+}
+
+// a single lane against libsodium, with outputs longer than one
+// blake2b hash
+static int test_sodium(void) {
+  uint8_t pwd[64], salt[crypto_pwhash_SALTBYTES], out[200], ref[200];
+  const size_t outlen = 16 + randombytes_uniform(sizeof out - 16);
+  const uint32_t t = 1 + randombytes_uniform(3);
+  const uint32_t m = 8 + randombytes_uniform(1024);
+  randombytes_buf(pwd, sizeof pwd);
+  randombytes_buf(salt, sizeof salt);
+  if(0!=crypto_pwhash(ref, outlen, (const char*) pwd, sizeof pwd, salt, t, (size_t) m * 1024,
+                      crypto_pwhash_ALG_ARGON2ID13)) return 1;
+  if(0!=argon2id(out, outlen, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, t, m, 1, NULL)) {
+    fprintf(stderr, "argon2id failed\n");
+    return 1;
+  }
+  if(memcmp(out, ref, outlen)!=0) {
+    fprintf(stderr, "mismatch with libsodium t=%u m=%u outlen=%zu\n", t, m, outlen);
+    return 1;
+  }
+  return 0;
+}
+
+// random lane counts, the results of all implementations must be
+// the same as those of the first one
+static int test_lanes(uint8_t out[][64], const size_t round) {
+  uint8_t pwd[16], salt[16];
+  uint32_t s = (uint32_t) round;
+  const uint32_t p = 1 + s % 9, t = 1 + s % 3, m = 8*p + (s * 37) % 700;
+  memset(pwd, (int) round, sizeof pwd);
+  memset(salt, (int) round + 1, sizeof salt);
+  if(0!=argon2id(out[round], 64, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, t, m, p, NULL)) {
+    fprintf(stderr, "argon2id failed\n");
+    return 1;
+  }
+  return 0;
+}
+
+// memory of a workspace, growing it, must give the same results as
+// allocating, and be wiped afterwards
+static int test_workspace(void) {
+  const uint32_t ms[] = {64, 700, 4096, 256}, ps[] = {1, 3, 4, 2};
+  uint8_t pwd[16]={1}, salt[16]={2}, out[64], ref[64];
+  size_t i, j;
+  Opaque_Workspace *ws = opaque_workspace_new(0);
+  if(ws==NULL) return 1;
+  for(i=0;i<sizeof ms / sizeof ms[0];i++) {
+    const size_t len = argon2_memory_len(ms[i], ps[i]);
+    uint8_t *mem = opaque_workspace_acquire(ws, len);
+    if(mem==NULL || opaque_workspace_acquire(ws, len)!=NULL) {
+      fprintf(stderr, "workspace acquire failed\n");
+      opaque_workspace_free(ws);
+      return 1;
+    }
+    int ret = argon2id(out, sizeof out, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, 2, ms[i], ps[i], mem);
+    for(j=0;j<len;j++) ret |= mem[j];
+    opaque_workspace_release(ws);
+    ret |= argon2id(ref, sizeof ref, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, 2, ms[i], ps[i], NULL);
+    if(ret!=0 || memcmp(out, ref, sizeof out)!=0) {
+      fprintf(stderr, "workspace mismatch m=%u p=%u\n", ms[i], ps[i]);
+      opaque_workspace_free(ws);
+      return 1;
+    }
+  }
+  fprintf(stderr, "workspace %s ok\n", opaque_workspace_backing(ws));
+  opaque_workspace_free(ws);
+  return 0;
+}
+
+// random budgets, from single blocks to more than a slice, must give
+// the same result as a single call
+static int test_steps(const size_t round) {
+  uint8_t pwd[16], salt[16], out[64], ref[64];
+  const uint32_t p = 1 + (uint32_t) round % 5, t = 1 + (uint32_t) round % 3, m = 8*p + randombytes_uniform(600);
+  randombytes_buf(pwd, sizeof pwd);
+  randombytes_buf(salt, sizeof salt);
+  if(0!=argon2id(ref, sizeof ref, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, t, m, p, NULL)) return 1;
+  Argon2_State *st = argon2id_begin(sizeof out, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, t, m, p, NULL);
+  if(st==NULL) return 1;
+  // a step that is not done has nothing to finalize
+  if(round==0) {
+    if(argon2id_step(st, 1)!=1) return 1;
+    if(0==argon2id_final(st, out)) {
+      fprintf(stderr, "unfinished state finalized\n");
+      return 1;
+    }
+    return 0;
+  }
+  while(argon2id_step(st, randombytes_uniform(round % 2 ? 8 : m / 2))!=0);
+  if(0!=argon2id_final(st, out) || memcmp(out, ref, sizeof out)!=0) {
+    fprintf(stderr, "steps mismatch t=%u m=%u p=%u\n", t, m, p);
+    return 1;
+  }
+  return 0;
+}
+
+static int test_invalid(void) {
+  uint8_t out[64], pwd[8]={0}, salt[16]={0};
+  if(0==argon2id(out, sizeof out, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, 0, 64, 1, NULL) ||
+     0==argon2id(out, sizeof out, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, 1, 64, 0, NULL) ||
+     0==argon2id(out, sizeof out, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, 1, 15, 2, NULL) ||
+     0==argon2id(out, sizeof out, pwd, sizeof pwd, salt, 7, NULL, 0, NULL, 0, 1, 64, 1, NULL) ||
+     0==argon2id(out, 15, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, 1, 64, 1, NULL)) {
+    fprintf(stderr, "invalid parameters accepted\n");
+    return 1;
+  }
+  return 0;
+}
+
+int main(void) {
+  if(sodium_init() < 0) return 1;
+  uint8_t lanes[ROUNDS][64], ref[ROUNDS][64];
+  int have_ref = 0;
+  size_t i, r;
+  if(test_invalid() || test_workspace()) return 1;
+  // dropping an unfinished state
+  uint8_t pwd[8]={0}, salt[8]={0};
+  Argon2_State *st = argon2id_begin(32, pwd, sizeof pwd, salt, sizeof salt, NULL, 0, NULL, 0, 1, 64, 2, NULL);
+  if(st==NULL || argon2id_step(st, 10)!=1) return 1;
+  argon2id_abort(st);
+  for(i=0;i<sizeof impls / sizeof impls[0];i++) {
+    if(0!=argon2_select(impls[i])) {
+      fprintf(stderr, "%s not supported, skipping\n", impls[i]);
+      continue;
+    }
+    if(test_vector()) {
+      fprintf(stderr, "%s failed\n", impls[i]);
+      return 1;
+    }
+    for(r=0;r<ROUNDS;r++) {
+      if(test_sodium() || test_lanes(lanes, r) || test_steps(r)) {
+        fprintf(stderr, "%s failed\n", impls[i]);
+        return 1;
+      }
+    }
+    if(!have_ref) {
+      memcpy(ref, lanes, sizeof ref);
+      have_ref = 1;
+    } else if(memcmp(ref, lanes, sizeof ref)!=0) {
+      fprintf(stderr, "%s lanes mismatch\n", impls[i]);
+      return 1;
+    }
+    fprintf(stderr, "%s ok\n", impls[i]);
+  }
+  fprintf(stderr, "all ok\n");
+  return 0;
+}
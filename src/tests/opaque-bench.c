@@ -0,0 +1,835 @@
+/*
+    @copyright 2018-2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* micro benchmarks of the server side login path
+ *
+ * usage: opaque-bench [iterations [threads]]
+ *
+ * to see the number of syscalls per login run it under strace:
+ *   strace -c -f ./tests/opaque-bench 1000 1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "../opaque.h"
+#include "../common.h"
+#include "../sha512mb.h"
+#include "../ristretto.h"
+#include "../argon2.h"
+#include "../pool.h"
+#include "../workspace.h"
+
+static const uint8_t pwdU[]="simple guessable dictionary password";
+static const uint8_t context[]="opaque-bench";
+static Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+
+static uint8_t rec[OPAQUE_USER_RECORD_LEN];
+static uint8_t pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+static uint8_t setup[OPAQUE_SERVER_SETUP_LEN];
+static uint8_t rec2[OPAQUE_USER_RECORD_V2_LEN];
+static Opaque_Keyring *keyring;
+static uint8_t rec3[OPAQUE_USER_RECORD_SEEDED_LEN];
+static Opaque_OprfSeed *cached, *uncached;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  const uint64_t x=*(const uint64_t*)a, y=*(const uint64_t*)b;
+  return (x>y) - (x<y);
+}
+
+static void report(const char *name, uint64_t *samples, const size_t n) {
+  qsort(samples, n, sizeof(uint64_t), cmp_u64);
+  uint64_t sum=0;
+  size_t i;
+  for(i=0;i<n;i++) sum+=samples[i];
+  printf("%-40s n=%-6zu mean=%8.1fus p50=%8.1fus p99=%8.1fus\n", name, n,
+         (double) sum / (double) n / 1000.0,
+         (double) samples[n/2] / 1000.0,
+         (double) samples[(n*99)/100] / 1000.0);
+}
+
+static int login(void) {
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU[crypto_auth_hmacsha512_BYTES];
+  return opaque_CreateCredentialResponse(pub, rec, &ids, context, sizeof context - 1, resp, sk, authU);
+}
+
+static int login_setup(void) {
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU[crypto_auth_hmacsha512_BYTES];
+  return opaque_CreateCredentialResponseWithSetup(pub, rec, &ids, setup, resp, sk, authU);
+}
+
+static int login_v2(void) {
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU[crypto_auth_hmacsha512_BYTES];
+  return opaque_CreateCredentialResponseV2(pub, rec2, &ids, keyring, context, sizeof context - 1, resp, sk, authU);
+}
+
+static int login_seeded(Opaque_OprfSeed *oprfseed) {
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU[crypto_auth_hmacsha512_BYTES];
+  return opaque_CreateCredentialResponseSeeded(pub, rec3, &ids, keyring, oprfseed, ids.idU, ids.idU_len,
+                                               context, sizeof context - 1, resp, sk, authU);
+}
+
+static int login_seeded_cached(void) {
+  return login_seeded(cached);
+}
+
+// derives kU on every login
+static int login_seeded_uncached(void) {
+  return login_seeded(uncached);
+}
+
+static Opaque_HotCache *hotcache;
+
+// the record of a login is in the cache after the first one
+static int login_cached(void) {
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU[crypto_auth_hmacsha512_BYTES];
+  return opaque_CreateCredentialResponseCached(pub, rec, &ids, hotcache, context, sizeof context - 1, resp, sk, authU);
+}
+
+typedef struct {
+  const char *name;
+  int (*fn)(void);
+} Login;
+
+static const Login logins[] = {
+  {"CreateCredentialResponse", login},
+  {"CreateCredentialResponseWithSetup", login_setup},
+  {"CreateCredentialResponseV2", login_v2},
+  {"CreateCredentialResponseSeeded", login_seeded_cached},
+  {"CreateCredentialResponseSeeded uncached", login_seeded_uncached},
+  {"CreateCredentialResponseCached", login_cached},
+};
+
+typedef struct {
+  int (*fn)(void);
+  size_t iterations;
+  uint64_t *samples;
+  int failed;
+} Worker;
+
+static void *login_worker(void *arg) {
+  Worker *w = (Worker*) arg;
+  size_t i;
+  for(i=0;i<w->iterations;i++) {
+    const uint64_t start = now_ns();
+    if(0!=w->fn()) w->failed++;
+    w->samples[i] = now_ns() - start;
+  }
+  return NULL;
+}
+
+static int bench_login(const Login *login, const size_t iterations, const size_t threads) {
+  Worker workers[threads];
+  pthread_t tids[threads];
+  uint64_t *samples = malloc(iterations * threads * sizeof(uint64_t));
+  if(samples==NULL) return 1;
+
+  size_t i;
+  const uint64_t start = now_ns();
+  for(i=0;i<threads;i++) {
+    workers[i].fn = login->fn;
+    workers[i].iterations = iterations;
+    workers[i].samples = samples + i*iterations;
+    workers[i].failed = 0;
+    if(0!=pthread_create(&tids[i], NULL, login_worker, &workers[i])) {
+      free(samples);
+      return 1;
+    }
+  }
+  int failed = 0;
+  for(i=0;i<threads;i++) {
+    pthread_join(tids[i], NULL);
+    failed += workers[i].failed;
+  }
+  const uint64_t elapsed = now_ns() - start;
+
+  char name[64];
+  snprintf(name, sizeof name, "%s x%zu", login->name, threads);
+  report(name, samples, iterations * threads);
+  printf("%-40s %.1f logins/s, %d failed\n", "",
+         (double) (iterations * threads) * 1e9 / (double) elapsed, failed);
+  free(samples);
+  return failed!=0;
+}
+
+static Opaque_Continuations *continuations;
+static uint8_t cont_authU[crypto_auth_hmacsha512_BYTES], cont_sk[OPAQUE_SHARED_SECRETBYTES];
+
+static int continuation_seal(void) {
+  uint8_t token[OPAQUE_CONTINUATION_LEN];
+  return opaque_SealContinuation(continuations, cont_authU, cont_sk, token);
+}
+
+static int continuation_round_trip(void) {
+  uint8_t token[OPAQUE_CONTINUATION_LEN], sk[OPAQUE_SHARED_SECRETBYTES];
+  if(0!=opaque_SealContinuation(continuations, cont_authU, cont_sk, token)) return -1;
+  return opaque_UserAuthContinuation(continuations, token, cont_authU, sk);
+}
+
+// the tokens carrying a login from its response to the authentication
+// of the client, sealed, and sealed and redeemed
+static int bench_continuations(const size_t iterations, const size_t threads) {
+  static const Login fns[] = {
+    {"SealContinuation", continuation_seal},
+    {"Seal+UserAuthContinuation", continuation_round_trip},
+  };
+  size_t i;
+  int failed = 0;
+  // every redeemed token is remembered for the lifetime
+  continuations = opaque_continuations_new(NULL, 1, 60, 1 << 20);
+  if(continuations==NULL) return 1;
+  randombytes(cont_authU, sizeof cont_authU);
+  randombytes(cont_sk, sizeof cont_sk);
+  for(i=0;i<sizeof fns / sizeof fns[0] && !failed;i++) {
+    failed = bench_login(&fns[i], iterations, 1);
+    if(!failed && threads>1) failed = bench_login(&fns[i], iterations, threads);
+  }
+  opaque_continuations_free(continuations);
+  return failed;
+}
+
+// logins from a single thread submitting to the pool and reaping the
+// results on its fd, keeping depth logins in flight, the latency is
+// from the submission to the reaping
+static int bench_async(const size_t iterations, const size_t threads, const size_t depth) {
+  Opaque_Async *async = opaque_async_new(threads, depth);
+  uint64_t *samples = malloc(iterations * sizeof(uint64_t)), *started = malloc(depth * sizeof(uint64_t));
+  uint8_t (*resp)[OPAQUE_SERVER_SESSION_LEN] = malloc(depth * OPAQUE_SERVER_SESSION_LEN);
+  uint8_t (*sk)[OPAQUE_SHARED_SECRETBYTES] = malloc(depth * OPAQUE_SHARED_SECRETBYTES);
+  uint8_t (*authU)[crypto_auth_hmacsha512_BYTES] = malloc(depth * crypto_auth_hmacsha512_BYTES);
+  // the slots not in flight
+  size_t *free_slots = malloc(depth * sizeof(size_t)), nfree = depth;
+  Opaque_AsyncResult results[64];
+  size_t submitted = 0, reaped = 0, i;
+  int failed = 0;
+  if(async==NULL || samples==NULL || started==NULL || resp==NULL || sk==NULL || authU==NULL || free_slots==NULL) {
+    failed = 1;
+    goto done;
+  }
+  for(i=0;i<depth;i++) free_slots[i] = i;
+
+  const uint64_t start = now_ns();
+  while(reaped < iterations) {
+    while(submitted < iterations && nfree > 0) {
+      const size_t slot = free_slots[--nfree];
+      started[slot] = now_ns();
+      if(0!=opaque_async_CreateCredentialResponse(async, NULL, (void*) slot, pub, rec, &ids, context, sizeof context - 1,
+                                                  resp[slot], sk[slot], authU[slot])) {
+        failed = 1;
+        goto done;
+      }
+      submitted++;
+    }
+    struct pollfd pfd = {.fd = opaque_async_fd(async), .events = POLLIN};
+    poll(&pfd, 1, -1);
+    const size_t n = opaque_async_complete(async, results, sizeof results / sizeof results[0]);
+    const uint64_t now = now_ns();
+    for(i=0;i<n;i++) {
+      const size_t slot = (size_t) results[i].user;
+      if(results[i].ret!=0) failed++;
+      samples[reaped++] = now - started[slot];
+      free_slots[nfree++] = slot;
+    }
+  }
+  const uint64_t elapsed = now_ns() - start;
+
+  char name[64];
+  snprintf(name, sizeof name, "async x%zu depth %zu", threads, depth);
+  report(name, samples, iterations);
+  printf("%-40s %.1f logins/s, %d failed\n", "", (double) iterations * 1e9 / (double) elapsed, failed);
+done:
+  opaque_async_free(async);
+  free(samples);
+  free(started);
+  free(resp);
+  free(sk);
+  free(authU);
+  free(free_slots);
+  return failed!=0;
+}
+
+// median cpu cycles of one call, on x86 only
+static void bench_cycles(const Login *login, const size_t iterations) {
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t *samples = malloc(iterations * sizeof(uint64_t));
+  if(samples==NULL) return;
+  size_t i;
+  for(i=0;i<iterations;i++) {
+    const uint64_t start = __rdtsc();
+    login->fn();
+    samples[i] = __rdtsc() - start;
+  }
+  qsort(samples, iterations, sizeof(uint64_t), cmp_u64);
+  char name[64];
+  snprintf(name, sizeof name, "%s cycles", login->name);
+  printf("%-40s p50=%8.1fk p99=%8.1fk\n", name,
+         (double) samples[iterations/2] / 1000.0,
+         (double) samples[(iterations*99)/100] / 1000.0);
+  free(samples);
+#else
+  (void) login;
+  (void) iterations;
+#endif
+}
+
+// logins/s and cycles of the server with each ristretto255 backend
+static int bench_backends(const size_t iterations) {
+  static const char *backends[] = {"sodium", "ref51", "avx2", "avx512"};
+  const char *selected = ristretto_backend();
+  char name[64];
+  size_t i;
+  for(i=0;i<sizeof backends / sizeof backends[0];i++) {
+    if(0!=ristretto_select(backends[i])) {
+      printf("%-40s not supported\n", backends[i]);
+      continue;
+    }
+    snprintf(name, sizeof name, "WithSetup ristretto=%s", backends[i]);
+    const Login l = {name, login_setup};
+    if(bench_login(&l, iterations, 1)) return 1;
+    bench_cycles(&l, iterations);
+  }
+  ristretto_select(selected);
+  return 0;
+}
+
+// throughput of opaque_CreateCredentialResponseBatch for batch sizes
+// 1..256, compare with the logins/s of the scalar path above
+static int bench_batch(const size_t iterations) {
+  const size_t max = 256;
+  uint8_t *pubs = malloc(max * OPAQUE_USER_SESSION_PUBLIC_LEN);
+  uint8_t *recs = malloc(max * OPAQUE_USER_RECORD_LEN);
+  uint8_t *resps = malloc(max * OPAQUE_SERVER_SESSION_LEN);
+  uint8_t *sks = malloc(max * OPAQUE_SHARED_SECRETBYTES);
+  uint8_t *authUs = malloc(max * crypto_auth_hmacsha512_BYTES);
+  Opaque_Ids *bids = malloc(max * sizeof(Opaque_Ids));
+  int failed = 0;
+  if(pubs==NULL || recs==NULL || resps==NULL || sks==NULL || authUs==NULL || bids==NULL) {
+    failed = 1;
+    goto out;
+  }
+  size_t i;
+  for(i=0;i<max;i++) {
+    memcpy(pubs + i*OPAQUE_USER_SESSION_PUBLIC_LEN, pub, sizeof pub);
+    memcpy(recs + i*OPAQUE_USER_RECORD_LEN, rec, sizeof rec);
+    bids[i] = ids;
+  }
+
+  size_t n;
+  for(n=1;n<=max;n*=4) {
+    const size_t rounds = (iterations + n - 1) / n;
+    const uint64_t start = now_ns();
+    for(i=0;i<rounds;i++) {
+      if(0!=opaque_CreateCredentialResponseBatch(n, pubs, recs, bids, context, sizeof context - 1,
+                                                 resps, sks, authUs, NULL)) failed++;
+    }
+    const uint64_t elapsed = now_ns() - start;
+    char name[64];
+    snprintf(name, sizeof name, "CreateCredentialResponseBatch n=%zu", n);
+    printf("%-40s %.1f logins/s, %d failed\n", name,
+           (double) (rounds * n) * 1e9 / (double) elapsed, failed);
+  }
+
+out:
+  free(pubs); free(recs); free(resps); free(sks); free(authUs); free(bids);
+  return failed!=0;
+}
+
+// cost of one hmac-sha512 over a typical hkdf label, when computed
+// with libsodium and in parallel lanes of the multi-buffer engine
+static void bench_hmac(const size_t iterations) {
+  uint8_t key[64], msg[SHA512MB_MAX_LANES][91], out[SHA512MB_MAX_LANES][crypto_auth_hmacsha512_BYTES];
+  const uint8_t *keys[SHA512MB_MAX_LANES], *in[SHA512MB_MAX_LANES];
+  size_t inlen[SHA512MB_MAX_LANES];
+  uint8_t *optr[SHA512MB_MAX_LANES];
+  size_t i, n;
+  randombytes(key, sizeof key);
+  randombytes((uint8_t*) msg, sizeof msg);
+  for(i=0;i<SHA512MB_MAX_LANES;i++) {
+    keys[i] = key;
+    in[i] = msg[i];
+    inlen[i] = sizeof msg[i];
+    optr[i] = out[i];
+  }
+  const size_t rounds = iterations * 100;
+
+  uint64_t start = now_ns();
+  for(i=0;i<rounds;i++) {
+    crypto_auth_hmacsha512_state st;
+    crypto_auth_hmacsha512_init(&st, key, sizeof key);
+    crypto_auth_hmacsha512_update(&st, msg[0], sizeof msg[0]);
+    crypto_auth_hmacsha512_final(&st, out[0]);
+  }
+  printf("%-40s %8.1fns/hmac\n", "hmacsha512 libsodium", (double) (now_ns() - start) / (double) rounds);
+
+  char name[64];
+  for(n=1;n<=SHA512MB_MAX_LANES;n*=2) {
+    start = now_ns();
+    for(i=0;i<rounds/n;i++) sha512mb_hmac(n, keys, sizeof key, in, inlen, optr);
+    snprintf(name, sizeof name, "hmacsha512 %s x%zu", sha512mb_impl(), n);
+    printf("%-40s %8.1fns/hmac\n", name, (double) (now_ns() - start) / (double) ((rounds/n)*n));
+  }
+}
+
+// wall time of the Argon2id hardening of the client (t=2, 64MB) for
+// growing lane counts with each block mixing implementation, and the
+// memory the lanes could fill in the time libsodium needs for one lane
+static void bench_argon2(void) {
+  static const char *impls[] = {"scalar", "avx2", "avx512"};
+  const char *selected = argon2_impl();
+  const uint32_t t = 2, m = 65536;
+  const size_t rounds = 5;
+  uint8_t out[64], y[64], salt[crypto_pwhash_SALTBYTES]={0};
+  uint64_t samples[5];
+  char name[64];
+  size_t i, j;
+  uint32_t p;
+  randombytes(y, sizeof y);
+
+  for(j=0;j<rounds;j++) {
+    const uint64_t start = now_ns();
+    if(0!=crypto_pwhash(out, sizeof out, (const char*) y, sizeof y, salt, t, (size_t) m * 1024,
+                        crypto_pwhash_ALG_ARGON2ID13)) return;
+    samples[j] = now_ns() - start;
+  }
+  report("argon2id libsodium p=1", samples, rounds);
+  const uint64_t sodium = samples[rounds/2];
+
+  printf("argon2id lanes on %zu threads\n", opaque_pool_threads());
+  for(i=0;i<sizeof impls / sizeof impls[0];i++) {
+    if(0!=argon2_select(impls[i])) {
+      printf("%-40s not supported\n", impls[i]);
+      continue;
+    }
+    for(p=1;p<=16;p*=2) {
+      for(j=0;j<rounds;j++) {
+        const uint64_t start = now_ns();
+        if(0!=argon2id(out, sizeof out, y, sizeof y, salt, sizeof salt, NULL, 0, NULL, 0, t, m, p, NULL)) return;
+        samples[j] = now_ns() - start;
+      }
+      snprintf(name, sizeof name, "argon2id %s p=%u", impls[i], p);
+      report(name, samples, rounds);
+      printf("%-40s m=%.0fMB at the wall time of libsodium\n", "",
+             (double) m / 1024.0 * (double) sodium / (double) samples[rounds/2]);
+    }
+  }
+  argon2_select(selected);
+}
+
+// counts the data TLB misses of this thread in user space, -1 if perf
+// events are not available
+static int dtlb_open(void) {
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.size = sizeof attr;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+static uint64_t dtlb_read(const int fd) {
+  uint64_t n = 0;
+#ifdef __linux__
+  if(fd<0 || read(fd, &n, sizeof n)!=sizeof n) return 0;
+#endif
+  return n;
+}
+
+static uint64_t minflt(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (uint64_t) ru.ru_minflt;
+}
+
+// opaque_Register with the default KSF (Argon2id t=2, 64MB), with the
+// memory allocated by each call and with a reused workspace: wall
+// time, page faults and data TLB misses per registration
+static int bench_workspace(void) {
+  const size_t rounds = 10;
+  uint8_t r[OPAQUE_USER_RECORD_LEN];
+  uint64_t samples[10];
+  char name[64];
+  size_t i, j;
+  const int fd = dtlb_open();
+  Opaque_Workspace *ws = opaque_workspace_new(65536);
+  if(ws==NULL) {
+    fprintf(stderr, "opaque_workspace_new failed.\n");
+    return 1;
+  }
+  for(i=0;i<2;i++) {
+    const Opaque_KSF ksf = {.alg=OPAQUE_KSF_ARGON2ID, .parallelism=1, .ops=2, .mem=65536,
+                            .workspace = i ? ws : NULL};
+    const uint64_t faults = minflt(), misses = dtlb_read(fd);
+    for(j=0;j<rounds;j++) {
+      const uint64_t start = now_ns();
+      if(0!=opaque_Register(pwdU, sizeof pwdU - 1, NULL, &ids, &ksf, r, NULL)) {
+        fprintf(stderr, "opaque_Register failed.\n");
+        opaque_workspace_free(ws);
+        return 1;
+      }
+      samples[j] = now_ns() - start;
+    }
+    const double f = (double) (minflt() - faults) / (double) rounds;
+    const double m = (double) (dtlb_read(fd) - misses) / (double) rounds;
+    snprintf(name, sizeof name, "register workspace=%s", i ? opaque_workspace_backing(ws) : "none");
+    report(name, samples, rounds);
+    if(fd<0) printf("%-40s %8.0f page faults/call, dTLB misses n/a\n", "", f);
+    else printf("%-40s %8.0f page faults/call %10.0f dTLB misses/call\n", "", f, m);
+  }
+#ifdef __linux__
+  if(fd>=0) close(fd);
+#endif
+  opaque_workspace_free(ws);
+  return 0;
+}
+
+// full logins, request to UserAuth, with the default KSF and a
+// hardened password cache: purged before every login (cold) and kept
+// (warm)
+static int bench_rwdcache(void) {
+  const size_t rounds = 10;
+  uint8_t s[OPAQUE_USER_SESSION_SECRET_LEN+sizeof pwdU - 1], p[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN], sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  uint64_t samples[10];
+  size_t i, j;
+  Opaque_RwdCache *cache = opaque_rwdcache_new(16, 3600);
+  if(cache==NULL) {
+    fprintf(stderr, "opaque_rwdcache_new failed.\n");
+    return 1;
+  }
+  const Opaque_KSF ksf = {.alg=OPAQUE_KSF_ARGON2ID, .parallelism=1, .ops=2, .mem=65536, .cache=cache};
+  for(i=0;i<2;i++) {
+    for(j=0;j<rounds;j++) {
+      if(i==0) opaque_rwdcache_purge(cache);
+      const uint64_t start = now_ns();
+      if(0!=opaque_CreateCredentialRequest(pwdU, sizeof pwdU - 1, s, p) ||
+         0!=opaque_CreateCredentialResponse(p, rec, &ids, context, sizeof context - 1, resp, sk, authU0) ||
+         0!=opaque_RecoverCredentials(resp, s, context, sizeof context - 1, &ids, &ksf, pk, authU1, NULL) ||
+         0!=opaque_UserAuth(authU0, authU1)) {
+        fprintf(stderr, "login failed.\n");
+        opaque_rwdcache_free(cache);
+        return 1;
+      }
+      samples[j] = now_ns() - start;
+    }
+    report(i ? "login rwdcache warm" : "login rwdcache cold", samples, rounds);
+  }
+  opaque_rwdcache_free(cache);
+  return 0;
+}
+
+// the server side of a resumption, opaque_CreateResumptionResponse,
+// with and without the ephemeral dh, to compare with the
+// CreateCredentialResponse of a full login above
+static int bench_resumption(const size_t iterations) {
+  const size_t req_len = OPAQUE_RESUME_REQUEST_LEN+OPAQUE_TICKET_LEN+4;
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], rs[OPAQUE_RESUMPTION_SECRETBYTES];
+  uint8_t ticket[OPAQUE_TICKET_LEN+4], rsec[OPAQUE_RESUME_SECRET_LEN], resp[OPAQUE_RESUME_RESPONSE_LEN];
+  uint8_t authU[crypto_auth_hmacsha512_BYTES], idU[4];
+  size_t i, j;
+  int failed = 0;
+  uint8_t *reqs = malloc(iterations * req_len);
+  uint64_t *samples = malloc(iterations * sizeof(uint64_t));
+  Opaque_Tickets *tickets = opaque_tickets_new(NULL, 3600, 2*iterations);
+  if(reqs==NULL || samples==NULL || tickets==NULL) {
+    free(reqs);
+    free(samples);
+    opaque_tickets_free(tickets);
+    return 1;
+  }
+  randombytes(sk, sizeof sk);
+  opaque_ResumptionSecret(sk, rs);
+  for(i=0;i<2;i++) {
+    for(j=0;j<iterations;j++) {
+      if(0!=opaque_IssueTicket(tickets, sk, ids.idU, ids.idU_len, ticket) ||
+         0!=opaque_CreateResumptionRequest(ticket, sizeof ticket, rs, i==0, rsec, reqs + j*req_len)) failed++;
+    }
+    for(j=0;j<iterations;j++) {
+      const uint64_t start = now_ns();
+      if(0!=opaque_CreateResumptionResponse(tickets, reqs + j*req_len, req_len, context, sizeof context - 1,
+                                            resp, sk, authU, idU)) failed++;
+      samples[j] = now_ns() - start;
+    }
+    report(i==0 ? "CreateResumptionResponse dh" : "CreateResumptionResponse psk", samples, iterations);
+  }
+  free(reqs);
+  free(samples);
+  opaque_tickets_free(tickets);
+  if(failed) fprintf(stderr, "%d resumptions failed.\n", failed);
+  return failed!=0;
+}
+
+// the reads from the OS per server response and per registration,
+// each a getrandom() syscall with libsodiums default randombytes, with
+// and without the per-thread generator. Requests would be one read
+// each without it, OPAQUE_DRBG=off does exactly that.
+static int bench_random(const size_t iterations) {
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  uint8_t r[OPAQUE_USER_RECORD_LEN];
+  uint64_t requests0, reads0, requests1, reads1;
+  size_t i, j;
+  int failed = 0;
+  for(i=0;i<2;i++) {
+    opaque_random_stats(&requests0, &reads0);
+    for(j=0;j<iterations;j++) {
+      if(0!=(i==0 ? login() : opaque_Register(pwdU, sizeof pwdU - 1, NULL, &ids, &identity, r, NULL))) failed++;
+    }
+    opaque_random_stats(&requests1, &reads1);
+    printf("%-40s %.2f random requests, %.4f os reads per call\n",
+           i==0 ? "CreateCredentialResponse" : "Register",
+           (double) (requests1 - requests0) / (double) iterations,
+           (double) (reads1 - reads0) / (double) iterations);
+  }
+  if(failed) fprintf(stderr, "%d calls failed.\n", failed);
+  return failed!=0;
+}
+
+// the kU of a seeded record, derived and taken from the cache, and a
+// fake record for an unknown user
+static int bench_oprfseed(const size_t iterations) {
+  uint8_t r[OPAQUE_USER_RECORD_LEN], fake[OPAQUE_USER_RECORD_SEEDED_LEN];
+  uint64_t *samples = malloc(iterations * sizeof(uint64_t));
+  size_t i, j;
+  int failed = 0;
+  if(samples==NULL) return 1;
+  for(i=0;i<3;i++) {
+    for(j=0;j<iterations;j++) {
+      const uint64_t start = now_ns();
+      if(i<2) {
+        if(0!=opaque_UserRecordFromSeeded(keyring, i==0 ? uncached : cached, ids.idU, ids.idU_len, rec3, r)) failed++;
+      } else {
+        if(0!=opaque_FakeUserRecordSeeded(cached, 1, ids.idS, ids.idS_len, fake)) failed++;
+      }
+      samples[j] = now_ns() - start;
+    }
+    report(i==0 ? "UserRecordFromSeeded uncached" : (i==1 ? "UserRecordFromSeeded" : "FakeUserRecordSeeded"),
+           samples, iterations);
+  }
+  free(samples);
+  if(failed) fprintf(stderr, "%d calls failed.\n", failed);
+  return failed!=0;
+}
+
+// the client side of a login without key stretching: a request and
+// the recovery of its response, once computing everything when the
+// password is entered and once with the password independent values
+// precomputed before
+// the latency of logins from the record cache and of logins that
+// missed it, every other login evicts the record first
+static int bench_hotcache(const size_t iterations) {
+  Opaque_HotCacheStats stats;
+  size_t i;
+  int failed = 0;
+  opaque_hotcache_purge(hotcache);
+  for(i=0;i<2*iterations;i++) {
+    if(i%2==0) opaque_hotcache_evict(hotcache, rec);
+    if(0!=login_cached()) failed++;
+  }
+  // the counters include the logins of the benchmarks before
+  opaque_hotcache_stats(hotcache, &stats);
+  printf("%-40s %.1f%% of %" PRIu64 " logins, hit mean=%8.1fus miss mean=%8.1fus\n", "record cache hits",
+         100.0 * (double) stats.hits / (double) (stats.hits + stats.misses), stats.hits + stats.misses,
+         (double) stats.hit_ns / (double) stats.hits / 1e3, (double) stats.miss_ns / (double) stats.misses / 1e3);
+  if(failed) fprintf(stderr, "%d calls failed.\n", failed);
+  return failed!=0;
+}
+
+static int bench_precompute(const size_t iterations) {
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  uint8_t r[OPAQUE_USER_RECORD_LEN], p[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t s[OPAQUE_USER_SESSION_SECRET_LEN+sizeof pwdU - 1], resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], authU[crypto_auth_hmacsha512_BYTES];
+  uint8_t *pre = malloc(iterations * OPAQUE_USER_PRECOMPUTED_LEN);
+  uint64_t *samples = malloc(iterations * sizeof(uint64_t));
+  uint64_t *precomp = malloc(iterations * sizeof(uint64_t));
+  size_t i, j;
+  int failed = 0;
+  if(pre==NULL || samples==NULL || precomp==NULL ||
+     0!=opaque_Register(pwdU, sizeof pwdU - 1, NULL, &ids, &identity, r, NULL)) {
+    free(pre);
+    free(samples);
+    free(precomp);
+    return 1;
+  }
+  for(i=0;i<2;i++) {
+    for(j=0;j<iterations;j++) {
+      uint8_t *pj = pre + j*OPAQUE_USER_PRECOMPUTED_LEN;
+      uint64_t start = now_ns();
+      if(i==1 && 0!=opaque_PrecomputeCredentialRequest(pj)) failed++;
+      precomp[j] = now_ns() - start;
+      start = now_ns();
+      if(0!=(i==0 ? opaque_CreateCredentialRequest(pwdU, sizeof pwdU - 1, s, p)
+                  : opaque_CreateCredentialRequestPrecomputed(pj, pwdU, sizeof pwdU - 1, s, p))) failed++;
+      uint64_t elapsed = now_ns() - start;
+      if(0!=opaque_CreateCredentialResponse(p, r, &ids, context, sizeof context - 1, resp, sk, authU)) failed++;
+      start = now_ns();
+      if(0!=opaque_RecoverCredentials(resp, s, context, sizeof context - 1, &ids, &identity, sk, authU, NULL)) failed++;
+      samples[j] = elapsed + now_ns() - start;
+    }
+    report(i==0 ? "client login" : "client login precomputed", samples, iterations);
+  }
+  report("PrecomputeCredentialRequest", precomp, iterations);
+  free(pre);
+  free(samples);
+  free(precomp);
+  if(failed) fprintf(stderr, "%d logins failed.\n", failed);
+  return failed!=0;
+}
+
+// bursts of logins with idle pauses between them, once generating the
+// keyshares in the response and once taking them from the queue that
+// a background thread refills during the pauses
+static int bench_keyshares(const size_t iterations) {
+  const size_t burst = 64;
+  uint64_t *samples = malloc(iterations * sizeof(uint64_t));
+  size_t i, j;
+  int failed = 0;
+  if(samples==NULL) return 1;
+  for(i=0;i<2;i++) {
+    if(i==1 && 0!=opaque_keyshares_start(2*burst, 1)) {
+      free(samples);
+      return 1;
+    }
+    for(j=0;j<iterations;j++) {
+      if(j%burst==0) usleep(20000);
+      const uint64_t start = now_ns();
+      if(0!=login_setup()) failed++;
+      samples[j] = now_ns() - start;
+    }
+    report(i==0 ? "bursts without keyshare queue" : "bursts with keyshare queue", samples, iterations);
+  }
+  opaque_keyshares_stop();
+  free(samples);
+  if(failed) fprintf(stderr, "%d logins failed.\n", failed);
+  return failed!=0;
+}
+
+int main(int argc, char **argv) {
+  const size_t iterations = (argc>1) ? strtoul(argv[1], NULL, 10) : 1000;
+  const size_t threads = (argc>2) ? strtoul(argv[2], NULL, 10) : 1;
+  if(iterations==0 || threads==0) {
+    fprintf(stderr, "usage: %s [iterations [threads]]\n", argv[0]);
+    return 1;
+  }
+
+  uint8_t skS[crypto_scalarmult_SCALARBYTES];
+  randombytes(skS, sizeof skS);
+  if(0!=opaque_CreateServerSetup(skS, context, sizeof context - 1, setup)) {
+    fprintf(stderr, "opaque_CreateServerSetup failed.\n");
+    return 1;
+  }
+  uint8_t export_key[crypto_hash_sha512_BYTES];
+  if(0!=opaque_Register(pwdU, sizeof pwdU - 1, skS, &ids, NULL, rec, export_key)) {
+    fprintf(stderr, "opaque_Register failed.\n");
+    return 1;
+  }
+  keyring = opaque_keyring_new(1);
+  if(keyring==NULL || 0!=opaque_keyring_add(keyring, 1, skS) || 0!=opaque_UserRecordToV2(keyring, rec, rec2)) {
+    fprintf(stderr, "opaque_UserRecordToV2 failed.\n");
+    return 1;
+  }
+  uint8_t rec1[OPAQUE_USER_RECORD_LEN];
+  hotcache = opaque_hotcache_new(1024, threads);
+  if(hotcache==NULL) {
+    fprintf(stderr, "opaque_hotcache_new failed.\n");
+    return 1;
+  }
+  cached = opaque_oprfseed_new(NULL, 1024);
+  uncached = opaque_oprfseed_new(NULL, 0);
+  if(cached==NULL || uncached==NULL ||
+     0!=opaque_RegisterSeeded(pwdU, sizeof pwdU - 1, skS, cached, ids.idU, ids.idU_len, &ids, NULL, rec1, export_key) ||
+     0!=opaque_UserRecordToSeeded(keyring, cached, ids.idU, ids.idU_len, rec1, rec3)) {
+    fprintf(stderr, "opaque_UserRecordToSeeded failed.\n");
+    return 1;
+  }
+  // the records of a million users, as stored and as cached in memory
+  printf("%-40s %d bytes, %.1f MiB per million users\n", "record",
+         OPAQUE_USER_RECORD_LEN, OPAQUE_USER_RECORD_LEN * 1e6 / (1 << 20));
+  printf("%-40s %d bytes, %.1f MiB per million users\n", "record v2",
+         OPAQUE_USER_RECORD_V2_LEN, OPAQUE_USER_RECORD_V2_LEN * 1e6 / (1 << 20));
+  printf("%-40s %d bytes, %.1f MiB per million users\n", "record seeded",
+         OPAQUE_USER_RECORD_SEEDED_LEN, OPAQUE_USER_RECORD_SEEDED_LEN * 1e6 / (1 << 20));
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+sizeof pwdU - 1];
+  if(0!=opaque_CreateCredentialRequest(pwdU, sizeof pwdU - 1, sec, pub)) {
+    fprintf(stderr, "opaque_CreateCredentialRequest failed.\n");
+    return 1;
+  }
+
+  size_t i;
+  for(i=0;i<sizeof logins / sizeof logins[0];i++) {
+    if(bench_login(&logins[i], iterations, 1)) return 1;
+    if(threads>1 && bench_login(&logins[i], iterations, threads)) return 1;
+  }
+  for(i=0;i<sizeof logins / sizeof logins[0];i++) bench_cycles(&logins[i], iterations);
+  if(bench_continuations(iterations, threads)) return 1;
+  if(bench_async(iterations, threads, 1) || bench_async(iterations, threads, 64)) return 1;
+  if(bench_keyshares(iterations)) return 1;
+  if(bench_hotcache(iterations)) return 1;
+  if(bench_precompute(iterations)) return 1;
+  if(bench_random(iterations)) return 1;
+  if(bench_oprfseed(iterations)) return 1;
+  if(bench_resumption(iterations)) return 1;
+  if(bench_backends(iterations)) return 1;
+  if(bench_batch(iterations)) return 1;
+  bench_hmac(iterations);
+  bench_argon2();
+  if(bench_workspace()) return 1;
+  if(bench_rwdcache()) return 1;
+  opaque_keyring_free(keyring);
+  opaque_oprfseed_free(cached);
+  opaque_oprfseed_free(uncached);
+  opaque_hotcache_free(hotcache);
+
+  return 0;
+}
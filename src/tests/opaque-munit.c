@@ -103,7 +103,7 @@ MunitResult opaque_test(const MunitParameter params[], void* user_data_or_fixtur
   if(type==ServerInit || type==Server1kInit) {
     // register user
     fprintf(stderr,"\nopaque_Register\n");
-    if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, rec, export_key)) {
+    if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, NULL, rec, export_key)) {
       fprintf(stderr,"opaque_Register failed.\n");
       return MUNIT_FAIL;
     }
@@ -124,7 +124,7 @@ MunitResult opaque_test(const MunitParameter params[], void* user_data_or_fixtur
     // user commits its secrets
     fprintf(stderr,"\nopaque_FinalizeRequest\n");
     unsigned char rrec[OPAQUE_REGISTRATION_RECORD_LEN]={0};
-    if(0!=opaque_FinalizeRequest(usr_ctx, rpub, &ids, rrec, export_key)) {
+    if(0!=opaque_FinalizeRequest(usr_ctx, rpub, &ids, NULL, rrec, export_key)) {
       fprintf(stderr,"opaque_FinalizeRequest failed.\n");
       return MUNIT_FAIL;
     }
@@ -142,7 +142,7 @@ MunitResult opaque_test(const MunitParameter params[], void* user_data_or_fixtur
   }
   fprintf(stderr,"\nopaque_RecoverCredentials\n");
 
-  if(0!=opaque_RecoverCredentials(resp, sec, (uint8_t*)"munit", 5, &ids, pk, authU, export_key)) {
+  if(0!=opaque_RecoverCredentials(resp, sec, (uint8_t*)"munit", 5, &ids, NULL, pk, authU, export_key)) {
     fprintf(stderr,"opaque_RecoverCredentials failed.\n");
     return MUNIT_FAIL;
   }
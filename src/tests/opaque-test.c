@@ -17,9 +17,890 @@
 */
 
 #include <stdio.h>
+#include <time.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include "../opaque.h"
 #include "../common.h"
+#include "../keyshares.h"
+
+// registers with ksf, once privately and once with opaque_Register,
+// and logs in with ksf and with other
+static int test_ksf(const Opaque_KSF *ksf, const Opaque_KSF *other) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  uint8_t usr_ctx[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len], M[crypto_core_ristretto255_BYTES];
+  uint8_t rsec[OPAQUE_REGISTER_SECRET_LEN], rpub[OPAQUE_REGISTER_PUBLIC_LEN];
+  uint8_t rrec[OPAQUE_REGISTRATION_RECORD_LEN], rec[2][OPAQUE_USER_RECORD_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  uint8_t export_key[crypto_hash_sha512_BYTES], export_key0[crypto_hash_sha512_BYTES];
+  int i;
+
+  if(0!=opaque_CreateRegistrationRequest(pwdU, pwdU_len, usr_ctx, M)) return 1;
+  if(0!=opaque_CreateRegistrationResponse(M, NULL, rsec, rpub)) return 1;
+  if(0!=opaque_FinalizeRequest(usr_ctx, rpub, &ids, ksf, rrec, export_key0)) return 1;
+  opaque_StoreUserRecord(rsec, rrec, rec[0]);
+  if(0!=opaque_Register(pwdU, pwdU_len, NULL, &ids, ksf, rec[1], export_key0)) return 1;
+
+  for(i=0;i<2;i++) {
+    opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+    if(0!=opaque_CreateCredentialResponse(pub, rec[i], &ids, context, sizeof context, resp, sk, authU0)) return 1;
+    if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, ksf, pk, authU1, export_key)) return 1;
+    if(sodium_memcmp(sk,pk,sizeof sk)!=0) return 1;
+    if(i==1 && memcmp(export_key, export_key0, sizeof export_key)!=0) return 1;
+    // a password registered with one KSF cannot be recovered with another
+    opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+    if(0!=opaque_CreateCredentialResponse(pub, rec[i], &ids, context, sizeof context, resp, sk, authU0)) return 1;
+    if(0==opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, other, pk, authU1, export_key)) return 1;
+  }
+  return 0;
+}
+
+// runs opaque_stretch_step() until it is done, returns the number of steps
+static int run_steps(Opaque_Stretch *st, const uint32_t budget) {
+  int steps = 0, ret;
+  while((ret=opaque_stretch_step(st, budget))==OPAQUE_STRETCH_MORE) steps++;
+  return (ret==OPAQUE_STRETCH_DONE) ? steps + 1 : -1;
+}
+
+typedef struct {
+  Opaque_Stretch *st;
+  uint32_t budget;
+  int steps;
+} StepsArg;
+
+static void *steps_thread(void *arg) {
+  StepsArg *a = (StepsArg*) arg;
+  a->steps = run_steps(a->st, a->budget);
+  return NULL;
+}
+
+// registers and logs in with the Begin/step/Finish functions, and
+// checks them against the functions doing it all at once
+static int test_steps(const Opaque_KSF *ksf, const uint32_t budget) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  uint8_t usr_ctx[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len], M[crypto_core_ristretto255_BYTES];
+  uint8_t rsec[OPAQUE_REGISTER_SECRET_LEN], rpub[OPAQUE_REGISTER_PUBLIC_LEN];
+  uint8_t rrec[OPAQUE_REGISTRATION_RECORD_LEN], rec[OPAQUE_USER_RECORD_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES], pk0[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  uint8_t export_key[crypto_hash_sha512_BYTES], export_key0[crypto_hash_sha512_BYTES];
+  Opaque_Stretch *st;
+
+  if(0!=opaque_CreateRegistrationRequest(pwdU, pwdU_len, usr_ctx, M)) return 1;
+  if(0!=opaque_CreateRegistrationResponse(M, NULL, rsec, rpub)) return 1;
+  // the steps run on another thread than Begin and Finish, like an
+  // event loop handing the state between its threads
+  if(NULL==(st=opaque_FinalizeRequestBegin(usr_ctx, rpub, ksf))) return 1;
+  StepsArg arg = {st, budget, -1};
+  pthread_t tid;
+  if(0!=pthread_create(&tid, NULL, steps_thread, &arg)) return 1;
+  pthread_join(tid, NULL);
+  if(arg.steps < 1) return 1;
+  if(0!=opaque_FinalizeRequestFinish(st, rpub, &ids, rrec, export_key0)) return 1;
+  opaque_StoreUserRecord(rsec, rrec, rec);
+
+  opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+  if(0!=opaque_CreateCredentialResponse(pub, rec, &ids, context, sizeof context, resp, sk, authU0)) return 1;
+  if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, ksf, pk0, authU1, export_key)) return 1;
+  if(sodium_memcmp(sk,pk0,sizeof sk)!=0) return 1;
+  if(memcmp(export_key, export_key0, sizeof export_key)!=0) return 1;
+
+  if(NULL==(st=opaque_RecoverCredentialsBegin(resp, sec, ksf))) return 1;
+  const int steps = run_steps(st, budget);
+  if(steps < 1) return 1;
+  if(0!=opaque_RecoverCredentialsFinish(st, resp, sec, context, sizeof context, &ids, pk, authU1, export_key)) return 1;
+  if(sodium_memcmp(pk,pk0,sizeof pk)!=0) return 1;
+  if(0!=opaque_UserAuth(authU0, authU1)) return 1;
+  if(memcmp(export_key, export_key0, sizeof export_key)!=0) return 1;
+  fprintf(stderr, "%d steps of %u blocks\n", steps, budget);
+
+  // stale logins are cancelled, unfinished ones cannot be finished
+  if(NULL==(st=opaque_RecoverCredentialsBegin(resp, sec, ksf))) return 1;
+  opaque_stretch_step(st, budget);
+  opaque_stretch_cancel(st);
+  if(steps > 1) {
+    if(NULL==(st=opaque_RecoverCredentialsBegin(resp, sec, ksf))) return 1;
+    if(opaque_stretch_step(st, budget)!=OPAQUE_STRETCH_MORE) return 1;
+    if(0==opaque_RecoverCredentialsFinish(st, resp, sec, context, sizeof context, &ids, pk, authU1, NULL)) return 1;
+  }
+  return 0;
+}
+
+// logs in with a cache, a hit is told by the key stretching being done
+// in a single step of one block
+static int test_rwdcache(void) {
+  const uint8_t pwdU[]="asdf", badU[]="asdg";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  uint8_t rec[OPAQUE_USER_RECORD_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  uint8_t export_key[crypto_hash_sha512_BYTES], export_key0[crypto_hash_sha512_BYTES];
+  Opaque_RwdCache *cache = opaque_rwdcache_new(2, 60);
+  Opaque_KSF ksf={.alg=OPAQUE_KSF_ARGON2ID, .parallelism=1, .ops=1, .mem=1024, .cache=cache};
+  const Opaque_KSF other={.alg=OPAQUE_KSF_ARGON2ID, .parallelism=1, .ops=2, .mem=1024, .cache=cache};
+  Opaque_Stretch *st;
+  int i, ret = 1;
+
+  if(cache==NULL || NULL!=opaque_rwdcache_new(0, 60) || NULL!=opaque_rwdcache_new(2, 0)) goto done;
+  ksf.cache=NULL;
+  if(0!=opaque_Register(pwdU, pwdU_len, NULL, &ids, &ksf, rec, export_key0)) goto done;
+  ksf.cache=cache;
+  // cold, warm, and warm again in steps
+  for(i=0;i<3;i++) {
+    opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+    if(0!=opaque_CreateCredentialResponse(pub, rec, &ids, context, sizeof context, resp, sk, authU0)) goto done;
+    if(NULL==(st=opaque_RecoverCredentialsBegin(resp, sec, &ksf))) goto done;
+    if(opaque_stretch_step(st, 1)!=(i==0 ? OPAQUE_STRETCH_MORE : OPAQUE_STRETCH_DONE)) {
+      opaque_stretch_cancel(st);
+      goto done;
+    }
+    if(i==2) {
+      if(0!=opaque_RecoverCredentialsFinish(st, resp, sec, context, sizeof context, &ids, pk, authU1, export_key)) goto done;
+    } else {
+      opaque_stretch_cancel(st);
+      if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &ksf, pk, authU1, export_key)) goto done;
+    }
+    if(sodium_memcmp(sk,pk,sizeof sk)!=0 || 0!=opaque_UserAuth(authU0, authU1)) goto done;
+    if(memcmp(export_key, export_key0, sizeof export_key)!=0) goto done;
+  }
+  // wrong passwords and other parameters miss, and still fail
+  opaque_CreateCredentialRequest(badU, pwdU_len, sec, pub);
+  if(0!=opaque_CreateCredentialResponse(pub, rec, &ids, context, sizeof context, resp, sk, authU0)) goto done;
+  for(i=0;i<2;i++) {
+    if(0==opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &ksf, pk, authU1, NULL)) goto done;
+  }
+  opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+  if(0!=opaque_CreateCredentialResponse(pub, rec, &ids, context, sizeof context, resp, sk, authU0)) goto done;
+  if(0==opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &other, pk, authU1, NULL)) goto done;
+  // failed logins are not stored, the right one is still there
+  if(NULL==(st=opaque_RecoverCredentialsBegin(resp, sec, &ksf))) goto done;
+  i = opaque_stretch_step(st, 1);
+  opaque_stretch_cancel(st);
+  if(i!=OPAQUE_STRETCH_DONE) goto done;
+  // purged entries miss
+  opaque_rwdcache_purge(cache);
+  if(NULL==(st=opaque_RecoverCredentialsBegin(resp, sec, &ksf))) goto done;
+  i = opaque_stretch_step(st, 1);
+  opaque_stretch_cancel(st);
+  if(i!=OPAQUE_STRETCH_MORE) goto done;
+  ret = 0;
+done:
+  opaque_rwdcache_free(cache);
+  return ret;
+}
+
+// seals rs and idU into ticket under key as tickets.h does, expiring
+// at expires
+static void seal_ticket(const uint8_t key[OPAQUE_TICKET_KEYBYTES], const uint64_t expires,
+                        const uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES],
+                        const uint8_t idU[4], uint8_t ticket[OPAQUE_TICKET_LEN+4]) {
+  const size_t nonce_len = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+  uint8_t plain[8+OPAQUE_RESUMPTION_SECRETBYTES+4];
+  int i;
+  for(i=0;i<8;i++) plain[i] = (uint8_t) (expires >> (56 - 8*i));
+  memcpy(plain+8, rs, OPAQUE_RESUMPTION_SECRETBYTES);
+  memcpy(plain+8+OPAQUE_RESUMPTION_SECRETBYTES, idU, 4);
+  randombytes(ticket, nonce_len);
+  ticket[nonce_len] = 0;
+  ticket[nonce_len+1] = 4;
+  crypto_aead_xchacha20poly1305_ietf_encrypt(ticket+nonce_len+2, NULL, plain, sizeof plain,
+                                             ticket+nonce_len, 2, NULL, ticket, key);
+}
+
+// seals authU and sk into token under key of key_id as
+// continuations.h does, expiring at expires
+static void seal_continuation(const uint8_t key[OPAQUE_CONTINUATION_KEYBYTES], const uint32_t key_id,
+                              const uint64_t expires,
+                              const uint8_t authU[crypto_auth_hmacsha512_BYTES],
+                              const uint8_t sk[OPAQUE_SHARED_SECRETBYTES],
+                              uint8_t token[OPAQUE_CONTINUATION_LEN]) {
+  const size_t nonce_len = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+  uint8_t plain[8+crypto_auth_hmacsha512_BYTES+OPAQUE_SHARED_SECRETBYTES];
+  int i;
+  for(i=0;i<8;i++) plain[i] = (uint8_t) (expires >> (56 - 8*i));
+  memcpy(plain+8, authU, crypto_auth_hmacsha512_BYTES);
+  memcpy(plain+8+crypto_auth_hmacsha512_BYTES, sk, OPAQUE_SHARED_SECRETBYTES);
+  for(i=0;i<4;i++) token[i] = (uint8_t) (key_id >> (24 - 8*i));
+  randombytes(token+4, nonce_len);
+  crypto_aead_xchacha20poly1305_ietf_encrypt(token+4+nonce_len, NULL, plain, sizeof plain,
+                                             token, 4, NULL, token+4, key);
+}
+
+// resumes a login with and without the ephemeral dh, and checks that
+// tickets are single use, expire, and are bound to the context
+static int test_resumption(void) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test", other[5]="other";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  uint8_t rec[OPAQUE_USER_RECORD_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES], ticket[OPAQUE_TICKET_LEN+4], idU[4];
+  uint8_t rsec[OPAQUE_RESUME_SECRET_LEN], req[OPAQUE_RESUME_REQUEST_LEN+sizeof ticket];
+  uint8_t rresp[OPAQUE_RESUME_RESPONSE_LEN];
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  uint8_t key[OPAQUE_TICKET_KEYBYTES];
+  randombytes(key, sizeof key);
+  Opaque_Tickets *tickets = opaque_tickets_new(NULL, 60, 8), *keyed = opaque_tickets_new(key, 60, 8);
+  Opaque_Tickets *small = opaque_tickets_new(NULL, 60, 1);
+  int i, ret = 1;
+
+  if(tickets==NULL || keyed==NULL || small==NULL ||
+     NULL!=opaque_tickets_new(NULL, 0, 8) || NULL!=opaque_tickets_new(NULL, 60, 0)) goto done;
+  if(0!=opaque_Register(pwdU, pwdU_len, NULL, &ids, &identity, rec, NULL)) goto done;
+  opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+  if(0!=opaque_CreateCredentialResponse(pub, rec, &ids, context, sizeof context, resp, sk, authU0)) goto done;
+  if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &identity, pk, authU1, NULL)) goto done;
+  if(0!=opaque_UserAuth(authU0, authU1)) goto done;
+  if(0!=opaque_IssueTicket(tickets, sk, ids.idU, ids.idU_len, ticket)) goto done;
+  opaque_ResumptionSecret(pk, rs);
+
+  // with dh, then without with the ticket of the resumed session
+  for(i=0;i<2;i++) {
+    if(0!=opaque_CreateResumptionRequest(ticket, sizeof ticket, rs, i==0, rsec, req)) goto done;
+    if(0!=opaque_CreateResumptionResponse(tickets, req, sizeof req, context, sizeof context, rresp, sk, authU0, idU)) goto done;
+    if(memcmp(idU, ids.idU, sizeof idU)!=0) goto done;
+    if(0!=opaque_RecoverResumption(rresp, rsec, context, sizeof context, pk, authU1)) goto done;
+    if(sodium_memcmp(sk, pk, sizeof sk)!=0 || 0!=opaque_UserAuth(authU0, authU1)) goto done;
+    // a ticket is redeemed once
+    if(0==opaque_CreateResumptionResponse(tickets, req, sizeof req, context, sizeof context, rresp, sk, authU0, idU)) goto done;
+    if(0!=opaque_IssueTicket(tickets, sk, ids.idU, ids.idU_len, ticket)) goto done;
+    opaque_ResumptionSecret(pk, rs);
+  }
+
+  // another context fails on the client
+  if(0!=opaque_CreateResumptionRequest(ticket, sizeof ticket, rs, 1, rsec, req)) goto done;
+  if(0!=opaque_CreateResumptionResponse(tickets, req, sizeof req, other, sizeof other, rresp, sk, authU0, idU)) goto done;
+  if(0==opaque_RecoverResumption(rresp, rsec, context, sizeof context, pk, authU1)) goto done;
+  // so does a response without the requested dh
+  if(0!=opaque_IssueTicket(tickets, sk, ids.idU, ids.idU_len, ticket)) goto done;
+  if(0!=opaque_CreateResumptionRequest(ticket, sizeof ticket, rs, 1, rsec, req)) goto done;
+  if(0!=opaque_CreateResumptionResponse(tickets, req, sizeof req, context, sizeof context, rresp, sk, authU0, idU)) goto done;
+  memset(rresp+OPAQUE_NONCE_BYTES, 0, crypto_scalarmult_BYTES);
+  if(0==opaque_RecoverResumption(rresp, rsec, context, sizeof context, pk, authU1)) goto done;
+  // tampered tickets, and tickets of another key
+  if(0!=opaque_IssueTicket(tickets, sk, ids.idU, ids.idU_len, ticket)) goto done;
+  if(0!=opaque_CreateResumptionRequest(ticket, sizeof ticket, rs, 0, rsec, req)) goto done;
+  req[sizeof req - 1]^=1;
+  if(0==opaque_CreateResumptionResponse(tickets, req, sizeof req, context, sizeof context, rresp, sk, authU0, idU)) goto done;
+  req[sizeof req - 1]^=1;
+  if(0==opaque_CreateResumptionResponse(small, req, sizeof req, context, sizeof context, rresp, sk, authU0, idU)) goto done;
+
+  // a full table of redeemed tickets forgets the ones expiring first,
+  // resumptions still work and the last ticket is still single use
+  for(i=0;i<32;i++) {
+    if(0!=opaque_IssueTicket(small, sk, ids.idU, ids.idU_len, ticket)) goto done;
+    if(0!=opaque_CreateResumptionRequest(ticket, sizeof ticket, rs, 0, rsec, req)) goto done;
+    if(0!=opaque_CreateResumptionResponse(small, req, sizeof req, context, sizeof context, rresp, sk, authU0, idU)) goto done;
+  }
+  if(0==opaque_CreateResumptionResponse(small, req, sizeof req, context, sizeof context, rresp, sk, authU0, idU)) goto done;
+
+  // the ticket is redeemed before the client is authenticated: a
+  // captured request sent first gets a response, without the secret it
+  // can not complete, and the request of the client is refused
+  if(0!=opaque_IssueTicket(tickets, sk, ids.idU, ids.idU_len, ticket)) goto done;
+  opaque_ResumptionSecret(sk, rs);
+  if(0!=opaque_CreateResumptionRequest(ticket, sizeof ticket, rs, 0, rsec, req)) goto done;
+  if(0!=opaque_CreateResumptionResponse(tickets, req, sizeof req, context, sizeof context, rresp, sk, authU0, idU)) goto done;
+  if(0==opaque_CreateResumptionResponse(tickets, req, sizeof req, context, sizeof context, rresp, sk, authU0, idU)) goto done;
+
+  // a ticket sealed with an expiry ahead opens, one in the past does not
+  for(i=0;i<2;i++) {
+    seal_ticket(key, (uint64_t) time(NULL) + ((i==0) ? 60 : -1), rs, ids.idU, ticket);
+    if(0!=opaque_CreateResumptionRequest(ticket, sizeof ticket, rs, 0, rsec, req)) goto done;
+    if((0==opaque_CreateResumptionResponse(keyed, req, sizeof req, context, sizeof context, rresp, sk, authU0, idU)) != (i==0)) goto done;
+  }
+  ret = 0;
+done:
+  opaque_tickets_free(tickets);
+  opaque_tickets_free(keyed);
+  opaque_tickets_free(small);
+  return ret;
+}
+
+// logs in with v2 records of two keys in a keyring, converts records
+// both ways, and rotates the first key out
+static int test_keyring(void) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  uint8_t skS[2][crypto_scalarmult_SCALARBYTES];
+  uint8_t rec[2][OPAQUE_USER_RECORD_LEN], rec1[OPAQUE_USER_RECORD_LEN], rec2[2][OPAQUE_USER_RECORD_V2_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  Opaque_Keyring *keyring = opaque_keyring_new(2), *small = opaque_keyring_new(1);
+  int i, ret = 1;
+
+  if(keyring==NULL || small==NULL ||
+     NULL!=opaque_keyring_new(0) || NULL!=opaque_keyring_new(OPAQUE_KEYRING_MAX_SLOTS+1)) goto done;
+  for(i=0;i<2;i++) {
+    crypto_core_ristretto255_scalar_random(skS[i]);
+    if(0!=opaque_Register(pwdU, pwdU_len, skS[i], &ids, &identity, rec[i], NULL)) goto done;
+  }
+  // not in the keyring yet
+  if(0==opaque_UserRecordToV2(keyring, rec[0], rec2[0])) goto done;
+  if(0!=opaque_keyring_add(keyring, 7, skS[0]) || 0!=opaque_keyring_add(keyring, 8, skS[1])) goto done;
+  // ids and keys are unique, and the keyring is full
+  if(0==opaque_keyring_add(small, 1, skS[0]) && 0==opaque_keyring_add(small, 2, skS[1])) goto done;
+  if(0==opaque_keyring_add(keyring, 9, skS[0])) goto done;
+
+  for(i=0;i<2;i++) {
+    if(0!=opaque_UserRecordToV2(keyring, rec[i], rec2[i])) goto done;
+    if(0!=opaque_UserRecordFromV2(keyring, rec2[i], rec1) || memcmp(rec1, rec[i], sizeof rec1)!=0) goto done;
+    opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+    if(0!=opaque_CreateCredentialResponseV2(pub, rec2[i], &ids, keyring, context, sizeof context, resp, sk, authU0)) goto done;
+    if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &identity, pk, authU1, NULL)) goto done;
+    if(sodium_memcmp(sk, pk, sizeof sk)!=0 || 0!=opaque_UserAuth(authU0, authU1)) goto done;
+  }
+
+  // records of a removed key no longer log in
+  if(0!=opaque_keyring_remove(keyring, 7) || 0==opaque_keyring_remove(keyring, 7)) goto done;
+  opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+  if(0==opaque_CreateCredentialResponseV2(pub, rec2[0], &ids, keyring, context, sizeof context, resp, sk, authU0)) goto done;
+  if(0==opaque_UserRecordFromV2(keyring, rec2[0], rec1)) goto done;
+  if(0!=opaque_CreateCredentialResponseV2(pub, rec2[1], &ids, keyring, context, sizeof context, resp, sk, authU0)) goto done;
+  ret = 0;
+done:
+  opaque_keyring_free(keyring);
+  opaque_keyring_free(small);
+  return ret;
+}
+
+// logins from the record cache, its eviction and its counters
+static int test_hotcache(void) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  uint8_t rec[5][OPAQUE_USER_RECORD_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  Opaque_HotCacheStats stats;
+  int i, ret = 1;
+
+  Opaque_HotCache *cache = opaque_hotcache_new(8, 2);
+  // a single set of 4 entries
+  Opaque_HotCache *tiny = opaque_hotcache_new(4, 1);
+  if(cache==NULL || tiny==NULL ||
+     NULL!=opaque_hotcache_new(0, 1) || NULL!=opaque_hotcache_new((1<<16)+1, 1) ||
+     NULL!=opaque_hotcache_new(8, 0) || NULL!=opaque_hotcache_new(8, 65)) goto done;
+  for(i=0;i<5;i++) {
+    if(0!=opaque_Register(pwdU, pwdU_len, NULL, &ids, &identity, rec[i], NULL)) goto done;
+  }
+  if(0!=opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub)) goto done;
+
+  // a miss, then hits, all of them log in
+  for(i=0;i<3;i++) {
+    if(0!=opaque_CreateCredentialResponseCached(pub, rec[0], &ids, cache, context, sizeof context, resp, sk, authU0) ||
+       0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &identity, pk, authU1, NULL) ||
+       sodium_memcmp(sk, pk, sizeof sk)!=0 || 0!=opaque_UserAuth(authU0, authU1)) goto done;
+  }
+  opaque_hotcache_stats(cache, &stats);
+  if(stats.hits!=2 || stats.misses!=1 || stats.entries!=1 || stats.evictions!=0 || stats.hit_ns==0 || stats.miss_ns==0) goto done;
+
+  // evicted records miss again
+  if(0!=opaque_hotcache_evict(cache, rec[0]) || 0==opaque_hotcache_evict(cache, rec[0])) goto done;
+  if(0!=opaque_CreateCredentialResponseCached(pub, rec[0], &ids, cache, context, sizeof context, resp, sk, authU0)) goto done;
+  opaque_hotcache_stats(cache, &stats);
+  if(stats.misses!=2 || stats.entries!=1) goto done;
+
+  // a record with an invalid client_public_key fails and is not cached
+  uint8_t bad[OPAQUE_USER_RECORD_LEN];
+  memcpy(bad, rec[1], sizeof bad);
+  // kU || skS || client_public_key ...
+  memset(bad + 2*crypto_scalarmult_SCALARBYTES, 0xff, crypto_scalarmult_BYTES);
+  if(0==opaque_CreateCredentialResponseCached(pub, bad, &ids, cache, context, sizeof context, resp, sk, authU0)) goto done;
+  opaque_hotcache_stats(cache, &stats);
+  if(stats.entries!=1) goto done;
+
+  // the fifth record replaces the least recently used one
+  for(i=0;i<5;i++) {
+    if(0!=opaque_CreateCredentialResponseCached(pub, rec[i], &ids, tiny, context, sizeof context, resp, sk, authU0)) goto done;
+  }
+  opaque_hotcache_stats(tiny, &stats);
+  if(stats.entries!=4 || stats.evictions!=1 || 0==opaque_hotcache_evict(tiny, rec[0]) ||
+     0!=opaque_hotcache_evict(tiny, rec[1])) goto done;
+  opaque_hotcache_purge(tiny);
+  opaque_hotcache_stats(tiny, &stats);
+  if(stats.entries!=0 || stats.misses!=5) goto done;
+  ret = 0;
+done:
+  opaque_hotcache_free(cache);
+  opaque_hotcache_free(tiny);
+  return ret;
+}
+
+// one login driven by callbacks, each step submits the next one
+typedef struct {
+  Opaque_Async *async;
+  const Opaque_Ids *ids;
+  const Opaque_KSF *ksf;
+  const uint8_t *rec;
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+4], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  int step;
+  atomic_int *ok, *failed;
+  // set once all logins are submitted
+  atomic_int *go;
+} AsyncLogin;
+
+// counts a failed call or submission in failed, a completed login in ok
+static void async_login_step(void *user, int ret) {
+  AsyncLogin *l = (AsyncLogin*) user;
+  if(ret!=0) {
+    atomic_fetch_add(l->failed, 1);
+    return;
+  }
+  switch(l->step++) {
+  case 0:
+    while(!atomic_load(l->go)) sched_yield();
+    ret = opaque_async_CreateCredentialResponse(l->async, async_login_step, l, l->pub, l->rec, l->ids,
+                                                NULL, 0, l->resp, l->sk, l->authU0);
+    break;
+  case 1:
+    ret = opaque_async_RecoverCredentials(l->async, async_login_step, l, l->resp, l->sec, NULL, 0, l->ids, l->ksf,
+                                          l->pk, l->authU1, NULL);
+    break;
+  case 2:
+    if(sodium_memcmp(l->sk, l->pk, sizeof l->sk)==0 &&
+       sodium_memcmp(l->authU0, l->authU1, sizeof l->authU0)==0) atomic_fetch_add(l->ok, 1);
+    break;
+  }
+  if(ret!=0) atomic_fetch_add(l->failed, 1);
+}
+
+// submits beyond the depth, completions through the fd and callbacks
+static int test_async(void) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  uint8_t rec[OPAQUE_USER_RECORD_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[4][OPAQUE_SERVER_SESSION_LEN], sk[4][OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU[4][crypto_auth_hmacsha512_BYTES];
+  uint8_t pk[OPAQUE_SHARED_SECRETBYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  Opaque_AsyncResult results[4];
+  AsyncLogin logins[8];
+  atomic_int ok = 0, failed = 0, go = 0;
+  size_t i, n;
+  int ret = 1;
+
+  Opaque_Async *queue = opaque_async_new(2, 4), *callbacks = opaque_async_new(0, 8);
+  if(queue==NULL || callbacks==NULL ||
+     NULL!=opaque_async_new(65, 4) || NULL!=opaque_async_new(1, 0) || NULL!=opaque_async_new(1, (1<<16)+1)) goto done;
+  if(0!=opaque_Register(pwdU, pwdU_len, NULL, &ids, &identity, rec, NULL)) goto done;
+  if(0!=opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub)) goto done;
+
+  // the fifth response waits for a result to be taken
+  for(i=0;i<4;i++) {
+    if(0!=opaque_async_CreateCredentialResponse(queue, NULL, (void*) (i + 1), pub, rec, &ids, NULL, 0,
+                                                resp[i], sk[i], authU[i])) goto done;
+  }
+  if(OPAQUE_ASYNC_FULL!=opaque_async_CreateCredentialResponse(queue, NULL, NULL, pub, rec, &ids, NULL, 0,
+                                                              resp[0], sk[0], authU[0])) goto done;
+  for(n=0;n<4;) {
+    struct pollfd pfd = {.fd = opaque_async_fd(queue), .events = POLLIN};
+    if(poll(&pfd, 1, 10000)!=1) goto done;
+    const size_t got = opaque_async_complete(queue, results, 4 - n);
+    for(i=0;i<got;i++) {
+      const size_t idx = (size_t) results[i].user - 1;
+      if(results[i].ret!=0 || idx >= 4) goto done;
+      if(0!=opaque_RecoverCredentials(resp[idx], sec, NULL, 0, &ids, &identity, pk, authU1, NULL) ||
+         sodium_memcmp(sk[idx], pk, sizeof pk)!=0 ||
+         sodium_memcmp(authU[idx], authU1, sizeof authU1)!=0) goto done;
+    }
+    n += got;
+  }
+  if(0!=opaque_async_complete(queue, results, 4)) goto done;
+  // the fd is not readable without results
+  struct pollfd pfd = {.fd = opaque_async_fd(queue), .events = POLLIN};
+  if(poll(&pfd, 1, 0)!=0) goto done;
+
+  // the failure of the call is its result
+  uint8_t bad[OPAQUE_USER_SESSION_PUBLIC_LEN] = {0};
+  if(0!=opaque_async_CreateCredentialResponse(queue, NULL, NULL, bad, rec, &ids, NULL, 0,
+                                              resp[0], sk[0], authU[0])) goto done;
+  opaque_async_drain(queue);
+  if(1!=opaque_async_complete(queue, results, 4) || results[0].ret==0) goto done;
+
+  // logins chained in callbacks, as many as the depth: the first
+  // callbacks wait until all are submitted, so each submits the next
+  // call into the slot of its own
+  for(i=0;i<8;i++) {
+    logins[i] = (AsyncLogin) {.async = callbacks, .ids = &ids, .ksf = &identity, .rec = rec,
+                              .ok = &ok, .failed = &failed, .go = &go};
+    if(0!=opaque_async_CreateCredentialRequest(callbacks, async_login_step, &logins[i], pwdU, pwdU_len,
+                                               logins[i].sec, logins[i].pub)) break;
+  }
+  atomic_store(&go, 1);
+  opaque_async_drain(callbacks);
+  if(i!=8 || atomic_load(&failed)!=0 || atomic_load(&ok)!=8) goto done;
+  ret = 0;
+done:
+  opaque_async_free(queue);
+  opaque_async_free(callbacks);
+  return ret;
+}
+
+// completes a login on another server with a continuation token, and
+// checks that tokens are single use, expire, and survive one rotation
+static int test_continuations(void) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  uint8_t rec[OPAQUE_USER_RECORD_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES], sk1[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  uint8_t key[OPAQUE_CONTINUATION_KEYBYTES], token[4][OPAQUE_CONTINUATION_LEN];
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  int i, ret = 1;
+
+  randombytes(key, sizeof key);
+  // two servers sharing the key
+  Opaque_Continuations *one = opaque_continuations_new(key, 1, 60, 16), *two = opaque_continuations_new(key, 1, 60, 16);
+  if(one==NULL || two==NULL ||
+     NULL!=opaque_continuations_new(NULL, 1, 0, 8) || NULL!=opaque_continuations_new(NULL, 1, 60, 0) ||
+     NULL!=opaque_continuations_new(NULL, 1, 60, (1<<20)+1)) goto done;
+  if(0!=opaque_Register(pwdU, pwdU_len, NULL, &ids, &identity, rec, NULL)) goto done;
+  opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+  if(0!=opaque_CreateCredentialResponse(pub, rec, &ids, context, sizeof context, resp, sk, authU0)) goto done;
+  if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &identity, pk, authU1, NULL)) goto done;
+  if(0!=opaque_SealContinuation(one, authU0, sk, token[0])) goto done;
+
+  // a wrong authU does not redeem the token, the right one does once
+  authU1[0]^=1;
+  if(0==opaque_UserAuthContinuation(two, token[0], authU1, sk1)) goto done;
+  authU1[0]^=1;
+  if(0!=opaque_UserAuthContinuation(two, token[0], authU1, sk1) || sodium_memcmp(sk1, pk, sizeof sk1)!=0) goto done;
+  if(0==opaque_UserAuthContinuation(two, token[0], authU1, sk1)) goto done;
+  // tampered tokens
+  if(0!=opaque_SealContinuation(one, authU0, sk, token[0])) goto done;
+  token[0][sizeof token[0] - 1]^=1;
+  if(0==opaque_UserAuthContinuation(two, token[0], authU1, sk1)) goto done;
+  token[0][sizeof token[0] - 1]^=1;
+  token[0][0]^=1;
+  if(0==opaque_UserAuthContinuation(two, token[0], authU1, sk1)) goto done;
+  token[0][0]^=1;
+
+  // tokens of the previous key are accepted, not those of the one
+  // before, nor those of a key the server does not have
+  if(0!=opaque_SealContinuation(one, authU0, sk, token[1])) goto done;
+  if(0!=opaque_continuations_rotate(one, NULL, 2) || 0==opaque_continuations_rotate(one, NULL, 2)) goto done;
+  if(0!=opaque_SealContinuation(one, authU0, sk, token[2])) goto done;
+  if(0==opaque_UserAuthContinuation(two, token[2], authU1, sk1)) goto done;
+  if(0!=opaque_UserAuthContinuation(one, token[0], authU1, sk1)) goto done;
+  if(0!=opaque_continuations_rotate(one, NULL, 3)) goto done;
+  if(0==opaque_UserAuthContinuation(one, token[1], authU1, sk1)) goto done;
+  if(0!=opaque_UserAuthContinuation(one, token[2], authU1, sk1)) goto done;
+
+  // a token sealed with an expiry ahead is accepted, one in the past
+  // is not
+  for(i=0;i<2;i++) {
+    seal_continuation(key, 1, (uint64_t) time(NULL) + ((i==0) ? 60 : -1), authU0, sk, token[3]);
+    if((0==opaque_UserAuthContinuation(two, token[3], authU1, sk1)) != (i==0)) goto done;
+  }
+  ret = 0;
+done:
+  opaque_continuations_free(one);
+  opaque_continuations_free(two);
+  return ret;
+}
+
+// kU derived from a seed with and without a cache, and fake records
+// for unknown users
+static int test_seeded(void) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  uint8_t seed[OPAQUE_OPRF_SEEDBYTES], skS[crypto_scalarmult_SCALARBYTES];
+  uint8_t rec[OPAQUE_USER_RECORD_LEN], rec1[OPAQUE_USER_RECORD_LEN];
+  uint8_t rec3[OPAQUE_USER_RECORD_SEEDED_LEN], fake[2][OPAQUE_USER_RECORD_SEEDED_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  uint8_t rsec[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len], blinded[crypto_core_ristretto255_BYTES];
+  uint8_t ssec[OPAQUE_REGISTER_SECRET_LEN], spub[3][OPAQUE_REGISTER_PUBLIC_LEN];
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  uint8_t credid[2] = {'u', 0};
+  int i, ret = 1;
+
+  randombytes(seed, sizeof seed);
+  crypto_core_ristretto255_scalar_random(skS);
+  Opaque_OprfSeed *cached = opaque_oprfseed_new(seed, 16), *uncached = opaque_oprfseed_new(seed, 0);
+  // a single set of 4 entries
+  Opaque_OprfSeed *tiny = opaque_oprfseed_new(seed, 4);
+  Opaque_Keyring *keyring = opaque_keyring_new(1);
+  if(cached==NULL || uncached==NULL || tiny==NULL || keyring==NULL ||
+     0!=opaque_keyring_add(keyring, 8, skS)) goto done;
+  if(NULL!=opaque_oprfseed_new(seed, (1<<20)+1)) goto done;
+
+  if(0!=opaque_RegisterSeeded(pwdU, pwdU_len, skS, cached, ids.idU, ids.idU_len, &ids, &identity, rec, NULL)) goto done;
+  if(0==opaque_RegisterSeeded(pwdU, pwdU_len, skS, cached, ids.idU, 0, &ids, &identity, rec1, NULL)) goto done;
+  // the same kU with and without the cache, but not for another credid
+  if(0!=opaque_UserRecordToSeeded(keyring, uncached, ids.idU, ids.idU_len, rec, rec3)) goto done;
+  if(0==opaque_UserRecordToSeeded(keyring, cached, ids.idS, ids.idS_len, rec, rec3)) goto done;
+  if(0!=opaque_UserRecordToSeeded(keyring, cached, ids.idU, ids.idU_len, rec, rec3)) goto done;
+  if(0!=opaque_UserRecordFromSeeded(keyring, uncached, ids.idU, ids.idU_len, rec3, rec1) ||
+     memcmp(rec1, rec, sizeof rec)!=0) goto done;
+  // a random kU is not the derived one
+  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, &identity, rec1, NULL)) goto done;
+  if(0==opaque_UserRecordToSeeded(keyring, cached, ids.idU, ids.idU_len, rec1, fake[0])) goto done;
+
+  // the first login derives kU, the second takes it from the cache
+  for(i=0;i<2;i++) {
+    opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+    if(0!=opaque_CreateCredentialResponseSeeded(pub, rec3, &ids, keyring, cached, ids.idU, ids.idU_len,
+                                                context, sizeof context, resp, sk, authU0)) goto done;
+    if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &identity, pk, authU1, NULL)) goto done;
+    if(sodium_memcmp(sk, pk, sizeof sk)!=0 || 0!=opaque_UserAuth(authU0, authU1)) goto done;
+  }
+
+  // the evaluation of a registration only depends on the credid
+  if(0!=opaque_CreateRegistrationRequest(pwdU, pwdU_len, rsec, blinded)) goto done;
+  if(0!=opaque_CreateRegistrationResponseSeeded(blinded, skS, cached, ids.idU, ids.idU_len, ssec, spub[0]) ||
+     0!=opaque_CreateRegistrationResponseSeeded(blinded, skS, uncached, ids.idU, ids.idU_len, ssec, spub[1]) ||
+     0!=opaque_CreateRegistrationResponseSeeded(blinded, skS, cached, ids.idS, ids.idS_len, ssec, spub[2])) goto done;
+  if(memcmp(spub[0], spub[1], sizeof spub[0])!=0 || memcmp(spub[0], spub[2], sizeof spub[0])==0) goto done;
+
+  // fake records are the same for the same credid, and the client can
+  // not open the response
+  if(0!=opaque_FakeUserRecordSeeded(cached, 8, ids.idS, ids.idS_len, fake[0]) ||
+     0!=opaque_FakeUserRecordSeeded(uncached, 8, ids.idS, ids.idS_len, fake[1]) ||
+     memcmp(fake[0], fake[1], sizeof fake[0])!=0) goto done;
+  if(0!=opaque_FakeUserRecordSeeded(cached, 8, ids.idU, ids.idU_len, fake[1]) ||
+     memcmp(fake[0], fake[1], sizeof fake[0])==0) goto done;
+  if(0==opaque_FakeUserRecordSeeded(cached, 8, ids.idS, 0, fake[1])) goto done;
+  opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+  if(0!=opaque_CreateCredentialResponseSeeded(pub, fake[0], &ids, keyring, cached, ids.idS, ids.idS_len,
+                                              context, sizeof context, resp, sk, authU0)) goto done;
+  if(0==opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &identity, pk, authU1, NULL)) goto done;
+
+  // more credids than the cache holds evict each other
+  for(i=0;i<8;i++) {
+    credid[1] = (uint8_t) i;
+    if(0!=opaque_RegisterSeeded(pwdU, pwdU_len, skS, tiny, credid, sizeof credid, &ids, &identity, rec, NULL)) goto done;
+    if(0!=opaque_UserRecordToSeeded(keyring, uncached, credid, sizeof credid, rec, rec3)) goto done;
+  }
+  for(i=0;i<8;i++) {
+    credid[1] = (uint8_t) i;
+    if(0!=opaque_RegisterSeeded(pwdU, pwdU_len, skS, uncached, credid, sizeof credid, &ids, &identity, rec, NULL)) goto done;
+    if(0!=opaque_UserRecordToSeeded(keyring, tiny, credid, sizeof credid, rec, rec3)) goto done;
+  }
+  ret = 0;
+done:
+  opaque_oprfseed_free(cached);
+  opaque_oprfseed_free(uncached);
+  opaque_oprfseed_free(tiny);
+  opaque_keyring_free(keyring);
+  return ret;
+}
+
+// the children of a fork and the parent continue with different
+// streams, and the generator reseeds after 1MiB
+static int test_drbg(void) {
+  uint8_t mine[32], theirs[2][32], big[4096];
+  uint64_t requests0, requests1, reads0, reads1;
+  const char *mode = getenv("OPAQUE_DRBG");
+  const int off = (mode!=NULL && strcmp(mode, "off")==0);
+  int fds[2], i, status;
+  pid_t pids[2];
+
+  opaque_randombytes(mine, sizeof mine);
+  if(0!=pipe(fds)) return 1;
+  for(i=0;i<2;i++) {
+    pids[i] = fork();
+    if(pids[i]<0) return 1;
+    if(pids[i]==0) {
+      opaque_randombytes(mine, sizeof mine);
+      _exit(write(fds[1], mine, sizeof mine)!=sizeof mine);
+    }
+  }
+  close(fds[1]);
+  for(i=0;i<2;i++) {
+    if(read(fds[0], theirs[i], sizeof theirs[i])!=sizeof theirs[i]) return 1;
+    if(waitpid(pids[i], &status, 0)<0 || !WIFEXITED(status) || WEXITSTATUS(status)!=0) return 1;
+  }
+  close(fds[0]);
+  opaque_randombytes(mine, sizeof mine);
+  if(memcmp(mine, theirs[0], sizeof mine)==0 ||
+     memcmp(mine, theirs[1], sizeof mine)==0 ||
+     memcmp(theirs[0], theirs[1], sizeof mine)==0) return 1;
+
+  opaque_random_stats(&requests0, &reads0);
+  for(i=0;i<(1<<20)/(int) sizeof big + 1;i++) opaque_randombytes(big, sizeof big);
+  opaque_random_stats(&requests1, &reads1);
+  // without the generator every request reads from the OS
+  if(reads1 - reads0 != (off ? requests1 - requests0 : 1)) return 1;
+  return 0;
+}
+
+// logs in with precomputed requests, which are single use
+static int test_precomputed(void) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  uint8_t rec[OPAQUE_USER_RECORD_LEN], pre[2][OPAQUE_USER_PRECOMPUTED_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t pub1[OPAQUE_USER_SESSION_PUBLIC_LEN], resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  int i;
+
+  if(0!=opaque_Register(pwdU, pwdU_len, NULL, &ids, &identity, rec, NULL)) return 1;
+  for(i=0;i<2;i++) if(0!=opaque_PrecomputeCredentialRequest(pre[i])) return 1;
+  for(i=0;i<2;i++) {
+    if(0!=opaque_CreateCredentialRequestPrecomputed(pre[i], pwdU, pwdU_len, sec, i==0 ? pub : pub1)) return 1;
+    if(0!=opaque_CreateCredentialResponse(i==0 ? pub : pub1, rec, &ids, context, sizeof context, resp, sk, authU0)) return 1;
+    if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &identity, pk, authU1, NULL)) return 1;
+    if(sodium_memcmp(sk, pk, sizeof sk)!=0 || 0!=opaque_UserAuth(authU0, authU1)) return 1;
+    // used values are wiped and rejected
+    if(!sodium_is_zero(pre[i], sizeof pre[i])) return 1;
+    if(0==opaque_CreateCredentialRequestPrecomputed(pre[i], pwdU, pwdU_len, sec, pub1)) return 1;
+  }
+  // every precomputation blinds and keys differently
+  if(memcmp(pub, pub1, sizeof pub)==0) return 1;
+  return 0;
+}
+
+// pops keyshares until the flag in arg is set
+static void *pop_thread(void *arg) {
+  atomic_int *stopped = arg;
+  Opaque_Keyshare ks;
+  while(!atomic_load(stopped)) opaque_keyshares_pop(&ks);
+  return NULL;
+}
+
+// logs in with responses taking their keyshares from the queue, with
+// the queue filled by the caller and by a background thread
+static int test_keyshares(void) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  uint8_t rec[OPAQUE_USER_RECORD_LEN], setup[OPAQUE_SERVER_SETUP_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  uint8_t skS[crypto_scalarmult_SCALARBYTES];
+  int i, ret = 1;
+
+  if(0==opaque_keyshares_start(1, 0) || 0==opaque_keyshares_start(8, 17)) return 1;
+  randombytes(skS, sizeof skS);
+  if(0!=opaque_CreateServerSetup(skS, context, sizeof context, setup)) return 1;
+  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, &identity, rec, NULL)) return 1;
+  // 5 is rounded up to 8
+  if(0!=opaque_keyshares_start(5, 0)) return 1;
+  if(0==opaque_keyshares_start(8, 0)) goto done;
+  if(opaque_keyshares_fill(100)!=8 || opaque_keyshares_available()!=8) goto done;
+  for(i=0;i<10;i++) {
+    opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+    if(i%2==0) {
+      if(0!=opaque_CreateCredentialResponse(pub, rec, &ids, context, sizeof context, resp, sk, authU0)) goto done;
+    } else {
+      if(0!=opaque_CreateCredentialResponseWithSetup(pub, rec, &ids, setup, resp, sk, authU0)) goto done;
+    }
+    if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &identity, pk, authU1, NULL)) goto done;
+    if(sodium_memcmp(sk, pk, sizeof sk)!=0 || 0!=opaque_UserAuth(authU0, authU1)) goto done;
+    // each keyshare is used once, the last two logins find the queue empty
+    if(opaque_keyshares_available()!=(size_t) (i<8 ? 7-i : 0)) goto done;
+  }
+  opaque_keyshares_stop();
+  if(opaque_keyshares_available()!=0 || opaque_keyshares_fill(1)!=0) goto done;
+
+  // the caller fills alongside the background thread, up to the capacity
+  if(0!=opaque_keyshares_start(16, 1)) goto done;
+  opaque_keyshares_fill(SIZE_MAX);
+  if(opaque_keyshares_available()!=16) goto done;
+  for(i=0;i<9;i++) {
+    opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+    if(0!=opaque_CreateCredentialResponse(pub, rec, &ids, context, sizeof context, resp, sk, authU0)) goto done;
+    if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, &identity, pk, authU1, NULL)) goto done;
+    if(0!=opaque_UserAuth(authU0, authU1)) goto done;
+  }
+  opaque_keyshares_fill(SIZE_MAX);
+  if(opaque_keyshares_available()!=16) goto done;
+
+  // stop waits for a pop running on another thread
+  pthread_t popper;
+  atomic_int stopped = 0;
+  if(0!=pthread_create(&popper, NULL, pop_thread, &stopped)) goto done;
+  opaque_keyshares_stop();
+  atomic_store(&stopped, 1);
+  pthread_join(popper, NULL);
+  ret = 0;
+done:
+  opaque_keyshares_stop();
+  return ret;
+}
+
+// invalid KSF parameters must be rejected by every function taking a KSF
+static int test_ksf_invalid(const Opaque_KSF *ksf) {
+  const uint8_t pwdU[]="asdf";
+  const uint16_t pwdU_len=strlen((char*) pwdU);
+  const uint8_t context[4]="test";
+  Opaque_Ids ids={4,(uint8_t*)"user",6,(uint8_t*)"server"};
+  uint8_t usr_ctx[OPAQUE_REGISTER_USER_SEC_LEN+pwdU_len], M[crypto_core_ristretto255_BYTES];
+  uint8_t rsec[OPAQUE_REGISTER_SECRET_LEN], rpub[OPAQUE_REGISTER_PUBLIC_LEN];
+  uint8_t rrec[OPAQUE_REGISTRATION_RECORD_LEN], rec[OPAQUE_USER_RECORD_LEN];
+  uint8_t sec[OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], pub[OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t resp[OPAQUE_SERVER_SESSION_LEN];
+  uint8_t sk[OPAQUE_SHARED_SECRETBYTES], pk[OPAQUE_SHARED_SECRETBYTES];
+  uint8_t authU0[crypto_auth_hmacsha512_BYTES], authU1[crypto_auth_hmacsha512_BYTES];
+
+  if(0!=opaque_CreateRegistrationRequest(pwdU, pwdU_len, usr_ctx, M)) return 1;
+  if(0!=opaque_CreateRegistrationResponse(M, NULL, rsec, rpub)) return 1;
+  if(0==opaque_FinalizeRequest(usr_ctx, rpub, &ids, ksf, rrec, NULL)) return 1;
+  if(NULL!=opaque_FinalizeRequestBegin(usr_ctx, rpub, ksf)) return 1;
+  if(0==opaque_Register(pwdU, pwdU_len, NULL, &ids, ksf, rec, NULL)) return 1;
+  if(0!=opaque_Register(pwdU, pwdU_len, NULL, &ids, NULL, rec, NULL)) return 1;
+  opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+  if(0!=opaque_CreateCredentialResponse(pub, rec, &ids, context, sizeof context, resp, sk, authU0)) return 1;
+  if(0==opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, ksf, pk, authU1, NULL)) return 1;
+  if(NULL!=opaque_RecoverCredentialsBegin(resp, sec, ksf)) return 1;
+  return 0;
+}
 
 int main(void) {
   const uint8_t pwdU[]="asdf";
@@ -37,6 +918,11 @@ int main(void) {
   uint8_t authU1[crypto_auth_hmacsha512_BYTES];
   const uint8_t context[4]="test";
 
+  if(0!=opaque_init()) {
+    fprintf(stderr, "opaque_init failed.\n");
+    return 1;
+  }
+
   fprintf(stderr, "\n\nprivate registration\n\n");
 
   // variant where user registration does not leak secrets to server
@@ -58,7 +944,7 @@ int main(void) {
   // user commits its secrets
   fprintf(stderr, "\nopaque_FinalizeRequest\n");
   unsigned char rrec[OPAQUE_REGISTRATION_RECORD_LEN]={0};
-  if(0!=opaque_FinalizeRequest(usr_ctx, rpub, &ids, rrec, export_key)) {
+  if(0!=opaque_FinalizeRequest(usr_ctx, rpub, &ids, NULL, rrec, export_key)) {
     fprintf(stderr, "opaque_FinalizeRequest failed.\n");
     return 1;
   }
@@ -75,7 +961,7 @@ int main(void) {
   }
   fprintf(stderr, "\nopaque_RecoverCredentials\n");
 
-  if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, pk, authU1, export_key)) return 1;
+  if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, NULL, pk, authU1, export_key)) return 1;
   assert(sodium_memcmp(sk,pk,sizeof sk)==0);
 
   // authenticate both parties:
@@ -87,7 +973,7 @@ int main(void) {
 
   // register user
   fprintf(stderr, "\nopaque_Register\n");
-  if(0!=opaque_Register(pwdU, pwdU_len, NULL, &ids, rec0, export_key0)) {
+  if(0!=opaque_Register(pwdU, pwdU_len, NULL, &ids, NULL, rec0, export_key0)) {
     fprintf(stderr, "opaque_Register failed.\n");
     return 1;
   }
@@ -107,7 +993,7 @@ int main(void) {
   }
   fprintf(stderr, "\nopaque_RecoverCredentials\n");
 
-  if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, pk, authU1, export_key)) return 1;
+  if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, NULL, pk, authU1, export_key)) return 1;
   assert(sodium_memcmp(sk,pk,sizeof sk)==0);
   assert(memcmp(export_key, export_key0, sizeof export_key)==0);
 
@@ -118,6 +1004,226 @@ int main(void) {
     return 1;
   }
 
+  // global server key with precomputed server setup
+  fprintf(stderr, "\nopaque_CreateServerSetup\n");
+  uint8_t skS[crypto_scalarmult_SCALARBYTES];
+  randombytes(skS, sizeof skS);
+  uint8_t setup[OPAQUE_SERVER_SETUP_LEN];
+  if(0!=opaque_CreateServerSetup(skS, context, sizeof context, setup)) {
+    fprintf(stderr, "opaque_CreateServerSetup failed.\n");
+    return 1;
+  }
+  if(0!=opaque_Register(pwdU, pwdU_len, skS, &ids, NULL, rec, export_key0)) {
+    fprintf(stderr, "opaque_Register failed.\n");
+    return 1;
+  }
+  opaque_CreateCredentialRequest(pwdU, pwdU_len, sec, pub);
+  fprintf(stderr, "\nopaque_CreateCredentialResponseWithSetup\n");
+  if(0!=opaque_CreateCredentialResponseWithSetup(pub, rec, &ids, setup, resp, sk, authU0)) {
+    fprintf(stderr, "opaque_CreateCredentialResponseWithSetup failed.\n");
+    return 1;
+  }
+  if(0!=opaque_RecoverCredentials(resp, sec, context, sizeof context, &ids, NULL, pk, authU1, export_key)) return 1;
+  assert(sodium_memcmp(sk,pk,sizeof sk)==0);
+  assert(memcmp(export_key, export_key0, sizeof export_key)==0);
+  if(-1==opaque_UserAuth(authU0, authU1)) {
+    fprintf(stderr, "failed authenticating user\n");
+    return 1;
+  }
+#ifndef NORANDOM
+  // records with a different server key must be rejected
+  if(0==opaque_CreateCredentialResponseWithSetup(pub, rec0, &ids, setup, resp, sk, authU0)) {
+    fprintf(stderr, "opaque_CreateCredentialResponseWithSetup accepted a foreign record.\n");
+    return 1;
+  }
+#endif
+
+  // batch of logins, records with different server keys and an invalid request
+  fprintf(stderr, "\nopaque_CreateCredentialResponseBatch\n");
+  uint8_t bsec[3][OPAQUE_USER_SESSION_SECRET_LEN+pwdU_len], bpub[3][OPAQUE_USER_SESSION_PUBLIC_LEN];
+  uint8_t brec[3][OPAQUE_USER_RECORD_LEN];
+  uint8_t bresp[3][OPAQUE_SERVER_SESSION_LEN];
+  uint8_t bsk[3][OPAQUE_SHARED_SECRETBYTES];
+  uint8_t bauthU[3][crypto_auth_hmacsha512_BYTES];
+  Opaque_Ids bids[3]={ids, ids, ids};
+  int brets[3];
+  memcpy(brec[0], rec, sizeof rec);
+  memcpy(brec[1], rec0, sizeof rec0);
+  memcpy(brec[2], rec, sizeof rec);
+  unsigned i;
+  for(i=0;i<3;i++) opaque_CreateCredentialRequest(pwdU, pwdU_len, bsec[i], bpub[i]);
+  memset(bpub[2], 0xff, crypto_core_ristretto255_BYTES);
+  if(1!=opaque_CreateCredentialResponseBatch(3, (uint8_t*) bpub, (uint8_t*) brec, bids, context, sizeof context,
+                                             (uint8_t*) bresp, (uint8_t*) bsk, (uint8_t*) bauthU, brets)) {
+    fprintf(stderr, "opaque_CreateCredentialResponseBatch failed.\n");
+    return 1;
+  }
+  assert(brets[0]==0 && brets[1]==0 && brets[2]!=0);
+  for(i=0;i<2;i++) {
+    if(0!=opaque_RecoverCredentials(bresp[i], bsec[i], context, sizeof context, &ids, NULL, pk, authU1, export_key)) return 1;
+    assert(sodium_memcmp(bsk[i],pk,sizeof pk)==0);
+    if(-1==opaque_UserAuth(bauthU[i], authU1)) {
+      fprintf(stderr, "failed authenticating user\n");
+      return 1;
+    }
+  }
+
+  // every key stretching profile, with cheap cost parameters
+  fprintf(stderr, "\nkey stretching functions\n");
+  const Opaque_KSF identity={.alg=OPAQUE_KSF_IDENTITY};
+  const Opaque_KSF argon2id={.alg=OPAQUE_KSF_ARGON2ID, .parallelism=1, .ops=1, .mem=1024};
+  const Opaque_KSF argon2id_p4={.alg=OPAQUE_KSF_ARGON2ID, .parallelism=4, .ops=2, .mem=1024};
+  const Opaque_KSF scrypt={.alg=OPAQUE_KSF_SCRYPT, .parallelism=1, .ops=1024, .mem=8};
+  const Opaque_KSF scrypt_p2={.alg=OPAQUE_KSF_SCRYPT, .parallelism=2, .ops=1024, .mem=8};
+  // allocated on first use, grown by the second profile
+  Opaque_Workspace *ws = opaque_workspace_new(0);
+  const Opaque_KSF argon2id_ws={.alg=OPAQUE_KSF_ARGON2ID, .parallelism=1, .ops=1, .mem=1024, .workspace=ws};
+  const Opaque_KSF argon2id_ws_p2={.alg=OPAQUE_KSF_ARGON2ID, .parallelism=2, .ops=2, .mem=4096, .workspace=ws};
+  if(ws==NULL ||
+     test_ksf(&identity, NULL) ||
+     test_ksf(&argon2id, &identity) ||
+     test_ksf(&argon2id_p4, &argon2id) ||
+     test_ksf(&argon2id_ws, &argon2id_p4) ||
+     test_ksf(&argon2id_ws_p2, &argon2id_ws) ||
+     test_ksf(&scrypt, &argon2id) ||
+     test_ksf(&scrypt_p2, &scrypt) ||
+     test_ksf(NULL, &argon2id)) {
+    fprintf(stderr, "key stretching round trip failed\n");
+    return 1;
+  }
+  fprintf(stderr, "\nkey stretching in steps\n");
+  if(test_steps(&argon2id, 7) ||
+     test_steps(&argon2id_p4, 1000) ||
+     test_steps(&argon2id_ws_p2, 300) ||
+     test_steps(&scrypt, 1) ||
+     test_steps(&identity, 0) ||
+     test_steps(NULL, 16384)) {
+    fprintf(stderr, "key stretching in steps failed\n");
+    return 1;
+  }
+  opaque_workspace_free(ws);
+  fprintf(stderr, "\nsession resumption\n");
+  if(test_resumption()) {
+    fprintf(stderr, "session resumption failed\n");
+    return 1;
+  }
+  fprintf(stderr, "\nserver keyring\n");
+  if(test_keyring()) {
+    fprintf(stderr, "server keyring failed\n");
+    return 1;
+  }
+  fprintf(stderr, "\nrecord cache\n");
+  if(test_hotcache()) {
+    fprintf(stderr, "record cache failed\n");
+    return 1;
+  }
+  fprintf(stderr, "\nasynchronous calls\n");
+  if(test_async()) {
+    fprintf(stderr, "asynchronous calls failed\n");
+    return 1;
+  }
+  fprintf(stderr, "\ncontinuation tokens\n");
+  if(test_continuations()) {
+    fprintf(stderr, "continuation tokens failed\n");
+    return 1;
+  }
+  fprintf(stderr, "\nkeys derived from a seed\n");
+  if(test_seeded()) {
+    fprintf(stderr, "keys derived from a seed failed\n");
+    return 1;
+  }
+  fprintf(stderr, "\nbuffered random numbers\n");
+  if(test_drbg()) {
+    fprintf(stderr, "buffered random numbers failed\n");
+    return 1;
+  }
+  fprintf(stderr, "\nprecomputed requests\n");
+  if(test_precomputed()) {
+    fprintf(stderr, "precomputed requests failed\n");
+    return 1;
+  }
+  fprintf(stderr, "\nprecomputed keyshares\n");
+  if(test_keyshares()) {
+    fprintf(stderr, "precomputed keyshares failed\n");
+    return 1;
+  }
+  fprintf(stderr, "\nhardened password cache\n");
+  if(test_rwdcache()) {
+    fprintf(stderr, "hardened password cache failed\n");
+    return 1;
+  }
+
+  // profiles, and a calibration cheap enough for a test
+  uint8_t profile[OPAQUE_KSF_PROFILE_LEN];
+  Opaque_KSF parsed, calibrated;
+  Opaque_KSF_Candidate candidates[16];
+  size_t ncandidates;
+  opaque_SerializeKSF(&scrypt_p2, profile);
+  if(0!=opaque_ParseKSF(profile, &parsed) || test_ksf(&parsed, &scrypt)) {
+    fprintf(stderr, "key stretching profile round trip failed\n");
+    return 1;
+  }
+  profile[0]++;
+  if(0==opaque_ParseKSF(profile, &parsed)) {
+    fprintf(stderr, "profile of unknown version accepted\n");
+    return 1;
+  }
+  // whether 50ms are met depends on the machine and its load, so only
+  // the shape of the result is checked: the least memory is measured
+  // first, all candidates are within the bounds, and the parameters
+  // picked are a candidate meeting the target
+  const int calibration = opaque_CalibrateKSF(50, 2048, 2, 1, &calibrated, candidates, 16, &ncandidates);
+  int picked = 0;
+  if(ncandidates < 1 || ncandidates > 16 || candidates[0].ksf.ops!=1 || candidates[0].ksf.mem!=1024) {
+    fprintf(stderr, "key stretching calibration failed\n");
+    return 1;
+  }
+  for(i=0;i<ncandidates;i++) {
+    const Opaque_KSF *c = &candidates[i].ksf;
+    if(c->alg!=OPAQUE_KSF_ARGON2ID || c->parallelism!=2 || c->ops < 1 || c->mem < 1024 || c->mem > 2048 ||
+       candidates[i].median_us > candidates[i].p95_us) {
+      fprintf(stderr, "key stretching calibration candidate %u out of bounds\n", i);
+      return 1;
+    }
+    if(calibration==0 && candidates[i].meets_target && c->ops==calibrated.ops && c->mem==calibrated.mem) picked = 1;
+  }
+  if(calibration==0) {
+    opaque_SerializeKSF(&calibrated, profile);
+    if(!picked || calibrated.parallelism!=2 || 0!=opaque_ParseKSF(profile, &parsed) ||
+       parsed.ops!=calibrated.ops || parsed.mem!=calibrated.mem || test_ksf(&parsed, &identity)) {
+      fprintf(stderr, "key stretching calibration failed\n");
+      return 1;
+    }
+    fprintf(stderr, "calibrated t=%u m=%u p=%u in %u candidates\n", (unsigned) calibrated.ops,
+            (unsigned) calibrated.mem, calibrated.parallelism, (unsigned) ncandidates);
+  } else if(candidates[0].meets_target) {
+    fprintf(stderr, "key stretching calibration failed with a candidate meeting the target\n");
+    return 1;
+  } else {
+    fprintf(stderr, "the least memory does not meet 50ms on this machine\n");
+  }
+  if(0==opaque_CalibrateKSF(50, 512, 1, 1, &calibrated, NULL, 0, NULL)) {
+    fprintf(stderr, "calibration below the least memory accepted\n");
+    return 1;
+  }
+
+  const Opaque_KSF invalid[]={
+    {.alg=3},
+    {.alg=OPAQUE_KSF_ARGON2ID, .parallelism=0, .ops=1, .mem=1024},
+    {.alg=OPAQUE_KSF_ARGON2ID, .parallelism=4, .ops=1, .mem=31},
+    {.alg=OPAQUE_KSF_ARGON2ID, .parallelism=1, .ops=0, .mem=1024},
+    {.alg=OPAQUE_KSF_ARGON2ID, .parallelism=1, .ops=1, .mem=1},
+    {.alg=OPAQUE_KSF_SCRYPT, .parallelism=1, .ops=1000, .mem=8},
+    {.alg=OPAQUE_KSF_SCRYPT, .parallelism=0, .ops=1024, .mem=8},
+    {.alg=OPAQUE_KSF_SCRYPT, .parallelism=1, .ops=1024, .mem=0},
+  };
+  for(i=0;i<sizeof invalid / sizeof invalid[0];i++) {
+    if(test_ksf_invalid(&invalid[i])) {
+      fprintf(stderr, "invalid key stretching parameters %u accepted\n", i);
+      return 1;
+    }
+  }
+
   fprintf(stderr, "\nall ok\n\n");
 
   return 0;
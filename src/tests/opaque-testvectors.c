@@ -20,6 +20,7 @@
 #include <assert.h>
 #include "../opaque.h"
 #include "../common.h"
+#include "../ristretto.h"
 #include "cfrg_test_vectors.h"
 
 typedef struct {
@@ -28,7 +29,12 @@ typedef struct {
   uint8_t pwdU[];
 } Opaque_RegisterUserSec;
 
-int main(void) {
+// usage: opaque-tv1 [ristretto backend]
+int main(int argc, char **argv) {
+  if(argc>1 && 0!=ristretto_select(argv[1])) {
+    fprintf(stderr, "%s not supported, skipping\n", argv[1]);
+    return 0;
+  }
   // test vector 1
   // create credential workflow
 
@@ -71,10 +77,12 @@ int main(void) {
   // finalize request
   // prepare params
   Opaque_Ids ids={0};
+  // the test vectors use the identity as KSF
+  const Opaque_KSF ksf={.alg=OPAQUE_KSF_IDENTITY};
   unsigned char rrec[OPAQUE_REGISTRATION_RECORD_LEN]={0};
   uint8_t ek[crypto_hash_sha512_BYTES]={0};
 
-  if(0!=opaque_FinalizeRequest(ctx, resp, &ids, rrec, ek)) return 1;
+  if(0!=opaque_FinalizeRequest(ctx, resp, &ids, &ksf, rrec, ek)) return 1;
 
   // verify test vectors
   if(memcmp(export_key, ek, sizeof export_key)!=0) {
@@ -143,7 +151,7 @@ int main(void) {
   uint8_t authUu[crypto_auth_hmacsha512_BYTES];
   uint8_t export_keyU[crypto_hash_sha512_BYTES];
   Opaque_Ids ids1={0};
-  opaque_RecoverCredentials(cresp, sec, context, sizeof context, &ids1, skU, authUu, export_keyU);
+  opaque_RecoverCredentials(cresp, sec, context, sizeof context, &ids1, &ksf, skU, authUu, export_keyU);
 
   if(memcmp(session_key, skU, sizeof session_key)!=0) {
     fprintf(stderr,"failed to reproduce session_key\n");
@@ -0,0 +1,289 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* compares the ristretto255 operations on decoded points of every
+   backend supported by this cpu against libsodium */
+
+#include <stdio.h>
+#include <string.h>
+#include "../ristretto.h"
+
+#define ROUNDS 1000
+
+static const char *backends[] = {"avx512", "avx2", "ref51", "sodium"};
+
+// the order of the group, n*L is the identity
+static const uint8_t L[crypto_core_ristretto255_SCALARBYTES] = {
+  0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10
+};
+
+// multiplies p with n with and without a table, compares to libsodium
+static int test_mult(const uint8_t p[crypto_core_ristretto255_BYTES],
+                     const uint8_t n[crypto_core_ristretto255_SCALARBYTES]) {
+  uint8_t ref[crypto_core_ristretto255_BYTES], out[crypto_core_ristretto255_BYTES];
+  ristretto_point P, Q;
+  ristretto_table t;
+  if(0!=ristretto_decode(&P, p)) {
+    fprintf(stderr, "decode of valid point failed\n");
+    return 1;
+  }
+  const int ret = crypto_scalarmult_ristretto255(ref, n, p);
+  if(ret!=ristretto_scalarmult(&Q, n, &P)) {
+    fprintf(stderr, "scalarmult return value mismatch\n");
+    return 1;
+  }
+  if(ret!=0) return 0;
+  ristretto_encode(out, &Q);
+  if(memcmp(ref, out, sizeof ref)!=0) {
+    fprintf(stderr, "scalarmult mismatch\n");
+    return 1;
+  }
+  ristretto_table_init(&t, &P);
+  memset(&Q, 0, sizeof Q);
+  if(0!=ristretto_scalarmult_table(&Q, n, &t)) {
+    fprintf(stderr, "scalarmult_table failed\n");
+    return 1;
+  }
+  ristretto_encode(out, &Q);
+  if(memcmp(ref, out, sizeof ref)!=0) {
+    fprintf(stderr, "scalarmult_table mismatch\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int test_base(const uint8_t n[crypto_core_ristretto255_SCALARBYTES]) {
+  uint8_t ref[crypto_core_ristretto255_BYTES], out[crypto_core_ristretto255_BYTES];
+  const int ret = crypto_scalarmult_ristretto255_base(ref, n);
+  if(ret!=ristretto_scalarmult_base(out, n)) {
+    fprintf(stderr, "scalarmult_base return value mismatch\n");
+    return 1;
+  }
+  if(ret==0 && memcmp(ref, out, sizeof ref)!=0) {
+    fprintf(stderr, "scalarmult_base mismatch\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int test_identity(void) {
+  uint8_t p[crypto_core_ristretto255_BYTES], n[crypto_core_ristretto255_SCALARBYTES];
+  ristretto_point P, Q;
+  crypto_core_ristretto255_random(p);
+  if(0!=ristretto_decode(&P, p)) return 1;
+  // the order of the group
+  if(-1!=ristretto_scalarmult(&Q, L, &P)) {
+    fprintf(stderr, "L*P is not the identity\n");
+    return 1;
+  }
+  memset(n, 0, sizeof n);
+  if(-1!=ristretto_scalarmult(&Q, n, &P)) {
+    fprintf(stderr, "0*P is not the identity\n");
+    return 1;
+  }
+  // the identity itself decodes but multiplies to the identity
+  memset(p, 0, sizeof p);
+  if(0!=ristretto_decode(&P, p)) {
+    fprintf(stderr, "decode of identity failed\n");
+    return 1;
+  }
+  crypto_core_ristretto255_scalar_random(n);
+  if(-1!=ristretto_scalarmult(&Q, n, &P)) {
+    fprintf(stderr, "n*identity is not the identity\n");
+    return 1;
+  }
+  if(-1!=ristretto_scalarmult_base(p, L)) {
+    fprintf(stderr, "L*G is not the identity\n");
+    return 1;
+  }
+  memset(n, 0, sizeof n);
+  if(-1!=ristretto_scalarmult_base(p, n)) {
+    fprintf(stderr, "0*G is not the identity\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int test_random(void) {
+  uint8_t p[crypto_core_ristretto255_BYTES], n[crypto_core_ristretto255_SCALARBYTES];
+  uint8_t h[crypto_core_ristretto255_HASHBYTES];
+  uint8_t ref[crypto_core_ristretto255_BYTES], out[crypto_core_ristretto255_BYTES];
+  ristretto_point P;
+
+  // encode(decode(p)) == p
+  crypto_core_ristretto255_random(p);
+  if(0!=ristretto_decode(&P, p)) {
+    fprintf(stderr, "decode failed\n");
+    return 1;
+  }
+  ristretto_encode(out, &P);
+  if(memcmp(p, out, sizeof p)!=0) {
+    fprintf(stderr, "encode(decode(p)) != p\n");
+    return 1;
+  }
+
+  // reduced and unreduced scalars, including ones with the top bit set
+  crypto_core_ristretto255_scalar_random(n);
+  if(test_mult(p, n)) return 1;
+  if(test_base(n)) return 1;
+  randombytes_buf(n, sizeof n);
+  if(test_mult(p, n)) return 1;
+  if(test_base(n)) return 1;
+
+  randombytes_buf(h, sizeof h);
+  crypto_core_ristretto255_from_hash(ref, h);
+  ristretto_from_hash(&P, h);
+  ristretto_encode(out, &P);
+  if(memcmp(ref, out, sizeof ref)!=0) {
+    fprintf(stderr, "from_hash mismatch\n");
+    return 1;
+  }
+
+  // encodings with the top bit set are not canonical, libsodium 1.0.18
+  // ignores the top bit though
+  randombytes_buf(p, sizeof p);
+  p[31] |= 0x80;
+  if(0==ristretto_decode(&P, p)) {
+    fprintf(stderr, "decoded encoding with top bit set\n");
+    return 1;
+  }
+  // mostly invalid encodings, also with the low bit cleared
+  p[31] &= 0x7f;
+  if(crypto_core_ristretto255_is_valid_point(p)!=(0==ristretto_decode(&P, p))) {
+    fprintf(stderr, "decode validity mismatch\n");
+    return 1;
+  }
+  p[0] &= 0xfe;
+  if(crypto_core_ristretto255_is_valid_point(p)!=(0==ristretto_decode(&P, p))) {
+    fprintf(stderr, "decode validity mismatch\n");
+    return 1;
+  }
+  return 0;
+}
+
+#define BATCH 9
+
+// batches of every size up to BATCH against the single operations,
+// with invalid encodings and identities in some of the lanes
+static int test_batch(void) {
+  uint8_t s[BATCH][crypto_core_ristretto255_BYTES], n[BATCH][crypto_core_ristretto255_SCALARBYTES];
+  uint8_t out[BATCH][crypto_core_ristretto255_BYTES], ref[crypto_core_ristretto255_BYTES];
+  ristretto_point P[BATCH], Q[BATCH], R;
+  ristretto_point *pp[BATCH], *qp[BATCH];
+  const uint8_t *sp[BATCH], *np[BATCH];
+  uint8_t *op[BATCH];
+  int rets[BATCH], valid[BATCH];
+  size_t size, i;
+  for(size=1;size<=BATCH;size++) {
+    for(i=0;i<size;i++) {
+      crypto_core_ristretto255_random(s[i]);
+      crypto_core_ristretto255_scalar_random(n[i]);
+      pp[i] = &P[i];
+      qp[i] = &Q[i];
+      sp[i] = s[i];
+      np[i] = n[i];
+      op[i] = out[i];
+    }
+    if(size>2) randombytes_buf(s[2], sizeof s[2]);
+    if(size>4) memset(n[4], 0, sizeof n[4]);
+    if(size>5) memcpy(n[5], L, sizeof n[5]);
+    if(size>6) memset(s[6], 0, sizeof s[6]);
+
+    ristretto_decode_batch(size, pp, sp, rets);
+    for(i=0;i<size;i++) {
+      valid[i] = ristretto_decode(&R, s[i])==0;
+      if(rets[i]!=(valid[i] ? 0 : -1)) {
+        fprintf(stderr, "decode_batch validity mismatch\n");
+        return 1;
+      }
+      // the multiplications need valid points
+      if(!valid[i]) {
+        crypto_core_ristretto255_random(s[i]);
+        if(0!=ristretto_decode(&P[i], s[i])) return 1;
+      }
+    }
+
+    ristretto_encode_batch(size, op, (const ristretto_point *const *) pp);
+    for(i=0;i<size;i++) {
+      if(memcmp(out[i], s[i], sizeof out[i])!=0) {
+        fprintf(stderr, "encode_batch(decode_batch(p)) != p\n");
+        return 1;
+      }
+    }
+
+    ristretto_scalarmult_batch(size, qp, np, (const ristretto_point *const *) pp, rets);
+    for(i=0;i<size;i++) {
+      const int ret = crypto_scalarmult_ristretto255(ref, n[i], s[i]);
+      if(ret!=rets[i]) {
+        fprintf(stderr, "scalarmult_batch return value mismatch\n");
+        return 1;
+      }
+      ristretto_encode(out[i], &Q[i]);
+      if(ret==0 && memcmp(ref, out[i], sizeof ref)!=0) {
+        fprintf(stderr, "scalarmult_batch mismatch\n");
+        return 1;
+      }
+    }
+
+    // in place
+    ristretto_scalarmult_batch(size, pp, np, (const ristretto_point *const *) pp, rets);
+    for(i=0;i<size;i++) {
+      ristretto_encode(ref, &P[i]);
+      if(memcmp(ref, out[i], sizeof ref)!=0) {
+        fprintf(stderr, "in place scalarmult_batch mismatch\n");
+        return 1;
+      }
+    }
+
+    ristretto_scalarmult_base_batch(size, op, np, rets);
+    for(i=0;i<size;i++) {
+      const int ret = crypto_scalarmult_ristretto255_base(ref, n[i]);
+      if(ret!=rets[i] || (ret==0 && memcmp(ref, out[i], sizeof ref)!=0)) {
+        fprintf(stderr, "scalarmult_base_batch mismatch\n");
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int main(void) {
+  if(sodium_init() < 0) return 1;
+  size_t i;
+  int rounds;
+  for(i=0;i<sizeof backends / sizeof backends[0];i++) {
+    if(0!=ristretto_select(backends[i])) {
+      fprintf(stderr, "%s not supported, skipping\n", backends[i]);
+      continue;
+    }
+    if(test_identity()) {
+      fprintf(stderr, "%s failed\n", backends[i]);
+      return 1;
+    }
+    for(rounds=0;rounds<ROUNDS;rounds++) {
+      if(test_random() || (rounds % 10==0 && test_batch())) {
+        fprintf(stderr, "%s failed\n", backends[i]);
+        return 1;
+      }
+    }
+    fprintf(stderr, "%s ok\n", backends[i]);
+  }
+  fprintf(stderr, "all ok\n");
+  return 0;
+}
@@ -0,0 +1,115 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* compares every multi-buffer sha512 implementation supported by this
+   cpu against libsodium */
+
+#include <stdio.h>
+#include <string.h>
+#include "../sha512mb.h"
+
+#define LANES 11
+#define MAXLEN 400
+
+static const char *impls[] = {"avx512", "avx2", "scalar"};
+
+static int test_hash(void) {
+  crypto_hash_sha512_state states[LANES];
+  const crypto_hash_sha512_state *st[LANES];
+  uint8_t msg[LANES][MAXLEN];
+  const uint8_t *in[LANES];
+  size_t inlen[LANES];
+  uint8_t out[LANES][crypto_hash_sha512_BYTES], *optr[LANES];
+  uint8_t ref[crypto_hash_sha512_BYTES];
+  size_t i;
+
+  for(i=0;i<LANES;i++) {
+    // lanes with different prefixes and lengths, covering the one and
+    // two block paddings and buffered bytes in the state
+    const size_t prefix = randombytes_uniform(300);
+    inlen[i] = randombytes_uniform(MAXLEN);
+    randombytes_buf(msg[i], sizeof msg[i]);
+    crypto_hash_sha512_init(&states[i]);
+    crypto_hash_sha512_update(&states[i], msg[i], prefix);
+    st[i] = &states[i];
+    in[i] = msg[i];
+    optr[i] = out[i];
+  }
+  sha512mb_final(LANES, st, in, inlen, optr);
+  for(i=0;i<LANES;i++) {
+    crypto_hash_sha512_state tmp = states[i];
+    crypto_hash_sha512_update(&tmp, in[i], inlen[i]);
+    crypto_hash_sha512_final(&tmp, ref);
+    if(memcmp(ref, out[i], sizeof ref)!=0) {
+      fprintf(stderr, "sha512 lane %zu mismatch\n", i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int test_hmac(void) {
+  uint8_t keys[LANES][64], msg[LANES][MAXLEN];
+  const uint8_t *kptr[LANES], *in[LANES];
+  size_t inlen[LANES];
+  uint8_t out[LANES][crypto_auth_hmacsha512_BYTES], *optr[LANES];
+  uint8_t ref[crypto_auth_hmacsha512_BYTES];
+  size_t i;
+
+  for(i=0;i<LANES;i++) {
+    randombytes_buf(keys[i], sizeof keys[i]);
+    randombytes_buf(msg[i], sizeof msg[i]);
+    inlen[i] = randombytes_uniform(MAXLEN);
+    kptr[i] = keys[i];
+    in[i] = msg[i];
+    optr[i] = out[i];
+  }
+  sha512mb_hmac(LANES, kptr, sizeof keys[0], in, inlen, optr);
+  for(i=0;i<LANES;i++) {
+    crypto_auth_hmacsha512_state st;
+    crypto_auth_hmacsha512_init(&st, keys[i], sizeof keys[i]);
+    crypto_auth_hmacsha512_update(&st, msg[i], inlen[i]);
+    crypto_auth_hmacsha512_final(&st, ref);
+    if(memcmp(ref, out[i], sizeof ref)!=0) {
+      fprintf(stderr, "hmac lane %zu mismatch\n", i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(void) {
+  if(sodium_init() < 0) return 1;
+  size_t i;
+  int rounds;
+  for(i=0;i<sizeof impls / sizeof impls[0];i++) {
+    if(0!=sha512mb_select(impls[i])) {
+      fprintf(stderr, "%s not supported, skipping\n", impls[i]);
+      continue;
+    }
+    for(rounds=0;rounds<100;rounds++) {
+      if(test_hash() || test_hmac()) {
+        fprintf(stderr, "%s failed\n", impls[i]);
+        return 1;
+      }
+    }
+    fprintf(stderr, "%s ok\n", impls[i]);
+  }
+  fprintf(stderr, "all ok\n");
+  return 0;
+}
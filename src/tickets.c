@@ -0,0 +1,180 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "common.h"
+#include "tickets.h"
+
+#define TICKETS_MAX_USED (1 << 20)
+#define TICKETS_WAYS 8
+#define TICKETS_LOCKS 64
+
+#define TICKET_NONCEBYTES crypto_aead_xchacha20poly1305_ietf_NPUBBYTES
+#define TICKET_HEADER_LEN (TICKET_NONCEBYTES + 2)
+// expires || rs
+#define TICKET_FIXED_LEN (8 + OPAQUE_RESUMPTION_SECRETBYTES)
+
+// an opened ticket, remembered until it expires
+typedef struct {
+  uint8_t nonce[TICKET_NONCEBYTES];
+  uint64_t expires;
+} Used;
+
+struct Opaque_Tickets {
+  uint32_t lifetime;
+  // the number of sets, a power of 2
+  size_t sets;
+  // sodium_malloc()ed
+  uint8_t *key;
+  Used *used;
+  pthread_mutex_t locks[TICKETS_LOCKS];
+};
+
+static uint64_t now_s(void) {
+  return (uint64_t) time(NULL);
+}
+
+static void store_be64(uint8_t out[8], const uint64_t v) {
+  int i;
+  for(i=0;i<8;i++) out[i] = (uint8_t) (v >> (56 - 8*i));
+}
+
+static uint64_t load_be64(const uint8_t in[8]) {
+  uint64_t v = 0;
+  int i;
+  for(i=0;i<8;i++) v = (v << 8) | in[i];
+  return v;
+}
+
+Opaque_Tickets *opaque_tickets_new(const uint8_t key[OPAQUE_TICKET_KEYBYTES],
+                                   const uint32_t lifetime, const size_t max_used) {
+  size_t sets = 1, i;
+  if(lifetime==0 || max_used==0 || max_used > TICKETS_MAX_USED) return NULL;
+  // at most half full, so that a set rarely fills up
+  while(sets * TICKETS_WAYS < 2 * max_used) sets <<= 1;
+  Opaque_Tickets *tickets = calloc(1, sizeof *tickets);
+  if(tickets==NULL) return NULL;
+  for(i=0;i<TICKETS_LOCKS;i++) pthread_mutex_init(&tickets->locks[i], NULL);
+  tickets->key = sodium_malloc(OPAQUE_TICKET_KEYBYTES);
+  tickets->used = calloc(sets * TICKETS_WAYS, sizeof(Used));
+  if(tickets->key==NULL || tickets->used==NULL) {
+    opaque_tickets_free(tickets);
+    return NULL;
+  }
+  if(key!=NULL) memcpy(tickets->key, key, OPAQUE_TICKET_KEYBYTES);
+  else randombytes(tickets->key, OPAQUE_TICKET_KEYBYTES);
+  tickets->lifetime = lifetime;
+  tickets->sets = sets;
+  return tickets;
+}
+
+void opaque_tickets_free(Opaque_Tickets *tickets) {
+  size_t i;
+  if(tickets==NULL) return;
+  // sodium_free wipes the key
+  if(tickets->key!=NULL) sodium_free(tickets->key);
+  free(tickets->used);
+  for(i=0;i<TICKETS_LOCKS;i++) pthread_mutex_destroy(&tickets->locks[i]);
+  free(tickets);
+}
+
+int opaque_tickets_seal(const Opaque_Tickets *tickets,
+                        const uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES],
+                        const uint8_t *idU, const uint16_t idU_len,
+                        uint8_t *ticket) {
+  if(idU_len > OPAQUE_TICKET_IDU_MAX || (idU==NULL && idU_len!=0)) return -1;
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *plain = opaque_scratch_alloc(TICKET_FIXED_LEN + idU_len);
+  if(plain==NULL) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  store_be64(plain, now_s() + tickets->lifetime);
+  memcpy(plain + 8, rs, OPAQUE_RESUMPTION_SECRETBYTES);
+  if(idU_len>0) memcpy(plain + TICKET_FIXED_LEN, idU, idU_len);
+
+  randombytes(ticket, TICKET_NONCEBYTES);
+  uint8_t *ad = ticket + TICKET_NONCEBYTES;
+  ad[0] = (uint8_t) (idU_len >> 8);
+  ad[1] = (uint8_t) idU_len;
+  crypto_aead_xchacha20poly1305_ietf_encrypt(ticket + TICKET_HEADER_LEN, NULL,
+                                             plain, TICKET_FIXED_LEN + idU_len,
+                                             ad, 2, NULL, ticket, tickets->key);
+  opaque_scratch_release(mark);
+  return 0;
+}
+
+// marks nonce as used until expires, fails if it already is. In a
+// full set the entry expiring first is forgotten.
+static int mark_used(Opaque_Tickets *tickets, const uint8_t nonce[TICKET_NONCEBYTES],
+                     const uint64_t expires, const uint64_t now) {
+  // the nonces are random, their first bytes select the set
+  size_t idx = 0, i;
+  for(i=0;i<sizeof idx;i++) idx = (idx << 8) | nonce[i];
+  idx &= tickets->sets - 1;
+  Used *set = &tickets->used[idx * TICKETS_WAYS], *slot = &set[0];
+  pthread_mutex_t *lock = &tickets->locks[idx % TICKETS_LOCKS];
+  int ret = 0;
+  pthread_mutex_lock(lock);
+  for(i=0;i<TICKETS_WAYS;i++) {
+    Used *u = &set[i];
+    if(u->expires > now && 0==memcmp(u->nonce, nonce, TICKET_NONCEBYTES)) {
+      ret = -1;
+      break;
+    }
+    // expired entries have the earliest expiry of all
+    if(u->expires < slot->expires) slot = u;
+  }
+  if(ret==0) {
+    memcpy(slot->nonce, nonce, TICKET_NONCEBYTES);
+    slot->expires = expires;
+  }
+  pthread_mutex_unlock(lock);
+  return ret;
+}
+
+int opaque_tickets_open(Opaque_Tickets *tickets,
+                        const uint8_t *ticket, const size_t ticket_len,
+                        uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES],
+                        uint8_t *idU) {
+  if(ticket_len < OPAQUE_TICKET_LEN) return -1;
+  const uint16_t idU_len = (uint16_t) ((ticket[TICKET_NONCEBYTES] << 8) | ticket[TICKET_NONCEBYTES+1]);
+  if(idU_len > OPAQUE_TICKET_IDU_MAX || ticket_len != OPAQUE_TICKET_LEN + (size_t) idU_len) return -1;
+  const size_t mark = opaque_scratch_mark();
+  uint8_t *plain = opaque_scratch_alloc(TICKET_FIXED_LEN + idU_len);
+  if(plain==NULL ||
+     0!=crypto_aead_xchacha20poly1305_ietf_decrypt(plain, NULL, NULL,
+                                                   ticket + TICKET_HEADER_LEN, ticket_len - TICKET_HEADER_LEN,
+                                                   ticket + TICKET_NONCEBYTES, 2, ticket, tickets->key)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  const uint64_t now = now_s(), expires = load_be64(plain);
+  if(expires <= now || 0!=mark_used(tickets, ticket, expires, now)) {
+    opaque_scratch_release(mark);
+    return -1;
+  }
+  memcpy(rs, plain + 8, OPAQUE_RESUMPTION_SECRETBYTES);
+  if(idU_len>0) memcpy(idU, plain + TICKET_FIXED_LEN, idU_len);
+  opaque_scratch_release(mark);
+  return 0;
+}
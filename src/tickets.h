@@ -0,0 +1,34 @@
+#ifndef TICKETS_H
+#define TICKETS_H
+
+#include <stdint.h>
+#include "opaque.h"
+
+/* sealing and opening of the resumption tickets of opaque.h
+ *
+ * A ticket is
+ *
+ *   nonce[24] || I2OSP(idU_len, 2) || XChaCha20-Poly1305(key, nonce,
+ *     ad = I2OSP(idU_len, 2), I2OSP(expires, 8) || rs[64] || idU)
+ *
+ * expires is in seconds of the unix epoch, so that tickets survive a
+ * restart of a server keeping its key. The nonce identifies a ticket
+ * for the replay protection, which is a set associative table of the
+ * nonces of opened tickets until they expire, with a lock per group
+ * of sets. */
+
+// seals rs and idU into ticket, valid for the lifetime of tickets
+int opaque_tickets_seal(const Opaque_Tickets *tickets,
+                        const uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES],
+                        const uint8_t *idU, const uint16_t idU_len,
+                        uint8_t *ticket/*[OPAQUE_TICKET_LEN+idU_len]*/);
+
+// opens a ticket of ticket_len bytes into rs and idU, which must have
+// space for ticket_len-OPAQUE_TICKET_LEN bytes. Fails if the ticket is
+// not authentic, has expired or was opened before.
+int opaque_tickets_open(Opaque_Tickets *tickets,
+                        const uint8_t *ticket, const size_t ticket_len,
+                        uint8_t rs[OPAQUE_RESUMPTION_SECRETBYTES],
+                        uint8_t *idU);
+
+#endif // TICKETS_H
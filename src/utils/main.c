@@ -1,9 +1,18 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
 #include <opaque.h>
 
 #define MAX_PWD_LEN 1024
+#define MAX_CANDIDATES 64
+// the most samples per candidate opaque_CalibrateKSF() takes
+#define MAX_SAMPLES 32
+
+// the key stretching profile of the OPAQUE_KSF environment variable,
+// NULL for the default
+static Opaque_KSF ksf_buf;
+static const Opaque_KSF *ksf = NULL;
 
 #if _WIN32 == 1 || _WIN64 == 1
 #include <sys/stat.h>
@@ -30,6 +39,87 @@ static void usage(const char *self) {
   fprintf(stderr, "\nRun OPAQUE\n");
   fprintf(stderr, "socat | %s server idU idS context 3<record 4>shared_key                                   - server portion of OPAQUE session\n", self);
   fprintf(stderr, "socat | %s user idU idS context 3< <(echo -n password) 4>export_key 5>shared_key [6<pkS]  - server portion of OPAQUE session\n", self);
+  fprintf(stderr, "\nKey stretching\n");
+  fprintf(stderr, "%s calibrate target_ms max_mem_MB [lanes [samples]] >profile                            - pick Argon2id parameters for this machine\n", self);
+  fprintf(stderr, "OPAQUE_KSF=profile %s ...                                                                 - register or login with a calibrated profile\n", self);
+}
+
+// loads the profile named by the OPAQUE_KSF environment variable
+static int load_ksf(void) {
+  const char *path = getenv("OPAQUE_KSF");
+  if(path==NULL || path[0]==0) return 0;
+  uint8_t profile[OPAQUE_KSF_PROFILE_LEN];
+  FILE *f = fopen(path, "rb");
+  if(f==NULL) {
+    perror("error: failed to open OPAQUE_KSF profile");
+    return 1;
+  }
+  if(1!=fread(profile, sizeof profile, 1, f) || 0!=opaque_ParseKSF(profile, &ksf_buf)) {
+    fprintf(stderr, "error: invalid key stretching profile in %s\n", path);
+    fclose(f);
+    return 1;
+  }
+  fclose(f);
+  ksf = &ksf_buf;
+  return 0;
+}
+
+static int calibrate(const int argc, const char** argv) {
+  char *end;
+  const unsigned long target_ms = strtoul(argv[2], &end, 10);
+  if(*end!=0 || target_ms==0 || target_ms > UINT32_MAX) {
+    fprintf(stderr, "error: invalid target latency \"%s\"\n", argv[2]);
+    return 1;
+  }
+  const unsigned long long mem_mb = strtoull(argv[3], &end, 10);
+  if(*end!=0 || mem_mb==0 || mem_mb > UINT64_MAX / 1024) {
+    fprintf(stderr, "error: invalid memory ceiling \"%s\"\n", argv[3]);
+    return 1;
+  }
+  // without them one lane per cpu and the default number of samples
+  unsigned long lanes = 0, samples = 0;
+  if(argc>4) {
+    lanes = strtoul(argv[4], &end, 10);
+    if(*argv[4]==0 || *end!=0 || lanes==0 || lanes > UINT32_MAX) {
+      fprintf(stderr, "error: invalid number of lanes \"%s\"\n", argv[4]);
+      return 1;
+    }
+  }
+  if(argc>5) {
+    samples = strtoul(argv[5], &end, 10);
+    if(*argv[5]==0 || *end!=0 || samples==0 || samples > MAX_SAMPLES) {
+      fprintf(stderr, "error: invalid number of samples \"%s\", at most %d\n", argv[5], MAX_SAMPLES);
+      return 1;
+    }
+  }
+
+  Opaque_KSF best;
+  Opaque_KSF_Candidate candidates[MAX_CANDIDATES];
+  size_t n, i;
+  const int ret = opaque_CalibrateKSF((uint32_t) target_ms, mem_mb * 1024, (uint32_t) lanes,
+                                      (unsigned) samples, &best, candidates, MAX_CANDIDATES, &n);
+  fprintf(stderr, "%6s %10s %6s %12s %12s\n", "t", "m(KiB)", "p", "median(ms)", "p95(ms)");
+  for(i=0;i<n;i++) {
+    fprintf(stderr, "%6llu %10llu %6u %12.1f %12.1f %s\n",
+            (unsigned long long) candidates[i].ksf.ops, (unsigned long long) candidates[i].ksf.mem,
+            candidates[i].ksf.parallelism,
+            (double) candidates[i].median_us / 1000.0, (double) candidates[i].p95_us / 1000.0,
+            candidates[i].meets_target ? "ok" : "too slow");
+  }
+  if(0!=ret) {
+    fprintf(stderr, "error: no Argon2id parameters meet %lums within %lluMB\n", target_ms, mem_mb);
+    return 1;
+  }
+  fprintf(stderr, "argon2id t=%llu m=%llu p=%u\n",
+          (unsigned long long) best.ops, (unsigned long long) best.mem, best.parallelism);
+
+  uint8_t profile[OPAQUE_KSF_PROFILE_LEN];
+  opaque_SerializeKSF(&best, profile);
+  if(1!=fwrite(profile, sizeof profile, 1, stdout)) {
+    perror("failed to write profile to stdout");
+    return 1;
+  }
+  return 0;
 }
 
 static int init(const char** argv) {
@@ -74,7 +164,7 @@ static int init(const char** argv) {
   uint8_t rec[OPAQUE_USER_RECORD_LEN];
   uint8_t export_key[crypto_hash_sha512_BYTES];
 
-  int ret = opaque_Register((const uint8_t*)pwd, pwd_len, skS, &ids, rec, export_key);
+  int ret = opaque_Register((const uint8_t*)pwd, pwd_len, skS, &ids, ksf, rec, export_key);
   sodium_munlock(pwd,sizeof pwd);
   if(0!=ret) {
     fprintf(stderr,"error: failed to initialize reccord\n");
@@ -253,7 +343,7 @@ static int finalize(const char** argv) {
   uint8_t export_key[crypto_hash_sha512_BYTES];
   unsigned char rrec[OPAQUE_REGISTRATION_RECORD_LEN]={0};
 
-  if(0!=opaque_FinalizeRequest((uint8_t*) usr_ctx, rpub, &ids, rrec, export_key)) {
+  if(0!=opaque_FinalizeRequest((uint8_t*) usr_ctx, rpub, &ids, ksf, rrec, export_key)) {
     fprintf(stderr, "opaque_FinalizeRequest failed.\n");
     fclose(ek_fd);
     return 1;
@@ -384,7 +474,7 @@ static int user_reg(const char** argv) {
   uint8_t export_key[crypto_hash_sha512_BYTES];
   uint8_t rec[OPAQUE_REGISTRATION_RECORD_LEN]={0};
 
-  if(0!=opaque_FinalizeRequest((uint8_t*) usr_ctx, rpub, &ids, rec, export_key)) {
+  if(0!=opaque_FinalizeRequest((uint8_t*) usr_ctx, rpub, &ids, ksf, rec, export_key)) {
     fprintf(stderr, "opaque_FinalizeRequest failed.\n");
     fclose(ek_fd);
     return 1;
@@ -555,7 +645,7 @@ static int user(const char** argv) {
     return 1;
   }
 
-  int ret = opaque_RecoverCredentials(resp, sec, context, context_len, &ids, sk, authU, export_key);
+  int ret = opaque_RecoverCredentials(resp, sec, context, context_len, &ids, ksf, sk, authU, export_key);
   if(0!=ret) {
     fprintf(stderr, "opaque_RecoverCredentials failed.\n");
     sodium_munlock(sk, sizeof sk);
@@ -681,6 +771,15 @@ int main(const int argc, const char **argv) {
     usage(argv[0]);
     return 0;
   }
+  if(0!=load_ksf()) return 1;
+
+  if(strcmp(argv[1],"calibrate")==0) {
+    if(argc<4) {
+      usage(argv[0]);
+      return 1;
+    }
+    return calibrate(argc, argv);
+  }
 
   if(strcmp(argv[1],"init")==0) {
     if(argc<4) {
@@ -0,0 +1,153 @@
+/*
+    @copyright 2021, opaque@ctrlc.hu
+    This file is part of libopaque
+
+    libopaque is free software: you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libopaque is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libopaque. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#if !(_WIN32 == 1 || _WIN64 == 1) && !defined(__EMSCRIPTEN__)
+#include <sys/mman.h>
+#define WORKSPACE_MMAP 1
+#endif
+#include "workspace.h"
+
+#define HUGE_PAGE_BYTES (2UL << 20)
+
+typedef enum {
+  BACKING_NONE = 0,
+  BACKING_HUGETLB,
+  BACKING_THP,
+  BACKING_MMAP,
+  BACKING_MALLOC,
+} Backing;
+
+struct Opaque_Workspace {
+  // set while a hardening call uses mem, a stretch in steps may
+  // release it on another thread than the one that acquired it
+  atomic_int in_use;
+  uint8_t *mem;
+  size_t len;
+  Backing backing;
+};
+
+static void unmap(Opaque_Workspace *ws) {
+  if(ws->mem==NULL) return;
+#ifdef WORKSPACE_MMAP
+  if(ws->backing!=BACKING_MALLOC) munmap(ws->mem, ws->len);
+  else
+#endif
+  free(ws->mem);
+  ws->mem = NULL;
+  ws->len = 0;
+  ws->backing = BACKING_NONE;
+}
+
+#ifdef WORKSPACE_MMAP
+// len is a multiple of HUGE_PAGE_BYTES
+static int map(Opaque_Workspace *ws, const size_t len) {
+  uint8_t *p;
+#ifdef MAP_HUGETLB
+  p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+  if(p!=MAP_FAILED) {
+    ws->backing = BACKING_HUGETLB;
+    goto mapped;
+  }
+#endif
+  // over-allocate by a huge page and trim to an aligned range, so that
+  // khugepaged is not needed to back it with huge pages
+  p = mmap(NULL, len + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p==MAP_FAILED) return -1;
+  const size_t head = (HUGE_PAGE_BYTES - ((uintptr_t) p % HUGE_PAGE_BYTES)) % HUGE_PAGE_BYTES;
+  if(head) munmap(p, head);
+  munmap(p + head + len, HUGE_PAGE_BYTES - head);
+  p += head;
+  ws->backing = BACKING_MMAP;
+#ifdef MADV_HUGEPAGE
+  if(0==madvise(p, len, MADV_HUGEPAGE)) ws->backing = BACKING_THP;
+#endif
+  // fault it in now instead of during the first hardening call
+  memset(p, 0, len);
+#ifdef MAP_HUGETLB
+mapped:
+#endif
+#ifdef MADV_DONTDUMP
+  madvise(p, len, MADV_DONTDUMP);
+#endif
+  ws->mem = p;
+  ws->len = len;
+  return 0;
+}
+#else
+static int map(Opaque_Workspace *ws, const size_t len) {
+  ws->mem = malloc(len);
+  if(ws->mem==NULL) return -1;
+  memset(ws->mem, 0, len);
+  ws->len = len;
+  ws->backing = BACKING_MALLOC;
+  return 0;
+}
+#endif
+
+static int grow(Opaque_Workspace *ws, const size_t len) {
+  if(len <= ws->len) return 0;
+  if(len > SIZE_MAX - HUGE_PAGE_BYTES) return -1;
+  unmap(ws);
+  return map(ws, (len + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES);
+}
+
+Opaque_Workspace *opaque_workspace_new(const uint64_t mem) {
+  if(mem > SIZE_MAX / 1024) return NULL;
+  Opaque_Workspace *ws = calloc(1, sizeof *ws);
+  if(ws==NULL) return NULL;
+  atomic_init(&ws->in_use, 0);
+  if(mem > 0 && 0!=grow(ws, (size_t) mem * 1024)) {
+    opaque_workspace_free(ws);
+    return NULL;
+  }
+  return ws;
+}
+
+void opaque_workspace_free(Opaque_Workspace *ws) {
+  if(ws==NULL) return;
+  unmap(ws);
+  free(ws);
+}
+
+void *opaque_workspace_acquire(Opaque_Workspace *ws, const size_t len) {
+  if(ws==NULL || len==0) return NULL;
+  int unused = 0;
+  // acquire orders the use of mem after the release of the last user
+  if(!atomic_compare_exchange_strong_explicit(&ws->in_use, &unused, 1,
+                                              memory_order_acquire, memory_order_relaxed)) return NULL;
+  if(0!=grow(ws, len)) {
+    atomic_store_explicit(&ws->in_use, 0, memory_order_release);
+    return NULL;
+  }
+  return ws->mem;
+}
+
+void opaque_workspace_release(Opaque_Workspace *ws) {
+  atomic_store_explicit(&ws->in_use, 0, memory_order_release);
+}
+
+const char *opaque_workspace_backing(const Opaque_Workspace *ws) {
+  static const char *names[] = {"none", "hugetlb", "thp", "mmap", "malloc"};
+  return names[ws->backing];
+}
@@ -0,0 +1,28 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <stddef.h>
+#include "opaque.h"
+
+/* the memory behind an Opaque_Workspace (see opaque.h)
+ *
+ * On linux it is mapped with MAP_HUGETLB if the system has reserved
+ * huge pages, otherwise it is aligned to 2MB and marked with
+ * madvise(MADV_HUGEPAGE) for transparent huge pages. Either way it is
+ * faulted in when it is mapped and excluded from core dumps. Other
+ * systems get plain malloc()ed memory. */
+
+// returns at least len bytes of the memory of ws, growing it if
+// needed, or NULL if ws is in use by another thread or out of
+// memory. The caller falls back to allocating its own memory then.
+void *opaque_workspace_acquire(Opaque_Workspace *ws, const size_t len);
+
+// ends the use of the memory returned by opaque_workspace_acquire(),
+// the caller has wiped the part of it that it used
+void opaque_workspace_release(Opaque_Workspace *ws);
+
+// how the memory of ws is backed: "hugetlb", "thp", "mmap", "malloc"
+// or "none" if nothing is allocated yet
+const char *opaque_workspace_backing(const Opaque_Workspace *ws);
+
+#endif // WORKSPACE_H